@@ -25,8 +25,14 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/threads.h>
@@ -44,6 +50,10 @@
 /* verity parameters */
 #define VERITY_CACHE_BLOCKS 4096
 #define VERITY_NO_CACHE UINT64_MAX
+/* number of hash tree blocks read and hashed at once in verify_tree */
+#define VERITY_HASH_BATCH_BLOCKS 64
+/* number of data blocks read at once in verity_read */
+#define VERITY_READAHEAD_BLOCKS 64
 
 /* verity definitions */
 #define VERITY_METADATA_SIZE (8 * FEC_BLOCKSIZE)
@@ -93,7 +103,14 @@ struct hashtree_info {
 
     // Checks if the bytes in 'block' has the expected hash. And the 'index' is
     // the block number of is the input block in the filesystem.
-    bool check_block_hash_with_index(uint64_t index, const uint8_t *block);
+    bool check_block_hash_with_index(uint64_t index,
+                                     const uint8_t *block) const;
+
+    // Checks 'count' consecutive blocks starting from 'blocks', the first of
+    // which is block number 'index', and sets 'valid[i]' to whether the i-th
+    // block has the expected hash. Returns false if hashing fails.
+    bool check_block_hashes_with_index(uint64_t index, const uint8_t *blocks,
+                                       size_t count, bool *valid) const;
 
     // Reads the verity hash tree, validates it against the root hash in `root',
     // corrects errors if necessary, and copies valid data blocks for later use
@@ -106,10 +123,14 @@ struct hashtree_info {
 
     // Computes the hash for FEC_BLOCKSIZE bytes from buffer 'block' and
     // compares it to the expected value in 'expected'.
-    bool check_block_hash(const uint8_t *expected, const uint8_t *block);
+    bool check_block_hash(const uint8_t *expected, const uint8_t *block) const;
 
     // Computes the hash of 'block' and put the result in 'hash'.
-    int get_hash(const uint8_t *block, uint8_t *hash);
+    int get_hash(const uint8_t *block, uint8_t *hash) const;
+
+    // Computes the hashes of 'count' consecutive blocks starting from
+    // 'blocks', and puts them digest_length_ bytes apart in 'hashes'.
+    int get_hashes(const uint8_t *blocks, size_t count, uint8_t *hashes) const;
 
     int nid_;  // NID for the hash algorithm.
     uint32_t digest_length_;
@@ -131,6 +152,30 @@ struct avb_info {
     hashtree_info hashtree;
 };
 
+/* a fixed set of threads that process reads for a fec_handle */
+class fec_worker_pool {
+   public:
+    explicit fec_worker_pool(int threads);
+    ~fec_worker_pool();
+
+    int size() const { return (int)threads_.size(); }
+
+    // Queues 'work' to run on one of the worker threads.
+    std::future<void> run(std::function<void()> work);
+
+    // Returns true if called from one of the worker threads of any pool.
+    static bool on_worker_thread();
+
+   private:
+    void worker_main();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::packaged_task<void()>> queue_;
+    bool exiting_ = false;
+    std::vector<std::thread> threads_;
+};
+
 struct fec_handle {
     ecc_info ecc;
     int fd;
@@ -144,8 +189,11 @@ struct fec_handle {
     // TODO(xunchang) switch to std::optional
     verity_info verity;
     avb_info avb;
+    /* started by the first read, and kept until the handle is closed */
+    std::once_flag pool_once;
+    std::unique_ptr<fec_worker_pool> pool;
 
-    hashtree_info hashtree() const {
+    const hashtree_info &hashtree() const {
         return avb.valid ? avb.hashtree : verity.hashtree;
     }
 };
@@ -14,7 +14,6 @@
  * limitations under the License.
  */
 
-#include <future>
 #include "fec_private.h"
 
 struct process_info {
@@ -28,6 +27,59 @@ struct process_info {
     size_t errors;
 };
 
+static thread_local bool is_worker_thread = false;
+
+fec_worker_pool::fec_worker_pool(int threads) {
+    for (int i = 0; i < threads; ++i) {
+        threads_.emplace_back(&fec_worker_pool::worker_main, this);
+    }
+}
+
+fec_worker_pool::~fec_worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exiting_ = true;
+    }
+    cond_.notify_all();
+
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+std::future<void> fec_worker_pool::run(std::function<void()> work) {
+    std::packaged_task<void()> task(std::move(work));
+    std::future<void> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+    return result;
+}
+
+bool fec_worker_pool::on_worker_thread() {
+    return is_worker_thread;
+}
+
+void fec_worker_pool::worker_main() {
+    is_worker_thread = true;
+
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return exiting_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        task();
+    }
+}
+
 /* thread function  */
 static process_info* __process(process_info* p) {
     debug("thread %d: [%" PRIu64 ", %" PRIu64 ")", p->id, p->offset, p->offset + p->count);
@@ -36,7 +88,7 @@ static process_info* __process(process_info* p) {
     return p;
 }
 
-/* launches a maximum number of threads to process a read */
+/* splits a read between the calling thread and the worker pool of `f' */
 ssize_t process(fec_handle* f, uint8_t* buf, size_t count, uint64_t offset, read_func func) {
     check(f);
     check(buf);
@@ -46,12 +98,25 @@ ssize_t process(fec_handle* f, uint8_t* buf, size_t count, uint64_t offset, read
         return 0;
     }
 
-    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    std::call_once(f->pool_once, [f]() {
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (threads < WORK_MIN_THREADS) {
+            threads = WORK_MIN_THREADS;
+        } else if (threads > WORK_MAX_THREADS) {
+            threads = WORK_MAX_THREADS;
+        }
+
+        /* the calling thread processes one part of each read */
+        f->pool.reset(new fec_worker_pool(threads - 1));
+    });
+
+    int threads = f->pool->size() + 1;
 
-    if (threads < WORK_MIN_THREADS) {
-        threads = WORK_MIN_THREADS;
-    } else if (threads > WORK_MAX_THREADS) {
-        threads = WORK_MAX_THREADS;
+    /* a read issued from a worker would wait for workers that may all be
+       busy, so process it on the calling thread */
+    if (fec_worker_pool::on_worker_thread()) {
+        threads = 1;
     }
 
     uint64_t start = (offset / FEC_BLOCKSIZE) * FEC_BLOCKSIZE;
@@ -70,11 +135,12 @@ ssize_t process(fec_handle* f, uint8_t* buf, size_t count, uint64_t offset, read
     debug("max %d threads, %zu bytes per thread (total %zu spanning %zu blocks)", threads,
           count_per_thread, count, blocks);
 
-    std::vector<std::future<process_info*>> handles;
+    std::vector<std::future<void>> handles;
     process_info info[threads];
+    int parts = 0;
     ssize_t rc = 0;
 
-    /* start threads to process queue */
+    /* queue all parts but the first to the worker pool */
     for (int i = 0; i < threads && left > 0; ++i) {
         info[i].id = i;
         info[i].f = f;
@@ -89,23 +155,34 @@ ssize_t process(fec_handle* f, uint8_t* buf, size_t count, uint64_t offset, read
             info[i].count = left;
         }
 
-        handles.push_back(std::async(std::launch::async, __process, &info[i]));
+        if (i > 0) {
+            process_info* p = &info[i];
+            handles.push_back(f->pool->run([p]() { __process(p); }));
+        }
+        ++parts;
 
         pos = end;
         end += count_per_thread;
         left -= info[i].count;
     }
 
-    ssize_t nread = 0;
+    if (parts > 0) {
+        __process(&info[0]);
+    }
 
-    /* wait for all threads to complete */
+    /* wait for the workers to complete */
     for (auto&& future : handles) {
-        process_info* p = future.get();
-        if (!p || p->rc == -1) {
+        future.get();
+    }
+
+    ssize_t nread = 0;
+
+    for (int i = 0; i < parts; ++i) {
+        if (info[i].rc == -1) {
             rc = -1;
         } else {
-            nread += p->rc;
-            f->errors += p->errors;
+            nread += info[i].rc;
+            f->errors += info[i].errors;
         }
     }
 
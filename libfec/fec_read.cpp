@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include <algorithm>
+
 extern "C" {
     #include <fec.h>
 }
@@ -85,7 +87,7 @@ static inline bool is_erasure(fec_handle *f, uint64_t offset,
 /* check if `offset' is within a block expected to contain zeros */
 static inline bool is_zero(fec_handle *f, uint64_t offset)
 {
-    auto hashtree = f->hashtree();
+    const auto &hashtree = f->hashtree();
 
     if (hashtree.hash_data.empty() || unlikely(offset >= f->data_size)) {
         return false;
@@ -279,6 +281,19 @@ static ssize_t ecc_read(fec_handle *f, uint8_t *dest, size_t count,
     return count;
 }
 
+/* asks the kernel to start reading `count' bytes from `offset' in the
+   background, so the data is cached by the time we read it */
+static inline void readahead_hint(int fd, uint64_t offset, size_t count)
+{
+#ifdef __linux__
+    posix_fadvise64(fd, offset, count, POSIX_FADV_WILLNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)count;
+#endif
+}
+
 /* reads `count' bytes from `offset', corrects possible errors with
    erasure detection, and verifies the integrity of read data using
    verity hash tree; returns the number of corrections in `errors' */
@@ -301,103 +316,151 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
         return -1;
     }
 
+    const auto &hashtree = f->hashtree();
     uint64_t curr = offset / FEC_BLOCKSIZE;
+    uint64_t last = fec_div_round_up(offset + count, FEC_BLOCKSIZE);
     size_t coff = (size_t)(offset - curr * FEC_BLOCKSIZE);
     size_t left = count;
-    uint8_t data[FEC_BLOCKSIZE];
 
     uint64_t max_hash_block =
-        (f->hashtree().hash_data.size() - SHA256_DIGEST_LENGTH) /
+        (hashtree.hash_data.size() - SHA256_DIGEST_LENGTH) /
         SHA256_DIGEST_LENGTH;
 
+    /* blocks are read and hashed VERITY_READAHEAD_BLOCKS at a time, and
+       verified one by one only if the window can't be read or doesn't
+       validate */
+    size_t window_blocks =
+        (size_t)std::min<uint64_t>(last - curr, VERITY_READAHEAD_BLOCKS);
+    std::unique_ptr<uint8_t[]> window(
+        new (std::nothrow) uint8_t[window_blocks * FEC_BLOCKSIZE]);
+    std::unique_ptr<bool[]> window_valid(new (std::nothrow) bool[window_blocks]);
+
+    if (unlikely(!window || !window_valid)) {
+        error("failed to allocate readahead buffer");
+        errno = ENOMEM;
+        return -1;
+    }
+
     while (left > 0) {
         check(curr <= max_hash_block);
-        uint64_t curr_offset = curr * FEC_BLOCKSIZE;
+        size_t n = (size_t)std::min<uint64_t>(last - curr, window_blocks);
+        check(curr + n - 1 <= max_hash_block);
+
+        if (curr + n < last) {
+            readahead_hint(f->fd, (curr + n) * FEC_BLOCKSIZE,
+                           std::min<uint64_t>(last - curr - n, window_blocks) *
+                               FEC_BLOCKSIZE);
+        }
 
-        bool expect_zeros = is_zero(f, curr_offset);
+        /* in read-only mode, we don't read blocks that are expected to
+           contain zeros */
+        bool need_read = (f->mode & O_ACCMODE) != O_RDONLY;
 
-        /* if we are in read-only mode and expect to read a zero block,
-           skip reading and just return zeros */
-        if ((f->mode & O_ACCMODE) == O_RDONLY && expect_zeros) {
-            memset(data, 0, FEC_BLOCKSIZE);
-            goto valid;
+        for (size_t i = 0; i < n && !need_read; ++i) {
+            need_read = !is_zero(f, (curr + i) * FEC_BLOCKSIZE);
         }
 
-        /* copy raw data without error correction */
-        if (!raw_pread(f->fd, data, FEC_BLOCKSIZE, curr_offset)) {
-            if (errno == EIO) {
-                warn("I/O error encounter when reading, attempting to recover using fec");
-            } else {
-                error("failed to read: %s", strerror(errno));
-                return -1;
+        bool window_checked = need_read &&
+            raw_pread(f->fd, window.get(), n * FEC_BLOCKSIZE,
+                      curr * FEC_BLOCKSIZE) &&
+            hashtree.check_block_hashes_with_index(curr, window.get(), n,
+                                                   window_valid.get());
+
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t *data = &window[i * FEC_BLOCKSIZE];
+            uint64_t curr_offset = curr * FEC_BLOCKSIZE;
+
+            bool expect_zeros = is_zero(f, curr_offset);
+
+            /* if we are in read-only mode and expect to read a zero block,
+               skip reading and just return zeros */
+            if ((f->mode & O_ACCMODE) == O_RDONLY && expect_zeros) {
+                memset(data, 0, FEC_BLOCKSIZE);
+                goto valid;
             }
-        }
 
-        if (likely(f->hashtree().check_block_hash_with_index(curr, data))) {
-            goto valid;
-        }
+            if (window_checked) {
+                if (likely(window_valid[i])) {
+                    goto valid;
+                }
+            } else {
+                /* copy raw data without error correction */
+                if (!raw_pread(f->fd, data, FEC_BLOCKSIZE, curr_offset)) {
+                    if (errno == EIO) {
+                        warn("I/O error encounter when reading, attempting to recover using fec");
+                    } else {
+                        error("failed to read: %s", strerror(errno));
+                        return -1;
+                    }
+                }
 
-        /* we know the block is supposed to contain zeros, so return zeros
-           instead of trying to correct it */
-        if (expect_zeros) {
-            memset(data, 0, FEC_BLOCKSIZE);
-            goto corrected;
-        }
+                if (likely(hashtree.check_block_hash_with_index(curr, data))) {
+                    goto valid;
+                }
+            }
 
-        if (!f->ecc.start) {
-            /* fatal error without ecc */
-            error("[%" PRIu64 ", %" PRIu64 "): corrupted block %" PRIu64,
-                offset, offset + count, curr);
-            return -1;
-        } else {
-            debug("[%" PRIu64 ", %" PRIu64 "): corrupted block %" PRIu64,
-                offset, offset + count, curr);
-        }
+            /* we know the block is supposed to contain zeros, so return zeros
+               instead of trying to correct it */
+            if (expect_zeros) {
+                memset(data, 0, FEC_BLOCKSIZE);
+                goto corrected;
+            }
 
-        /* try to correct without erasures first, because checking for
-           erasure locations is slower */
-        if (__ecc_read(f, rs.get(), data, curr_offset, false, ecc_data.get(),
-                       errors) == FEC_BLOCKSIZE &&
-            f->hashtree().check_block_hash_with_index(curr, data)) {
-            goto corrected;
-        }
+            if (!f->ecc.start) {
+                /* fatal error without ecc */
+                error("[%" PRIu64 ", %" PRIu64 "): corrupted block %" PRIu64,
+                    offset, offset + count, curr);
+                return -1;
+            } else {
+                debug("[%" PRIu64 ", %" PRIu64 "): corrupted block %" PRIu64,
+                    offset, offset + count, curr);
+            }
 
-        /* try to correct with erasures */
-        if (__ecc_read(f, rs.get(), data, curr_offset, true, ecc_data.get(),
-                       errors) == FEC_BLOCKSIZE &&
-            f->hashtree().check_block_hash_with_index(curr, data)) {
-            goto corrected;
-        }
+            /* try to correct without erasures first, because checking for
+               erasure locations is slower */
+            if (__ecc_read(f, rs.get(), data, curr_offset, false, ecc_data.get(),
+                           errors) == FEC_BLOCKSIZE &&
+                hashtree.check_block_hash_with_index(curr, data)) {
+                goto corrected;
+            }
 
-        error("[%" PRIu64 ", %" PRIu64 "): corrupted block %" PRIu64
-            " (offset %" PRIu64 ") cannot be recovered",
-            offset, offset + count, curr, curr_offset);
-        dump("decoded block", curr, data, FEC_BLOCKSIZE);
+            /* try to correct with erasures */
+            if (__ecc_read(f, rs.get(), data, curr_offset, true, ecc_data.get(),
+                           errors) == FEC_BLOCKSIZE &&
+                hashtree.check_block_hash_with_index(curr, data)) {
+                goto corrected;
+            }
 
-        errno = EIO;
-        return -1;
+            error("[%" PRIu64 ", %" PRIu64 "): corrupted block %" PRIu64
+                " (offset %" PRIu64 ") cannot be recovered",
+                offset, offset + count, curr, curr_offset);
+            dump("decoded block", curr, data, FEC_BLOCKSIZE);
 
-corrected:
-        /* update the corrected block to the file if we are in r/w mode */
-        if (f->mode & O_RDWR &&
-            !raw_pwrite(f->fd, data, FEC_BLOCKSIZE, curr_offset)) {
-            error("failed to write: %s", strerror(errno));
+            errno = EIO;
             return -1;
-        }
+
+corrected:
+            /* update the corrected block to the file if we are in r/w mode */
+            if (f->mode & O_RDWR &&
+                !raw_pwrite(f->fd, data, FEC_BLOCKSIZE, curr_offset)) {
+                error("failed to write: %s", strerror(errno));
+                return -1;
+            }
 
 valid:
-        size_t copy = FEC_BLOCKSIZE - coff;
+            size_t copy = FEC_BLOCKSIZE - coff;
 
-        if (copy > left) {
-            copy = left;
-        }
+            if (copy > left) {
+                copy = left;
+            }
 
-        memcpy(dest, &data[coff], copy);
+            memcpy(dest, &data[coff], copy);
 
-        dest += copy;
-        left -= copy;
-        coff = 0;
-        ++curr;
+            dest += copy;
+            left -= copy;
+            coff = 0;
+            ++curr;
+        }
     }
 
     return count;
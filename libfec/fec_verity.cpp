@@ -18,6 +18,7 @@
 #include <stdlib.h>
 
 #include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -121,20 +122,35 @@ uint64_t verity_get_size(uint64_t file_size, uint32_t *verity_levels,
     return total * FEC_BLOCKSIZE;
 }
 
-int hashtree_info::get_hash(const uint8_t *block, uint8_t *hash) {
+int hashtree_info::get_hash(const uint8_t *block, uint8_t *hash) const {
+    return get_hashes(block, 1, hash);
+}
+
+int hashtree_info::get_hashes(const uint8_t *blocks, size_t count,
+                              uint8_t *hashes) const {
     auto md = EVP_get_digestbynid(nid_);
     check(md);
-    auto mdctx = EVP_MD_CTX_new();
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> salted_ctx(
+        EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    check(salted_ctx);
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> mdctx(
+        EVP_MD_CTX_new(), EVP_MD_CTX_free);
     check(mdctx);
 
-    EVP_DigestInit_ex(mdctx, md, nullptr);
-    EVP_DigestUpdate(mdctx, salt.data(), salt.size());
-    EVP_DigestUpdate(mdctx, block, FEC_BLOCKSIZE);
-    unsigned int hash_size;
-    EVP_DigestFinal_ex(mdctx, hash, &hash_size);
-    EVP_MD_CTX_free(mdctx);
+    /* hash the salt only once, and start each block from a copy of the
+       salted state */
+    EVP_DigestInit_ex(salted_ctx.get(), md, nullptr);
+    EVP_DigestUpdate(salted_ctx.get(), salt.data(), salt.size());
 
-    check(hash_size == digest_length_);
+    for (size_t i = 0; i < count; ++i) {
+        EVP_MD_CTX_copy_ex(mdctx.get(), salted_ctx.get());
+        EVP_DigestUpdate(mdctx.get(), &blocks[i * FEC_BLOCKSIZE],
+                         FEC_BLOCKSIZE);
+        unsigned int hash_size;
+        EVP_DigestFinal_ex(mdctx.get(), &hashes[i * digest_length_],
+                           &hash_size);
+        check(hash_size == digest_length_);
+    }
     return 0;
 }
 
@@ -155,7 +171,7 @@ int hashtree_info::initialize(uint64_t hash_start, uint64_t data_blocks,
 }
 
 bool hashtree_info::check_block_hash(const uint8_t *expected,
-                                     const uint8_t *block) {
+                                     const uint8_t *block) const {
     check(block);
     std::vector<uint8_t> hash(digest_length_, 0);
 
@@ -169,13 +185,41 @@ bool hashtree_info::check_block_hash(const uint8_t *expected,
 }
 
 bool hashtree_info::check_block_hash_with_index(uint64_t index,
-                                                const uint8_t *block) {
+                                                const uint8_t *block) const {
     check(index < data_blocks);
 
     const uint8_t *expected = &hash_data[index * padded_digest_length_];
     return check_block_hash(expected, block);
 }
 
+bool hashtree_info::check_block_hashes_with_index(uint64_t index,
+                                                  const uint8_t *blocks,
+                                                  size_t count,
+                                                  bool *valid) const {
+    /* check() would return -1, which converts to true */
+    if (unlikely(!blocks || !valid || index > data_blocks ||
+                 count > data_blocks - index)) {
+        error("invalid block range: %" PRIu64 " + %zu", index, count);
+        errno = EFAULT;
+        return false;
+    }
+
+    std::vector<uint8_t> hashes(count * digest_length_);
+
+    if (unlikely(get_hashes(blocks, count, hashes.data()) == -1)) {
+        error("failed to hash");
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *expected =
+            &hash_data[(index + i) * padded_digest_length_];
+        valid[i] = !memcmp(expected, &hashes[i * digest_length_],
+                           digest_length_);
+    }
+    return true;
+}
+
 // Reads the hash and the corresponding data block using error correction, if
 // available.
 bool hashtree_info::ecc_read_hashes(fec_handle *f, uint64_t hash_offset,
@@ -271,51 +315,74 @@ int hashtree_info::verify_tree(const fec_handle *f, const uint8_t *root) {
     /* validate the rest of the hash tree */
     data_offset = hash_offset + FEC_BLOCKSIZE;
 
-    std::vector<uint8_t> buffer(padded_digest_length_, 0);
+    /* read and hash the blocks of each level in batches */
+    std::vector<uint8_t> expected(VERITY_HASH_BATCH_BLOCKS *
+                                  padded_digest_length_);
+    std::vector<uint8_t> batch(VERITY_HASH_BATCH_BLOCKS * FEC_BLOCKSIZE);
+    std::vector<uint8_t> actual(VERITY_HASH_BATCH_BLOCKS * digest_length_);
     for (uint32_t i = 1; i < levels; ++i) {
         uint32_t blocks = hashes[levels - i];
 
-        for (uint32_t j = 0; j < blocks; ++j) {
+        for (uint32_t start = 0; start < blocks;
+             start += VERITY_HASH_BATCH_BLOCKS) {
+            uint32_t count =
+                std::min<uint32_t>(blocks - start, VERITY_HASH_BATCH_BLOCKS);
+
             /* ecc reads are very I/O intensive, so read raw hash tree and do
                error correcting only if it doesn't validate */
-            if (!raw_pread(f->fd, buffer.data(), padded_digest_length_,
-                           hash_offset + j * padded_digest_length_) ||
-                !raw_pread(f->fd, data, FEC_BLOCKSIZE,
-                           data_offset + j * FEC_BLOCKSIZE)) {
+            if (!raw_pread(f->fd, expected.data(),
+                           count * padded_digest_length_,
+                           hash_offset + start * padded_digest_length_) ||
+                !raw_pread(f->fd, batch.data(), count * FEC_BLOCKSIZE,
+                           data_offset + start * FEC_BLOCKSIZE)) {
                 error("failed to read hashes: %s", strerror(errno));
                 return -1;
             }
 
-            if (!check_block_hash(buffer.data(), data)) {
-                /* try to correct */
-                if (!ecc_read_hashes(const_cast<fec_handle *>(f),
-                                     hash_offset + j * padded_digest_length_,
-                                     buffer.data(),
-                                     data_offset + j * FEC_BLOCKSIZE, data) ||
-                    !check_block_hash(buffer.data(), data)) {
-                    error("invalid hash tree: hash_offset %" PRIu64
-                          ", "
-                          "data_offset %" PRIu64 ", block %u",
-                          hash_offset, data_offset, j);
-                    return -1;
-                }
+            if (get_hashes(batch.data(), count, actual.data()) == -1) {
+                error("failed to hash");
+                return -1;
+            }
 
-                /* update the corrected blocks to the file if we are in r/w
-                   mode */
-                if (f->mode & O_RDWR) {
-                    if (!raw_pwrite(f->fd, buffer.data(), padded_digest_length_,
-                                    hash_offset + j * padded_digest_length_) ||
-                        !raw_pwrite(f->fd, data, FEC_BLOCKSIZE,
-                                    data_offset + j * FEC_BLOCKSIZE)) {
-                        error("failed to write hashes: %s", strerror(errno));
+            for (uint32_t k = 0; k < count; ++k) {
+                uint32_t j = start + k;
+                uint8_t *hash = &expected[k * padded_digest_length_];
+                uint8_t *block = &batch[k * FEC_BLOCKSIZE];
+
+                if (memcmp(hash, &actual[k * digest_length_],
+                           digest_length_)) {
+                    /* try to correct */
+                    if (!ecc_read_hashes(
+                            const_cast<fec_handle *>(f),
+                            hash_offset + j * padded_digest_length_, hash,
+                            data_offset + j * FEC_BLOCKSIZE, block) ||
+                        !check_block_hash(hash, block)) {
+                        error("invalid hash tree: hash_offset %" PRIu64
+                              ", "
+                              "data_offset %" PRIu64 ", block %u",
+                              hash_offset, data_offset, j);
                         return -1;
                     }
+
+                    /* update the corrected blocks to the file if we are in
+                       r/w mode */
+                    if (f->mode & O_RDWR) {
+                        if (!raw_pwrite(f->fd, hash, padded_digest_length_,
+                                        hash_offset +
+                                            j * padded_digest_length_) ||
+                            !raw_pwrite(f->fd, block, FEC_BLOCKSIZE,
+                                        data_offset + j * FEC_BLOCKSIZE)) {
+                            error("failed to write hashes: %s",
+                                  strerror(errno));
+                            return -1;
+                        }
+                    }
                 }
-            }
 
-            if (blocks == hash_data_blocks) {
-                std::copy(data, data + FEC_BLOCKSIZE,
-                          data_hashes.begin() + j * FEC_BLOCKSIZE);
+                if (blocks == hash_data_blocks) {
+                    std::copy(block, block + FEC_BLOCKSIZE,
+                              data_hashes.begin() + j * FEC_BLOCKSIZE);
+                }
             }
         }
 
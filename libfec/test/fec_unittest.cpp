@@ -227,6 +227,47 @@ TEST_F(FecUnitTest, VerityImage_FecRead) {
     ASSERT_EQ(53388, fec_pread(handle, large_data.data(), 53388, 385132));
 }
 
+TEST_F(FecUnitTest, VerityImage_SequentialRead) {
+    TemporaryFile verity_image;
+    BuildAndAppendsVerityMetadata();
+    ASSERT_TRUE(android::base::WriteFully(verity_image.fd, image_.data(),
+                                          image_.size()));
+
+    struct fec_handle *handle = nullptr;
+    ASSERT_EQ(0,
+              fec_open(&handle, verity_image.path, O_RDONLY, FEC_FS_EXT4, 2));
+    std::unique_ptr<fec_handle> guard(handle);
+
+    // Read the file system in unaligned chunks spanning multiple readahead
+    // windows, reusing the worker pool of the handle.
+    std::vector<uint8_t> read_data;
+    std::vector<uint8_t> buf(300 * 1024 + 123);
+    fec_worker_pool *pool = nullptr;
+    while (true) {
+        ssize_t rc = fec_read(handle, buf.data(), buf.size());
+        ASSERT_GE(rc, 0);
+        if (rc == 0) {
+            break;
+        }
+        read_data.insert(read_data.end(), buf.begin(), buf.begin() + rc);
+        ASSERT_NE(nullptr, handle->pool);
+        if (pool != nullptr) {
+            ASSERT_EQ(pool, handle->pool.get());
+        }
+        pool = handle->pool.get();
+    }
+    ASSERT_EQ(std::vector<uint8_t>(image_.begin(), image_.begin() + 1024 * 1024),
+              read_data);
+
+    // Corrupt a block in the middle of a readahead window.
+    uint64_t corrupt_offset = 4096 * 50;
+    std::vector<uint8_t> corruption(100, 10);
+    ASSERT_TRUE(android::base::WriteFullyAtOffset(
+        verity_image.fd, corruption.data(), corruption.size(), corrupt_offset));
+    ASSERT_EQ(-1, fec_pread(handle, buf.data(), buf.size(), 0));
+    ASSERT_EQ(4096 * 50, fec_pread(handle, buf.data(), 4096 * 50, 0));
+}
+
 TEST_F(FecUnitTest, LoadAvbImage_HashtreeFooter) {
     TemporaryFile avb_image;
     ASSERT_TRUE(
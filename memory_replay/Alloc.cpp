@@ -40,6 +40,32 @@ bool AllocDoesFree(const AllocEntry& entry) {
   }
 }
 
+void AllocUpdateLiveCount(const AllocEntry& entry, size_t* num_allocs) {
+  switch (entry.type) {
+    case THREAD_DONE:
+      break;
+    case MALLOC:
+    case CALLOC:
+    case MEMALIGN:
+      if (entry.ptr != 0) {
+        (*num_allocs)++;
+      }
+      break;
+    case REALLOC:
+      if (entry.ptr == 0 && entry.u.old_ptr != 0) {
+        (*num_allocs)--;
+      } else if (entry.ptr != 0 && entry.u.old_ptr == 0) {
+        (*num_allocs)++;
+      }
+      break;
+    case FREE:
+      if (entry.ptr != 0) {
+        (*num_allocs)--;
+      }
+      break;
+  }
+}
+
 static uint64_t MallocExecute(const AllocEntry& entry, Pointers* pointers) {
   int pagesize = getpagesize();
   uint64_t time_nsecs = Nanotime();
@@ -23,4 +23,7 @@ class Pointers;
 
 bool AllocDoesFree(const AllocEntry& entry);
 
+// Updates the number of live allocations after executing the entry.
+void AllocUpdateLiveCount(const AllocEntry& entry, size_t* num_allocs);
+
 uint64_t AllocExecute(const AllocEntry& entry, Pointers* pointers);
@@ -16,16 +16,25 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <ziparchive/zip_archive.h>
 
 #include "Alloc.h"
@@ -75,9 +84,96 @@ static void WaitPid(pid_t pid) {
   }
 }
 
+// Returns true if the file starts with the binary trace magic.
+static bool IsBinaryTrace(const char* filename) {
+  android::base::unique_fd fd(open(filename, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    return false;
+  }
+  char magic[sizeof(kBinaryTraceMagic)];
+  return android::base::ReadFully(fd, magic, sizeof(magic)) &&
+         memcmp(magic, kBinaryTraceMagic, sizeof(magic)) == 0;
+}
+
+// Maps a binary trace and validates its header.
+static const BinaryTraceHeader* MapBinaryTrace(const char* filename, size_t* map_size) {
+  android::base::unique_fd fd(open(filename, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    err(1, "Unable to open %s", filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    err(1, "Unable to stat %s", filename);
+  }
+  if (static_cast<size_t>(st.st_size) < sizeof(BinaryTraceHeader)) {
+    errx(1, "Binary trace %s is too small", filename);
+  }
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    err(1, "Unable to mmap %s", filename);
+  }
+  const BinaryTraceHeader* header = reinterpret_cast<const BinaryTraceHeader*>(map);
+  if (header->version != kBinaryTraceVersion) {
+    errx(1, "Unsupported binary trace version %u in %s", header->version, filename);
+  }
+  if (header->entry_size != sizeof(BinaryTraceEntry) ||
+      header->num_entries != (st.st_size - sizeof(BinaryTraceHeader)) / sizeof(BinaryTraceEntry) ||
+      (st.st_size - sizeof(BinaryTraceHeader)) % sizeof(BinaryTraceEntry) != 0) {
+    errx(1, "Binary trace %s is truncated or corrupted", filename);
+  }
+  *map_size = st.st_size;
+  return header;
+}
+
+static const BinaryTraceEntry* GetBinaryEntries(const BinaryTraceHeader* header) {
+  return reinterpret_cast<const BinaryTraceEntry*>(header + 1);
+}
+
+static void BinaryEntryToAllocEntry(const BinaryTraceEntry& record, AllocEntry* entry) {
+  if (record.type > THREAD_DONE) {
+    errx(1, "Invalid entry type %u in binary trace", record.type);
+  }
+  entry->tid = record.tid;
+  entry->type = static_cast<AllocEnum>(record.type);
+  entry->ptr = record.ptr;
+  entry->size = record.size;
+  entry->u.old_ptr = record.u;
+  entry->st = record.st;
+  entry->et = record.et;
+}
+
+static void AllocEntryToBinaryEntry(const AllocEntry& entry, BinaryTraceEntry* record) {
+  *record = {};
+  record->tid = entry.tid;
+  record->type = entry.type;
+  record->ptr = entry.ptr;
+  record->size = entry.size;
+  record->u = entry.u.old_ptr;
+  record->st = entry.st;
+  record->et = entry.et;
+}
+
 // This function should not do any memory allocations in the main function.
 // Any true allocation should happen in fork'd code.
 void GetUnwindInfo(const char* filename, AllocEntry** entries, size_t* num_entries) {
+  if (IsBinaryTrace(filename)) {
+    size_t map_size;
+    const BinaryTraceHeader* header = MapBinaryTrace(filename, &map_size);
+    *num_entries = header->num_entries;
+    void* mem = mmap(nullptr, *num_entries * sizeof(AllocEntry), PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    if (mem == MAP_FAILED) {
+      err(1, "Unable to allocate a shared map of size %zu", *num_entries * sizeof(AllocEntry));
+    }
+    *entries = reinterpret_cast<AllocEntry*>(mem);
+    const BinaryTraceEntry* records = GetBinaryEntries(header);
+    for (size_t i = 0; i < *num_entries; i++) {
+      BinaryEntryToAllocEntry(records[i], &(*entries)[i]);
+    }
+    munmap(const_cast<BinaryTraceHeader*>(header), map_size);
+    return;
+  }
+
   void* mem =
       mmap(nullptr, sizeof(size_t), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
   if (mem == MAP_FAILED) {
@@ -170,3 +266,221 @@ void GetUnwindInfo(const char* filename, AllocEntry** entries, size_t* num_entri
 void FreeEntries(AllocEntry* entries, size_t num_entries) {
   munmap(entries, num_entries * sizeof(AllocEntry));
 }
+
+bool WriteBinaryTrace(const char* filename, const AllocEntry* entries, size_t num_entries) {
+  android::base::unique_fd fd(open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (fd == -1) {
+    return false;
+  }
+
+  BinaryTraceHeader header = {};
+  memcpy(header.magic, kBinaryTraceMagic, sizeof(header.magic));
+  header.version = kBinaryTraceVersion;
+  header.entry_size = sizeof(BinaryTraceEntry);
+  header.num_entries = num_entries;
+  size_t num_allocs = 0;
+  for (size_t i = 0; i < num_entries; i++) {
+    AllocUpdateLiveCount(entries[i], &num_allocs);
+    header.max_allocs = std::max<uint64_t>(header.max_allocs, num_allocs);
+  }
+  if (!android::base::WriteFully(fd, &header, sizeof(header))) {
+    return false;
+  }
+
+  constexpr size_t kWriteEntries = 4096;
+  std::vector<BinaryTraceEntry> records(kWriteEntries);
+  for (size_t i = 0; i < num_entries; i += kWriteEntries) {
+    size_t count = std::min(kWriteEntries, num_entries - i);
+    for (size_t j = 0; j < count; j++) {
+      AllocEntryToBinaryEntry(entries[i + j], &records[j]);
+    }
+    if (!android::base::WriteFully(fd, records.data(), count * sizeof(BinaryTraceEntry))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes a text or zip trace one chunk at a time, and calls callback with
+// each entry. Only used in fork'd code.
+static void ForEachEntry(const char* filename,
+                         const std::function<void(const AllocEntry&)>& callback) {
+  struct Decoder {
+    const std::function<void(const AllocEntry&)>& callback;
+    // The part of the last line that didn't fit in the previous chunk.
+    std::string partial_line;
+
+    void Decode(const char* data, size_t size) {
+      const char* end = data + size;
+      while (data < end) {
+        const char* newline = static_cast<const char*>(memchr(data, '\n', end - data));
+        if (newline == nullptr) {
+          partial_line.append(data, end);
+          break;
+        }
+        partial_line.append(data, newline);
+        AllocEntry entry;
+        AllocGetData(partial_line, &entry);
+        callback(entry);
+        partial_line.clear();
+        data = newline + 1;
+      }
+    }
+  } decoder{callback, {}};
+
+  if (android::base::EndsWith(filename, ".zip")) {
+    ZipArchiveHandle archive;
+    if (OpenArchive(filename, &archive) != 0) {
+      errx(1, "Unable to open zip file %s", filename);
+    }
+    // It is assumed that the archive contains only a single entry.
+    void* cookie;
+    ZipEntry entry;
+    std::string name;
+    if (StartIteration(archive, &cookie) != 0 || Next(cookie, &entry, &name) != 0) {
+      errx(1, "Contents of zip file %s is empty.", filename);
+    }
+    auto decode = [](const uint8_t* buf, size_t buf_size, void* arg) {
+      reinterpret_cast<Decoder*>(arg)->Decode(reinterpret_cast<const char*>(buf), buf_size);
+      return true;
+    };
+    if (ProcessZipEntryContents(archive, &entry, decode, &decoder) != 0) {
+      errx(1, "Unable to decompress %s", filename);
+    }
+    CloseArchive(archive);
+  } else {
+    FILE* fp = fopen(filename, "re");
+    if (fp == nullptr) {
+      err(1, "Unable to open %s", filename);
+    }
+    std::vector<char> buf(64 * 1024);
+    size_t size;
+    while ((size = fread(buf.data(), 1, buf.size(), fp)) != 0) {
+      decoder.Decode(buf.data(), size);
+    }
+    if (ferror(fp)) {
+      errx(1, "Unable to read %s", filename);
+    }
+    fclose(fp);
+  }
+  if (!decoder.partial_line.empty()) {
+    // The last line doesn't end in '\n'.
+    AllocEntry entry;
+    AllocGetData(decoder.partial_line, &entry);
+    callback(entry);
+  }
+}
+
+void OpenEntryStream(const char* filename, EntryStream* stream) {
+  *stream = EntryStream();
+
+  if (IsBinaryTrace(filename)) {
+    const BinaryTraceHeader* header = MapBinaryTrace(filename, &stream->map_size);
+    stream->map = const_cast<BinaryTraceHeader*>(header);
+    stream->num_entries = header->num_entries;
+    stream->max_allocs = header->max_allocs;
+    return;
+  }
+
+  // The first pass only counts the entries and the maximum number of live
+  // allocations, so the replay can allocate everything up front.
+  struct TraceCounts {
+    size_t num_entries;
+    size_t max_allocs;
+  };
+  void* mem =
+      mmap(nullptr, sizeof(TraceCounts), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+  if (mem == MAP_FAILED) {
+    err(1, "Unable to allocate a shared map of size %zu", sizeof(TraceCounts));
+  }
+  TraceCounts* counts = reinterpret_cast<TraceCounts*>(mem);
+  *counts = {};
+
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    size_t num_allocs = 0;
+    ForEachEntry(filename, [&](const AllocEntry& entry) {
+      counts->num_entries++;
+      AllocUpdateLiveCount(entry, &num_allocs);
+      counts->max_allocs = std::max(counts->max_allocs, num_allocs);
+    });
+    _exit(0);
+  } else if (pid == -1) {
+    err(1, "fork() call failed");
+  }
+  WaitPid(pid);
+  stream->num_entries = counts->num_entries;
+  stream->max_allocs = counts->max_allocs;
+  munmap(mem, sizeof(TraceCounts));
+
+  // The second pass sends the entries through a pipe, so the decoding process
+  // can run ahead of the replay by at most the pipe size.
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    err(1, "pipe() call failed");
+  }
+#if defined(F_SETPIPE_SZ)
+  constexpr int kPipeSize = 1024 * 1024;
+  fcntl(fds[1], F_SETPIPE_SZ, kPipeSize);
+#endif
+  if ((pid = fork()) == 0) {
+    close(fds[0]);
+    constexpr size_t kWriteEntries = 1024;
+    std::vector<AllocEntry> entries;
+    entries.reserve(kWriteEntries);
+    auto flush = [&]() {
+      if (!android::base::WriteFully(fds[1], entries.data(),
+                                     entries.size() * sizeof(AllocEntry))) {
+        err(1, "Unable to write entries to the pipe");
+      }
+      entries.clear();
+    };
+    ForEachEntry(filename, [&](const AllocEntry& entry) {
+      entries.push_back(entry);
+      if (entries.size() == kWriteEntries) {
+        flush();
+      }
+    });
+    flush();
+    _exit(0);
+  } else if (pid == -1) {
+    err(1, "fork() call failed");
+  }
+  close(fds[1]);
+  stream->fd = fds[0];
+  stream->pid = pid;
+}
+
+size_t ReadEntries(EntryStream* stream, AllocEntry* entries, size_t max_entries) {
+  size_t count = std::min(max_entries, stream->num_entries - stream->entries_read);
+  if (stream->map != nullptr) {
+    const BinaryTraceEntry* records =
+        GetBinaryEntries(reinterpret_cast<const BinaryTraceHeader*>(stream->map)) +
+        stream->entries_read;
+    for (size_t i = 0; i < count; i++) {
+      BinaryEntryToAllocEntry(records[i], &entries[i]);
+    }
+  } else if (count > 0 &&
+             !android::base::ReadFully(stream->fd, entries, count * sizeof(AllocEntry))) {
+    errx(1, "Unable to read entries from the decoding process");
+  }
+  stream->entries_read += count;
+  return count;
+}
+
+void CloseEntryStream(EntryStream* stream) {
+  if (stream->map != nullptr) {
+    munmap(stream->map, stream->map_size);
+  }
+  if (stream->fd != -1) {
+    close(stream->fd);
+    if (stream->entries_read == stream->num_entries) {
+      WaitPid(stream->pid);
+    } else {
+      // The decoding process may be blocked writing to the pipe.
+      kill(stream->pid, SIGKILL);
+      TEMP_FAILURE_RETRY(waitpid(stream->pid, nullptr, 0));
+    }
+  }
+  *stream = EntryStream();
+}
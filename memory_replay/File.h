@@ -17,15 +17,74 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <string>
 
 // Forward Declarations.
 struct AllocEntry;
 
+// The binary trace format is a BinaryTraceHeader followed by num_entries
+// BinaryTraceEntry records. The layout is the same on 32 bit and 64 bit, so
+// the records can be mmapped and used without any text parsing.
+constexpr char kBinaryTraceMagic[8] = {'M', 'E', 'M', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t kBinaryTraceVersion = 1;
+
+struct BinaryTraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t num_entries;
+  // The maximum number of live allocations at any point in the trace.
+  uint64_t max_allocs;
+};
+
+struct BinaryTraceEntry {
+  uint64_t ptr;
+  uint64_t size;
+  uint64_t u;
+  uint64_t st;
+  uint64_t et;
+  int32_t tid;
+  uint8_t type;
+  uint8_t reserved[3];
+};
+static_assert(sizeof(BinaryTraceHeader) == 32);
+static_assert(sizeof(BinaryTraceEntry) == 48);
+
 std::string ZipGetContents(const char* filename);
 
-// If filename ends with .zip, treat as a zip file to decompress.
+// If filename ends with .zip, treat as a zip file to decompress. Binary traces
+// are recognized by their header.
 void GetUnwindInfo(const char* filename, AllocEntry** entries, size_t* num_entries);
 
 void FreeEntries(AllocEntry* entries, size_t num_entries);
+
+// Writes the entries to filename in the binary trace format.
+bool WriteBinaryTrace(const char* filename, const AllocEntry* entries, size_t num_entries);
+
+// Reads the entries of a trace in chunks, so the whole trace never has to be
+// in memory. Text and zip traces are decoded by a forked process, which sends
+// the entries through a pipe. Binary traces are mmapped.
+struct EntryStream {
+  size_t num_entries = 0;
+  size_t max_allocs = 0;
+
+  // The read end of the pipe, and the process decoding the trace.
+  int fd = -1;
+  pid_t pid = -1;
+  // The mmapped binary trace.
+  void* map = nullptr;
+  size_t map_size = 0;
+
+  size_t entries_read = 0;
+};
+
+// Like GetUnwindInfo, this function doesn't do any memory allocations in the
+// calling process.
+void OpenEntryStream(const char* filename, EntryStream* stream);
+
+// Reads up to max_entries entries. Returns 0 at the end of the trace.
+size_t ReadEntries(EntryStream* stream, AllocEntry* entries, size_t max_entries);
+
+void CloseEntryStream(EntryStream* stream);
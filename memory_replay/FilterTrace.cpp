@@ -38,7 +38,8 @@ static std::string GetBaseExec() {
 static void Usage() {
   fprintf(
       stderr,
-      "Usage: %s [--min_size SIZE] [--max_size SIZE] [--print_trace_format] [--help] TRACE_FILE\n",
+      "Usage: %s [--min_size SIZE] [--max_size SIZE] [--print_trace_format] [--write_binary FILE] "
+      "[--help] TRACE_FILE\n",
       GetBaseExec().c_str());
   fprintf(stderr, "  --min_size SIZE\n");
   fprintf(stderr, "      Display all allocations that are greater than or equal to SIZE\n");
@@ -46,6 +47,9 @@ static void Usage() {
   fprintf(stderr, "      Display all allocations that are less than or equal to SIZE\n");
   fprintf(stderr, "  --print_trace_format\n");
   fprintf(stderr, "      Display all allocations from the trace in the trace format\n");
+  fprintf(stderr, "  --write_binary FILE\n");
+  fprintf(stderr, "      Convert the whole trace to the binary trace format and write it to FILE\n");
+  fprintf(stderr, "      instead of displaying any allocations\n");
   fprintf(stderr, "  --help\n");
   fprintf(stderr, "      Display this usage message\n");
   fprintf(stderr, "  TRACE_FILE\n");
@@ -56,12 +60,14 @@ static void Usage() {
 }
 
 static bool ParseOptions(int argc, char** argv, size_t& min_size, size_t& max_size,
-                         bool& print_trace_format, std::string_view& trace_file) {
+                         bool& print_trace_format, std::string_view& binary_file,
+                         std::string_view& trace_file) {
   while (true) {
     option options[] = {
         {"min_size", required_argument, nullptr, 'i'},
         {"max_size", required_argument, nullptr, 'x'},
         {"print_trace_format", no_argument, nullptr, 'p'},
+        {"write_binary", required_argument, nullptr, 'w'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0},
     };
@@ -89,6 +95,9 @@ static bool ParseOptions(int argc, char** argv, size_t& min_size, size_t& max_si
       case 'p':
         print_trace_format = true;
         break;
+      case 'w':
+        binary_file = optarg;
+        break;
       case 'h':
       default:
         return false;
@@ -199,12 +208,26 @@ int main(int argc, char** argv) {
   size_t min_size = 0;
   size_t max_size = std::numeric_limits<size_t>::max();
   bool print_trace_format = false;
+  std::string_view binary_file;
   std::string_view trace_file;
-  if (!ParseOptions(argc, argv, min_size, max_size, print_trace_format, trace_file)) {
+  if (!ParseOptions(argc, argv, min_size, max_size, print_trace_format, binary_file,
+                    trace_file)) {
     Usage();
     return 1;
   }
 
+  if (!binary_file.empty()) {
+    AllocEntry* entries;
+    size_t num_entries;
+    GetUnwindInfo(trace_file.data(), &entries, &num_entries);
+    bool written = WriteBinaryTrace(binary_file.data(), entries, num_entries);
+    FreeEntries(entries, num_entries);
+    if (!written) {
+      err(1, "Failed to write binary trace %s", binary_file.data());
+    }
+    return 0;
+  }
+
   ProcessTrace(trace_file, min_size, max_size, print_trace_format);
   return 0;
 }
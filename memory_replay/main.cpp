@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -39,33 +40,14 @@
 
 constexpr size_t kDefaultMaxThreads = 512;
 
+// The number of entries held in memory at once when streaming a trace.
+constexpr size_t kStreamChunkEntries = 65536;
+
 static size_t GetMaxAllocs(const AllocEntry* entries, size_t num_entries) {
   size_t max_allocs = 0;
   size_t num_allocs = 0;
   for (size_t i = 0; i < num_entries; i++) {
-    switch (entries[i].type) {
-      case THREAD_DONE:
-        break;
-      case MALLOC:
-      case CALLOC:
-      case MEMALIGN:
-        if (entries[i].ptr != 0) {
-          num_allocs++;
-        }
-        break;
-      case REALLOC:
-        if (entries[i].ptr == 0 && entries[i].u.old_ptr != 0) {
-          num_allocs--;
-        } else if (entries[i].ptr != 0 && entries[i].u.old_ptr == 0) {
-          num_allocs++;
-        }
-        break;
-      case FREE:
-        if (entries[i].ptr != 0) {
-          num_allocs--;
-        }
-        break;
-    }
+    AllocUpdateLiveCount(entries[i], &num_allocs);
     if (num_allocs > max_allocs) {
       max_allocs = num_allocs;
     }
@@ -109,11 +91,69 @@ static void PrintLogStats(const char* log_name) {
   android_logger_list_close(list);
 }
 
-static void ProcessDump(const AllocEntry* entries, size_t num_entries, size_t max_threads) {
-  // Do a pass to get the maximum number of allocations used at one
-  // time to allow a single mmap that can hold the maximum number of
-  // pointers needed at once.
-  size_t max_allocs = GetMaxAllocs(entries, num_entries);
+static void ProcessEntry(const AllocEntry& entry, Threads& threads) {
+  Thread* thread = threads.FindThread(entry.tid);
+  if (thread == nullptr) {
+    thread = threads.CreateThread(entry.tid);
+  }
+
+  // Wait for the thread to complete any previous actions before handling
+  // the next action.
+  thread->WaitForReady();
+
+  thread->SetAllocEntry(&entry);
+
+  bool does_free = AllocDoesFree(entry);
+  if (does_free) {
+    // Make sure that any other threads doing allocations are complete
+    // before triggering the action. Otherwise, another thread could
+    // be creating the allocation we are going to free.
+    threads.WaitForAllToQuiesce();
+  }
+
+  // Tell the thread to execute the action.
+  thread->SetPending();
+
+  if (entry.type == THREAD_DONE) {
+    // Wait for the thread to finish and clear the thread entry.
+    threads.Finish(thread);
+  }
+
+  // Wait for this action to complete. This avoids a race where
+  // another thread could be creating the same allocation where are
+  // trying to free.
+  if (does_free) {
+    thread->WaitForReady();
+  }
+}
+
+static void ProcessDump(const char* filename, bool stream, size_t max_threads) {
+  AllocEntry* entries;
+  size_t num_entries;
+  size_t max_allocs;
+  EntryStream entry_stream;
+  if (stream) {
+    // Only kStreamChunkEntries entries are decoded at a time, and the maximum
+    // number of allocations comes from a streaming pass or the binary header.
+    OpenEntryStream(filename, &entry_stream);
+    num_entries = entry_stream.num_entries;
+    max_allocs = entry_stream.max_allocs;
+    void* mem = mmap(nullptr, kStreamChunkEntries * sizeof(AllocEntry), PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (mem == MAP_FAILED) {
+      err(1, "Unable to allocate a map of size %zu", kStreamChunkEntries * sizeof(AllocEntry));
+    }
+    entries = reinterpret_cast<AllocEntry*>(mem);
+  } else {
+    GetUnwindInfo(filename, &entries, &num_entries);
+    // Do a pass to get the maximum number of allocations used at one
+    // time to allow a single mmap that can hold the maximum number of
+    // pointers needed at once.
+    max_allocs = GetMaxAllocs(entries, num_entries);
+  }
+
+  dprintf(STDOUT_FILENO, "Processing: %s\n", filename);
+
   Pointers pointers(max_allocs);
   Threads threads(&pointers, max_threads);
 
@@ -123,44 +163,24 @@ static void ProcessDump(const AllocEntry* entries, size_t num_entries, size_t ma
 
   NativePrintInfo("Initial ");
 
-  for (size_t i = 0; i < num_entries; i++) {
-    if (((i + 1) % 100000) == 0) {
-      dprintf(STDOUT_FILENO, "  At line %zu:\n", i + 1);
-      NativePrintInfo("    ");
-    }
-    const AllocEntry& entry = entries[i];
-    Thread* thread = threads.FindThread(entry.tid);
-    if (thread == nullptr) {
-      thread = threads.CreateThread(entry.tid);
-    }
-
-    // Wait for the thread to complete any previous actions before handling
-    // the next action.
-    thread->WaitForReady();
-
-    thread->SetAllocEntry(&entry);
-
-    bool does_free = AllocDoesFree(entry);
-    if (does_free) {
-      // Make sure that any other threads doing allocations are complete
-      // before triggering the action. Otherwise, another thread could
-      // be creating the allocation we are going to free.
+  size_t line = 0;
+  while (line < num_entries) {
+    size_t chunk_entries = num_entries;
+    if (stream) {
+      // The threads keep pointers to their current entries, so they must be
+      // done before the chunk is overwritten.
       threads.WaitForAllToQuiesce();
+      chunk_entries = ReadEntries(&entry_stream, entries, kStreamChunkEntries);
+      if (chunk_entries == 0) {
+        break;
+      }
     }
-
-    // Tell the thread to execute the action.
-    thread->SetPending();
-
-    if (entries[i].type == THREAD_DONE) {
-      // Wait for the thread to finish and clear the thread entry.
-      threads.Finish(thread);
-    }
-
-    // Wait for this action to complete. This avoids a race where
-    // another thread could be creating the same allocation where are
-    // trying to free.
-    if (does_free) {
-      thread->WaitForReady();
+    for (size_t i = 0; i < chunk_entries; i++, line++) {
+      if (((line + 1) % 100000) == 0) {
+        dprintf(STDOUT_FILENO, "  At line %zu:\n", line + 1);
+        NativePrintInfo("    ");
+      }
+      ProcessEntry(entries[i], threads);
     }
   }
   // Wait for all threads to stop processing actions.
@@ -174,6 +194,13 @@ static void ProcessDump(const AllocEntry* entries, size_t num_entries, size_t ma
   threads.FinishAll();
   pointers.FreeAll();
 
+  if (stream) {
+    munmap(entries, kStreamChunkEntries * sizeof(AllocEntry));
+    CloseEntryStream(&entry_stream);
+  } else {
+    FreeEntries(entries, num_entries);
+  }
+
   // Print out the total time making all allocation calls.
   char buffer[256];
   uint64_t total_nsecs = threads.total_time_nsecs();
@@ -190,15 +217,25 @@ static void ProcessDump(const AllocEntry* entries, size_t num_entries, size_t ma
 }
 
 int main(int argc, char** argv) {
+  bool stream = false;
+  if (argc > 1 && strcmp(argv[1], "--stream") == 0) {
+    stream = true;
+    argc--;
+    argv++;
+  }
   if (argc != 2 && argc != 3) {
     if (argc > 3) {
       fprintf(stderr, "Only two arguments are expected.\n");
     } else {
       fprintf(stderr, "Requires at least one argument.\n");
     }
-    fprintf(stderr, "Usage: %s MEMORY_LOG_FILE [MAX_THREADS]\n", basename(argv[0]));
+    fprintf(stderr, "Usage: %s [--stream] MEMORY_LOG_FILE [MAX_THREADS]\n", basename(argv[0]));
+    fprintf(stderr, "  --stream\n");
+    fprintf(stderr, "    Decode the trace in chunks while it is replayed, instead of loading\n");
+    fprintf(stderr, "    the whole trace into memory first.\n");
     fprintf(stderr, "  MEMORY_LOG_FILE\n");
-    fprintf(stderr, "    This can either be a text file or a zipped text file.\n");
+    fprintf(stderr, "    This can either be a text file, a zipped text file, or a binary\n");
+    fprintf(stderr, "    trace written by filter_trace --write_binary.\n");
     fprintf(stderr, "  MAX_THREADs\n");
     fprintf(stderr, "    The maximum number of threads in the trace. The default is %zu.\n",
             kDefaultMaxThreads);
@@ -223,15 +260,7 @@ int main(int argc, char** argv) {
     max_threads = atoi(argv[2]);
   }
 
-  AllocEntry* entries;
-  size_t num_entries;
-  GetUnwindInfo(argv[1], &entries, &num_entries);
-
-  dprintf(STDOUT_FILENO, "Processing: %s\n", argv[1]);
-
-  ProcessDump(entries, num_entries, max_threads);
-
-  FreeEntries(entries, num_entries);
+  ProcessDump(argv[1], stream, max_threads);
 
   return 0;
 }
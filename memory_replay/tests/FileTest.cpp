@@ -110,3 +110,101 @@ TEST(FileTest, get_unwind_info_bad_file) {
   size_t num_entries;
   EXPECT_DEATH(GetUnwindInfo("/does/not/exist", &entries, &num_entries), "");
 }
+
+TEST(FileTest, binary_trace_round_trip) {
+  AllocEntry* entries;
+  size_t num_entries;
+  GetUnwindInfo((GetTestDirectory() + "/test.txt").c_str(), &entries, &num_entries);
+
+  TemporaryFile tf;
+  ASSERT_TRUE(WriteBinaryTrace(tf.path, entries, num_entries));
+  FreeEntries(entries, num_entries);
+
+  size_t mallinfo_before = mallinfo().uordblks;
+  GetUnwindInfo(tf.path, &entries, &num_entries);
+  size_t mallinfo_after = mallinfo().uordblks;
+
+  // Verify no memory is allocated.
+  EXPECT_EQ(mallinfo_after, mallinfo_before);
+
+  ASSERT_EQ(2U, num_entries);
+  EXPECT_EQ(98765, entries[0].tid);
+  EXPECT_EQ(MEMALIGN, entries[0].type);
+  EXPECT_EQ(0xa000U, entries[0].ptr);
+  EXPECT_EQ(124U, entries[0].size);
+  EXPECT_EQ(16U, entries[0].u.align);
+
+  EXPECT_EQ(98765, entries[1].tid);
+  EXPECT_EQ(FREE, entries[1].type);
+  EXPECT_EQ(0xa000U, entries[1].ptr);
+  EXPECT_EQ(0U, entries[1].size);
+
+  FreeEntries(entries, num_entries);
+}
+
+static void VerifyEntryStream(const std::string& file_name) {
+  AllocEntry entries[4];
+
+  size_t mallinfo_before = mallinfo().uordblks;
+  EntryStream stream;
+  OpenEntryStream(file_name.c_str(), &stream);
+  size_t num_read = ReadEntries(&stream, entries, 1);
+  size_t num_read_end = ReadEntries(&stream, &entries[1], 3);
+  size_t num_read_after_end = ReadEntries(&stream, &entries[2], 2);
+  size_t num_entries = stream.num_entries;
+  size_t max_allocs = stream.max_allocs;
+  CloseEntryStream(&stream);
+  size_t mallinfo_after = mallinfo().uordblks;
+
+  // Verify no memory is allocated.
+  EXPECT_EQ(mallinfo_after, mallinfo_before);
+
+  EXPECT_EQ(2U, num_entries);
+  EXPECT_EQ(1U, max_allocs);
+  EXPECT_EQ(1U, num_read);
+  EXPECT_EQ(1U, num_read_end);
+  EXPECT_EQ(0U, num_read_after_end);
+
+  EXPECT_EQ(MEMALIGN, entries[0].type);
+  EXPECT_EQ(0xa000U, entries[0].ptr);
+  EXPECT_EQ(124U, entries[0].size);
+  EXPECT_EQ(16U, entries[0].u.align);
+
+  EXPECT_EQ(FREE, entries[1].type);
+  EXPECT_EQ(0xa000U, entries[1].ptr);
+}
+
+TEST(FileTest, entry_stream_from_text_file) {
+  VerifyEntryStream(GetTestDirectory() + "/test.txt");
+}
+
+TEST(FileTest, entry_stream_from_binary_file) {
+  AllocEntry* entries;
+  size_t num_entries;
+  GetUnwindInfo((GetTestDirectory() + "/test.txt").c_str(), &entries, &num_entries);
+  TemporaryFile tf;
+  ASSERT_TRUE(WriteBinaryTrace(tf.path, entries, num_entries));
+  FreeEntries(entries, num_entries);
+
+  VerifyEntryStream(tf.path);
+}
+
+TEST(FileTest, entry_stream_from_zip_file) {
+  AllocEntry entries[2];
+  EntryStream stream;
+  OpenEntryStream(GetTestZip().c_str(), &stream);
+  EXPECT_EQ(2U, stream.num_entries);
+  ASSERT_EQ(2U, ReadEntries(&stream, entries, 2));
+  CloseEntryStream(&stream);
+
+  EXPECT_EQ(12345, entries[0].tid);
+  EXPECT_EQ(MALLOC, entries[0].type);
+  EXPECT_EQ(0x1000U, entries[0].ptr);
+  EXPECT_EQ(16U, entries[0].size);
+  EXPECT_EQ(FREE, entries[1].type);
+}
+
+TEST(FileTest, entry_stream_bad_file) {
+  EntryStream stream;
+  EXPECT_DEATH(OpenEntryStream("/does/not/exist", &stream), "");
+}
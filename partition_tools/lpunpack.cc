@@ -17,16 +17,24 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdio.h>
+#include <string.h>
 #include <sysexits.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/parseint.h>
@@ -41,20 +49,26 @@ using SparsePtr = std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)>;
 class ImageExtractor final {
   public:
     ImageExtractor(std::vector<unique_fd>&& image_fds, std::unique_ptr<LpMetadata>&& metadata,
-                   std::unordered_set<std::string>&& partitions, const std::string& output_dir);
+                   std::unordered_set<std::string>&& partitions, const std::string& output_dir,
+                   uint32_t jobs);
 
     bool Extract();
 
   private:
     bool BuildPartitionList();
+    void ExtractPartitions(std::atomic<size_t>* next, std::atomic<bool>* failed);
     bool ExtractPartition(const LpMetadataPartition* partition);
-    bool ExtractExtent(const LpMetadataExtent& extent, int output_fd);
 
     std::vector<unique_fd> image_fds_;
     std::unique_ptr<LpMetadata> metadata_;
     std::unordered_set<std::string> partitions_;
     std::string output_dir_;
+    uint32_t jobs_;
     std::unordered_map<std::string, const LpMetadataPartition*> partition_map_;
+    std::vector<const LpMetadataPartition*> partition_list_;
+    // Partitions are extracted concurrently, so messages are printed under this lock.
+    std::mutex output_lock_;
+    std::atomic<uint64_t> bytes_extracted_ = 0;
 };
 
 // Note that "sparse" here refers to filesystem sparse, not the Android sparse
@@ -67,13 +81,18 @@ class SparseWriter final {
     bool Finish();
 
   private:
-    bool WriteBlock(const uint8_t* data);
+    bool WriteBlocks(const uint8_t* data, size_t num_blocks);
 
     borrowed_fd output_fd_;
     uint32_t block_size_;
     off_t hole_size_ = 0;
+    std::unique_ptr<uint8_t[]> buffer_;
+    size_t buffer_size_;
 };
 
+// Extents are read in chunks of about this size.
+static constexpr size_t kReadChunkSize = 1024 * 1024;
+
 /* Prints program usage to |where|. */
 static int usage(int /* argc */, char* argv[]) {
     fprintf(stderr,
@@ -92,7 +111,9 @@ static int usage(int /* argc */, char* argv[]) {
             "                           This can be specified multiple times.\n"
             "  -p, --partition=NAME     Extract the named partition. This can\n"
             "                           be specified multiple times.\n"
-            "  -S, --slot=NUM           Slot number (default is 0).\n",
+            "  -S, --slot=NUM           Slot number (default is 0).\n"
+            "  -j, --jobs=NUM           Number of partitions to extract in parallel\n"
+            "                           (default is the number of CPUs).\n",
             argv[0], argv[0]);
     return EX_USAGE;
 }
@@ -103,16 +124,18 @@ int main(int argc, char* argv[]) {
         { "image",      required_argument,  nullptr, 'i' },
         { "partition",  required_argument,  nullptr, 'p' },
         { "slot",       required_argument,  nullptr, 'S' },
+        { "jobs",       required_argument,  nullptr, 'j' },
         { nullptr,      0,                  nullptr, 0 },
     };
     // clang-format on
 
     uint32_t slot_num = 0;
+    uint32_t jobs = std::max(std::thread::hardware_concurrency(), 1u);
     std::unordered_set<std::string> partitions;
     std::vector<std::string> image_files;
 
     int rv, index;
-    while ((rv = getopt_long_only(argc, argv, "+p:sh", options, &index)) != -1) {
+    while ((rv = getopt_long_only(argc, argv, "+p:shj:", options, &index)) != -1) {
         switch (rv) {
             case 'h':
                 usage(argc, argv);
@@ -126,6 +149,12 @@ int main(int argc, char* argv[]) {
                     return usage(argc, argv);
                 }
                 break;
+            case 'j':
+                if (!android::base::ParseUint(optarg, &jobs) || jobs == 0) {
+                    std::cerr << "Jobs must be a valid positive number.\n";
+                    return usage(argc, argv);
+                }
+                break;
             case 'i':
                 image_files.push_back(optarg);
                 break;
@@ -188,7 +217,8 @@ int main(int argc, char* argv[]) {
     }
 
     // Now do actual extraction.
-    ImageExtractor extractor(std::move(fds), std::move(metadata), std::move(partitions), output_dir);
+    ImageExtractor extractor(std::move(fds), std::move(metadata), std::move(partitions), output_dir,
+                             jobs);
     if (!extractor.Extract()) {
         return EX_SOFTWARE;
     }
@@ -197,11 +227,12 @@ int main(int argc, char* argv[]) {
 
 ImageExtractor::ImageExtractor(std::vector<unique_fd>&& image_fds, std::unique_ptr<LpMetadata>&& metadata,
                                std::unordered_set<std::string>&& partitions,
-                               const std::string& output_dir)
+                               const std::string& output_dir, uint32_t jobs)
     : image_fds_(std::move(image_fds)),
       metadata_(std::move(metadata)),
       partitions_(std::move(partitions)),
-      output_dir_(output_dir) {}
+      output_dir_(output_dir),
+      jobs_(jobs) {}
 
 bool ImageExtractor::Extract() {
     std::filesystem::create_directories(output_dir_);
@@ -209,15 +240,54 @@ bool ImageExtractor::Extract() {
         return false;
     }
 
-    for (const auto& [name, info] : partition_map_) {
-        std::cout << "Attempting to extract partition '" << name << "'...\n";
-        if (!ExtractPartition(info)) {
-            return false;
-        }
+    // Partitions don't share any output, and all reads from the super images
+    // use pread, so each worker can take the next partition from the list.
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> failed = false;
+    size_t num_threads = std::min<size_t>(jobs_, partition_list_.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(&ImageExtractor::ExtractPartitions, this, &next, &failed);
     }
+    ExtractPartitions(&next, &failed);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failed) {
+        return false;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double mib = bytes_extracted_ / (1024.0 * 1024.0);
+    std::cout << "Extracted " << partition_list_.size() << " partition(s), " << std::fixed
+              << std::setprecision(1) << mib << " MiB in " << std::setprecision(2)
+              << elapsed.count() << " s";
+    if (elapsed.count() > 0) {
+        std::cout << " (" << std::setprecision(1) << mib / elapsed.count() << " MiB/s)";
+    }
+    std::cout << ".\n";
     return true;
 }
 
+void ImageExtractor::ExtractPartitions(std::atomic<size_t>* next, std::atomic<bool>* failed) {
+    while (!*failed) {
+        size_t index = (*next)++;
+        if (index >= partition_list_.size()) {
+            break;
+        }
+        const LpMetadataPartition* partition = partition_list_[index];
+        {
+            std::lock_guard<std::mutex> lock(output_lock_);
+            std::cout << "Attempting to extract partition '" << GetPartitionName(*partition)
+                      << "'...\n";
+        }
+        if (!ExtractPartition(partition)) {
+            *failed = true;
+        }
+    }
+}
+
 bool ImageExtractor::BuildPartitionList() {
     bool extract_all = partitions_.empty();
 
@@ -233,6 +303,23 @@ bool ImageExtractor::BuildPartitionList() {
         std::cerr << "Could not find partition: " << *partitions_.begin() << "\n";
         return false;
     }
+
+    // Start with the largest partitions, so a big partition picked up last
+    // doesn't leave the other workers idle.
+    auto partition_size = [this](const LpMetadataPartition* partition) {
+        uint64_t sectors = 0;
+        for (uint32_t i = 0; i < partition->num_extents; i++) {
+            sectors += metadata_->extents[partition->first_extent_index + i].num_sectors;
+        }
+        return sectors;
+    };
+    for (const auto& [name, info] : partition_map_) {
+        partition_list_.emplace_back(info);
+    }
+    std::stable_sort(partition_list_.begin(), partition_list_.end(),
+                     [&](const LpMetadataPartition* a, const LpMetadataPartition* b) {
+                         return partition_size(a) > partition_size(b);
+                     });
     return true;
 }
 
@@ -242,6 +329,7 @@ bool ImageExtractor::ExtractPartition(const LpMetadataPartition* partition) {
     for (uint32_t i = 0; i < partition->num_extents; i++) {
         uint32_t index = partition->first_extent_index + i;
         const LpMetadataExtent& extent = metadata_->extents[index];
+        std::lock_guard<std::mutex> lock(output_lock_);
         std::cout << "  Dealing with extent " << i << " from target source " << extent.target_source << "...\n";
 
         if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
@@ -274,64 +362,100 @@ bool ImageExtractor::ExtractPartition(const LpMetadataPartition* partition) {
             return false;
         }
     }
-    return writer.Finish();
+    if (!writer.Finish()) {
+        return false;
+    }
+    bytes_extracted_ += total_size;
+    return true;
 }
 
 SparseWriter::SparseWriter(borrowed_fd output_fd, uint32_t block_size)
-    : output_fd_(output_fd), block_size_(block_size) {}
+    : output_fd_(output_fd),
+      block_size_(block_size),
+      buffer_size_(std::max<size_t>(kReadChunkSize / block_size * block_size, block_size)) {
+    buffer_ = std::make_unique<uint8_t[]>(buffer_size_);
+}
 
 bool SparseWriter::WriteExtent(borrowed_fd image_fd, const LpMetadataExtent& extent) {
-    auto buffer = std::make_unique<uint8_t[]>(block_size_);
-
-    off_t super_offset = extent.target_data * LP_SECTOR_SIZE;
-    if (lseek(image_fd.get(), super_offset, SEEK_SET) < 0) {
-        std::cerr << "image lseek failed: " << strerror(errno) << "\n";
+    uint64_t offset = extent.target_data * LP_SECTOR_SIZE;
+    uint64_t remaining_bytes = extent.num_sectors * LP_SECTOR_SIZE;
+    if (remaining_bytes % block_size_) {
+        std::cerr << "extent is not block-aligned\n";
         return false;
     }
 
-    uint64_t remaining_bytes = extent.num_sectors * LP_SECTOR_SIZE;
     while (remaining_bytes) {
-        if (remaining_bytes < block_size_) {
-            std::cerr << "extent is not block-aligned\n";
-            return false;
+        // Ranges that are holes in the super image itself read back as zeroes,
+        // so skip them without reading. The file offset of image_fd isn't used
+        // for reads, so moving it here doesn't matter.
+        off_t data = lseek(image_fd.get(), offset, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+            // The rest of the image is a hole, unless the image is too short,
+            // which the read below reports.
+            off_t end = lseek(image_fd.get(), 0, SEEK_END);
+            if (end >= 0 && static_cast<uint64_t>(end) >= offset + remaining_bytes) {
+                hole_size_ += remaining_bytes;
+                break;
+            }
+            data = offset;
+        }
+        if (data > static_cast<off_t>(offset)) {
+            uint64_t skip = std::min<uint64_t>(data - offset, remaining_bytes);
+            skip -= skip % block_size_;
+            hole_size_ += skip;
+            offset += skip;
+            remaining_bytes -= skip;
+            if (!remaining_bytes) {
+                break;
+            }
         }
-        if (!android::base::ReadFully(image_fd, buffer.get(), block_size_)) {
+
+        size_t len = std::min<uint64_t>(remaining_bytes, buffer_size_);
+        if (!android::base::ReadFullyAtOffset(image_fd, buffer_.get(), len, offset)) {
             std::cerr << "read failed: " << strerror(errno) << "\n";
             return false;
         }
-        if (!WriteBlock(buffer.get())) {
+        if (!WriteBlocks(buffer_.get(), len / block_size_)) {
             return false;
         }
-        remaining_bytes -= block_size_;
+        offset += len;
+        remaining_bytes -= len;
     }
     return true;
 }
 
 static bool ShouldSkipChunk(const uint8_t* data, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        if (data[i] != 0) {
-            return false;
-        }
-    }
-    return true;
+    // A buffer is all zeroes if its first byte is zero and every byte equals
+    // the next one. memcmp is vectorized, unlike a byte loop.
+    return len == 0 || (data[0] == 0 && memcmp(data, data + 1, len - 1) == 0);
 }
 
-bool SparseWriter::WriteBlock(const uint8_t* data) {
-    if (ShouldSkipChunk(data, block_size_)) {
-        hole_size_ += block_size_;
-        return true;
-    }
+bool SparseWriter::WriteBlocks(const uint8_t* data, size_t num_blocks) {
+    size_t i = 0;
+    while (i < num_blocks) {
+        if (ShouldSkipChunk(data + i * block_size_, block_size_)) {
+            hole_size_ += block_size_;
+            i++;
+            continue;
+        }
 
-    if (hole_size_) {
-        if (lseek(output_fd_.get(), hole_size_, SEEK_CUR) < 0) {
-            std::cerr << "lseek failed: " << strerror(errno) << "\n";
+        // Write all consecutive non-zero blocks at once.
+        size_t first = i++;
+        while (i < num_blocks && !ShouldSkipChunk(data + i * block_size_, block_size_)) {
+            i++;
+        }
+        if (hole_size_) {
+            if (lseek(output_fd_.get(), hole_size_, SEEK_CUR) < 0) {
+                std::cerr << "lseek failed: " << strerror(errno) << "\n";
+                return false;
+            }
+            hole_size_ = 0;
+        }
+        if (!android::base::WriteFully(output_fd_, data + first * block_size_,
+                                       (i - first) * block_size_)) {
+            std::cerr << "write failed: " << strerror(errno) << "\n";
             return false;
         }
-        hole_size_ = 0;
-    }
-    if (!android::base::WriteFully(output_fd_, data, block_size_)) {
-        std::cerr << "write failed: " << strerror(errno) << "\n";
-        return false;
     }
     return true;
 }
@@ -15,8 +15,9 @@
 #define MEMINSPECT_FAIL_OPEN 1
 #define MEMINSPECT_FAIL_FSTAT 2
 #define MEMINSPECT_FAIL_MINCORE 3
+#define MEMINSPECT_FAIL_MMAP 4
 
-#define DEFAULT_PAGES_PER_MINCORE 1
+#define DEFAULT_PAGES_PER_MINCORE 1024
 
 /**
  * This class stores an offset defined vma which exists
@@ -24,11 +25,11 @@
  */
 class VmaRange {
   public:
-    uint32_t offset;
-    uint32_t length;
+    uint64_t offset;
+    uint64_t length;
 
     VmaRange() {}
-    VmaRange(uint32_t off, uint32_t len) : offset(off), length(len) {}
+    VmaRange(uint64_t off, uint64_t len) : offset(off), length(len) {}
 
     bool is_empty() const;
 
@@ -75,7 +76,7 @@ class VmaRange {
      */
     VmaRange union_merge(const VmaRange& target) const;
 
-    uint32_t end_offset() const;
+    uint64_t end_offset() const;
 };
 
 /**
@@ -249,6 +250,22 @@ int64_t get_file_size(const std::string& file);
 int probe_resident_memory(std::string probed_file, VmaRangeGroup& out_resident_mem,
                           int pages_per_mincore = DEFAULT_PAGES_PER_MINCORE);
 
+/**
+ * @brief Probe resident memory for several files in parallel.
+ *
+ * @param probed_files Files to probe as defined by their paths.
+ * @param out_resident_mems Inspection results. This is populated when called, with
+ * one entry per file in the same order as |probed_files|.
+ * @param num_threads Maximum number of files probed at once, 0 means one per CPU.
+ * @param pages_per_mincore Size of mincore window used, see |probe_resident_memory|.
+ * @return the result of |probe_resident_memory| for each file, in the same order
+ * as |probed_files|.
+ */
+std::vector<int> probe_resident_memory_batch(const std::vector<std::string>& probed_files,
+                                             std::vector<VmaRangeGroup>& out_resident_mems,
+                                             unsigned int num_threads = 0,
+                                             int pages_per_mincore = DEFAULT_PAGES_PER_MINCORE);
+
 /**
  * @brief Align vma ranges to a certain page size
  *
@@ -265,4 +282,23 @@ void align_ranges(std::vector<VmaRange>& ranges, unsigned int alignment);
  * @param ranges vma ranges that need to be merged.
  * @return new vector with ranges merged.
  */
-std::vector<VmaRange> merge_ranges(const std::vector<VmaRange>& ranges);
\ No newline at end of file
+std::vector<VmaRange> merge_ranges(const std::vector<VmaRange>& ranges);
+
+/**
+ * @brief Computes the parts of |ranges| that are not covered by |to_remove|.
+ * This is mostly used to diff two probes of the same file, where the result
+ * is the memory that became resident between the two probes.
+ *
+ * Subtract Operation:
+ *
+ * [   Range A    ]   [ Range B ]
+ *      [ To Remove ]
+ * Result:
+ * [ C ]              [ Range B ]
+ *
+ * @param ranges vma ranges to subtract from.
+ * @param to_remove vma ranges to subtract.
+ * @return new vector with the remaining ranges sorted by offset.
+ */
+std::vector<VmaRange> subtract_ranges(const std::vector<VmaRange>& ranges,
+                                      const std::vector<VmaRange>& to_remove);
\ No newline at end of file
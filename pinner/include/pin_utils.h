@@ -21,7 +21,7 @@ struct PinConfig {
 /**
  * @brief Generate a pinlist file from a given list of vmas containing a list of 4-byte pairs
  * representing (4-byte offset, 4-byte len) contiguous in memory and they are stored in big endian
- * format.
+ * format. Ranges that start beyond 4GB are skipped.
  *
  * @param output_file Output file to write pinlist
  * @param vmas_to_pin Set of vmas to write into pinlist file.
@@ -55,9 +55,9 @@ class PinTool {
   private:
     std::string input_file_;
     std::string custom_probe_file_;
-    PinConfig* pinconfig_;
+    PinConfig* pinconfig_ = nullptr;
     std::vector<ZipEntryCoverage> filtered_files_;
-    bool verbose_;
+    bool verbose_ = false;
     ZipMemInspector* zip_inspector_ = nullptr;
 
   public:
@@ -79,6 +79,13 @@ class PinTool {
     // Compute a resident memory probe for |input_file_|
     int probe_resident();
 
+    // Retrieves the current probe, if any exists.
+    VmaRangeGroup* get_probe();
+
+    // Remove the ranges found in |base_probe_file|, a pinlist.meta style
+    // file, from the current probe so only newly resident memory remains.
+    int subtract_probe_from_pinlist(std::string base_probe_file);
+
     // Compute coverage for each zip entry contained within
     // |input_file_|.
     // Note: It only works for zip files
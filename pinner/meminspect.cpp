@@ -1,5 +1,8 @@
 #include "meminspect.h"
 #include <android-base/unique_fd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "ziparchive/zip_archive.h"
 
 using namespace std;
@@ -8,7 +11,7 @@ using namespace ::android::base;
 
 const static VmaRange VMA_RANGE_EMPTY = VmaRange(0, 0);
 
-uint32_t VmaRange::end_offset() const {
+uint64_t VmaRange::end_offset() const {
     return offset + length;
 }
 
@@ -50,7 +53,7 @@ VmaRange VmaRange::intersect(const VmaRange& target) const {
     VmaRange result;
     // the slice should now be inside the range so compute the intersection.
     result.offset = std::max(target.offset, this->offset);
-    uint32_t res_end = std::min(target.end_offset(), end_offset());
+    uint64_t res_end = std::min(target.end_offset(), end_offset());
     result.length = res_end - result.offset;
 
     return result;
@@ -66,14 +69,14 @@ VmaRange VmaRange::union_merge(const VmaRange& target) const {
     // Since there is an intersection, merge ranges between lowest
     // and highest value.
     result.offset = std::min(offset, target.offset);
-    uint32_t res_end = std::max(target.end_offset(), end_offset());
+    uint64_t res_end = std::max(target.end_offset(), end_offset());
     result.length = res_end - result.offset;
     return result;
 }
 
 void align_ranges(std::vector<VmaRange>& vmas_to_align, unsigned int alignment) {
     for (auto&& vma_to_align : vmas_to_align) {
-        uint32_t unaligned_offset = vma_to_align.offset % alignment;
+        uint64_t unaligned_offset = vma_to_align.offset % alignment;
         vma_to_align.offset -= unaligned_offset;
         vma_to_align.length += unaligned_offset;
     }
@@ -111,6 +114,39 @@ std::vector<VmaRange> merge_ranges(const std::vector<VmaRange>& ranges) {
     return merged_ranges;
 }
 
+std::vector<VmaRange> subtract_ranges(const std::vector<VmaRange>& ranges,
+                                      const std::vector<VmaRange>& to_remove) {
+    // Once merged, both lists are sorted and have no overlaps, so a single
+    // pass over both is enough.
+    std::vector<VmaRange> merged = merge_ranges(ranges);
+    std::vector<VmaRange> merged_to_remove = merge_ranges(to_remove);
+    std::vector<VmaRange> result;
+    size_t iRemove = 0;
+    for (auto&& range : merged) {
+        uint64_t start = range.offset;
+        uint64_t end = range.end_offset();
+        // Skip the ranges that end before this one.
+        while (iRemove < merged_to_remove.size() &&
+               merged_to_remove[iRemove].end_offset() <= start) {
+            ++iRemove;
+        }
+        for (size_t i = iRemove; i < merged_to_remove.size(); ++i) {
+            const VmaRange& remove = merged_to_remove[i];
+            if (remove.offset >= end) {
+                break;
+            }
+            if (remove.offset > start) {
+                result.push_back(VmaRange(start, remove.offset - start));
+            }
+            start = std::max(start, remove.end_offset());
+        }
+        if (start < end) {
+            result.push_back(VmaRange(start, end - start));
+        }
+    }
+    return result;
+}
+
 int64_t get_file_size(const std::string& file) {
     unique_fd file_ufd(open(file.c_str(), O_RDONLY));
     int fd = file_ufd.get();
@@ -129,78 +165,109 @@ int64_t get_file_size(const std::string& file) {
 
 int probe_resident_memory(string probed_file,
                           /*out*/ VmaRangeGroup& resident_ranges, int pages_per_mincore) {
-    unique_fd probed_file_ufd(open(probed_file.c_str(), O_RDONLY));
+    unique_fd probed_file_ufd(open(probed_file.c_str(), O_RDONLY | O_CLOEXEC));
     int probe_fd = probed_file_ufd.get();
     if (probe_fd == -1) {
         return MEMINSPECT_FAIL_OPEN;
     }
 
-    int64_t total_bytes = get_file_size(probed_file);
-    if (total_bytes < 0) {
+    struct stat fstat_res;
+    if (fstat(probe_fd, &fstat_res) == -1) {
         return MEMINSPECT_FAIL_FSTAT;
     }
+    uint64_t total_bytes = fstat_res.st_size;
+    if (total_bytes == 0) {
+        // Nothing can be resident in an empty file.
+        return 0;
+    }
 
     char* base_address =
-            (char*)mmap(0, (uint64_t)total_bytes, PROT_READ, MAP_SHARED, probe_fd, /*offset*/ 0);
+            (char*)mmap(0, total_bytes, PROT_READ, MAP_SHARED, probe_fd, /*offset*/ 0);
+    if (base_address == MAP_FAILED) {
+        return MEMINSPECT_FAIL_MMAP;
+    }
 
     // this determines how many pages to inspect per mincore syscall
-    unsigned char* window = new unsigned char[pages_per_mincore];
+    pages_per_mincore = std::max(pages_per_mincore, 1);
+    std::vector<unsigned char> window(pages_per_mincore);
 
-    unsigned int page_size = sysconf(_SC_PAGESIZE);
-    unsigned long bytes_inspected = 0;
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t total_pages = (total_bytes + page_size - 1) / page_size;
 
-    // total bytes in inspection window
-    unsigned long window_bytes = page_size * pages_per_mincore;
-
-    char* window_base;
+    int res = 0;
     bool started_vma_range = false;
-    uint32_t resident_vma_start_offset = 0;
-    for (window_base = base_address; bytes_inspected < total_bytes;
-         window_base += window_bytes, bytes_inspected += window_bytes) {
-        int res = mincore(window_base, window_bytes, window);
-        if (res != 0) {
-            if (errno == ENOMEM) {
-                // Did not find page, maybe it's a hole.
-                continue;
+    uint64_t resident_vma_start_offset = 0;
+    for (uint64_t window_page = 0; window_page < total_pages; window_page += pages_per_mincore) {
+        // The last window may be shorter, so it doesn't go past the mapping.
+        uint64_t window_pages = std::min<uint64_t>(pages_per_mincore, total_pages - window_page);
+        if (mincore(base_address + window_page * page_size, window_pages * page_size,
+                    window.data()) != 0) {
+            if (errno != ENOMEM) {
+                res = MEMINSPECT_FAIL_MINCORE;
+                break;
             }
-            return MEMINSPECT_FAIL_MINCORE;
+            // Did not find page, maybe it's a hole.
+            std::fill(window.begin(), window.end(), 0);
         }
         // Inspect the provided mincore window result sequentially
         // and as soon as a change in residency happens a range is
         // created or finished.
-        for (int iWin = 0; iWin < pages_per_mincore; ++iWin) {
-            if ((window[iWin] & (unsigned char)1) != 0) {
-                // Page is resident
-                if (!started_vma_range) {
-                    // End of range
-                    started_vma_range = true;
-                    uint32_t window_offset = iWin * page_size;
-                    resident_vma_start_offset = window_base + window_offset - base_address;
-                }
+        for (uint64_t iWin = 0; iWin < window_pages; ++iWin) {
+            bool resident = (window[iWin] & (unsigned char)1) != 0;
+            if (resident == started_vma_range) {
+                continue;
+            }
+            uint64_t offset = (window_page + iWin) * page_size;
+            if (resident) {
+                // Start of range
+                resident_vma_start_offset = offset;
             } else {
-                // Page is not resident
-                if (started_vma_range) {
-                    // Start of range
-                    started_vma_range = false;
-                    uint32_t window_offset = iWin * page_size;
-                    uint32_t resident_vma_end_offset = window_base + window_offset - base_address;
-                    uint32_t resident_len = resident_vma_end_offset - resident_vma_start_offset;
-                    VmaRange vma_range(resident_vma_start_offset, resident_len);
-                    resident_ranges.ranges.push_back(vma_range);
-                }
+                // End of range
+                resident_ranges.ranges.push_back(
+                        VmaRange(resident_vma_start_offset, offset - resident_vma_start_offset));
             }
+            started_vma_range = resident;
         }
     }
     // This was the last window, so close any opened vma range
-    if (started_vma_range) {
-        started_vma_range = false;
-        uint32_t in_memory_vma_end = window_base - base_address;
-        uint32_t resident_len = in_memory_vma_end - resident_vma_start_offset;
-        VmaRange vma_range(resident_vma_start_offset, resident_len);
-        resident_ranges.ranges.push_back(vma_range);
+    if (res == 0 && started_vma_range) {
+        uint64_t in_memory_vma_end = total_pages * page_size;
+        resident_ranges.ranges.push_back(VmaRange(
+                resident_vma_start_offset, in_memory_vma_end - resident_vma_start_offset));
     }
 
-    return 0;
+    munmap(base_address, total_bytes);
+    return res;
+}
+
+std::vector<int> probe_resident_memory_batch(const std::vector<std::string>& probed_files,
+                                             std::vector<VmaRangeGroup>& out_resident_mems,
+                                             unsigned int num_threads, int pages_per_mincore) {
+    out_resident_mems.assign(probed_files.size(), VmaRangeGroup());
+    std::vector<int> results(probed_files.size(), 0);
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    num_threads = std::min<size_t>(num_threads, probed_files.size());
+
+    // Each file is probed independently, so threads just take the next file.
+    std::atomic<size_t> next_file = 0;
+    auto probe_files = [&]() {
+        size_t i;
+        while ((i = next_file++) < probed_files.size()) {
+            results[i] =
+                    probe_resident_memory(probed_files[i], out_resident_mems[i], pages_per_mincore);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; ++i) {
+        threads.emplace_back(probe_files);
+    }
+    probe_files();
+    for (auto&& thread : threads) {
+        thread.join();
+    }
+    return results;
 }
 
 ZipMemInspector::~ZipMemInspector() {
@@ -42,8 +42,15 @@ int write_pinlist_file(const std::string& output_file, const std::vector<VmaRang
     processed_vmas_to_write = merge_ranges(processed_vmas_to_write);
 
     for (auto&& processed_vma_to_write : processed_vmas_to_write) {
+        // Pinlist entries use 32-bit offsets and lengths, so memory past 4GB
+        // cannot be pinned.
+        if (processed_vma_to_write.offset > UINT32_MAX) {
+            cerr << "Skipping range beyond 4GB start=" << processed_vma_to_write.offset << endl;
+            continue;
+        }
         uint32_t vma_start_offset = processed_vma_to_write.offset;
-        uint32_t vma_length = processed_vma_to_write.length;
+        uint32_t vma_length =
+                std::min<uint64_t>(processed_vma_to_write.length, UINT32_MAX - vma_start_offset);
         if (has_quota && (total_written + vma_length > write_quota)) {
             // We would go beyond quota, set the maximum allowed write and exit.
             vma_length = write_quota - total_written;
@@ -79,10 +86,10 @@ int read_pinlist_file(const std::string& pinner_file, /*out*/ std::vector<VmaRan
 
     uint32_t vma_start;
     uint32_t vma_length;
-    while (!pinlist_file.eof()) {
-        pinlist_file.read(reinterpret_cast<char*>(&vma_start), sizeof(vma_start));
+    while (pinlist_file.read(reinterpret_cast<char*>(&vma_start), sizeof(vma_start))) {
         pinlist_file.read(reinterpret_cast<char*>(&vma_length), sizeof(vma_length));
         if (pinlist_file.fail()) {
+            // Truncated entry.
             return 1;
         }
         vma_start = betoh32(vma_start);
@@ -197,6 +204,29 @@ int PinTool::probe_resident() {
     return zip_inspector_->probe_resident();
 }
 
+VmaRangeGroup* PinTool::get_probe() {
+    return zip_inspector_->get_probe();
+}
+
+int PinTool::subtract_probe_from_pinlist(std::string base_probe_file) {
+    VmaRangeGroup* probe = zip_inspector_->get_probe();
+    if (probe == nullptr) {
+        cerr << "No probe to diff against " << base_probe_file << endl;
+        return 1;
+    }
+    std::vector<VmaRange> base_ranges;
+    if (read_pinlist_file(base_probe_file, base_ranges) != 0) {
+        cerr << "Failed reading base probe " << base_probe_file << endl;
+        return 1;
+    }
+    probe->ranges = subtract_ranges(probe->ranges, base_ranges);
+    if (verbose_) {
+        cout << "Newly resident bytes since " << base_probe_file << ": "
+             << probe->compute_total_size() << endl;
+    }
+    return 0;
+}
+
 void PinTool::compute_zip_entry_coverages() {
     zip_inspector_->compute_per_file_coverage();
     if (verbose_) {
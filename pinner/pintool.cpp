@@ -5,6 +5,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -18,6 +19,7 @@ using namespace android::base;
 enum ToolMode {
     MAPPED_FILE,  // Files that are mapped in memory
     PINLIST,      // pinlist.meta style file
+    BATCH,        // Many files probed at once
     UNKNOWN
 };
 
@@ -41,6 +43,7 @@ int perform_file_action(const vector<string>& options) {
     std::string custom_probe_file;
     std::string output_file;
     std::string pinconfig_file;
+    std::string diff_probe_file;
 
     bool verbose = false;
     bool is_zip = false;
@@ -88,6 +91,11 @@ int perform_file_action(const vector<string>& options) {
             custom_probe_file = options[i];
             continue;
         }
+        if (option == "--diff-probe") {
+            ++i;
+            diff_probe_file = options[i];
+            continue;
+        }
         if (option == "--pinconfig") {
             ++i;
             pinconfig_file = options[i];
@@ -122,6 +130,7 @@ int perform_file_action(const vector<string>& options) {
         cout << "Setting input file: " << input_file.c_str() << endl;
         cout << "Setting pinconfig file: " << pinconfig_file.c_str() << endl;
         cout << "Setting custom probe file: " << custom_probe_file.c_str() << endl;
+        cout << "Setting diff probe file: " << diff_probe_file.c_str() << endl;
         cout << "Setting probe type: " << probe_type << endl;
         cout << "Dump enabled: " << dump_results << endl;
         cout << "Is Zip file: " << is_zip << endl;
@@ -130,6 +139,11 @@ int perform_file_action(const vector<string>& options) {
         }
     }
 
+    if (!diff_probe_file.empty() && probe_type != ProbeType::GENERATE) {
+        cerr << "--diff-probe requires --gen-probe. See usage for details." << endl;
+        return 1;
+    }
+
     PinTool pintool(input_file);
 
     if (is_zip) {
@@ -148,6 +162,10 @@ int perform_file_action(const vector<string>& options) {
                 cerr << "Failed to generate probe. Error Code: " << res << endl;
                 return 1;
             }
+            if (!diff_probe_file.empty() &&
+                pintool.subtract_probe_from_pinlist(diff_probe_file) != 0) {
+                return 1;
+            }
         }
         pintool.compute_zip_entry_coverages();
 
@@ -182,18 +200,20 @@ int perform_file_action(const vector<string>& options) {
 
         // Generic file probing will just return resident memory and offsets
         // without more contextual information.
-        VmaRangeGroup resident;
-
+        pintool.set_verbose_output(verbose);
         int res = pintool.probe_resident();
         if (res > 0) {
             cerr << "Failed to generate probe. Error Code: " << res << endl;
             return 1;
         }
+        if (!diff_probe_file.empty() && pintool.subtract_probe_from_pinlist(diff_probe_file) != 0) {
+            return 1;
+        }
 
         pintool.dump_coverages(PinTool::DumpType::PROBE);
 
         if (output_file.length() > 0) {
-            res = write_pinlist_file(output_file, resident.ranges, write_quota);
+            res = write_pinlist_file(output_file, pintool.get_probe()->ranges, write_quota);
             if (res > 0) {
                 cerr << "Failed to write pin file at: " << output_file << endl;
             } else if (verbose) {
@@ -257,6 +277,113 @@ int perform_pinlist_action(const vector<string>& options) {
     return 0;
 }
 
+// Name of the pinlist written for |file| in batch mode. Many files share a
+// basename (e.g. base.apk), so the whole path is used.
+string get_batch_pinlist_name(const string& file) {
+    string name = file;
+    name.erase(0, name.find_first_not_of('/'));
+    std::replace(name.begin(), name.end(), '/', '_');
+    return name + ".pinlist.meta";
+}
+
+int perform_batch_action(const vector<string>& options) {
+    vector<string> files;
+    string out_dir;
+    string diff_dir;
+    unsigned int num_threads = 0;
+    bool verbose = false;
+
+    for (int i = 0; i < options.size(); ++i) {
+        string option = options[i];
+        if (option == "--threads") {
+            ++i;
+            if (i >= options.size() || !android::base::ParseUint(options[i], &num_threads)) {
+                cerr << "--threads requires a number. See usage for details." << endl;
+                return 1;
+            }
+            continue;
+        }
+        if (option == "--out-dir") {
+            ++i;
+            out_dir = i < options.size() ? options[i] : "";
+            continue;
+        }
+        if (option == "--diff-dir") {
+            ++i;
+            diff_dir = i < options.size() ? options[i] : "";
+            continue;
+        }
+        if (option == "-v") {
+            verbose = true;
+            continue;
+        }
+        files.push_back(option);
+    }
+
+    if (files.empty()) {
+        cerr << "Missing files for batch mode, see usage for details." << endl;
+        return 1;
+    }
+
+    vector<VmaRangeGroup> probes;
+    vector<int> results = probe_resident_memory_batch(files, probes, num_threads);
+
+    int res = 0;
+    uint64_t total_resident = 0;
+    uint64_t total_new = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (results[i] != 0) {
+            cerr << "Failed to generate probe for " << files[i] << ". Error Code: " << results[i]
+                 << endl;
+            res = 1;
+            continue;
+        }
+        string pinlist_name = get_batch_pinlist_name(files[i]);
+        uint64_t resident = probes[i].compute_total_size();
+        total_resident += resident;
+        cout << files[i] << " resident(B)=" << resident;
+
+        if (!diff_dir.empty()) {
+            // Only keep the memory that became resident since the base probe
+            // of this file was taken.
+            vector<VmaRange> base_ranges;
+            string base_file = diff_dir + "/" + pinlist_name;
+            if (read_pinlist_file(base_file, base_ranges) != 0) {
+                cout << endl;
+                cerr << "Failed reading base probe " << base_file << endl;
+                res = 1;
+                continue;
+            }
+            probes[i].ranges = subtract_ranges(probes[i].ranges, base_ranges);
+            uint64_t new_resident = probes[i].compute_total_size();
+            total_new += new_resident;
+            cout << " new_resident(B)=" << new_resident;
+        }
+        cout << endl;
+
+        if (verbose) {
+            for (auto&& range : probes[i].ranges) {
+                cout << "file_offset=" << range.offset << " total_bytes=" << range.length << endl;
+            }
+        }
+
+        if (!out_dir.empty()) {
+            string output_file = out_dir + "/" + pinlist_name;
+            if (write_pinlist_file(output_file, probes[i].ranges) > 0) {
+                cerr << "Failed to write pin file at: " << output_file << endl;
+                res = 1;
+            }
+        }
+    }
+
+    cout << "--batch summary--" << endl;
+    cout << "files=" << files.size() << " total_resident_bytes=" << total_resident << endl;
+    if (!diff_dir.empty()) {
+        cout << "total_new_resident_bytes=" << total_new << endl;
+    }
+    return res;
+}
+
 void print_usage() {
     const string usage = R"(
     Expected usage: pintool <mode> <required> [option]
@@ -276,6 +403,9 @@ void print_usage() {
                 --pinconfig <path_to_pinconfig.txt>
                     Filter output coverage ranges using a provided pinconfig.txt style file. See README.md for samples
                     on the format of that file.
+                --diff-probe <path_to_base_pinlist.meta>
+                    Requires --gen-probe. Only keep memory that was not resident in a previously
+                    generated probe, e.g. before launching an app.
                 -v
                     Enable verbose output.
 
@@ -289,6 +419,21 @@ void print_usage() {
                     Enable verbose output.
                 --summary
                     Summary results for the pinlist.meta file
+
+        batch <file>... [option]
+            <file>...
+                Mapped files to probe. Files are probed in parallel.
+            [option]
+                --threads <num>
+                    Maximum number of files probed at once, defaults to one per CPU.
+                --out-dir <dir>
+                    Write a pinlist.meta style file per probed file into <dir>, named
+                    after the path of the probed file.
+                --diff-dir <dir>
+                    Only keep memory that was not resident in the pinlist files previously
+                    written to <dir> with --out-dir, e.g. before launching an app.
+                -v
+                    Enable verbose output.
     )";
     cout << usage.c_str();
 }
@@ -314,6 +459,8 @@ int main(int argc, char** argv) {
         mode = ToolMode::MAPPED_FILE;
     } else if (strcmp(argv[1], "pinlist") == 0) {
         mode = ToolMode::PINLIST;
+    } else if (strcmp(argv[1], "batch") == 0) {
+        mode = ToolMode::BATCH;
     }
 
     if (mode == ToolMode::UNKNOWN) {
@@ -334,6 +481,9 @@ int main(int argc, char** argv) {
         case ToolMode::PINLIST:
             res = perform_pinlist_action(options);
             break;
+        case ToolMode::BATCH:
+            res = perform_batch_action(options);
+            break;
         case ToolMode::UNKNOWN:
             cerr << "Unknown <MODE> see usage for details." << endl;
             return 1;
@@ -281,4 +281,80 @@ TEST(meminspect_test, range_alignment_and_merge_matches) {
     EXPECT_EQ(merged[0].offset, (uint32_t)0);
     EXPECT_EQ(merged[0].length, (uint32_t)800);
     EXPECT_EQ(merged.size(), (uint32_t)1);
-}
\ No newline at end of file
+}
+
+TEST(meminspect_test, subtract_ranges_keeps_new_ranges) {
+    std::vector<VmaRange> before;
+    before.push_back(VmaRange(100, 200));
+    before.push_back(VmaRange(1000, 100));
+    before.push_back(VmaRange(1500, 100));
+
+    std::vector<VmaRange> after;
+    after.push_back(VmaRange(1200, 1000));
+    after.push_back(VmaRange(0, 1100));
+
+    // Before: [100,300],[1000,1100],[1500,1600]
+    // After:  [0,1100],[1200,2200]
+    // New:    [0,100],[300,1000],[1200,1500],[1600,2200]
+    std::vector<VmaRange> result = subtract_ranges(after, before);
+    ASSERT_EQ(result.size(), (size_t)4);
+    EXPECT_EQ(result[0].offset, (uint64_t)0);
+    EXPECT_EQ(result[0].length, (uint64_t)100);
+    EXPECT_EQ(result[1].offset, (uint64_t)300);
+    EXPECT_EQ(result[1].length, (uint64_t)700);
+    EXPECT_EQ(result[2].offset, (uint64_t)1200);
+    EXPECT_EQ(result[2].length, (uint64_t)300);
+    EXPECT_EQ(result[3].offset, (uint64_t)1600);
+    EXPECT_EQ(result[3].length, (uint64_t)600);
+
+    // Nothing new when the same probe is taken twice.
+    EXPECT_TRUE(subtract_ranges(before, before).empty());
+}
+
+TEST(meminspect_test, ranges_beyond_4gb_match) {
+    uint64_t four_gb = 1ULL << 32;
+    VmaRange range_a(four_gb - 100, 200);
+    VmaRange range_b(four_gb + 50, four_gb);
+
+    VmaRange intersection = range_a.intersect(range_b);
+    EXPECT_EQ(intersection.offset, four_gb + 50);
+    EXPECT_EQ(intersection.length, (uint64_t)50);
+
+    VmaRange merged = range_a.union_merge(range_b);
+    EXPECT_EQ(merged.offset, four_gb - 100);
+    EXPECT_EQ(merged.end_offset(), 2 * four_gb + 50);
+}
+
+TEST(meminspect_test, batch_probe_matches_single_probe) {
+    std::vector<std::string> test_files = {"/data/local/tmp/meminspect_batch_test0",
+                                           "/data/local/tmp/meminspect_batch_test1",
+                                           "/data/local/tmp/meminspect_batch_test2"};
+    unsigned int page_size = sysconf(_SC_PAGESIZE);
+    std::vector<char> page_data(page_size, 1);
+    for (size_t i = 0; i < test_files.size(); ++i) {
+        int fd = open(test_files[i].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        ASSERT_NE(fd, -1) << "Failed to open test file. errno: " << std::strerror(errno);
+        for (size_t page = 0; page < 10 * (i + 1); ++page) {
+            write(fd, page_data.data(), page_size);
+        }
+        close(fd);
+    }
+    // A missing file only fails its own probe.
+    test_files.push_back("/data/local/tmp/meminspect_batch_test_missing");
+
+    std::vector<VmaRangeGroup> probes;
+    std::vector<int> results = probe_resident_memory_batch(test_files, probes, 2);
+    ASSERT_EQ(results.size(), test_files.size());
+    ASSERT_EQ(probes.size(), test_files.size());
+    EXPECT_EQ(results[3], MEMINSPECT_FAIL_OPEN);
+
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(results[i], 0);
+        VmaRangeGroup single_probe;
+        EXPECT_EQ(probe_resident_memory(test_files[i], single_probe), 0);
+        // Freshly written pages stay in the page cache, so both probes see the same ranges.
+        EXPECT_EQ(probes[i].compute_total_size(), single_probe.compute_total_size());
+        EXPECT_EQ(probes[i].ranges.size(), single_probe.ranges.size());
+        remove(test_files[i].c_str());
+    }
+}
@@ -134,4 +134,22 @@ TEST(pintool_test, pinconfig_filter_coverage_matches) {
     EXPECT_EQ(filtered[1].coverage.ranges[0].length, (unsigned long)200);
     EXPECT_EQ(filtered[1].coverage.ranges[1].offset, (unsigned long)1400);
     EXPECT_EQ(filtered[1].coverage.ranges[1].length, (unsigned long)200);
-}
\ No newline at end of file
+}
+
+TEST(pintool_test, pinlist_skips_ranges_beyond_4gb) {
+    vector<VmaRange> vma_ranges;
+    uint64_t four_gb = 1ULL << 32;
+    vma_ranges.push_back(VmaRange(0, 4096));
+    vma_ranges.push_back(VmaRange(four_gb + 4096, 4096));
+
+    string test_file = "/data/local/tmp/pintool_test";
+    write_pinlist_file(test_file, vma_ranges);
+
+    vector<VmaRange> read_ranges;
+    EXPECT_EQ(read_pinlist_file(test_file, read_ranges), 0);
+    ASSERT_EQ(read_ranges.size(), (size_t)1);
+    EXPECT_EQ(read_ranges[0].offset, (uint64_t)0);
+    EXPECT_EQ(read_ranges[0].length, (uint64_t)4096);
+
+    remove(test_file.c_str());
+}
@@ -16,6 +16,8 @@
 
 #include "BranchListFile.h"
 
+#include <algorithm>
+
 #include "ETMDecoder.h"
 #include "system/extras/simpleperf/branch_list.pb.h"
 
@@ -136,6 +138,294 @@ bool StringToETMBinaryMap(const std::string& s, ETMBinaryMap& binary_map) {
   return ParseBranchListData(s, binary_map, lbr_data);
 }
 
+static constexpr const char ETM_BRANCH_LIST_COMPACT_MAGIC[] = "SPETMBL1";
+static constexpr size_t ETM_BRANCH_LIST_COMPACT_MAGIC_SIZE =
+    sizeof(ETM_BRANCH_LIST_COMPACT_MAGIC) - 1;
+// Binaries are compressed in blocks of at most 128K bytes, split into multiple records if needed.
+static constexpr size_t kCompactBlockSize = 128 * 1024;
+static constexpr int kCompactCompressLevel = 6;
+
+static void AppendVarint(std::string& s, uint64_t value) {
+  while (value >= 0x80) {
+    s.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  s.push_back(static_cast<char>(value));
+}
+
+static void AppendString(std::string& s, const std::string& value) {
+  AppendVarint(s, value.size());
+  s += value;
+}
+
+ETMBranchListCompactWriter::ETMBranchListCompactWriter(std::string& output) : output_(output) {
+  output_.append(ETM_BRANCH_LIST_COMPACT_MAGIC, ETM_BRANCH_LIST_COMPACT_MAGIC_SIZE);
+}
+
+bool ETMBranchListCompactWriter::AddBinary(const BinaryKey& key, const ETMBinary& binary) {
+  auto opt_binary_type = ToProtoBinaryType(binary.dso_type);
+  if (!opt_binary_type.has_value()) {
+    return false;
+  }
+  std::vector<uint64_t> addrs;
+  addrs.reserve(binary.branch_map.size());
+  for (const auto& p : binary.branch_map) {
+    addrs.push_back(p.first);
+  }
+  std::sort(addrs.begin(), addrs.end());
+
+  // Split addresses of a binary into records, so each block is at most kCompactBlockSize bytes
+  // after decompression. Readers merge records of the same binary. Record sizes are estimated
+  // with the max size of varints.
+  constexpr size_t kMaxVarintSize = 10;
+  size_t header_size = key.path.size() + BuildId::Size() + kMaxVarintSize * 6;
+  size_t start = 0;
+  do {
+    // Branch patterns are shared by many addresses. So store each pattern once in a record.
+    std::unordered_map<std::vector<bool>, uint64_t> pattern_ids;
+    std::vector<const std::vector<bool>*> patterns;
+    size_t record_size = header_size;
+    size_t end = start;
+    for (; end < addrs.size(); end++) {
+      const auto& b_map = binary.branch_map.at(addrs[end]);
+      size_t addr_size = kMaxVarintSize * 2 * (b_map.size() + 1);
+      for (const auto& p : b_map) {
+        if (pattern_ids.count(p.first) == 0) {
+          addr_size += kMaxVarintSize + (p.first.size() + 7) / 8;
+        }
+      }
+      if (record_size + addr_size > kCompactBlockSize) {
+        if (end == start) {
+          LOG(ERROR) << "too many branches at addr 0x" << std::hex << addrs[end] << " in "
+                     << key.path;
+          return false;
+        }
+        break;
+      }
+      record_size += addr_size;
+      for (const auto& p : b_map) {
+        if (auto res = pattern_ids.emplace(p.first, patterns.size()); res.second) {
+          patterns.push_back(&res.first->first);
+        }
+      }
+    }
+
+    std::string record;
+    AppendString(record, key.path);
+    if (key.build_id.IsEmpty()) {
+      AppendVarint(record, 0);
+    } else {
+      AppendVarint(record, BuildId::Size());
+      record.append(reinterpret_cast<const char*>(key.build_id.Data()), BuildId::Size());
+    }
+    AppendVarint(record, opt_binary_type.value());
+    AppendVarint(record, binary.dso_type == DSO_KERNEL ? key.kernel_start_addr : 0);
+    AppendVarint(record, patterns.size());
+    for (const std::vector<bool>* pattern : patterns) {
+      AppendVarint(record, pattern->size());
+      record += ETMBranchToProtoString(*pattern);
+    }
+    AppendVarint(record, end - start);
+    uint64_t prev_addr = 0;
+    for (size_t i = start; i < end; i++) {
+      AppendVarint(record, addrs[i] - prev_addr);
+      prev_addr = addrs[i];
+      const auto& b_map = binary.branch_map.at(addrs[i]);
+      AppendVarint(record, b_map.size());
+      for (const auto& [branch, count] : b_map) {
+        AppendVarint(record, pattern_ids[branch]);
+        AppendVarint(record, count);
+      }
+    }
+    CHECK_LE(record.size(), kCompactBlockSize);
+    if (block_.size() + record.size() > kCompactBlockSize && !FlushBlock()) {
+      return false;
+    }
+    block_ += record;
+    start = end;
+  } while (start < addrs.size());
+  return true;
+}
+
+bool ETMBranchListCompactWriter::Finish() {
+  return FlushBlock();
+}
+
+bool ETMBranchListCompactWriter::FlushBlock() {
+  if (block_.empty()) {
+    return true;
+  }
+  std::vector<char> compressed_data;
+  if (!ZlibCompress(block_.data(), block_.size(), kCompactCompressLevel, &compressed_data)) {
+    return false;
+  }
+  if (block_.size() > UINT32_MAX || compressed_data.size() > UINT32_MAX) {
+    LOG(ERROR) << "branch list block is too large: " << block_.size();
+    return false;
+  }
+  uint32_t sizes[2] = {static_cast<uint32_t>(block_.size()),
+                       static_cast<uint32_t>(compressed_data.size())};
+  output_.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  output_.append(compressed_data.data(), compressed_data.size());
+  block_.clear();
+  return true;
+}
+
+bool ETMBinaryMapToCompactString(const ETMBinaryMap& binary_map, std::string& s) {
+  ETMBranchListCompactWriter writer(s);
+  for (const auto& [key, binary] : binary_map) {
+    if (!writer.AddBinary(key, binary)) {
+      return false;
+    }
+  }
+  return writer.Finish();
+}
+
+bool IsCompactETMBranchList(const std::string& s) {
+  return s.compare(0, ETM_BRANCH_LIST_COMPACT_MAGIC_SIZE, ETM_BRANCH_LIST_COMPACT_MAGIC) == 0;
+}
+
+namespace {
+
+// Read varints and strings in a decompressed block, with bound checks.
+class CompactBlockReader {
+ public:
+  CompactBlockReader(const char* data, size_t size) : p_(data), end_(data + size) {}
+
+  bool Empty() const { return p_ == end_; }
+
+  bool ReadVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p_ < end_; shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(*p_++);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadBytes(size_t size, std::string& value) {
+    if (static_cast<size_t>(end_ - p_) < size) {
+      return false;
+    }
+    value.assign(p_, size);
+    p_ += size;
+    return true;
+  }
+
+  bool ReadString(std::string& value) {
+    uint64_t size;
+    return ReadVarint(size) && ReadBytes(size, value);
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+}  // namespace
+
+static bool ReadCompactBinary(CompactBlockReader& reader, BinaryKey& key, ETMBinary& binary) {
+  std::string build_id;
+  uint64_t build_id_size;
+  uint64_t binary_type;
+  if (!reader.ReadString(key.path) || !reader.ReadVarint(build_id_size) ||
+      !reader.ReadBytes(build_id_size, build_id) || !reader.ReadVarint(binary_type) ||
+      !reader.ReadVarint(key.kernel_start_addr)) {
+    return false;
+  }
+  key.build_id = build_id.empty() ? BuildId() : BuildId(build_id.data(), build_id.size());
+  auto dso_type = ToDsoType(static_cast<proto::ETMBinary::BinaryType>(binary_type));
+  if (!dso_type) {
+    return false;
+  }
+  binary.dso_type = dso_type.value();
+
+  uint64_t pattern_count;
+  if (!reader.ReadVarint(pattern_count)) {
+    return false;
+  }
+  std::vector<std::vector<bool>> patterns;
+  std::string bits;
+  for (uint64_t i = 0; i < pattern_count; i++) {
+    uint64_t bit_size;
+    if (!reader.ReadVarint(bit_size) || !reader.ReadBytes((bit_size + 7) / 8, bits)) {
+      return false;
+    }
+    patterns.emplace_back(ProtoStringToETMBranch(bits, bit_size));
+  }
+
+  uint64_t addr_count;
+  if (!reader.ReadVarint(addr_count)) {
+    return false;
+  }
+  binary.branch_map.clear();
+  uint64_t addr = 0;
+  for (uint64_t i = 0; i < addr_count; i++) {
+    uint64_t addr_delta;
+    uint64_t branch_count;
+    if (!reader.ReadVarint(addr_delta) || !reader.ReadVarint(branch_count)) {
+      return false;
+    }
+    addr += addr_delta;
+    auto& b_map = binary.branch_map[addr];
+    for (uint64_t j = 0; j < branch_count; j++) {
+      uint64_t pattern_id;
+      uint64_t count;
+      if (!reader.ReadVarint(pattern_id) || !reader.ReadVarint(count) ||
+          pattern_id >= patterns.size()) {
+        return false;
+      }
+      b_map[patterns[pattern_id]] = count;
+    }
+  }
+  return true;
+}
+
+bool ReadCompactETMBranchList(const std::string& s, const ETMBinaryReaderCallback& callback) {
+  if (!IsCompactETMBranchList(s)) {
+    LOG(ERROR) << "not in compact etm branch list format";
+    return false;
+  }
+  size_t pos = ETM_BRANCH_LIST_COMPACT_MAGIC_SIZE;
+  std::vector<char> block;
+  while (pos < s.size()) {
+    uint32_t sizes[2];
+    if (s.size() - pos < sizeof(sizes)) {
+      LOG(ERROR) << "truncated compact etm branch list";
+      return false;
+    }
+    memcpy(sizes, s.data() + pos, sizeof(sizes));
+    pos += sizeof(sizes);
+    // The writer never creates blocks larger than kCompactBlockSize. So don't trust larger sizes.
+    if (sizes[0] > kCompactBlockSize) {
+      LOG(ERROR) << "invalid block size in compact etm branch list: " << sizes[0];
+      return false;
+    }
+    if (s.size() - pos < sizes[1]) {
+      LOG(ERROR) << "truncated compact etm branch list";
+      return false;
+    }
+    if (!ZlibDecompress(s.data() + pos, sizes[1], sizes[0], &block)) {
+      return false;
+    }
+    pos += sizes[1];
+    CompactBlockReader reader(block.data(), block.size());
+    while (!reader.Empty()) {
+      BinaryKey key;
+      ETMBinary binary;
+      if (!ReadCompactBinary(reader, key, binary)) {
+        LOG(ERROR) << "invalid binary in compact etm branch list";
+        return false;
+      }
+      callback(key, binary);
+    }
+  }
+  return true;
+}
+
 class ETMThreadTreeWhenRecording : public ETMThreadTree {
  public:
   ETMThreadTreeWhenRecording(bool dump_maps_from_proc)
@@ -208,6 +498,7 @@ class ETMBranchListGeneratorImpl : public ETMBranchListGenerator {
 
   bool ProcessRecord(const Record& r, bool& consumed) override;
   ETMBinaryMap GetETMBinaryMap() override;
+  bool WriteCompactBranchList(std::string& s) override;
 
  private:
   struct AuxRecordData {
@@ -227,6 +518,7 @@ class ETMBranchListGeneratorImpl : public ETMBranchListGenerator {
   bool ProcessAuxRecord(const AuxRecord& r);
   bool ProcessAuxTraceRecord(const AuxTraceRecord& r);
   void ProcessBranchList(const ETMBranchList& branch_list);
+  std::optional<BinaryKey> GetBinaryKey(Dso* dso, ETMBinary& binary);
 
   ETMThreadTreeWhenRecording thread_tree_;
   uint64_t kernel_map_start_addr_ = 0;
@@ -329,28 +621,50 @@ void ETMBranchListGeneratorImpl::ProcessBranchList(const ETMBranchList& branch_l
   ++branch_map[branch_list.addr][branch_list.branch];
 }
 
+std::optional<BinaryKey> ETMBranchListGeneratorImpl::GetBinaryKey(Dso* dso, ETMBinary& binary) {
+  binary.dso_type = dso->type();
+  BuildId build_id;
+  GetBuildId(*dso, build_id);
+  BinaryKey key(dso->Path(), build_id);
+  if (binary.dso_type == DSO_KERNEL) {
+    if (kernel_map_start_addr_ == 0) {
+      LOG(WARNING) << "Can't convert kernel ip addresses without kernel start addr. So remove "
+                      "branches for the kernel.";
+      return std::nullopt;
+    }
+    key.kernel_start_addr = kernel_map_start_addr_;
+  }
+  return key;
+}
+
 ETMBinaryMap ETMBranchListGeneratorImpl::GetETMBinaryMap() {
   ETMBinaryMap binary_map;
   for (auto& p : branch_list_binary_map_) {
     Dso* dso = p.first;
     ETMBinary& binary = p.second;
-    binary.dso_type = dso->type();
-    BuildId build_id;
-    GetBuildId(*dso, build_id);
-    BinaryKey key(dso->Path(), build_id);
-    if (binary.dso_type == DSO_KERNEL) {
-      if (kernel_map_start_addr_ == 0) {
-        LOG(WARNING) << "Can't convert kernel ip addresses without kernel start addr. So remove "
-                        "branches for the kernel.";
-        continue;
-      }
-      key.kernel_start_addr = kernel_map_start_addr_;
+    if (auto key = GetBinaryKey(dso, binary); key) {
+      binary_map[key.value()] = std::move(binary);
     }
-    binary_map[key] = std::move(binary);
   }
   return binary_map;
 }
 
+bool ETMBranchListGeneratorImpl::WriteCompactBranchList(std::string& s) {
+  ETMBranchListCompactWriter writer(s);
+  for (auto& p : branch_list_binary_map_) {
+    Dso* dso = p.first;
+    ETMBinary& binary = p.second;
+    if (auto key = GetBinaryKey(dso, binary); key) {
+      if (!writer.AddBinary(key.value(), binary)) {
+        return false;
+      }
+    }
+    binary.branch_map.clear();
+  }
+  branch_list_binary_map_.clear();
+  return writer.Finish();
+}
+
 std::unique_ptr<ETMBranchListGenerator> ETMBranchListGenerator::Create(bool dump_maps_from_proc) {
   return std::unique_ptr<ETMBranchListGenerator>(
       new ETMBranchListGeneratorImpl(dump_maps_from_proc));
@@ -387,6 +701,17 @@ bool LBRDataToString(const LBRData& data, std::string& s) {
 }
 
 bool ParseBranchListData(const std::string& s, ETMBinaryMap& etm_data, LBRData& lbr_data) {
+  if (IsCompactETMBranchList(s)) {
+    return ReadCompactETMBranchList(s, [&](const BinaryKey& key, ETMBinary& binary) {
+      ETMBinary& dest = etm_data[key];
+      dest.dso_type = binary.dso_type;
+      if (dest.branch_map.empty()) {
+        dest.branch_map = std::move(binary.branch_map);
+      } else {
+        dest.Merge(binary);
+      }
+    });
+  }
   proto::BranchList branch_list_proto;
   if (!branch_list_proto.ParseFromString(s)) {
     PLOG(ERROR) << "failed to read ETMBranchList msg";
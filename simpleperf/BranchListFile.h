@@ -132,6 +132,36 @@ using ETMBinaryMap = std::unordered_map<BinaryKey, ETMBinary, BinaryKeyHash>;
 bool ETMBinaryMapToString(const ETMBinaryMap& binary_map, std::string& s);
 bool StringToETMBinaryMap(const std::string& s, ETMBinaryMap& binary_map);
 
+// The compact branch list format stores ETM branch lists without using protobuf. It can be
+// written and read one binary at a time, without building a message for all binaries.
+// It is made of a magic string "SPETMBL1" and a list of blocks. Each block contains:
+//   uint32 uncompressed_size, uint32 compressed_size, binaries compressed by zlib
+// Each binary contains (integers are LEB128 varints, strings are a varint size and bytes):
+//   path, build_id, binary_type (in branch_list.proto), kernel_start_addr,
+//   pattern_count, patterns (a varint bit size, and bits as in ETMBranchToProtoString()),
+//   addr_count, addrs sorted by address, each has:
+//     the delta to the previous addr, branch_count, (pattern_index, count) of each branch
+class ETMBranchListCompactWriter {
+ public:
+  // Encoded data is appended to output.
+  ETMBranchListCompactWriter(std::string& output);
+  bool AddBinary(const BinaryKey& key, const ETMBinary& binary);
+  // Write buffered binaries to output.
+  bool Finish();
+
+ private:
+  bool FlushBlock();
+
+  std::string& output_;
+  std::string block_;
+};
+
+bool ETMBinaryMapToCompactString(const ETMBinaryMap& binary_map, std::string& s);
+bool IsCompactETMBranchList(const std::string& s);
+// Read binaries in compact branch list format one by one.
+using ETMBinaryReaderCallback = std::function<void(const BinaryKey&, ETMBinary&)>;
+bool ReadCompactETMBranchList(const std::string& s, const ETMBinaryReaderCallback& callback);
+
 // Convert ETM data into branch lists while recording.
 class ETMBranchListGenerator {
  public:
@@ -142,6 +172,9 @@ class ETMBranchListGenerator {
   virtual void SetBinaryFilter(const RegEx* binary_name_regex) = 0;
   virtual bool ProcessRecord(const Record& r, bool& consumed) = 0;
   virtual ETMBinaryMap GetETMBinaryMap() = 0;
+  // Write branch lists in compact branch list format. Branch lists of each binary are released
+  // after being written.
+  virtual bool WriteCompactBranchList(std::string& s) = 0;
 };
 
 struct LBRBranch {
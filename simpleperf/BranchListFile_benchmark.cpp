@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "BranchListFile.h"
+
+using namespace simpleperf;
+
+// Creates a branch list similar to the one collected from a busy device, with
+// binary_count binaries each having addr_count branch addresses.
+static ETMBinaryMap CreateBinaryMap(size_t binary_count, size_t addr_count) {
+  ETMBinaryMap binary_map;
+  srand(0);
+  for (size_t i = 0; i < binary_count; i++) {
+    BinaryKey key("/system/lib64/lib" + std::to_string(i) + ".so", BuildId());
+    ETMBinary& binary = binary_map[key];
+    binary.dso_type = DSO_ELF_FILE;
+    uint64_t addr = 0x1000;
+    for (size_t j = 0; j < addr_count; j++) {
+      addr += 4 * (1 + rand() % 64);
+      auto& b_map = binary.branch_map[addr];
+      size_t pattern_count = 1 + rand() % 3;
+      for (size_t k = 0; k < pattern_count; k++) {
+        std::vector<bool> branch(rand() % 32);
+        for (size_t n = 0; n < branch.size(); n++) {
+          branch[n] = rand() % 2;
+        }
+        b_map[branch] = 1 + rand() % 1000;
+      }
+    }
+  }
+  return binary_map;
+}
+
+static bool WriteBranchList(const ETMBinaryMap& binary_map, bool compact, std::string& s) {
+  return compact ? ETMBinaryMapToCompactString(binary_map, s) : ETMBinaryMapToString(binary_map, s);
+}
+
+// Writes a branch list, arg is 0 for the proto format and 1 for the compact format.
+static void BM_WriteBranchList(benchmark::State& state) {
+  ETMBinaryMap binary_map = CreateBinaryMap(100, 2000);
+  bool compact = state.range(0) != 0;
+  std::string s;
+  for (auto _ : state) {
+    s.clear();
+    if (!WriteBranchList(binary_map, compact, s)) {
+      state.SkipWithError("failed to write branch list");
+      return;
+    }
+    benchmark::DoNotOptimize(s.data());
+  }
+  state.counters["file_size"] = s.size();
+}
+BENCHMARK(BM_WriteBranchList)->Arg(0)->Arg(1);
+
+// Parses a branch list, arg is 0 for the proto format and 1 for the compact format.
+static void BM_ParseBranchList(benchmark::State& state) {
+  ETMBinaryMap binary_map = CreateBinaryMap(100, 2000);
+  std::string s;
+  if (!WriteBranchList(binary_map, state.range(0) != 0, s)) {
+    state.SkipWithError("failed to write branch list");
+    return;
+  }
+  for (auto _ : state) {
+    ETMBinaryMap read_map;
+    if (!StringToETMBinaryMap(s, read_map)) {
+      state.SkipWithError("failed to parse branch list");
+      return;
+    }
+    benchmark::DoNotOptimize(read_map.size());
+  }
+  state.counters["file_size"] = s.size();
+  state.SetBytesProcessed(state.iterations() * s.size());
+}
+BENCHMARK(BM_ParseBranchList)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
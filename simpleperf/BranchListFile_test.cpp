@@ -33,3 +33,64 @@ TEST(BranchListFile, etm_branch_to_proto_string) {
     ASSERT_EQ(branch, branch2);
   }
 }
+
+TEST(BranchListFile, compact_branch_list_format) {
+  ETMBinaryMap binary_map;
+  BinaryKey key1("/system/lib64/libc.so", BuildId("0123456789abcdef0123456789abcdef01234567"));
+  ETMBinary& binary1 = binary_map[key1];
+  binary1.dso_type = DSO_ELF_FILE;
+  for (uint64_t addr = 0x1000; addr < 0x3000; addr += 0x40) {
+    auto& b_map = binary1.branch_map[addr];
+    b_map[{true, false}] = addr;
+    b_map[std::vector<bool>(addr % 100, true)] = 1;
+  }
+  BinaryKey key2("[kernel.kallsyms]", BuildId());
+  key2.kernel_start_addr = 0xffffffc008000000;
+  ETMBinary& binary2 = binary_map[key2];
+  binary2.dso_type = DSO_KERNEL;
+  binary2.branch_map[0xffffffc008010000][{}] = UINT64_MAX;
+
+  std::string compact_data;
+  ASSERT_TRUE(ETMBinaryMapToCompactString(binary_map, compact_data));
+  ASSERT_TRUE(IsCompactETMBranchList(compact_data));
+  std::string proto_data;
+  ASSERT_TRUE(ETMBinaryMapToString(binary_map, proto_data));
+  ASSERT_FALSE(IsCompactETMBranchList(proto_data));
+  ASSERT_LT(compact_data.size(), proto_data.size());
+
+  ETMBinaryMap read_map;
+  ASSERT_TRUE(StringToETMBinaryMap(compact_data, read_map));
+  ASSERT_EQ(read_map.size(), binary_map.size());
+  for (const auto& [key, binary] : binary_map) {
+    auto it = read_map.find(key);
+    ASSERT_NE(it, read_map.end());
+    ASSERT_EQ(it->second.dso_type, binary.dso_type);
+    ASSERT_EQ(it->second.GetOrderedBranchMap(), binary.GetOrderedBranchMap());
+  }
+
+  // Truncated data is rejected.
+  ASSERT_FALSE(StringToETMBinaryMap(compact_data.substr(0, compact_data.size() - 1), read_map));
+}
+
+TEST(BranchListFile, compact_branch_list_large_binary) {
+  // A binary larger than a block is split into multiple records.
+  ETMBinaryMap binary_map;
+  BinaryKey key("/system/lib64/libart.so", BuildId());
+  ETMBinary& binary = binary_map[key];
+  binary.dso_type = DSO_ELF_FILE;
+  for (uint64_t addr = 0; addr < 100000; addr++) {
+    binary.branch_map[addr * 4][{addr % 2 == 0, addr % 3 == 0}] = addr + 1;
+  }
+  std::string compact_data;
+  ASSERT_TRUE(ETMBinaryMapToCompactString(binary_map, compact_data));
+  ETMBinaryMap read_map;
+  ASSERT_TRUE(StringToETMBinaryMap(compact_data, read_map));
+  ASSERT_EQ(read_map.size(), 1);
+  ASSERT_EQ(read_map[key].GetOrderedBranchMap(), binary.GetOrderedBranchMap());
+
+  // Blocks claiming a decompressed size larger than the block limit are rejected.
+  std::string bad_data = compact_data.substr(0, 8);
+  uint32_t sizes[2] = {UINT32_MAX, 0};
+  bad_data.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  ASSERT_FALSE(StringToETMBinaryMap(bad_data, read_map));
+}
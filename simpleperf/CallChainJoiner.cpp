@@ -16,6 +16,10 @@
 
 #include "CallChainJoiner.h"
 
+#include <algorithm>
+#include <memory>
+#include <thread>
+
 #include <android-base/logging.h>
 
 #include "environment.h"
@@ -267,21 +271,32 @@ static FILE* CreateTempFp() {
 }
 
 CallChainJoiner::CallChainJoiner(size_t cache_size, size_t matched_node_count_to_extend_callchain,
-                                 bool keep_original_callchains)
-    : keep_original_callchains_(keep_original_callchains),
-      original_chains_fp_(nullptr),
-      joined_chains_fp_(nullptr),
-      next_chain_index_(0u) {
+                                 bool keep_original_callchains, size_t job_count)
+    : keep_original_callchains_(keep_original_callchains), next_chain_index_(0u) {
+  // Each shard needs a cache having at least 2 nodes.
+  job_count = std::max<size_t>(1, std::min(job_count, cache_size / (sizeof(CacheNode) * 2)));
+  job_count = std::min<size_t>(job_count, UINT16_MAX);
+  shards_.resize(job_count);
+  for (size_t i = 0; i < job_count; ++i) {
+    shards_[i].cache_stat.cache_size = cache_size / job_count;
+    shards_[i].cache_stat.matched_node_count_to_extend_callchain =
+        matched_node_count_to_extend_callchain;
+  }
   cache_stat_.cache_size = cache_size;
   cache_stat_.matched_node_count_to_extend_callchain = matched_node_count_to_extend_callchain;
 }
 
 CallChainJoiner::~CallChainJoiner() {
-  if (original_chains_fp_ != nullptr) {
-    fclose(original_chains_fp_);
+  for (auto& shard : shards_) {
+    if (shard.original_chains_fp != nullptr) {
+      fclose(shard.original_chains_fp);
+    }
+    if (shard.joined_chains_fp != nullptr) {
+      fclose(shard.joined_chains_fp);
+    }
   }
-  if (joined_chains_fp_ != nullptr) {
-    fclose(joined_chains_fp_);
+  if (chain_order_fp_ != nullptr) {
+    fclose(chain_order_fp_);
   }
 }
 
@@ -312,44 +327,104 @@ bool CallChainJoiner::AddCallChain(pid_t pid, pid_t tid, ChainType type,
     }
   }
 
-  if (original_chains_fp_ == nullptr) {
-    original_chains_fp_ = CreateTempFp();
-    if (original_chains_fp_ == nullptr) {
+  size_t shard_index = static_cast<uint32_t>(tid) % shards_.size();
+  Shard& shard = shards_[shard_index];
+  if (shard.original_chains_fp == nullptr) {
+    shard.original_chains_fp = CreateTempFp();
+    if (shard.original_chains_fp == nullptr) {
+      return false;
+    }
+  }
+  if (shards_.size() > 1u) {
+    if (chain_order_fp_ == nullptr) {
+      chain_order_fp_ = CreateTempFp();
+      if (chain_order_fp_ == nullptr) {
+        return false;
+      }
+    }
+    uint16_t index = static_cast<uint16_t>(shard_index);
+    if (fwrite(&index, sizeof(index), 1, chain_order_fp_) != 1) {
+      PLOG(ERROR) << "fwrite";
       return false;
     }
   }
   stat_.chain_count++;
-  return WriteCallChain(original_chains_fp_, pid, tid, type, ips, sps, ip_count);
+  shard.stat.chain_count++;
+  return WriteCallChain(shard.original_chains_fp, pid, tid, type, ips, sps, ip_count);
 }
 
 bool CallChainJoiner::JoinCallChains() {
   if (stat_.chain_count == 0u) {
     return true;
   }
-  LRUCache cache(cache_stat_.cache_size, cache_stat_.matched_node_count_to_extend_callchain);
-  std::unique_ptr<FILE, decltype(&fclose)> tmp_fp(CreateTempFp(), fclose);
-  if (!tmp_fp) {
-    return false;
+  // Create temp files before joining in parallel, because ScopedTempFiles isn't thread-safe.
+  std::vector<std::unique_ptr<FILE, decltype(&fclose)>> tmp_fps;
+  for (auto& shard : shards_) {
+    if (shard.stat.chain_count == 0u) {
+      tmp_fps.emplace_back(nullptr, fclose);
+      continue;
+    }
+    tmp_fps.emplace_back(CreateTempFp(), fclose);
+    shard.joined_chains_fp = CreateTempFp();
+    if (!tmp_fps.back() || shard.joined_chains_fp == nullptr) {
+      return false;
+    }
+  }
+  bool result = true;
+  if (shards_.size() == 1u) {
+    result = JoinCallChainsInShard(shards_[0], tmp_fps[0].get());
+  } else {
+    std::vector<std::thread> threads;
+    std::unique_ptr<bool[]> results(new bool[shards_.size()]);
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      threads.emplace_back(
+          [&, i]() { results[i] = JoinCallChainsInShard(shards_[i], tmp_fps[i].get()); });
+    }
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      threads[i].join();
+      result &= results[i];
+    }
   }
-  joined_chains_fp_ = CreateTempFp();
-  if (joined_chains_fp_ == nullptr) {
+  if (!result) {
     return false;
   }
+  cache_stat_.max_node_count = 0;
+  cache_stat_.used_node_count = 0;
+  cache_stat_.recycled_node_count = 0;
+  for (auto& shard : shards_) {
+    cache_stat_.max_node_count += shard.cache_stat.max_node_count;
+    cache_stat_.used_node_count += shard.cache_stat.used_node_count;
+    cache_stat_.recycled_node_count += shard.cache_stat.recycled_node_count;
+    stat_.before_join_node_count += shard.stat.before_join_node_count;
+    stat_.after_join_node_count += shard.stat.after_join_node_count;
+    stat_.after_join_max_chain_length =
+        std::max(stat_.after_join_max_chain_length, shard.stat.after_join_max_chain_length);
+  }
+  return true;
+}
+
+bool CallChainJoiner::JoinCallChainsInShard(Shard& shard, FILE* tmp_fp) {
+  if (shard.stat.chain_count == 0u) {
+    return true;
+  }
+  LRUCache cache(shard.cache_stat.cache_size,
+                 shard.cache_stat.matched_node_count_to_extend_callchain);
   pid_t pid;
   pid_t tid;
   ChainType type;
   std::vector<uint64_t> ips;
   std::vector<uint64_t> sps;
-  if (fseek(original_chains_fp_, 0, SEEK_END) != 0) {
+  if (fseek(shard.original_chains_fp, 0, SEEK_END) != 0) {
     PLOG(ERROR) << "fseek";
     return false;
   }
+  Stat& stat = shard.stat;
   std::vector<std::pair<FILE*, FILE*>> file_pairs = {
-      std::make_pair(original_chains_fp_, tmp_fp.get()),
-      std::make_pair(tmp_fp.get(), joined_chains_fp_)};
+      std::make_pair(shard.original_chains_fp, tmp_fp),
+      std::make_pair(tmp_fp, shard.joined_chains_fp)};
   for (size_t pass = 0; pass < 2u; ++pass) {
     auto& pair = file_pairs[pass];
-    for (size_t i = 0; i < stat_.chain_count; ++i) {
+    for (size_t i = 0; i < stat.chain_count; ++i) {
       if (!ReadCallChainInReverseOrder(pair.first, pid, tid, type, ips, sps)) {
         return false;
       }
@@ -359,14 +434,14 @@ bool CallChainJoiner::JoinCallChains() {
         } else if (type == ORIGINAL_REMOTE) {
           type = JOINED_REMOTE;
         }
-        stat_.before_join_node_count += ips.size();
+        stat.before_join_node_count += ips.size();
       }
 
       cache.AddCallChain(tid, ips, sps);
 
       if (pass == 1u) {
-        stat_.after_join_node_count += ips.size();
-        stat_.after_join_max_chain_length = std::max(stat_.after_join_max_chain_length, ips.size());
+        stat.after_join_node_count += ips.size();
+        stat.after_join_max_chain_length = std::max(stat.after_join_max_chain_length, ips.size());
       }
 
       if (!WriteCallChain(pair.second, pid, tid, type, ips, sps, ips.size())) {
@@ -374,7 +449,7 @@ bool CallChainJoiner::JoinCallChains() {
       }
     }
   }
-  cache_stat_ = cache.Stat();
+  shard.cache_stat = cache.Stat();
   return true;
 }
 
@@ -385,18 +460,33 @@ bool CallChainJoiner::GetNextCallChain(pid_t& pid, pid_t& tid, ChainType& type,
     return false;
   }
   if (next_chain_index_ == 0u) {
-    if (fseek(original_chains_fp_, 0, SEEK_SET) != 0 ||
-        fseek(joined_chains_fp_, 0, SEEK_SET) != 0) {
+    for (auto& shard : shards_) {
+      if (shard.stat.chain_count > 0u && (fseek(shard.original_chains_fp, 0, SEEK_SET) != 0 ||
+                                          fseek(shard.joined_chains_fp, 0, SEEK_SET) != 0)) {
+        PLOG(ERROR) << "fseek";
+        return false;
+      }
+    }
+    if (chain_order_fp_ != nullptr && fseek(chain_order_fp_, 0, SEEK_SET) != 0) {
       PLOG(ERROR) << "fseek";
       return false;
     }
   }
+  if (next_chain_index_ % 2 == 0 && chain_order_fp_ != nullptr) {
+    uint16_t index;
+    if (fread(&index, sizeof(index), 1, chain_order_fp_) != 1) {
+      PLOG(ERROR) << "fread";
+      return false;
+    }
+    cur_chain_shard_ = index;
+  }
+  Shard& shard = shards_[cur_chain_shard_];
   FILE* fp;
   if (keep_original_callchains_) {
-    fp = (next_chain_index_ & 1) ? joined_chains_fp_ : original_chains_fp_;
+    fp = (next_chain_index_ & 1) ? shard.joined_chains_fp : shard.original_chains_fp;
     next_chain_index_++;
   } else {
-    fp = joined_chains_fp_;
+    fp = shard.joined_chains_fp;
     next_chain_index_ += 2;
   }
   return ReadCallChain(fp, pid, tid, type, ips, sps);
@@ -422,6 +512,14 @@ void CallChainJoiner::DumpStat() {
                << (stat_.after_join_node_count * 1.0 / stat_.chain_count);
   }
   LOG(DEBUG) << "  after_join_max_chain_length: " << stat_.after_join_max_chain_length;
+  if (shards_.size() > 1u) {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      const Shard& shard = shards_[i];
+      LOG(DEBUG) << "  shard " << i << ": call_chain_count " << shard.stat.chain_count
+                 << ", used_node_count " << shard.cache_stat.used_node_count
+                 << ", recycled_node_count " << shard.cache_stat.recycled_node_count;
+    }
+  }
 }
 
 }  // namespace simpleperf
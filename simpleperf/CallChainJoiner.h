@@ -137,11 +137,15 @@ class LRUCache {
 // Because we know (ip A, sp A) calls (ip B, sp B) in sample 1, then we can guess the (ip B, sp B)
 // in sample 2 is also called from (ip A, sp A). So we can add (ip A, sp A) in sample 2 as below.
 //   sample 2: (ip A, sp A) -> (ip B, sp B) -> (ip C, sp C) -> ...
+//
+// As call chains are only joined with call chains in the same thread, they are partitioned by tid
+// into [job_count] shards, which are joined in parallel. Each shard uses an LRUCache of
+// cache_size / job_count bytes, so the total memory used by caches is still cache_size.
 class CallChainJoiner {
  public:
-  // The parameters are used in LRUCache.
+  // cache_size and matched_node_count_to_extend_callchain are used in LRUCache.
   CallChainJoiner(size_t cache_size, size_t matched_node_count_to_extend_callchain,
-                  bool keep_original_callchains);
+                  bool keep_original_callchains, size_t job_count = 1);
   ~CallChainJoiner();
 
   enum ChainType {
@@ -165,13 +169,32 @@ class CallChainJoiner {
   };
   void DumpStat();
   const Stat& GetStat() { return stat_; }
+  // Return cache stat summed over all shards.
   const call_chain_joiner_impl::LRUCacheStat& GetCacheStat() { return cache_stat_; }
+  size_t GetShardCount() const { return shards_.size(); }
+  const call_chain_joiner_impl::LRUCacheStat& GetShardCacheStat(size_t shard) const {
+    return shards_[shard].cache_stat;
+  }
 
  private:
+  struct Shard {
+    FILE* original_chains_fp = nullptr;
+    FILE* joined_chains_fp = nullptr;
+    Stat stat;
+    call_chain_joiner_impl::LRUCacheStat cache_stat;
+  };
+
+  bool JoinCallChainsInShard(Shard& shard, FILE* tmp_fp);
+
   bool keep_original_callchains_;
-  FILE* original_chains_fp_;
-  FILE* joined_chains_fp_;
+  std::vector<Shard> shards_;
+  // The shard index (uint16_t) of each call chain, in the order they are added. It's kept in a
+  // temp file, so memory use doesn't grow with the number of call chains. Not used when there
+  // is only one shard.
+  FILE* chain_order_fp_ = nullptr;
   size_t next_chain_index_;
+  // The shard of the call chain returned by GetNextCallChain().
+  size_t cur_chain_shard_ = 0;
   call_chain_joiner_impl::LRUCacheStat cache_stat_;
   Stat stat_;
 };
@@ -230,6 +230,47 @@ TEST_F(CallChainJoinerTest, smoke) {
   ASSERT_EQ(joiner.GetStat().after_join_max_chain_length, 5u);
 }
 
+TEST_F(CallChainJoinerTest, join_in_parallel) {
+  // Without recycling cache nodes, joining in shards gets the same result as joining together.
+  CallChainJoiner joiner1(sizeof(CacheNode) * 1024, 1, true);
+  CallChainJoiner joiner4(sizeof(CacheNode) * 1024, 1, true, 4);
+  ASSERT_EQ(joiner4.GetShardCount(), 4u);
+  for (auto joiner : {&joiner1, &joiner4}) {
+    for (pid_t tid = 0; tid < 10; ++tid) {
+      ASSERT_TRUE(
+          joiner->AddCallChain(1, tid, CallChainJoiner::ORIGINAL_OFFLINE, {1, 2, 3}, {1, 2, 3}));
+      ASSERT_TRUE(joiner->AddCallChain(1, tid, CallChainJoiner::ORIGINAL_OFFLINE, {3, 4, 5},
+                                       {3, 4, 5}));
+      ASSERT_TRUE(
+          joiner->AddCallChain(1, tid, CallChainJoiner::ORIGINAL_OFFLINE, {1, 4}, {1, 4}));
+    }
+    ASSERT_TRUE(joiner->JoinCallChains());
+  }
+  pid_t pid1, pid4;
+  pid_t tid1, tid4;
+  CallChainJoiner::ChainType type1, type4;
+  std::vector<uint64_t> ips1, ips4;
+  std::vector<uint64_t> sps1, sps4;
+  while (joiner1.GetNextCallChain(pid1, tid1, type1, ips1, sps1)) {
+    ASSERT_TRUE(joiner4.GetNextCallChain(pid4, tid4, type4, ips4, sps4));
+    ASSERT_EQ(pid1, pid4);
+    ASSERT_EQ(tid1, tid4);
+    ASSERT_EQ(type1, type4);
+    ASSERT_EQ(ips1, ips4);
+    ASSERT_EQ(sps1, sps4);
+  }
+  ASSERT_FALSE(joiner4.GetNextCallChain(pid4, tid4, type4, ips4, sps4));
+  joiner4.DumpStat();
+  ASSERT_EQ(joiner1.GetCacheStat().used_node_count, joiner4.GetCacheStat().used_node_count);
+  ASSERT_EQ(joiner1.GetStat().after_join_node_count, joiner4.GetStat().after_join_node_count);
+  size_t used_node_count = 0;
+  for (size_t i = 0; i < joiner4.GetShardCount(); ++i) {
+    ASSERT_EQ(joiner4.GetShardCacheStat(i).max_node_count, 256u);
+    used_node_count += joiner4.GetShardCacheStat(i).used_node_count;
+  }
+  ASSERT_EQ(used_node_count, joiner4.GetCacheStat().used_node_count);
+}
+
 TEST_F(CallChainJoinerTest, no_original_chains) {
   CallChainJoiner joiner(sizeof(CacheNode) * 1024, 1, false);
   ASSERT_TRUE(joiner.AddCallChain(0, 0, CallChainJoiner::ORIGINAL_OFFLINE, {1}, {1}));
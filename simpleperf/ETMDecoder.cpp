@@ -16,7 +16,11 @@
 
 #include "ETMDecoder.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <android-base/expected.h>
 #include <android-base/logging.h>
@@ -235,6 +239,29 @@ class MapLocator : public PacketCallback {
 
   void SetUseVmid(uint8_t trace_id, bool value) { trace_data_[trace_id].use_vmid = value; }
 
+  // When decoders for different cpus run in parallel, they share Dsos, which initialize some
+  // states lazily. Then Dsos should be accessed with dso_lock held.
+  void SetDsoLock(std::mutex* dso_lock) { dso_lock_ = dso_lock; }
+  std::mutex* DsoLock() { return dso_lock_; }
+
+  uint64_t GetVaddrInFile(const MapEntry* map, uint64_t addr) {
+    if (dso_lock_ == nullptr) {
+      return map->GetVaddrInFile(addr);
+    }
+    if (!map->Contains(addr)) {
+      return 0;
+    }
+    // vaddr_in_file is a linear function of addr in a map. So cache the difference to avoid
+    // taking the lock for each address.
+    auto it = vaddr_diff_map_.find(map);
+    if (it == vaddr_diff_map_.end()) {
+      std::lock_guard<std::mutex> guard(*dso_lock_);
+      uint64_t diff = map->GetVaddrInFile(map->start_addr) - map->start_addr;
+      it = vaddr_diff_map_.emplace(map, diff).first;
+    }
+    return addr + it->second;
+  }
+
  private:
   struct TraceData {
     int32_t tid = -1;  // thread id, -1 if invalid
@@ -245,6 +272,8 @@ class MapLocator : public PacketCallback {
 
   ETMThreadTree& thread_tree_;
   TraceData trace_data_[256];
+  std::mutex* dso_lock_ = nullptr;
+  std::unordered_map<const MapEntry*, uint64_t> vaddr_diff_map_;
 };
 
 // Map (trace_id, ip address) to (binary_path, binary_offset), and read binary files.
@@ -272,8 +301,7 @@ class MemAccess : public ITargetMemAccess {
     if (map != nullptr) {
       llvm::MemoryBuffer* memory = GetMemoryBuffer(map->dso);
       if (memory != nullptr) {
-        if (auto opt_offset = map->dso->IpToFileOffset(address, map->start_addr, map->pgoff);
-            opt_offset) {
+        if (auto opt_offset = IpToFileOffset(map, address); opt_offset) {
           uint64_t offset = opt_offset.value();
           size_t file_size = memory->getBufferSize();
           copy_size = file_size > offset ? std::min<size_t>(file_size - offset, *num_bytes) : 0;
@@ -307,13 +335,28 @@ class MemAccess : public ITargetMemAccess {
   llvm::MemoryBuffer* GetMemoryBuffer(Dso* dso) {
     auto it = elf_map_.find(dso);
     if (it == elf_map_.end()) {
+      std::string debug_file_path;
+      if (std::mutex* dso_lock = map_locator_.DsoLock(); dso_lock != nullptr) {
+        std::lock_guard<std::mutex> guard(*dso_lock);
+        debug_file_path = dso->GetDebugFilePath();
+      } else {
+        debug_file_path = dso->GetDebugFilePath();
+      }
       ElfStatus status;
-      auto res = elf_map_.emplace(dso, ElfFile::Open(dso->GetDebugFilePath(), &status));
+      auto res = elf_map_.emplace(dso, ElfFile::Open(debug_file_path, &status));
       it = res.first;
     }
     return it->second ? it->second->GetMemoryBuffer() : nullptr;
   }
 
+  std::optional<uint64_t> IpToFileOffset(const MapEntry* map, uint64_t address) {
+    if (std::mutex* dso_lock = map_locator_.DsoLock(); dso_lock != nullptr) {
+      std::lock_guard<std::mutex> guard(*dso_lock);
+      return map->dso->IpToFileOffset(address, map->start_addr, map->pgoff);
+    }
+    return map->dso->IpToFileOffset(address, map->start_addr, map->pgoff);
+  }
+
   struct TraceData {
     const MapEntry* buffer_map = nullptr;
     const char* buffer = nullptr;
@@ -453,7 +496,7 @@ class InstrRangeParser : public ElementCallback {
         FlushData(data);
         return OCSD_RESP_CONT;
       }
-      uint64_t start_addr = map->GetVaddrInFile(elem.st_addr);
+      uint64_t start_addr = map_locator_.GetVaddrInFile(map, elem.st_addr);
       auto& instr_range = data.instr_range;
 
       if (data.wait_for_branch_to_addr_fix) {
@@ -465,14 +508,14 @@ class InstrRangeParser : public ElementCallback {
       FlushData(data);
       instr_range.dso = map->dso;
       instr_range.start_addr = start_addr;
-      instr_range.end_addr = map->GetVaddrInFile(elem.en_addr - elem.last_instr_sz);
+      instr_range.end_addr = map_locator_.GetVaddrInFile(map, elem.en_addr - elem.last_instr_sz);
       bool end_with_branch =
           elem.last_i_type == OCSD_INSTR_BR || elem.last_i_type == OCSD_INSTR_BR_INDIRECT;
       bool branch_taken = end_with_branch && elem.last_instr_exec;
       if (elem.last_i_type == OCSD_INSTR_BR && branch_taken) {
         // It is based on the assumption that we only do immediate branch inside a binary,
         // which may not be true for all cases. TODO: http://b/151665001.
-        instr_range.branch_to_addr = map->GetVaddrInFile(next_instr->branch_addr);
+        instr_range.branch_to_addr = map_locator_.GetVaddrInFile(map, next_instr->branch_addr);
         data.wait_for_branch_to_addr_fix = true;
       } else {
         instr_range.branch_to_addr = 0;
@@ -608,7 +651,7 @@ class BranchListParser : public PacketCallback {
         return;
       }
       data.branch.dso = map->dso;
-      data.branch.addr = map->GetVaddrInFile(data.addr);
+      data.branch.addr = map_locator_.GetVaddrInFile(map, data.addr);
       if (data.isa == 1) {  // thumb instruction, mark it in bit 0.
         data.branch.addr |= 1;
       }
@@ -774,10 +817,17 @@ class ETMDecoderImpl : public ETMDecoder {
     return true;
   }
 
+  // Should be called before registering callbacks.
+  void SetDsoLock(std::mutex* dso_lock) {
+    CHECK(!map_locator_);
+    dso_lock_ = dso_lock;
+  }
+
  private:
   void InstallMapLocator() {
     if (!map_locator_) {
       map_locator_.reset(new MapLocator(thread_tree_));
+      map_locator_->SetDsoLock(dso_lock_);
       for (auto& cfg : configs_) {
         int64_t configr = (*(const ocsd_etmv4_cfg*)*cfg.second).reg_configr;
         map_locator_->SetUseVmid(cfg.first,
@@ -821,6 +871,145 @@ class ETMDecoderImpl : public ETMDecoder {
   std::unique_ptr<InstrRangeParser> instr_range_parser_;
   std::unique_ptr<MapLocator> map_locator_;
   std::unique_ptr<BranchListParser> branch_list_parser_;
+  std::mutex* dso_lock_ = nullptr;
+};
+
+class ParallelETMDecoderImpl : public ParallelETMDecoder {
+ public:
+  ParallelETMDecoderImpl(size_t jobs) : jobs_(jobs) {}
+
+  void CreateDecoders(const AuxTraceInfoRecord& auxtrace_info, ETMThreadTree& thread_tree) {
+    uint64_t* info = auxtrace_info.data->info;
+    for (int i = 0; i < auxtrace_info.data->nr_cpu; i++) {
+      uint64_t cpu;
+      if (info[0] == AuxTraceInfoRecord::MAGIC_ETM4) {
+        auto& etm4 = *reinterpret_cast<AuxTraceInfoRecord::ETM4Info*>(info);
+        cpu = etm4.cpu;
+        info = reinterpret_cast<uint64_t*>(&etm4 + 1);
+      } else {
+        CHECK_EQ(info[0], AuxTraceInfoRecord::MAGIC_ETE);
+        auto& ete = *reinterpret_cast<AuxTraceInfoRecord::ETEInfo*>(info);
+        cpu = ete.cpu;
+        info = reinterpret_cast<uint64_t*>(&ete + 1);
+      }
+      cpu_to_index_.emplace(cpu, decoders_.size());
+      AddDecoder(auxtrace_info, thread_tree);
+    }
+    if (decoders_.empty()) {
+      AddDecoder(auxtrace_info, thread_tree);
+    }
+    buffers_.resize(decoders_.size());
+  }
+
+  size_t DecoderCount() const override { return decoders_.size(); }
+
+  void RegisterCallback(const InstrRangeCallbackFn& callback) override {
+    for (size_t i = 0; i < decoders_.size(); i++) {
+      decoders_[i]->RegisterCallback(ETMDecoder::InstrRangeCallbackFn(
+          [callback, i](const ETMInstrRange& range) { callback(i, range); }));
+    }
+  }
+
+  void RegisterCallback(const BranchListCallbackFn& callback) override {
+    for (size_t i = 0; i < decoders_.size(); i++) {
+      decoders_[i]->RegisterCallback(ETMDecoder::BranchListCallbackFn(
+          [callback, i](const ETMBranchList& branch) { callback(i, branch); }));
+    }
+  }
+
+  bool ProcessData(const uint8_t* data, size_t size, bool formatted, uint32_t cpu) override {
+    // Data of a cpu not in AuxTraceInfoRecord is decoded by the first decoder.
+    size_t index = 0;
+    if (auto it = cpu_to_index_.find(cpu); it != cpu_to_index_.end()) {
+      index = it->second;
+    }
+    Buffer& buffer = buffers_[index];
+    buffer.blocks.emplace_back(DataBlock{buffer.data.size(), size, formatted, cpu});
+    buffer.data.insert(buffer.data.end(), data, data + size);
+    buffered_size_ += size;
+    if (buffered_size_ >= kMaxBufferedSize) {
+      return Flush();
+    }
+    return true;
+  }
+
+  bool Flush() override {
+    if (buffered_size_ == 0) {
+      return true;
+    }
+    std::atomic<size_t> next_index = 0;
+    std::atomic<bool> failed = false;
+    auto decode = [&]() {
+      for (size_t i = next_index++; i < decoders_.size() && !failed; i = next_index++) {
+        Buffer& buffer = buffers_[i];
+        for (const DataBlock& block : buffer.blocks) {
+          if (!decoders_[i]->ProcessData(buffer.data.data() + block.offset, block.size,
+                                         block.formatted, block.cpu)) {
+            failed = true;
+            break;
+          }
+        }
+      }
+    };
+    size_t thread_count = std::min(jobs_, decoders_.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; i++) {
+      threads.emplace_back(decode);
+    }
+    decode();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (Buffer& buffer : buffers_) {
+      buffer.data.clear();
+      buffer.blocks.clear();
+    }
+    buffered_size_ = 0;
+    return !failed;
+  }
+
+  bool FinishData() override {
+    if (!Flush()) {
+      return false;
+    }
+    for (auto& decoder : decoders_) {
+      if (!decoder->FinishData()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  // Limit memory used to buffer etm data between two flushes.
+  static constexpr size_t kMaxBufferedSize = 256 * 1024 * 1024;
+
+  void AddDecoder(const AuxTraceInfoRecord& auxtrace_info, ETMThreadTree& thread_tree) {
+    // Each decoder has configs of all cpus, in case a data block contains trace of other cpus.
+    auto decoder = std::make_unique<ETMDecoderImpl>(thread_tree);
+    decoder->CreateDecodeTree(auxtrace_info);
+    decoder->SetDsoLock(&dso_lock_);
+    decoders_.emplace_back(std::move(decoder));
+  }
+
+  struct DataBlock {
+    size_t offset;
+    size_t size;
+    bool formatted;
+    uint32_t cpu;
+  };
+
+  struct Buffer {
+    std::vector<uint8_t> data;
+    std::vector<DataBlock> blocks;
+  };
+
+  const size_t jobs_;
+  std::mutex dso_lock_;
+  std::vector<std::unique_ptr<ETMDecoderImpl>> decoders_;
+  std::unordered_map<uint64_t, size_t> cpu_to_index_;
+  std::vector<Buffer> buffers_;
+  size_t buffered_size_ = 0;
 };
 
 }  // namespace
@@ -848,6 +1037,14 @@ std::unique_ptr<ETMDecoder> ETMDecoder::Create(const AuxTraceInfoRecord& auxtrac
   return std::unique_ptr<ETMDecoder>(decoder.release());
 }
 
+std::unique_ptr<ParallelETMDecoder> ParallelETMDecoder::Create(
+    const AuxTraceInfoRecord& auxtrace_info, ETMThreadTree& thread_tree, size_t jobs) {
+  CHECK_GE(jobs, 1u);
+  auto decoder = std::make_unique<ParallelETMDecoderImpl>(jobs);
+  decoder->CreateDecoders(auxtrace_info, thread_tree);
+  return std::unique_ptr<ParallelETMDecoder>(decoder.release());
+}
+
 // Use OpenCSD instruction decoder to convert branches to instruction addresses.
 class BranchDecoder {
  public:
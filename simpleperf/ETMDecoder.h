@@ -87,6 +87,30 @@ class ETMDecoder {
   virtual bool FinishData() = 0;
 };
 
+// Decode ETM data of different cpus in parallel, using an ETMDecoder for each cpu in
+// AuxTraceInfoRecord. Data passed to ProcessData() is buffered and decoded in Flush(). Decoders
+// read the thread tree when decoding, so the caller should call Flush() before updating the
+// thread tree. Callbacks receive the index of the decoder generating the data. Callbacks of the
+// same decoder are called sequentially, while callbacks of different decoders can be called in
+// parallel.
+class ParallelETMDecoder {
+ public:
+  static std::unique_ptr<ParallelETMDecoder> Create(const AuxTraceInfoRecord& auxtrace_info,
+                                                    ETMThreadTree& thread_tree, size_t jobs);
+  virtual ~ParallelETMDecoder() {}
+  virtual size_t DecoderCount() const = 0;
+
+  using InstrRangeCallbackFn = std::function<void(size_t, const ETMInstrRange&)>;
+  virtual void RegisterCallback(const InstrRangeCallbackFn& callback) = 0;
+
+  using BranchListCallbackFn = std::function<void(size_t, const ETMBranchList&)>;
+  virtual void RegisterCallback(const BranchListCallbackFn& callback) = 0;
+
+  virtual bool ProcessData(const uint8_t* data, size_t size, bool formatted, uint32_t cpu) = 0;
+  virtual bool Flush() = 0;
+  virtual bool FinishData() = 0;
+};
+
 // Map from addrs to a map of (branch_list, count).
 // Use maps instead of unordered_maps. Because it helps locality by decoding instructions for sorted
 // addresses.
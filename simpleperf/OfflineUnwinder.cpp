@@ -19,6 +19,7 @@
 #include <inttypes.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <unordered_map>
 
 #include <android-base/logging.h>
@@ -185,6 +186,15 @@ unwindstack::Regs* OfflineUnwinderImpl::GetBacktraceRegs(const RegSet& regs) {
   }
 }
 
+// Look up values CreateMapInfo() needs and caches in shared objects, so CreateMapInfo() only reads
+// them when called on ParallelUnwinder worker threads.
+static void PrepareMapInfo(const MapEntry* entry) {
+  auto tuple = SplitUrlInApk(entry->dso->GetDebugFilePath());
+  if (std::get<0>(tuple)) {
+    ApkInspector::FindElfInApkByName(std::get<1>(tuple), std::get<2>(tuple));
+  }
+}
+
 static std::shared_ptr<unwindstack::MapInfo> CreateMapInfo(const MapEntry* entry) {
   std::string name_holder;
   const char* name = entry->dso->GetDebugFilePath().data();
@@ -365,4 +375,92 @@ std::unique_ptr<OfflineUnwinder> OfflineUnwinder::Create(bool collect_stat) {
   return std::unique_ptr<OfflineUnwinder>(new OfflineUnwinderImpl(collect_stat));
 }
 
+ParallelUnwinder::ParallelUnwinder(size_t thread_count, bool collect_stat) {
+  thread_count = std::max<size_t>(thread_count, 1);
+  for (size_t i = 0; i < thread_count; ++i) {
+    unwinders_.emplace_back(OfflineUnwinder::Create(collect_stat));
+  }
+  // unwinders_[0] is used by the thread calling UnwindCallChains().
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads_.emplace_back(&ParallelUnwinder::WorkerLoop, this, i);
+  }
+}
+
+ParallelUnwinder::~ParallelUnwinder() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    exiting_ = true;
+  }
+  start_cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ParallelUnwinder::UnwindCallChains(std::vector<Task>& tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  PrepareMaps(tasks);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tasks_ = &tasks;
+    next_task_ = 0;
+    running_workers_ = threads_.size();
+    generation_++;
+  }
+  start_cond_.notify_all();
+  RunTasks(*unwinders_[0]);
+  std::unique_lock<std::mutex> lock(lock_);
+  finish_cond_.wait(lock, [this] { return running_workers_ == 0; });
+  tasks_ = nullptr;
+}
+
+void ParallelUnwinder::PrepareMaps(const std::vector<Task>& tasks) {
+  for (const Task& task : tasks) {
+    const MapSet& map_set = *task.thread->maps;
+    auto [it, inserted] = prepared_map_versions_.try_emplace(&map_set, map_set.version);
+    if (!inserted) {
+      if (it->second == map_set.version) {
+        continue;
+      }
+      it->second = map_set.version;
+    }
+    for (const auto& p : map_set.maps) {
+      PrepareMapInfo(p.second);
+    }
+  }
+}
+
+void ParallelUnwinder::WorkerLoop(size_t unwinder_index) {
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      start_cond_.wait(lock, [&] { return exiting_ || generation_ != generation; });
+      if (exiting_) {
+        return;
+      }
+      generation = generation_;
+    }
+    RunTasks(*unwinders_[unwinder_index]);
+    std::lock_guard<std::mutex> guard(lock_);
+    if (--running_workers_ == 0) {
+      finish_cond_.notify_one();
+    }
+  }
+}
+
+void ParallelUnwinder::RunTasks(OfflineUnwinder& unwinder) {
+  std::vector<Task>& tasks = *tasks_;
+  for (size_t i = next_task_++; i < tasks.size(); i = next_task_++) {
+    Task& task = tasks[i];
+    task.result = unwinder.UnwindCallChain(*task.thread, task.regs, task.stack, task.stack_size,
+                                           &task.ips, &task.sps);
+    task.unwinding_result = unwinder.GetUnwindingResult();
+    task.is_callchain_broken_for_incomplete_jit_debug_info =
+        unwinder.IsCallChainBrokenForIncompleteJITDebugInfo();
+  }
+}
+
 }  // namespace simpleperf
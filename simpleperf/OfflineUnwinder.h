@@ -17,7 +17,12 @@
 #ifndef SIMPLE_PERF_OFFLINE_UNWINDER_H_
 #define SIMPLE_PERF_OFFLINE_UNWINDER_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "perf_regs.h"
@@ -83,6 +88,59 @@ class OfflineUnwinder {
   bool is_callchain_broken_for_incomplete_jit_debug_info_ = false;
 };
 
+// Unwinds call chains of many samples on several threads. Each thread has its own
+// OfflineUnwinder, so maps cached for unwinding aren't shared between threads. Threads and their
+// maps must not change while UnwindCallChains() is running. Dso paths used to create unwinding maps
+// are looked up on the calling thread before tasks are dispatched, so worker threads only read
+// them.
+class ParallelUnwinder {
+ public:
+  struct Task {
+    const ThreadEntry* thread;
+    RegSet regs;
+    const char* stack;
+    size_t stack_size;
+
+    // Unwinding results, as returned by OfflineUnwinder.
+    bool result = false;
+    std::vector<uint64_t> ips;
+    std::vector<uint64_t> sps;
+    UnwindingResult unwinding_result = {};
+    bool is_callchain_broken_for_incomplete_jit_debug_info = false;
+
+    Task(const ThreadEntry* thread, const RegSet& regs, const char* stack, size_t stack_size)
+        : thread(thread), regs(regs), stack(stack), stack_size(stack_size) {}
+  };
+
+  ParallelUnwinder(size_t thread_count, bool collect_stat);
+  ~ParallelUnwinder();
+
+  size_t ThreadCount() const { return unwinders_.size(); }
+
+  // Unwinds all tasks and returns when they are done. The calling thread also unwinds tasks.
+  void UnwindCallChains(std::vector<Task>& tasks);
+
+ private:
+  void PrepareMaps(const std::vector<Task>& tasks);
+  void WorkerLoop(size_t unwinder_index);
+  void RunTasks(OfflineUnwinder& unwinder);
+
+  std::vector<std::unique_ptr<OfflineUnwinder>> unwinders_;
+  std::vector<std::thread> threads_;
+  // Map from MapSet to the version of it prepared by PrepareMaps().
+  std::unordered_map<const MapSet*, uint64_t> prepared_map_versions_;
+
+  std::mutex lock_;
+  std::condition_variable start_cond_;
+  std::condition_variable finish_cond_;
+  // Incremented for each UnwindCallChains() call, to wake up worker threads.
+  uint64_t generation_ = 0;
+  size_t running_workers_ = 0;
+  bool exiting_ = false;
+  std::vector<Task>* tasks_ = nullptr;
+  std::atomic<size_t> next_task_ = 0;
+};
+
 }  // namespace simpleperf
 
 #endif  // SIMPLE_PERF_OFFLINE_UNWINDER_H_
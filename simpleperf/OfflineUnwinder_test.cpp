@@ -22,6 +22,9 @@
 
 #include <gtest/gtest.h>
 
+#include "get_test_data.h"
+#include "record_file.h"
+
 using namespace simpleperf;
 
 bool CheckUnwindMaps(UnwindMaps& maps, const MapSet& map_set) {
@@ -115,3 +118,56 @@ TEST(OfflineUnwinder, ARM64PackMask) {
   arm64.set_pc(0xffccccccccULL);
   ASSERT_EQ(arm64.pc(), 0xccccccccULL);
 }
+
+TEST(ParallelUnwinder, same_result_as_unwinding_serially) {
+  // The file has samples in a native library embedded in an apk, so unwinding them looks up dso
+  // paths and elf files in the apk.
+  Dso::SetSymFsDir(GetTestDataDir());
+  std::unique_ptr<RecordFileReader> reader =
+      RecordFileReader::CreateInstance(GetTestData("perf_unwind_embedded_lib_in_apk.data"));
+  ASSERT_TRUE(reader);
+  ThreadTree thread_tree;
+  ASSERT_TRUE(reader->LoadBuildIdAndFileFeatures(thread_tree));
+  ScopedCurrentArch scoped_arch(GetArchType(reader->ReadFeatureString(PerfFileFormat::FEAT_ARCH)));
+
+  std::unique_ptr<OfflineUnwinder> unwinder = OfflineUnwinder::Create(false);
+  ParallelUnwinder parallel_unwinder(4, false);
+  std::vector<std::vector<uint64_t>> serial_ips;
+  std::vector<std::vector<uint64_t>> parallel_ips;
+  std::vector<ParallelUnwinder::Task> tasks;
+  // Samples are kept until unwound, since tasks refer to their stack data.
+  std::vector<std::unique_ptr<Record>> samples;
+  auto unwind_in_parallel = [&]() {
+    parallel_unwinder.UnwindCallChains(tasks);
+    for (const auto& task : tasks) {
+      parallel_ips.push_back(task.result ? task.ips : std::vector<uint64_t>());
+    }
+    tasks.clear();
+    samples.clear();
+  };
+  ASSERT_TRUE(reader->ReadDataSection([&](std::unique_ptr<Record> r) {
+    if (r->type() != PERF_RECORD_SAMPLE) {
+      // Like the record command, unwind pending samples before maps change.
+      unwind_in_parallel();
+      thread_tree.Update(*r);
+      return true;
+    }
+    auto& sr = *static_cast<SampleRecord*>(r.get());
+    if (sr.stack_user_data.size == 0) {
+      return true;
+    }
+    const ThreadEntry* thread = thread_tree.FindThreadOrNew(sr.tid_data.pid, sr.tid_data.tid);
+    RegSet regs(sr.regs_user_data.abi, sr.regs_user_data.reg_mask, sr.regs_user_data.regs);
+    std::vector<uint64_t> ips;
+    std::vector<uint64_t> sps;
+    bool result = unwinder->UnwindCallChain(*thread, regs, sr.stack_user_data.data,
+                                            sr.stack_user_data.size, &ips, &sps);
+    serial_ips.push_back(result ? ips : std::vector<uint64_t>());
+    tasks.emplace_back(thread, regs, sr.stack_user_data.data, sr.stack_user_data.size);
+    samples.emplace_back(std::move(r));
+    return true;
+  }));
+  unwind_in_parallel();
+  ASSERT_FALSE(serial_ips.empty());
+  ASSERT_EQ(serial_ips, parallel_ips);
+}
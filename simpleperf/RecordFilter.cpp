@@ -16,6 +16,8 @@
 
 #include "RecordFilter.h"
 
+#include <unordered_set>
+
 #include "environment.h"
 #include "utils.h"
 
@@ -28,15 +30,26 @@ namespace {
 
 class CpuFilter : public RecordFilterCondition {
  public:
-  void AddCpus(const std::set<int>& cpus) { cpus_.insert(cpus.begin(), cpus.end()); }
+  void AddCpus(const std::set<int>& cpus) {
+    for (int cpu : cpus) {
+      if (cpu >= 0) {
+        if (static_cast<size_t>(cpu) >= cpu_bitmap_.size()) {
+          cpu_bitmap_.resize(cpu + 1, false);
+        }
+        cpu_bitmap_[cpu] = true;
+      }
+    }
+    has_cpus_ = has_cpus_ || !cpus.empty();
+  }
 
   bool Check(const SampleRecord& sample) override {
-    int cpu = static_cast<int>(sample.cpu_data.cpu);
-    return cpus_.empty() || cpus_.count(cpu) == 1;
+    uint32_t cpu = sample.cpu_data.cpu;
+    return !has_cpus_ || (cpu < cpu_bitmap_.size() && cpu_bitmap_[cpu]);
   }
 
  private:
-  std::set<int> cpus_;
+  bool has_cpus_ = false;
+  std::vector<bool> cpu_bitmap_;
 };
 
 class PidFilter : public RecordFilterCondition {
@@ -47,7 +60,7 @@ class PidFilter : public RecordFilterCondition {
   }
 
   bool Check(const SampleRecord& sample) override {
-    uint32_t pid = sample.tid_data.pid;
+    pid_t pid = static_cast<pid_t>(sample.tid_data.pid);
     if (!include_pids_.empty() && include_pids_.count(pid) == 0) {
       return false;
     }
@@ -55,8 +68,8 @@ class PidFilter : public RecordFilterCondition {
   }
 
  private:
-  std::set<pid_t> include_pids_;
-  std::set<pid_t> exclude_pids_;
+  std::unordered_set<pid_t> include_pids_;
+  std::unordered_set<pid_t> exclude_pids_;
 };
 
 class TidFilter : public RecordFilterCondition {
@@ -67,7 +80,7 @@ class TidFilter : public RecordFilterCondition {
   }
 
   bool Check(const SampleRecord& sample) override {
-    uint32_t tid = sample.tid_data.tid;
+    pid_t tid = static_cast<pid_t>(sample.tid_data.tid);
     if (!include_tids_.empty() && include_tids_.count(tid) == 0) {
       return false;
     }
@@ -75,8 +88,8 @@ class TidFilter : public RecordFilterCondition {
   }
 
  private:
-  std::set<pid_t> include_tids_;
-  std::set<pid_t> exclude_tids_;
+  std::unordered_set<pid_t> include_tids_;
+  std::unordered_set<pid_t> exclude_tids_;
 };
 
 static bool SearchInRegs(std::string_view s, const std::vector<std::unique_ptr<RegEx>>& regs) {
@@ -88,66 +101,64 @@ static bool SearchInRegs(std::string_view s, const std::vector<std::unique_ptr<R
   return false;
 }
 
-class ProcessNameFilter : public RecordFilterCondition {
+// Filter samples by the name of the process (for_process = true) or the thread.
+class NameFilter : public RecordFilterCondition {
  public:
-  ProcessNameFilter(const ThreadTree& thread_tree) : thread_tree_(thread_tree) {}
+  NameFilter(const ThreadTree& thread_tree, bool for_process)
+      : thread_tree_(thread_tree),
+        for_process_(for_process),
+        thread_tree_clear_count_(thread_tree.GetClearCount()) {}
 
-  bool AddProcessNameRegex(const std::string& process_name, bool exclude) {
-    if (auto regex = RegEx::Create(process_name); regex != nullptr) {
+  bool AddNameRegex(const std::string& name, bool exclude) {
+    if (auto regex = RegEx::Create(name); regex != nullptr) {
       auto& dest = exclude ? exclude_names_ : include_names_;
       dest.emplace_back(std::move(regex));
+      result_cache_.clear();
       return true;
     }
     return false;
   }
 
   bool Check(const SampleRecord& sample) override {
-    ThreadEntry* process = thread_tree_.FindThread(sample.tid_data.pid);
-    if (process == nullptr) {
+    int tid = static_cast<int>(for_process_ ? sample.tid_data.pid : sample.tid_data.tid);
+    ThreadEntry* thread = thread_tree_.FindThread(tid);
+    if (thread == nullptr) {
       return false;
     }
-    std::string_view process_name = process->comm;
-    if (!include_names_.empty() && !SearchInRegs(process_name, include_names_)) {
-      return false;
+    // Searching regexs is slow. So cache the result for each thread. ThreadTree sets a new comm
+    // pointer when a thread name changes, which invalidates the cached result. Comm pointers are
+    // freed by ThreadTree::ClearThreadAndMap(), so drop the cache after that.
+    if (thread_tree_clear_count_ != thread_tree_.GetClearCount()) {
+      thread_tree_clear_count_ = thread_tree_.GetClearCount();
+      result_cache_.clear();
+    }
+    CachedResult& cached = result_cache_[tid];
+    if (cached.comm != thread->comm) {
+      cached.comm = thread->comm;
+      cached.result = CheckName(thread->comm);
     }
-    return !SearchInRegs(process_name, exclude_names_);
+    return cached.result;
   }
 
  private:
-  const ThreadTree& thread_tree_;
-  std::vector<std::unique_ptr<RegEx>> include_names_;
-  std::vector<std::unique_ptr<RegEx>> exclude_names_;
-};
-
-class ThreadNameFilter : public RecordFilterCondition {
- public:
-  ThreadNameFilter(const ThreadTree& thread_tree) : thread_tree_(thread_tree) {}
-
-  bool AddThreadNameRegex(const std::string& thread_name, bool exclude) {
-    if (auto regex = RegEx::Create(thread_name); regex != nullptr) {
-      auto& dest = exclude ? exclude_names_ : include_names_;
-      dest.emplace_back(std::move(regex));
-      return true;
-    }
-    return false;
-  }
+  struct CachedResult {
+    const char* comm = nullptr;
+    bool result = false;
+  };
 
-  bool Check(const SampleRecord& sample) override {
-    ThreadEntry* thread = thread_tree_.FindThread(sample.tid_data.tid);
-    if (thread == nullptr) {
+  bool CheckName(std::string_view name) {
+    if (!include_names_.empty() && !SearchInRegs(name, include_names_)) {
       return false;
     }
-    std::string_view thread_name = thread->comm;
-    if (!include_names_.empty() && !SearchInRegs(thread_name, include_names_)) {
-      return false;
-    }
-    return !SearchInRegs(thread_name, exclude_names_);
+    return !SearchInRegs(name, exclude_names_);
   }
 
- private:
   const ThreadTree& thread_tree_;
+  const bool for_process_;
   std::vector<std::unique_ptr<RegEx>> include_names_;
   std::vector<std::unique_ptr<RegEx>> exclude_names_;
+  std::unordered_map<int, CachedResult> result_cache_;
+  uint64_t thread_tree_clear_count_ = 0;
 };
 
 class UidFilter : public RecordFilterCondition {
@@ -213,6 +224,15 @@ class TimeRanges {
 
   bool Empty() const { return ranges_.empty(); }
 
+  // Return the smallest range covering all ranges. Should only be called when not empty.
+  TimeRange GetBounds() const {
+    uint64_t end = 0;
+    for (const auto& range : ranges_) {
+      end = std::max(end, range.second);
+    }
+    return TimeRange(ranges_.front().first, end);
+  }
+
   bool InRange(uint64_t timestamp) const {
     auto it = std::upper_bound(ranges_.begin(), ranges_.end(),
                                std::pair<uint64_t, uint64_t>(timestamp, 0));
@@ -266,6 +286,38 @@ class TimeFilter : public RecordFilterCondition {
     return global_ranges_.Empty() && process_ranges_.empty() && thread_ranges_.empty();
   }
 
+  // Return a time range [start, end) covering all samples that can pass the filter.
+  TimeRange GetTimeRange() const {
+    TimeRange result(0, UINT64_MAX);
+    auto intersect = [&](const TimeRange& range) {
+      result.first = std::max(result.first, range.first);
+      result.second = std::min(result.second, range.second);
+    };
+    auto intersect_union = [&](const std::unordered_map<pid_t, TimeRanges>& ranges_map) {
+      if (ranges_map.empty()) {
+        return;
+      }
+      TimeRange bounds(UINT64_MAX, 0);
+      for (const auto& [_, ranges] : ranges_map) {
+        if (!ranges.Empty()) {
+          TimeRange range = ranges.GetBounds();
+          bounds.first = std::min(bounds.first, range.first);
+          bounds.second = std::max(bounds.second, range.second);
+        }
+      }
+      intersect(bounds);
+    };
+    if (!global_ranges_.Empty()) {
+      intersect(global_ranges_.GetBounds());
+    }
+    intersect_union(process_ranges_);
+    intersect_union(thread_ranges_);
+    if (result.first >= result.second) {
+      return TimeRange(0, 0);
+    }
+    return result;
+  }
+
   bool Check(const SampleRecord& sample) override {
     uint64_t timestamp = sample.Timestamp();
     if (!global_ranges_.Empty() && !global_ranges_.InRange(timestamp)) {
@@ -477,19 +529,17 @@ void RecordFilter::AddTids(const std::set<pid_t>& tids, bool exclude) {
 bool RecordFilter::AddProcessNameRegex(const std::string& process_name, bool exclude) {
   std::unique_ptr<RecordFilterCondition>& process_name_filter = conditions_["process_name"];
   if (!process_name_filter) {
-    process_name_filter.reset(new ProcessNameFilter(thread_tree_));
+    process_name_filter.reset(new NameFilter(thread_tree_, true));
   }
-  return static_cast<ProcessNameFilter&>(*process_name_filter)
-      .AddProcessNameRegex(process_name, exclude);
+  return static_cast<NameFilter&>(*process_name_filter).AddNameRegex(process_name, exclude);
 }
 
 bool RecordFilter::AddThreadNameRegex(const std::string& thread_name, bool exclude) {
   std::unique_ptr<RecordFilterCondition>& thread_name_filter = conditions_["thread_name"];
   if (!thread_name_filter) {
-    thread_name_filter.reset(new ThreadNameFilter(thread_tree_));
+    thread_name_filter.reset(new NameFilter(thread_tree_, false));
   }
-  return static_cast<ThreadNameFilter&>(*thread_name_filter)
-      .AddThreadNameRegex(thread_name, exclude);
+  return static_cast<NameFilter&>(*thread_name_filter).AddNameRegex(thread_name, exclude);
 }
 
 void RecordFilter::AddUids(const std::set<uint32_t>& uids, bool exclude) {
@@ -530,6 +580,16 @@ bool RecordFilter::CheckClock(const std::string& clock) {
   return true;
 }
 
+std::optional<std::pair<uint64_t, uint64_t>> RecordFilter::GetTimeRange() const {
+  if (auto it = conditions_.find("time"); it != conditions_.end()) {
+    const TimeFilter& time_filter = static_cast<const TimeFilter&>(*it->second);
+    if (!time_filter.Empty()) {
+      return time_filter.GetTimeRange();
+    }
+  }
+  return std::nullopt;
+}
+
 void RecordFilter::Clear() {
   conditions_.clear();
 }
@@ -130,6 +130,10 @@ class RecordFilter {
   // Check if the clock matches the clock for timestamps in the filter file.
   bool CheckClock(const std::string& clock);
 
+  // Return a time range [start, end) covering all samples that can pass the time filter set by
+  // the filter file, or nullopt if there is no time filter.
+  std::optional<std::pair<uint64_t, uint64_t>> GetTimeRange() const;
+
   // Clear filter conditions.
   void Clear();
 
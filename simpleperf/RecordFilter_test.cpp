@@ -69,6 +69,8 @@ TEST_F(RecordFilterTest, cpu) {
   ASSERT_TRUE(filter.Check(r));
   r.cpu_data.cpu = 2;
   ASSERT_FALSE(filter.Check(r));
+  r.cpu_data.cpu = 1000;
+  ASSERT_FALSE(filter.Check(r));
 }
 
 TEST_F(RecordFilterTest, exclude_pid) {
@@ -99,6 +101,31 @@ TEST_F(RecordFilterTest, exclude_thread_name_regex) {
   ASSERT_TRUE(filter.Check(GetRecord(1, 2)));
 }
 
+TEST_F(RecordFilterTest, thread_name_change) {
+  ASSERT_TRUE(filter.AddThreadNameRegex("threadA", true));
+  ASSERT_TRUE(filter.AddProcessNameRegex("processB", true));
+  thread_tree.SetThreadName(1, 1, "processA");
+  thread_tree.SetThreadName(1, 2, "threadB");
+  ASSERT_TRUE(filter.Check(GetRecord(1, 2)));
+  // The result of a thread is updated after its name changes.
+  thread_tree.SetThreadName(1, 2, "threadA");
+  ASSERT_FALSE(filter.Check(GetRecord(1, 2)));
+  thread_tree.SetThreadName(1, 2, "threadC");
+  ASSERT_TRUE(filter.Check(GetRecord(1, 2)));
+  thread_tree.SetThreadName(1, 1, "processB");
+  ASSERT_FALSE(filter.Check(GetRecord(1, 2)));
+  // Adding a regex updates results of all threads.
+  thread_tree.SetThreadName(1, 1, "processA");
+  ASSERT_TRUE(filter.Check(GetRecord(1, 2)));
+  ASSERT_TRUE(filter.AddThreadNameRegex("threadC", true));
+  ASSERT_FALSE(filter.Check(GetRecord(1, 2)));
+  // Cached results are dropped after clearing the thread tree.
+  thread_tree.ClearThreadAndMap();
+  thread_tree.SetThreadName(1, 1, "processA");
+  thread_tree.SetThreadName(1, 2, "threadD");
+  ASSERT_TRUE(filter.Check(GetRecord(1, 2)));
+}
+
 #if defined(__linux__)
 TEST_F(RecordFilterTest, exclude_uid) {
   pid_t pid = getpid();
@@ -239,6 +266,32 @@ TEST_F(RecordFilterTest, clock_in_time_filter) {
   ASSERT_FALSE(filter.CheckClock("monotonic"));
 }
 
+TEST_F(RecordFilterTest, time_range_of_time_filter) {
+  using TimeRange = std::pair<uint64_t, uint64_t>;
+  ASSERT_FALSE(filter.GetTimeRange().has_value());
+  ASSERT_TRUE(SetFilterData(""));
+  ASSERT_FALSE(filter.GetTimeRange().has_value());
+  ASSERT_TRUE(
+      SetFilterData("GLOBAL_BEGIN 1000\n"
+                    "GLOBAL_END 2000\n"
+                    "GLOBAL_BEGIN 3000\n"
+                    "GLOBAL_END 4000"));
+  ASSERT_EQ(filter.GetTimeRange(), TimeRange(1000, 4000));
+  ASSERT_TRUE(SetFilterData("GLOBAL_BEGIN 1000"));
+  ASSERT_EQ(filter.GetTimeRange(), TimeRange(1000, UINT64_MAX));
+  // Process and thread ranges narrow the global range.
+  ASSERT_TRUE(
+      SetFilterData("GLOBAL_BEGIN 1000\n"
+                    "GLOBAL_END 4000\n"
+                    "PROCESS_BEGIN 1 2000\n"
+                    "PROCESS_END 1 3000\n"
+                    "PROCESS_BEGIN 2 2500\n"
+                    "PROCESS_END 2 5000\n"
+                    "THREAD_BEGIN 3 500\n"
+                    "THREAD_END 3 3500"));
+  ASSERT_EQ(filter.GetTimeRange(), TimeRange(2000, 3500));
+}
+
 TEST_F(RecordFilterTest, error_in_time_filter) {
   // no timestamp error
   ASSERT_FALSE(SetFilterData("GLOBAL_BEGIN"));
@@ -78,7 +78,8 @@ void RecordBuffer::FinishWrite() {
 
 char* RecordBuffer::GetCurrentRecord() {
   size_t write_head = write_head_.load(std::memory_order_acquire);
-  size_t read_head = read_head_.load(std::memory_order_relaxed);
+  size_t read_head =
+      (read_head_.load(std::memory_order_relaxed) + cur_read_record_size_) % buffer_size_;
   if (read_head == write_head) {
     return nullptr;
   }
@@ -336,6 +337,45 @@ std::unique_ptr<Record> RecordReadThread::GetRecord() {
   return nullptr;
 }
 
+const std::vector<Record*>& RecordReadThread::GetRecordBatch(size_t max_records) {
+  record_buffer_.MoveToNextRecord();
+  record_batch_.clear();
+  for (auto& pair : record_pools_) {
+    pair.second.used_count = 0;
+  }
+  while (record_batch_.size() < max_records) {
+    char* p = record_buffer_.GetCurrentRecord();
+    if (p == nullptr) {
+      break;
+    }
+    auto header = reinterpret_cast<const perf_event_header*>(p);
+    RecordPool& pool = record_pools_[header->type];
+    Record* r;
+    if (pool.used_count < pool.records.size()) {
+      r = pool.records[pool.used_count].get();
+      CHECK(r->ParseInPlace(attr_, p, record_buffer_.BufferEnd()));
+    } else {
+      std::unique_ptr<Record> new_r = ReadRecordFromBuffer(attr_, p, record_buffer_.BufferEnd());
+      CHECK(new_r);
+      r = new_r.get();
+      pool.records.emplace_back(std::move(new_r));
+    }
+    pool.used_count++;
+    if (r->type() == PERF_RECORD_AUXTRACE) {
+      auto auxtrace = static_cast<AuxTraceRecord*>(r);
+      record_buffer_.AddCurrentRecordSize(auxtrace->data->aux_size);
+      auxtrace->location.addr = r->Binary() + r->size();
+    }
+    record_batch_.push_back(r);
+  }
+  if (record_batch_.empty() && has_data_notification_) {
+    char unused;
+    TEMP_FAILURE_RETRY(read(read_data_fd_, &unused, 1));
+    has_data_notification_ = false;
+  }
+  return record_batch_;
+}
+
 void RecordReadThread::RunReadThread() {
   IncreaseThreadPriority();
   IOEventLoop loop;
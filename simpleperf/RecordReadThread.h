@@ -24,7 +24,9 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/macros.h>
 #include <android-base/unique_fd.h>
@@ -50,10 +52,12 @@ class RecordBuffer {
   // Called after writing a record, let the read thread see the record.
   void FinishWrite();
 
-  // Get data of the current record. Return nullptr if there is no records in the buffer.
+  // Get data of the next record not read yet. Return nullptr if there is no records in the
+  // buffer. Records read are kept in the buffer until MoveToNextRecord() is called, so several
+  // records can be used at the same time.
   char* GetCurrentRecord();
   void AddCurrentRecordSize(size_t size) { cur_read_record_size_ += size; }
-  // Called after reading a record, the space of the record will be writable.
+  // Called after reading records, the space of the records read will be writable.
   void MoveToNextRecord();
 
  private:
@@ -154,6 +158,10 @@ class RecordReadThread {
 
   // If available, return the next record in the RecordBuffer, otherwise return nullptr.
   std::unique_ptr<Record> GetRecord();
+  // Return up to [max_records] records in the RecordBuffer. The records are parsed in place,
+  // without copying their data or allocating Record objects. They are valid until the next call
+  // of GetRecordBatch() or GetRecord(), which releases their space in the RecordBuffer.
+  const std::vector<Record*>& GetRecordBatch(size_t max_records);
 
   const RecordStat& GetStat() const { return stat_; }
 
@@ -215,6 +223,14 @@ class RecordReadThread {
   std::unordered_set<EventFd*> event_fds_disabled_by_kernel_;
 
   RecordStat stat_;
+
+  // Record objects reused by GetRecordBatch(), indexed by record type.
+  struct RecordPool {
+    std::vector<std::unique_ptr<Record>> records;
+    size_t used_count = 0;
+  };
+  std::unordered_map<uint32_t, RecordPool> record_pools_;
+  std::vector<Record*> record_batch_;
 };
 
 }  // namespace simpleperf
@@ -323,6 +323,41 @@ TEST_F(RecordReadThreadTest, read_records) {
   }
 }
 
+TEST_F(RecordReadThreadTest, read_record_batch) {
+  perf_event_attr attr = CreateFakeEventAttr();
+  RecordReadThread thread(128 * 1024, attr, 1, 1, 0);
+  IOEventLoop loop;
+  size_t record_index = 0;
+  auto callback = [&]() {
+    while (true) {
+      const std::vector<Record*>& records = thread.GetRecordBatch(3);
+      if (records.empty()) {
+        break;
+      }
+      if (records.size() > 3) {
+        return false;
+      }
+      // All records in a batch are valid at the same time.
+      for (Record* r : records) {
+        std::unique_ptr<Record>& expected = records_[record_index++];
+        if (r->size() != expected->size() ||
+            memcmp(r->Binary(), expected->Binary(), r->size()) != 0) {
+          return false;
+        }
+      }
+    }
+    return loop.ExitLoop();
+  };
+  ASSERT_TRUE(thread.RegisterDataCallback(loop, callback));
+  records_ = CreateFakeRecords(attr, 20, 0, 0);
+  std::vector<EventFd*> event_fds = CreateFakeEventFds(attr, 2);
+  ASSERT_TRUE(thread.AddEventFds(event_fds));
+  ASSERT_TRUE(thread.SyncKernelBuffer());
+  ASSERT_TRUE(loop.RunLoop());
+  ASSERT_EQ(record_index, records_.size());
+  ASSERT_TRUE(thread.RemoveEventFds(event_fds));
+}
+
 TEST_F(RecordReadThreadTest, process_sample_record) {
   perf_event_attr attr = CreateFakeEventAttr();
   attr.sample_type |= PERF_SAMPLE_STACK_USER;
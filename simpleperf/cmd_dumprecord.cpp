@@ -564,6 +564,17 @@ bool DumpRecordCommand::DumpFeatureSection() {
           PrintIndented(2, "size: %" PRIu64 "\n", file.size);
         }
       }
+    } else if (feature == FEAT_TIME_INDEX) {
+      auto time_index = record_file_reader_->ReadTimeIndexFeature();
+      if (!time_index) {
+        return false;
+      }
+      PrintIndented(1, "time_index:\n");
+      for (const TimeIndexBlock& block : time_index->blocks) {
+        PrintIndented(2, "block: data_offset %" PRIu64 ", time [%" PRIu64 ", %" PRIu64 "]\n",
+                      block.data_offset, block.min_time, block.max_time);
+      }
+      PrintIndented(2, "state_record_count: %zu\n", time_index->state_record_offsets.size());
     } else if (feature == FEAT_ETM_BRANCH_LIST) {
       std::string data;
       if (!record_file_reader_->ReadFeatureSection(FEAT_ETM_BRANCH_LIST, &data)) {
@@ -18,9 +18,13 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <string>
+#include <thread>
 
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
@@ -52,6 +56,7 @@ struct AddrPairHash {
 enum class OutputFormat {
   AutoFDO,
   BranchList,
+  BranchListCompact,
 };
 
 struct AutoFDOBinaryInfo {
@@ -228,10 +233,17 @@ class ETMThreadTreeWithFilter : public ETMThreadTree {
 class ETMPerfDataReader : public PerfDataReader {
  public:
   ETMPerfDataReader(std::unique_ptr<RecordFileReader> reader, bool exclude_perf,
-                    const RegEx* binary_name_regex, ETMDumpOption etm_dump_option)
+                    const RegEx* binary_name_regex, ETMDumpOption etm_dump_option, size_t jobs)
       : PerfDataReader(std::move(reader), exclude_perf, binary_name_regex),
         etm_dump_option_(etm_dump_option),
-        etm_thread_tree_(thread_tree_, exclude_pid_) {}
+        etm_thread_tree_(thread_tree_, exclude_pid_) {
+    // Dumping etm data from multiple threads makes the output unreadable. So decode in parallel
+    // only when not dumping.
+    if (jobs > 1 && !etm_dump_option.dump_raw_data && !etm_dump_option.dump_packets &&
+        !etm_dump_option.dump_elements) {
+      jobs_ = jobs;
+    }
+  }
 
   bool Read() override {
     if (reader_->HasFeature(PerfFileFormat::FEAT_ETM_BRANCH_LIST)) {
@@ -242,7 +254,16 @@ class ETMPerfDataReader : public PerfDataReader {
 
  private:
   bool ProcessRecord(Record& r) override {
+    if (parallel_etm_decoder_ && UpdatesThreadTree(r)) {
+      // Buffered etm data should be decoded with the thread tree before this record.
+      if (!parallel_etm_decoder_->Flush()) {
+        return false;
+      }
+    }
     thread_tree_.Update(r);
+    if (r.type() == PERF_RECORD_AUXTRACE_INFO && jobs_ > 1) {
+      return CreateParallelETMDecoder(static_cast<AuxTraceInfoRecord&>(r));
+    }
     if (r.type() == PERF_RECORD_AUXTRACE_INFO) {
       etm_decoder_ = ETMDecoder::Create(static_cast<AuxTraceInfoRecord&>(r), etm_thread_tree_);
       if (!etm_decoder_) {
@@ -269,6 +290,10 @@ class ETMPerfDataReader : public PerfDataReader {
                                   error)) {
           return !error;
         }
+        if (parallel_etm_decoder_) {
+          return parallel_etm_decoder_->ProcessData(aux_data_buffer_.data(), aux_size,
+                                                    !aux.Unformatted(), aux.Cpu());
+        }
         if (!etm_decoder_) {
           LOG(ERROR) << "ETMDecoder isn't created";
           return false;
@@ -285,10 +310,74 @@ class ETMPerfDataReader : public PerfDataReader {
     return true;
   }
 
+  static bool UpdatesThreadTree(const Record& r) {
+    switch (r.type()) {
+      case PERF_RECORD_MMAP:
+      case PERF_RECORD_MMAP2:
+      case PERF_RECORD_COMM:
+      case PERF_RECORD_FORK:
+      case PERF_RECORD_EXIT:
+      case SIMPLE_PERF_RECORD_KERNEL_SYMBOL:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool CreateParallelETMDecoder(const AuxTraceInfoRecord& r) {
+    parallel_etm_decoder_ = ParallelETMDecoder::Create(r, etm_thread_tree_, jobs_);
+    if (!parallel_etm_decoder_) {
+      return false;
+    }
+    // Each decoder adds results to its own map, which are merged in PostProcess().
+    size_t decoder_count = parallel_etm_decoder_->DecoderCount();
+    binary_filters_.assign(decoder_count, binary_filter_);
+    if (autofdo_callback_) {
+      decoder_autofdo_binary_maps_.resize(decoder_count);
+      parallel_etm_decoder_->RegisterCallback(ParallelETMDecoder::InstrRangeCallbackFn(
+          [this](size_t index, const ETMInstrRange& range) {
+            if (binary_filters_[index].Filter(range.dso)) {
+              decoder_autofdo_binary_maps_[index][range.dso].AddInstrRange(range);
+            }
+          }));
+    } else if (etm_binary_callback_) {
+      decoder_etm_binary_maps_.resize(decoder_count);
+      parallel_etm_decoder_->RegisterCallback(ParallelETMDecoder::BranchListCallbackFn(
+          [this](size_t index, const ETMBranchList& branch_list) {
+            if (binary_filters_[index].Filter(branch_list.dso)) {
+              auto& branch_map = decoder_etm_binary_maps_[index][branch_list.dso].branch_map;
+              ++branch_map[branch_list.addr][branch_list.branch];
+            }
+          }));
+    }
+    return true;
+  }
+
+  void MergeParallelDecodeResults() {
+    for (auto& binary_map : decoder_autofdo_binary_maps_) {
+      for (auto& [dso, binary] : binary_map) {
+        autofdo_binary_map_[dso].Merge(binary);
+      }
+    }
+    decoder_autofdo_binary_maps_.clear();
+    for (auto& binary_map : decoder_etm_binary_maps_) {
+      for (auto& [dso, binary] : binary_map) {
+        etm_binary_map_[dso].Merge(binary);
+      }
+    }
+    decoder_etm_binary_maps_.clear();
+  }
+
   bool PostProcess() override {
     if (etm_decoder_ && !etm_decoder_->FinishData()) {
       return false;
     }
+    if (parallel_etm_decoder_) {
+      if (!parallel_etm_decoder_->FinishData()) {
+        return false;
+      }
+      MergeParallelDecodeResults();
+    }
     if (autofdo_callback_) {
       ProcessAutoFDOBinaryInfo();
     } else if (etm_binary_callback_) {
@@ -369,6 +458,13 @@ class ETMPerfDataReader : public PerfDataReader {
   uint64_t kernel_map_start_addr_ = 0;
   // Store etm branch list data.
   std::unordered_map<Dso*, ETMBinary> etm_binary_map_;
+
+  // Used when decoding etm data of different cpus in parallel.
+  size_t jobs_ = 1;
+  std::unique_ptr<ParallelETMDecoder> parallel_etm_decoder_;
+  std::vector<BinaryFilter> binary_filters_;
+  std::vector<std::unordered_map<const Dso*, AutoFDOBinaryInfo>> decoder_autofdo_binary_maps_;
+  std::vector<std::unordered_map<Dso*, ETMBinary>> decoder_etm_binary_maps_;
 };
 
 static std::optional<std::vector<AutoFDOBinaryInfo>> ConvertLBRDataToAutoFDO(
@@ -495,7 +591,7 @@ class LBRPerfDataReader : public PerfDataReader {
   std::unordered_map<const Dso*, uint32_t> dso_map_;
 };
 
-// Read a protobuf file specified by branch_list.proto.
+// Read a protobuf file specified by branch_list.proto, or a file in compact branch list format.
 class BranchListReader {
  public:
   BranchListReader(const std::string& filename, const RegEx* binary_name_regex)
@@ -510,6 +606,15 @@ class BranchListReader {
       PLOG(ERROR) << "failed to read " << filename_;
       return false;
     }
+    data_size_ = s.size();
+    if (IsCompactETMBranchList(s)) {
+      // Pass binaries one by one, without building ETMBinaryMap for the whole file.
+      return ReadCompactETMBranchList(s, [&](const BinaryKey& key, ETMBinary& binary) {
+        if (etm_binary_callback_ && binary_filter_.Filter(key.path)) {
+          etm_binary_callback_(key, binary);
+        }
+      });
+    }
     ETMBinaryMap etm_data;
     LBRData lbr_data;
     if (!ParseBranchListData(s, etm_data, lbr_data)) {
@@ -525,6 +630,8 @@ class BranchListReader {
     return true;
   }
 
+  size_t DataSize() const { return data_size_; }
+
  private:
   void ProcessETMData(ETMBinaryMap& etm_data) {
     for (auto& [key, binary] : etm_data) {
@@ -588,6 +695,7 @@ class BranchListReader {
   BinaryFilter binary_filter_;
   ETMBinaryCallback etm_binary_callback_;
   LBRDataCallback lbr_data_callback_;
+  size_t data_size_ = 0;
 };
 
 // Convert ETMBinary into AutoFDOBinaryInfo.
@@ -778,6 +886,18 @@ struct BranchListMerger {
     }
   }
 
+  // Move data in [other] into this merger.
+  void Merge(BranchListMerger& other) {
+    for (auto& [key, binary] : other.etm_data_) {
+      AddETMBinary(key, binary);
+    }
+    other.etm_data_.clear();
+    if (!other.lbr_data_.samples.empty()) {
+      AddLBRData(other.lbr_data_);
+      other.lbr_data_ = LBRData();
+    }
+  }
+
   ETMBinaryMap& GetETMData() { return etm_data_; }
 
   LBRData& GetLBRData() { return lbr_data_; }
@@ -788,15 +908,23 @@ struct BranchListMerger {
   std::unordered_map<BinaryKey, uint32_t, BinaryKeyHash> lbr_binary_id_map_;
 };
 
-// Write branch lists to a protobuf file specified by branch_list.proto.
+// Write branch lists to a protobuf file specified by branch_list.proto. If compact is true,
+// ETM branch lists are written in compact branch list format.
 static bool WriteBranchListFile(const std::string& output_filename, const ETMBinaryMap& etm_data,
-                                const LBRData& lbr_data) {
+                                const LBRData& lbr_data, bool compact) {
   std::string s;
   if (!etm_data.empty()) {
-    if (!ETMBinaryMapToString(etm_data, s)) {
+    if (compact) {
+      if (!ETMBinaryMapToCompactString(etm_data, s)) {
+        return false;
+      }
+    } else if (!ETMBinaryMapToString(etm_data, s)) {
       return false;
     }
   } else if (!lbr_data.samples.empty()) {
+    if (compact) {
+      LOG(WARNING) << "LBR data is written in protobuf format";
+    }
     if (!LBRDataToString(lbr_data, s)) {
       return false;
     }
@@ -822,17 +950,25 @@ class InjectCommand : public Command {
 "--binary binary_name         Generate data only for binaries matching binary_name regex.\n"
 "-i file1,file2,...           Input files. Default is perf.data. Support below formats:\n"
 "                               1. perf.data generated by recording cs-etm event type.\n"
-"                               2. branch_list file generated by `inject --output branch-list`.\n"
+"                               2. branch_list file generated by `inject --output branch-list`\n"
+"                                  or `inject --output branch-list-compact`.\n"
 "                             If a file name starts with @, it contains a list of input files.\n"
 "-o <file>                    output file. Default is perf_inject.data.\n"
 "--output <format>            Select output file format:\n"
 "                               autofdo      -- text format accepted by TextSampleReader\n"
 "                                               of AutoFDO\n"
 "                               branch-list  -- protobuf file in etm_branch_list.proto\n"
+"                               branch-list-compact  -- branch list file with sorted,\n"
+"                                               delta encoded addresses and zlib compressed\n"
+"                                               blocks, smaller and faster to read than\n"
+"                                               branch-list. Only used for ETM data.\n"
 "                             Default is autofdo.\n"
 "--dump-etm type1,type2,...   Dump etm data. A type is one of raw, packet and element.\n"
 "--exclude-perf               Exclude trace data for the recording process.\n"
 "--symdir <dir>               Look for binaries in a directory recursively.\n"
+"-j <jobs>                    Use jobs threads to read and merge branch_list input files, or\n"
+"                             to decode etm data of different cpus in a perf.data input file.\n"
+"                             Default is 1. perf.data input files are still read one by one.\n"
 "\n"
 "Examples:\n"
 "1. Generate autofdo text output.\n"
@@ -856,6 +992,7 @@ class InjectCommand : public Command {
         case OutputFormat::AutoFDO:
           return ConvertPerfDataToAutoFDO();
         case OutputFormat::BranchList:
+        case OutputFormat::BranchListCompact:
           return ConvertPerfDataToBranchList();
       }
     } else {
@@ -863,6 +1000,7 @@ class InjectCommand : public Command {
         case OutputFormat::AutoFDO:
           return ConvertBranchListToAutoFDO();
         case OutputFormat::BranchList:
+        case OutputFormat::BranchListCompact:
           return ConvertBranchListToBranchList();
       }
     }
@@ -875,6 +1013,7 @@ class InjectCommand : public Command {
         {"--dump-etm", {OptionValueType::STRING, OptionType::SINGLE}},
         {"--exclude-perf", {OptionValueType::NONE, OptionType::SINGLE}},
         {"-i", {OptionValueType::STRING, OptionType::MULTIPLE}},
+        {"-j", {OptionValueType::UINT, OptionType::SINGLE}},
         {"-o", {OptionValueType::STRING, OptionType::SINGLE}},
         {"--output", {OptionValueType::STRING, OptionType::SINGLE}},
         {"--symdir", {OptionValueType::STRING, OptionType::MULTIPLE}},
@@ -913,6 +1052,9 @@ class InjectCommand : public Command {
     if (input_filenames_.empty()) {
       input_filenames_.emplace_back("perf.data");
     }
+    if (!options.PullUintValue("-j", &jobs_, 1)) {
+      return false;
+    }
     options.PullStringValue("-o", &output_filename_);
     if (auto value = options.PullValue("--output"); value) {
       const std::string& output = *value->str_value;
@@ -920,6 +1062,8 @@ class InjectCommand : public Command {
         output_format_ = OutputFormat::AutoFDO;
       } else if (output == "branch-list") {
         output_format_ = OutputFormat::BranchList;
+      } else if (output == "branch-list-compact") {
+        output_format_ = OutputFormat::BranchListCompact;
       } else {
         LOG(ERROR) << "unknown format in --output option: " << output;
         return false;
@@ -970,7 +1114,7 @@ class InjectCommand : public Command {
       std::unique_ptr<PerfDataReader> reader;
       if (data_type == "etm") {
         reader.reset(new ETMPerfDataReader(std::move(file_reader), exclude_perf_,
-                                           binary_name_regex_.get(), etm_dump_option_));
+                                           binary_name_regex_.get(), etm_dump_option_, jobs_));
       } else if (data_type == "lbr") {
         reader.reset(
             new LBRPerfDataReader(std::move(file_reader), exclude_perf_, binary_name_regex_.get()));
@@ -1012,23 +1156,83 @@ class InjectCommand : public Command {
     if (!ReadPerfDataFiles(reader_callback)) {
       return false;
     }
-    return WriteBranchListFile(output_filename_, merger.GetETMData(), merger.GetLBRData());
+    return WriteBranchListFile(output_filename_, merger.GetETMData(), merger.GetLBRData(),
+                               output_format_ == OutputFormat::BranchListCompact);
+  }
+
+  // Read branch list files into [merger]. Input files are split into [jobs_] contiguous shards.
+  // Each thread merges a shard into its own BranchListMerger. Then the mergers are merged in
+  // parallel pairwise, keeping the order of input files.
+  bool ReadBranchListFiles(BranchListMerger& merger) {
+    auto start_time = std::chrono::steady_clock::now();
+    size_t file_count = input_filenames_.size();
+    size_t shard_count = std::max<size_t>(1, std::min<size_t>(jobs_, file_count));
+    std::vector<BranchListMerger> mergers(shard_count);
+    std::atomic<uint64_t> data_size = 0;
+    std::atomic<bool> failed = false;
+
+    auto read_shard = [&](size_t shard) {
+      BranchListMerger& shard_merger = mergers[shard];
+      auto etm_callback = [&](const BinaryKey& key, ETMBinary& binary) {
+        shard_merger.AddETMBinary(key, binary);
+      };
+      auto lbr_callback = [&](LBRData& lbr_data) { shard_merger.AddLBRData(lbr_data); };
+      size_t begin = file_count * shard / shard_count;
+      size_t end = file_count * (shard + 1) / shard_count;
+      for (size_t i = begin; i < end && !failed; ++i) {
+        BranchListReader reader(input_filenames_[i], binary_name_regex_.get());
+        reader.AddCallback(etm_callback);
+        reader.AddCallback(lbr_callback);
+        if (!reader.Read()) {
+          failed = true;
+          return;
+        }
+        data_size += reader.DataSize();
+      }
+    };
+    auto run_in_parallel = [](size_t count, const std::function<void(size_t)>& fn) {
+      std::vector<std::thread> threads;
+      for (size_t i = 1; i < count; ++i) {
+        threads.emplace_back(fn, i);
+      }
+      fn(0);
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    };
+
+    run_in_parallel(shard_count, read_shard);
+    if (failed) {
+      return false;
+    }
+    auto read_end_time = std::chrono::steady_clock::now();
+    for (size_t step = 1; step < shard_count; step *= 2) {
+      size_t pair_count = (shard_count + step - 1) / (2 * step);
+      run_in_parallel(pair_count, [&](size_t pair) {
+        size_t i = pair * 2 * step;
+        mergers[i].Merge(mergers[i + step]);
+      });
+    }
+    merger = std::move(mergers[0]);
+    auto end_time = std::chrono::steady_clock::now();
+
+    auto to_sec = [](auto duration) {
+      return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+    };
+    double read_sec = to_sec(read_end_time - start_time);
+    double total_sec = to_sec(end_time - start_time);
+    LOG(VERBOSE) << "read " << file_count << " branch list files (" << data_size << " bytes) with "
+                 << shard_count << " threads in " << read_sec << " s, merged in "
+                 << total_sec - read_sec << " s, "
+                 << (total_sec > 0 ? data_size / total_sec / 1024 / 1024 : 0) << " MB/s";
+    return true;
   }
 
   bool ConvertBranchListToAutoFDO() {
     // Step1 : Merge branch lists from all input files.
     BranchListMerger merger;
-    auto etm_callback = [&](const BinaryKey& key, ETMBinary& binary) {
-      merger.AddETMBinary(key, binary);
-    };
-    auto lbr_callback = [&](LBRData& lbr_data) { merger.AddLBRData(lbr_data); };
-    for (const auto& input_filename : input_filenames_) {
-      BranchListReader reader(input_filename, binary_name_regex_.get());
-      reader.AddCallback(etm_callback);
-      reader.AddCallback(lbr_callback);
-      if (!reader.Read()) {
-        return false;
-      }
+    if (!ReadBranchListFiles(merger)) {
+      return false;
     }
 
     // Step2: Convert ETMBinary and LBRData to AutoFDOBinaryInfo.
@@ -1062,25 +1266,18 @@ class InjectCommand : public Command {
   bool ConvertBranchListToBranchList() {
     // Step1 : Merge branch lists from all input files.
     BranchListMerger merger;
-    auto etm_callback = [&](const BinaryKey& key, ETMBinary& binary) {
-      merger.AddETMBinary(key, binary);
-    };
-    auto lbr_callback = [&](LBRData& lbr_data) { merger.AddLBRData(lbr_data); };
-    for (const auto& input_filename : input_filenames_) {
-      BranchListReader reader(input_filename, binary_name_regex_.get());
-      reader.AddCallback(etm_callback);
-      reader.AddCallback(lbr_callback);
-      if (!reader.Read()) {
-        return false;
-      }
+    if (!ReadBranchListFiles(merger)) {
+      return false;
     }
     // Step2: Write ETMBinary.
-    return WriteBranchListFile(output_filename_, merger.GetETMData(), merger.GetLBRData());
+    return WriteBranchListFile(output_filename_, merger.GetETMData(), merger.GetLBRData(),
+                               output_format_ == OutputFormat::BranchListCompact);
   }
 
   std::unique_ptr<RegEx> binary_name_regex_;
   bool exclude_perf_ = false;
   std::vector<std::string> input_filenames_;
+  size_t jobs_ = 1;
   std::string output_filename_ = "perf_inject.data";
   OutputFormat output_format_ = OutputFormat::AutoFDO;
   ETMDumpOption etm_dump_option_;
@@ -142,6 +142,51 @@ TEST(cmd_inject, unformatted_trace) {
   CheckMatchingExpectedData(data);
 }
 
+TEST(cmd_inject, compact_branch_list_output) {
+  TemporaryFile proto_file;
+  close(proto_file.release());
+  ASSERT_TRUE(RunInjectCmd({"--output", "branch-list", "-o", proto_file.path}));
+  TemporaryFile compact_file;
+  close(compact_file.release());
+  ASSERT_TRUE(RunInjectCmd({"--output", "branch-list-compact", "-o", compact_file.path}));
+  std::string proto_data;
+  std::string compact_data;
+  ASSERT_TRUE(android::base::ReadFileToString(proto_file.path, &proto_data));
+  ASSERT_TRUE(android::base::ReadFileToString(compact_file.path, &compact_data));
+  ASSERT_LT(compact_data.size(), proto_data.size());
+
+  // Convert compact branch list to autofdo.
+  std::string data;
+  ASSERT_TRUE(RunInjectCmd({"-i", compact_file.path}, &data));
+  CheckMatchingExpectedData(data);
+
+  // Merge files in both branch list formats.
+  TemporaryFile tmpfile;
+  close(tmpfile.release());
+  ASSERT_TRUE(RunInjectCmd({"-i", std::string(compact_file.path) + "," + proto_file.path,
+                            "--output", "branch-list-compact", "-o", tmpfile.path}));
+  ASSERT_TRUE(RunInjectCmd({"-i", tmpfile.path}, &data));
+  ASSERT_NE(data.find("etm_test_loop"), std::string::npos);
+}
+
+TEST(cmd_inject, decode_etm_data_in_parallel) {
+  std::string data;
+  ASSERT_TRUE(RunInjectCmd({"-j", "4"}, &data));
+  CheckMatchingExpectedData(data);
+
+  std::string perf_with_unformatted_trace =
+      GetTestData(std::string("etm") + OS_PATH_SEPARATOR + "perf_with_unformatted_trace.data");
+  ASSERT_TRUE(RunInjectCmd({"-i", perf_with_unformatted_trace, "-j", "2"}, &data));
+  CheckMatchingExpectedData(data);
+
+  // Test branch-list output.
+  TemporaryFile tmpfile;
+  close(tmpfile.release());
+  ASSERT_TRUE(RunInjectCmd({"-j", "4", "--output", "branch-list", "-o", tmpfile.path}));
+  ASSERT_TRUE(RunInjectCmd({"-i", tmpfile.path}, &data));
+  CheckMatchingExpectedData(data);
+}
+
 TEST(cmd_inject, multiple_input_files) {
   std::string data;
   std::string perf_data = GetTestData(PERF_DATA_ETM_TEST_LOOP);
@@ -176,6 +221,19 @@ TEST(cmd_inject, merge_branch_list_files) {
   std::string autofdo_data;
   ASSERT_TRUE(RunInjectCmd({"-i", tmpfile2.path, "--output", "autofdo"}, &autofdo_data));
   ASSERT_NE(autofdo_data.find("106c->1074:200"), std::string::npos);
+
+  // Merging branch list files with multiple threads gets the same result.
+  std::string input_files = tmpfile.path;
+  for (size_t i = 0; i < 4; i++) {
+    input_files += std::string(",") + tmpfile.path;
+  }
+  std::string expected_data;
+  ASSERT_TRUE(RunInjectCmd({"-i", input_files, "--output", "autofdo"}, &expected_data));
+  for (const char* jobs : {"2", "3", "8"}) {
+    ASSERT_TRUE(RunInjectCmd({"-i", input_files, "-j", jobs, "--output", "autofdo"}, &autofdo_data));
+    ASSERT_EQ(autofdo_data, expected_data);
+  }
+  ASSERT_FALSE(RunInjectCmd({"-i", input_files, "-j", "0"}));
 }
 
 TEST(cmd_inject, report_warning_when_overflow) {
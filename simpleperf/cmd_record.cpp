@@ -22,6 +22,7 @@
 #include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <filesystem>
 #include <optional>
 #include <set>
@@ -108,6 +109,13 @@ static constexpr size_t DESIRED_PAGES_IN_MAPPED_BUFFER = 1024;
 // Cache size used by CallChainJoiner to cache call chains in memory.
 static constexpr size_t DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE = 8 * kMegabyte;
 
+// The max number of samples waiting to be unwound together by ParallelUnwinder. Each of them can
+// hold up to 64K stack data.
+static constexpr size_t kMaxPendingSamplesForUnwinding = 256;
+// The max number of records (including samples without stack data) waiting to be written after
+// samples unwound by ParallelUnwinder.
+static constexpr size_t kMaxPendingRecordsForUnwinding = 4096;
+
 static constexpr size_t kDefaultAuxBufferSize = 4 * kMegabyte;
 
 // On Pixel 3, it takes about 1ms to enable ETM, and 16-40ms to disable ETM and copy 4M ETM data.
@@ -263,6 +271,17 @@ class RecordCommand : public Command {
 "--callchain-joiner-min-matching-nodes count\n"
 "               When callchain joiner is used, set the matched nodes needed to join\n"
 "               callchains. The count should be >= 1. By default it is 1.\n"
+"--callchain-joiner-cache-size size_in_bytes\n"
+"               When callchain joiner is used, set the memory used to cache callchains.\n"
+"               By default it is 8M.\n"
+"--callchain-joiner-jobs count\n"
+"               When callchain joiner is used, join callchains of different threads in\n"
+"               count threads. The cache memory is split evenly between them, so a\n"
+"               thread with many samples gets less cache. Default is 1.\n"
+"--unwind-jobs count\n"
+"               If `--call-graph dwarf` option is used, unwind samples in count threads,\n"
+"               both while recording and with --post-unwind. Samples are still written in\n"
+"               the order they are received. Default is 1.\n"
 "--no-cut-samples   Simpleperf uses a record buffer to cache records received from the kernel.\n"
 "                   When the available space in the buffer reaches low level, the stack data in\n"
 "                   samples is truncated to 1KB. When the available space reaches critical level,\n"
@@ -288,6 +307,12 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
 "                 This option is used to provide files with symbol table and\n"
 "                 debug information, which are used for unwinding and dumping symbols.\n"
 "--add-meta-info key=value     Add extra meta info, which will be stored in the recording file.\n"
+"--time-index                  Add a time index to the recording file. It allows reading\n"
+"                              records in a time range without reading the whole file, like\n"
+"                              when reporting with --filter-file.\n"
+"-z               Compress records in the data section with zlib on a background thread.\n"
+"                 It reduces the size of the recording file, like when recording with\n"
+"                 --call-graph dwarf. Can't be used with --time-index.\n"
 "\n"
 "ETM recording options:\n"
 "--addr-filter filter_str1,filter_str2,...\n"
@@ -313,6 +338,9 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
 "--decode-etm                     Convert ETM data into branch lists while recording.\n"
 "--binary binary_name             Used with --decode-etm to only generate data for binaries\n"
 "                                 matching binary_name regex.\n"
+"--compact-branch-list            Used with --decode-etm to store branch lists in compact\n"
+"                                 branch list format, which is smaller than the protobuf\n"
+"                                 format. It can be read by the inject command.\n"
 "--record-timestamp               Generate timestamp packets in ETM stream.\n"
 "--record-cycles                  Generate cycle count packets in ETM stream.\n"
 "\n"
@@ -353,6 +381,9 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
         exclude_kernel_callchain_(false),
         allow_callchain_joiner_(true),
         callchain_joiner_min_matching_nodes_(1u),
+        callchain_joiner_cache_size_(DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE),
+        callchain_joiner_jobs_(1u),
+        unwind_jobs_(1u),
         last_record_timestamp_(0u),
         record_filter_(thread_tree_) {
     // If we run `adb shell simpleperf record xxx` and stop profiling by ctrl-c, adb closes
@@ -390,17 +421,26 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
 
   // recording functions
   bool ProcessRecord(Record* record);
+  bool ProcessRecordInReadBatch(Record* record);
   bool ShouldOmitRecord(Record* record);
   bool DumpMapsForRecord(Record* record);
   bool SaveRecordForPostUnwinding(Record* record);
-  bool SaveRecordAfterUnwinding(Record* record);
+  bool SaveRecordAfterUnwinding(Record* record, std::unique_ptr<Record> owned_record = nullptr);
+  bool SaveSampleAfterUnwinding(SampleRecord& r);
+  bool ChangesPendingUnwindThreads(const Record& record);
+  bool CopyPendingRecordsInReadBatch();
+  bool UnwindPendingSamples();
   bool SaveRecordWithoutUnwinding(Record* record);
+  bool WriteRecord(const Record& record);
   bool ProcessJITDebugInfo(std::vector<JITDebugInfo> debug_info, bool sync_kernel_records);
   bool ProcessControlCmd(IOEventLoop* loop);
   void UpdateRecord(Record* record);
   bool UnwindRecord(SampleRecord& r);
+  bool NeedUnwindRecord(const SampleRecord& r);
+  bool FinishUnwindRecord(SampleRecord& r, const std::vector<uint64_t>& ips,
+                          const std::vector<uint64_t>& sps, const UnwindingResult& result);
   bool KeepFailedUnwindingResult(const SampleRecord& r, const std::vector<uint64_t>& ips,
-                                 const std::vector<uint64_t>& sps);
+                                 const std::vector<uint64_t>& sps, const UnwindingResult& result);
 
   // post recording functions
   std::unique_ptr<RecordFileReader> MoveRecordFile(const std::string& old_filename);
@@ -424,7 +464,27 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
   bool post_unwind_;
   bool keep_failed_unwinding_result_ = false;
   bool keep_failed_unwinding_debug_info_ = false;
+  bool time_index_ = false;
+  bool compress_records_ = false;
   std::unique_ptr<OfflineUnwinder> offline_unwinder_;
+  size_t unwind_jobs_;
+  std::unique_ptr<ParallelUnwinder> parallel_unwinder_;
+  // Samples waiting to be unwound by parallel_unwinder_, and other records received after them,
+  // in the order they were received. Other records are applied to thread_tree_ when received, and
+  // written after the samples before them. Samples are unwound before a record changing their
+  // threads or maps is applied, so they see the same maps as when unwound one by one.
+  struct PendingRecord {
+    Record* record;
+    bool in_read_batch;
+    std::unique_ptr<Record> owned_record;
+    // Index in unwind_tasks_, or -1 if the record doesn't need to unwind a stack.
+    ssize_t task_index;
+  };
+  std::vector<PendingRecord> pending_records_;
+  std::vector<ParallelUnwinder::Task> unwind_tasks_;
+  // Threads used by unwind_tasks_, as a map from tid to pid, and their pids.
+  std::unordered_map<int, int> pending_unwind_threads_;
+  std::unordered_set<int> pending_unwind_pids_;
   bool child_inherit_;
   uint64_t delay_in_ms_ = 0;
   double duration_in_sec_;
@@ -441,6 +501,9 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
   std::string record_filename_;
   android::base::unique_fd out_fd_;
   std::unique_ptr<RecordFileWriter> record_file_writer_;
+  // The record from the RecordBuffer being processed. Its data stays valid until the end of the
+  // read batch, so it can be written without copying.
+  const Record* record_in_read_batch_ = nullptr;
   android::base::unique_fd stop_signal_fd_;
 
   uint64_t sample_record_count_;
@@ -458,6 +521,8 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
   // For CallChainJoiner
   bool allow_callchain_joiner_;
   size_t callchain_joiner_min_matching_nodes_;
+  size_t callchain_joiner_cache_size_;
+  size_t callchain_joiner_jobs_;
   std::unique_ptr<CallChainJoiner> callchain_joiner_;
   bool allow_truncating_samples_ = true;
 
@@ -478,6 +543,7 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_RECORDING
   std::vector<std::string> add_counters_;
 
   std::unique_ptr<ETMBranchListGenerator> etm_branch_list_generator_;
+  bool compact_branch_list_ = false;
   std::unique_ptr<RegEx> binary_name_regex_;
 };
 
@@ -603,10 +669,14 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
   if (unwind_dwarf_callchain_) {
     bool collect_stat = keep_failed_unwinding_result_;
     offline_unwinder_ = OfflineUnwinder::Create(collect_stat);
+    if (unwind_jobs_ > 1) {
+      parallel_unwinder_.reset(new ParallelUnwinder(unwind_jobs_, collect_stat));
+    }
   }
   if (unwind_dwarf_callchain_ && allow_callchain_joiner_) {
-    callchain_joiner_.reset(new CallChainJoiner(DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE,
-                                                callchain_joiner_min_matching_nodes_, false));
+    callchain_joiner_.reset(new CallChainJoiner(callchain_joiner_cache_size_,
+                                                callchain_joiner_min_matching_nodes_, false,
+                                                callchain_joiner_jobs_));
   }
 
   // 4. Add monitored targets.
@@ -669,8 +739,12 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
                                            allow_truncating_samples_, exclude_perf_)) {
     return false;
   }
-  auto callback = std::bind(&RecordCommand::ProcessRecord, this, std::placeholders::_1);
-  if (!event_selection_set_.PrepareToReadMmapEventData(callback)) {
+  auto callback = std::bind(&RecordCommand::ProcessRecordInReadBatch, this, std::placeholders::_1);
+  auto batch_end_callback = [this]() {
+    // Records in the read batch are only valid until the end of the batch.
+    return CopyPendingRecordsInReadBatch() && record_file_writer_->FlushRecordBatch();
+  };
+  if (!event_selection_set_.PrepareToReadMmapEventData(callback, batch_end_callback)) {
     return false;
   }
 
@@ -837,7 +911,7 @@ static bool WriteRecordDataToOutFd(const std::string& in_filename,
 
 bool RecordCommand::PostProcessRecording(const std::vector<std::string>& args) {
   // 1. Read records left in the buffer.
-  if (!event_selection_set_.FinishReadMmapEventData()) {
+  if (!event_selection_set_.FinishReadMmapEventData() || !UnwindPendingSamples()) {
     return false;
   }
 
@@ -1018,6 +1092,16 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
                              &callchain_joiner_min_matching_nodes_, 1)) {
     return false;
   }
+  if (!options.PullUintValue("--callchain-joiner-cache-size", &callchain_joiner_cache_size_,
+                             1024)) {
+    return false;
+  }
+  if (!options.PullUintValue("--callchain-joiner-jobs", &callchain_joiner_jobs_, 1)) {
+    return false;
+  }
+  if (!options.PullUintValue("--unwind-jobs", &unwind_jobs_, 1)) {
+    return false;
+  }
 
   if (auto value = options.PullValue("--clockid"); value) {
     clockid_ = *value->str_value;
@@ -1040,6 +1124,11 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
   if (options.PullBoolValue("--decode-etm")) {
     etm_branch_list_generator_ = ETMBranchListGenerator::Create(system_wide_collection_);
   }
+  compact_branch_list_ = options.PullBoolValue("--compact-branch-list");
+  if (compact_branch_list_ && !etm_branch_list_generator_) {
+    LOG(ERROR) << "--compact-branch-list should be used with --decode-etm";
+    return false;
+  }
 
   if (options.PullBoolValue("--record-timestamp")) {
     ETMRecorder& recorder = ETMRecorder::GetInstance();
@@ -1182,6 +1271,12 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
     }
   }
 
+  time_index_ = options.PullBoolValue("--time-index");
+  compress_records_ = options.PullBoolValue("-z");
+  if (time_index_ && compress_records_) {
+    LOG(ERROR) << "-z can't be used with --time-index";
+    return false;
+  }
   trace_offcpu_ = options.PullBoolValue("--trace-offcpu");
 
   if (auto value = options.PullValue("--tracepoint-events"); value) {
@@ -1435,6 +1530,12 @@ std::unique_ptr<RecordFileWriter> RecordCommand::CreateRecordFile(const std::str
                                                                   const EventAttrIds& attrs) {
   std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(filename);
   if (writer != nullptr && writer->WriteAttrSection(attrs)) {
+    if (time_index_) {
+      writer->EnableTimeIndex();
+    }
+    if (compress_records_) {
+      writer->EnableCompression();
+    }
     return writer;
   }
   return nullptr;
@@ -1560,6 +1661,13 @@ bool RecordCommand::ProcessRecord(Record* record) {
   return SaveRecordWithoutUnwinding(record);
 }
 
+bool RecordCommand::ProcessRecordInReadBatch(Record* record) {
+  record_in_read_batch_ = record;
+  bool result = ProcessRecord(record);
+  record_in_read_batch_ = nullptr;
+  return result;
+}
+
 bool RecordCommand::DumpAuxTraceInfo() {
   if (event_selection_set_.HasAuxTrace()) {
     AuxTraceInfoRecord auxtrace_info = ETMRecorder::GetInstance().CreateAuxTraceInfoRecord();
@@ -1605,7 +1713,7 @@ bool RecordCommand::DumpMapsForRecord(Record* record) {
 }
 
 bool RecordCommand::SaveRecordForPostUnwinding(Record* record) {
-  if (!record_file_writer_->WriteRecord(*record)) {
+  if (!WriteRecord(*record)) {
     LOG(ERROR) << "If there isn't enough space for storing profiling data, consider using "
                << "--no-post-unwind option.";
     return false;
@@ -1613,26 +1721,190 @@ bool RecordCommand::SaveRecordForPostUnwinding(Record* record) {
   return true;
 }
 
-bool RecordCommand::SaveRecordAfterUnwinding(Record* record) {
+bool RecordCommand::SaveRecordAfterUnwinding(Record* record, std::unique_ptr<Record> owned_record) {
+  bool in_read_batch = record == record_in_read_batch_;
+  // The record data stays valid until the end of the read batch or as long as we own it, so
+  // unwinding can be delayed and done for many samples at once.
+  bool can_delay = parallel_unwinder_ && (in_read_batch || owned_record);
   if (record->type() == PERF_RECORD_SAMPLE) {
     auto& r = *static_cast<SampleRecord*>(record);
     // AdjustCallChainGeneratedByKernel() should go before UnwindRecord(). Because we don't want
     // to adjust callchains generated by dwarf unwinder.
     r.AdjustCallChainGeneratedByKernel();
-    if (!UnwindRecord(r)) {
+    if (can_delay) {
+      ssize_t task_index = -1;
+      if (NeedUnwindRecord(r) && r.GetValidStackSize() > 0) {
+        int pid = r.tid_data.pid;
+        int tid = r.tid_data.tid;
+        // Finding a thread with a reused tid removes the old thread, which may be used by a task.
+        for (int id : {tid, pid}) {
+          if (auto it = pending_unwind_threads_.find(id);
+              it != pending_unwind_threads_.end() && it->second != pid) {
+            if (!UnwindPendingSamples()) {
+              return false;
+            }
+            break;
+          }
+        }
+        ThreadEntry* thread = thread_tree_.FindThreadOrNew(pid, tid);
+        RegSet regs(r.regs_user_data.abi, r.regs_user_data.reg_mask, r.regs_user_data.regs);
+        task_index = unwind_tasks_.size();
+        unwind_tasks_.emplace_back(thread, regs, r.stack_user_data.data, r.GetValidStackSize());
+        pending_unwind_threads_[tid] = pid;
+        pending_unwind_pids_.insert(pid);
+      }
+      pending_records_.push_back({&r, in_read_batch, std::move(owned_record), task_index});
+      if (unwind_tasks_.size() >= kMaxPendingSamplesForUnwinding ||
+          pending_records_.size() >= kMaxPendingRecordsForUnwinding) {
+        return UnwindPendingSamples();
+      }
+      return true;
+    }
+    if (!UnwindPendingSamples() || !UnwindRecord(r)) {
       return false;
     }
-    // ExcludeKernelCallChain() should go after UnwindRecord() to notice the generated user call
-    // chain.
-    if (r.InKernel() && exclude_kernel_callchain_ && !r.ExcludeKernelCallChain()) {
-      // If current record contains no user callchain, skip it.
-      return true;
+    return SaveSampleAfterUnwinding(r);
+  }
+  // Aux data isn't in the record binary, so auxtrace records can't be copied at the end of a read
+  // batch.
+  if (pending_records_.empty() || !can_delay || record->type() == PERF_RECORD_AUXTRACE ||
+      ChangesPendingUnwindThreads(*record)) {
+    if (!UnwindPendingSamples()) {
+      return false;
     }
-    sample_record_count_++;
-  } else {
     thread_tree_.Update(*record);
+    return WriteRecord(*record);
+  }
+  thread_tree_.Update(*record);
+  pending_records_.push_back({record, in_read_batch, std::move(owned_record), -1});
+  if (pending_records_.size() >= kMaxPendingRecordsForUnwinding) {
+    return UnwindPendingSamples();
+  }
+  return true;
+}
+
+bool RecordCommand::SaveSampleAfterUnwinding(SampleRecord& r) {
+  // ExcludeKernelCallChain() should go after UnwindRecord() to notice the generated user call
+  // chain.
+  if (r.InKernel() && exclude_kernel_callchain_ && !r.ExcludeKernelCallChain()) {
+    // If current record contains no user callchain, skip it.
+    return true;
+  }
+  sample_record_count_++;
+  return WriteRecord(r);
+}
+
+// Returns true if applying the record to thread_tree_ may change or remove threads or maps used
+// by unwind_tasks_.
+bool RecordCommand::ChangesPendingUnwindThreads(const Record& record) {
+  auto uses_thread = [this](int pid, int tid) {
+    // A thread with a reused tid or pid replaces the old thread in thread_tree_.
+    return pending_unwind_pids_.count(pid) != 0 || pending_unwind_threads_.count(tid) != 0 ||
+           pending_unwind_threads_.count(pid) != 0;
+  };
+  switch (record.type()) {
+    case PERF_RECORD_MMAP: {
+      auto& r = static_cast<const MmapRecord&>(record);
+      return !r.InKernel() && uses_thread(r.data->pid, r.data->tid);
+    }
+    case PERF_RECORD_MMAP2: {
+      auto& r = static_cast<const Mmap2Record&>(record);
+      return !r.InKernel() && uses_thread(r.data->pid, r.data->tid);
+    }
+    case PERF_RECORD_COMM: {
+      auto& r = static_cast<const CommRecord&>(record);
+      return uses_thread(r.data->pid, r.data->tid);
+    }
+    case PERF_RECORD_FORK: {
+      auto& r = static_cast<const ForkRecord&>(record);
+      return uses_thread(r.data->pid, r.data->tid) || uses_thread(r.data->ppid, r.data->ptid);
+    }
+    case PERF_RECORD_EXIT: {
+      auto& r = static_cast<const ExitRecord&>(record);
+      return uses_thread(r.data->pid, r.data->tid);
+    }
   }
-  return record_file_writer_->WriteRecord(*record);
+  return false;
+}
+
+// Pending records in the read batch are released at the end of the batch. Instead of unwinding
+// them now, copy them, so unwinding can go on with samples in the next batches.
+bool RecordCommand::CopyPendingRecordsInReadBatch() {
+  for (auto& pending : pending_records_) {
+    if (!pending.in_read_batch) {
+      continue;
+    }
+    const Record& r = *pending.record;
+    std::unique_ptr<char[]> binary(new char[r.size()]);
+    memcpy(binary.get(), r.Binary(), r.size());
+    // Records in the RecordBuffer are parsed with the first perf_event_attr.
+    pending.owned_record = ReadRecordFromBuffer(dumping_attr_id_.attr, r.type(), binary.get(),
+                                                binary.get() + r.size());
+    if (!pending.owned_record) {
+      return false;
+    }
+    binary.release();
+    pending.owned_record->OwnBinary();
+    pending.record = pending.owned_record.get();
+    pending.in_read_batch = false;
+    if (pending.task_index != -1) {
+      auto& sample = *static_cast<SampleRecord*>(pending.record);
+      unwind_tasks_[pending.task_index].stack = sample.stack_user_data.data;
+    }
+  }
+  return true;
+}
+
+bool RecordCommand::UnwindPendingSamples() {
+  if (pending_records_.empty()) {
+    return true;
+  }
+  // Take the pending records first, because writing them may add new records.
+  std::vector<PendingRecord> records = std::move(pending_records_);
+  std::vector<ParallelUnwinder::Task> tasks = std::move(unwind_tasks_);
+  pending_records_.clear();
+  unwind_tasks_.clear();
+  pending_unwind_threads_.clear();
+  pending_unwind_pids_.clear();
+  parallel_unwinder_->UnwindCallChains(tasks);
+
+  const Record* saved_record_in_read_batch = record_in_read_batch_;
+  bool maps_may_change = false;
+  bool result = true;
+  for (auto& pending : records) {
+    if (pending.record->type() != PERF_RECORD_SAMPLE) {
+      // It has been applied to thread_tree_ when received.
+      record_in_read_batch_ = pending.in_read_batch ? pending.record : nullptr;
+      result = WriteRecord(*pending.record);
+    } else {
+      SampleRecord& r = *static_cast<SampleRecord*>(pending.record);
+      if (pending.task_index == -1) {
+        result = UnwindRecord(r);
+      } else {
+        auto& task = tasks[pending.task_index];
+        // Retrying unwinding for incomplete JIT debug info adds map records, which samples after
+        // it should see. So unwind them again.
+        if (jit_debug_reader_ && !post_unwind_ &&
+            task.is_callchain_broken_for_incomplete_jit_debug_info) {
+          maps_may_change = true;
+        }
+        if (maps_may_change) {
+          result = UnwindRecord(r);
+        } else {
+          result = task.result && FinishUnwindRecord(r, task.ips, task.sps, task.unwinding_result);
+        }
+      }
+      if (result) {
+        record_in_read_batch_ = pending.in_read_batch ? &r : nullptr;
+        result = SaveSampleAfterUnwinding(r);
+      }
+    }
+    if (!result) {
+      break;
+    }
+  }
+  record_in_read_batch_ = saved_record_in_read_batch;
+  return result;
 }
 
 bool RecordCommand::SaveRecordWithoutUnwinding(Record* record) {
@@ -1647,7 +1919,14 @@ bool RecordCommand::SaveRecordWithoutUnwinding(Record* record) {
     }
     sample_record_count_++;
   }
-  return record_file_writer_->WriteRecord(*record);
+  return WriteRecord(*record);
+}
+
+bool RecordCommand::WriteRecord(const Record& record) {
+  if (&record == record_in_read_batch_) {
+    return record_file_writer_->AddRecordToBatch(record);
+  }
+  return record_file_writer_->WriteRecord(record);
 }
 
 bool RecordCommand::ProcessJITDebugInfo(std::vector<JITDebugInfo> debug_info,
@@ -1778,9 +2057,13 @@ void RecordCommand::UpdateRecord(Record* record) {
   }
 }
 
+bool RecordCommand::NeedUnwindRecord(const SampleRecord& r) {
+  return (r.sample_type & PERF_SAMPLE_CALLCHAIN) || !(r.sample_type & PERF_SAMPLE_REGS_USER) ||
+         (r.regs_user_data.reg_mask == 0) || !(r.sample_type & PERF_SAMPLE_STACK_USER);
+}
+
 bool RecordCommand::UnwindRecord(SampleRecord& r) {
-  if (!(r.sample_type & PERF_SAMPLE_CALLCHAIN) && (r.sample_type & PERF_SAMPLE_REGS_USER) &&
-      (r.regs_user_data.reg_mask != 0) && (r.sample_type & PERF_SAMPLE_STACK_USER)) {
+  if (!NeedUnwindRecord(r)) {
     return true;
   }
   if (r.GetValidStackSize() > 0) {
@@ -1803,26 +2086,32 @@ bool RecordCommand::UnwindRecord(SampleRecord& r) {
         return false;
       }
     }
-    if (keep_failed_unwinding_result_ && !KeepFailedUnwindingResult(r, ips, sps)) {
-      return false;
-    }
-    r.ReplaceRegAndStackWithCallChain(ips);
-    if (callchain_joiner_ &&
-        !callchain_joiner_->AddCallChain(r.tid_data.pid, r.tid_data.tid,
-                                         CallChainJoiner::ORIGINAL_OFFLINE, ips, sps)) {
-      return false;
-    }
-  } else {
-    // For kernel samples, we still need to remove user stack and register fields.
-    r.ReplaceRegAndStackWithCallChain({});
+    return FinishUnwindRecord(r, ips, sps, offline_unwinder_->GetUnwindingResult());
+  }
+  // For kernel samples, we still need to remove user stack and register fields.
+  r.ReplaceRegAndStackWithCallChain({});
+  return true;
+}
+
+bool RecordCommand::FinishUnwindRecord(SampleRecord& r, const std::vector<uint64_t>& ips,
+                                       const std::vector<uint64_t>& sps,
+                                       const UnwindingResult& result) {
+  if (keep_failed_unwinding_result_ && !KeepFailedUnwindingResult(r, ips, sps, result)) {
+    return false;
+  }
+  r.ReplaceRegAndStackWithCallChain(ips);
+  if (callchain_joiner_ &&
+      !callchain_joiner_->AddCallChain(r.tid_data.pid, r.tid_data.tid,
+                                       CallChainJoiner::ORIGINAL_OFFLINE, ips, sps)) {
+    return false;
   }
   return true;
 }
 
 bool RecordCommand::KeepFailedUnwindingResult(const SampleRecord& r,
                                               const std::vector<uint64_t>& ips,
-                                              const std::vector<uint64_t>& sps) {
-  auto& result = offline_unwinder_->GetUnwindingResult();
+                                              const std::vector<uint64_t>& sps,
+                                              const UnwindingResult& result) {
   if (result.error_code != unwindstack::ERROR_NONE) {
     if (keep_failed_unwinding_debug_info_) {
       return record_file_writer_->WriteRecord(UnwindingResultRecord(
@@ -1917,9 +2206,10 @@ bool RecordCommand::PostUnwindRecords() {
 
   sample_record_count_ = 0;
   auto callback = [this](std::unique_ptr<Record> record) {
-    return SaveRecordAfterUnwinding(record.get());
+    Record* r = record.get();
+    return SaveRecordAfterUnwinding(r, std::move(record));
   };
-  return reader->ReadDataSection(callback);
+  return reader->ReadDataSection(callback) && UnwindPendingSamples();
 }
 
 bool RecordCommand::JoinCallChains() {
@@ -2214,10 +2504,16 @@ void RecordCommand::CollectHitFileInfo(const SampleRecord& r, std::unordered_set
 }
 
 bool RecordCommand::DumpETMBranchListFeature() {
-  ETMBinaryMap binary_map = etm_branch_list_generator_->GetETMBinaryMap();
   std::string s;
-  if (!ETMBinaryMapToString(binary_map, s)) {
-    return false;
+  if (compact_branch_list_) {
+    if (!etm_branch_list_generator_->WriteCompactBranchList(s)) {
+      return false;
+    }
+  } else {
+    ETMBinaryMap binary_map = etm_branch_list_generator_->GetETMBinaryMap();
+    if (!ETMBinaryMapToString(binary_map, s)) {
+      return false;
+    }
   }
   return record_file_writer_->WriteFeature(PerfFileFormat::FEAT_ETM_BRANCH_LIST, s.data(),
                                            s.size());
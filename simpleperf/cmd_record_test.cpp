@@ -294,6 +294,32 @@ TEST(record_cmd, post_unwind_option) {
   ASSERT_TRUE(RunRecordCmd({"-p", pid, "--call-graph", "dwarf", "--post-unwind=no"}));
 }
 
+TEST(record_cmd, unwind_jobs_option) {
+  OMIT_TEST_ON_NON_NATIVE_ABIS();
+  ASSERT_TRUE(IsDwarfCallChainSamplingSupported());
+  std::vector<std::unique_ptr<Workload>> workloads;
+  CreateProcesses(1, &workloads);
+  std::string pid = std::to_string(workloads[0]->GetPid());
+  ASSERT_TRUE(RunRecordCmd({"-p", pid, "--call-graph", "dwarf", "--unwind-jobs", "1"}));
+  TemporaryFile tmpfile;
+  ASSERT_TRUE(RunRecordCmd({"-p", pid, "--call-graph", "dwarf", "--unwind-jobs", "4"},
+                           tmpfile.path));
+  auto reader = RecordFileReader::CreateInstance(tmpfile.path);
+  ASSERT_TRUE(reader);
+  // Check that reg and stack fields are removed after unwinding in parallel.
+  for (const auto& attr : reader->AttrSection()) {
+    ASSERT_EQ(attr.attr.sample_type & (PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER), 0);
+  }
+  ASSERT_TRUE(RunRecordCmd(
+      {"-p", pid, "--call-graph", "dwarf", "--post-unwind=yes", "--unwind-jobs", "4"}));
+  ASSERT_FALSE(RunRecordCmd({"-p", pid, "--call-graph", "dwarf", "--unwind-jobs", "0"}));
+  // Records of another process are written after pending samples, without unwinding them first.
+  std::vector<std::unique_ptr<Workload>> other_workloads;
+  CreateProcesses(1, &other_workloads);
+  std::string pids = pid + "," + std::to_string(other_workloads[0]->GetPid());
+  ASSERT_TRUE(RunRecordCmd({"-p", pids, "--call-graph", "dwarf", "--unwind-jobs", "4"}));
+}
+
 TEST(record_cmd, existing_processes) {
   std::vector<std::unique_ptr<Workload>> workloads;
   CreateProcesses(2, &workloads);
@@ -1085,6 +1111,8 @@ TEST(record_cmd, decode_etm_option) {
   }
   ASSERT_TRUE(RunRecordCmd({"-e", "cs-etm", "--decode-etm"}));
   ASSERT_TRUE(RunRecordCmd({"-e", "cs-etm", "--decode-etm", "--exclude-perf"}));
+  ASSERT_TRUE(RunRecordCmd({"-e", "cs-etm", "--decode-etm", "--compact-branch-list"}));
+  ASSERT_FALSE(RunRecordCmd({"-e", "cs-etm", "--compact-branch-list"}));
 }
 
 TEST(record_cmd, record_timestamp) {
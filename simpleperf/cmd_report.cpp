@@ -420,12 +420,20 @@ class ReportCommand : public Command {
 "                      Default is caller mode.\n"
 "-i <file>  Specify path of record file, default is perf.data.\n"
 "--kallsyms <file>     Set the file to read kernel symbols.\n"
+"--load-symbols-jobs <count>\n"
+"                      Load symbols of shared libraries in the record file in <count>\n"
+"                      threads before reporting. By default, symbols are loaded lazily\n"
+"                      one shared library at a time.\n"
 "--max-stack <frames>  Set max stack frames shown when printing call graph.\n"
 "-n         Print the sample count for each item.\n"
 "--no-demangle         Don't demangle symbol names.\n"
 "--no-show-ip          Don't show vaddr in file for unknown symbols.\n"
 "-o report_file_name   Set report file name, default is stdout.\n"
 "--percent-limit <percent>  Set min percentage in report entries and call graphs.\n"
+"--pipeline            Read and parse records in a separate thread, overlapping with building\n"
+"                      the report. Thread updates, symbolization and building the report still\n"
+"                      run on one thread, so at most two cores are used. It can be slower on\n"
+"                      single-core hosts. Not used with --trace-offcpu.\n"
 "--print-event-count   Print event counts for each item. Additional events can be added by\n"
 "                      --add-counter in record cmd.\n"
 "--raw-period          Report period count instead of period percentage.\n"
@@ -448,6 +456,9 @@ class ReportCommand : public Command {
 "                        symbol_to       -- name of function branched to\n"
 "                      The default sort keys are:\n"
 "                        comm,pid,tid,dso,symbol\n"
+"--symbol-cache-dir <dir>\n"
+"                      Cache symbols read from elf files in <dir>, keyed by build id.\n"
+"                      Later reports using the same <dir> load cached symbols directly.\n"
 "--symfs <dir>         Look for files with symbols relative to this directory.\n"
 "--vmlinux <file>      Parse kernel symbols from <file>.\n"
 "\n"
@@ -483,7 +494,8 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_REPORTING
   bool ReadEventAttrFromRecordFile();
   bool ReadFeaturesFromRecordFile();
   bool ReadSampleTreeFromRecordFile();
-  bool ProcessRecord(std::unique_ptr<Record> record);
+  bool ProcessRecord(const Record& record, size_t attr_id);
+  bool ProcessRecordInTraceOffCpuMode(std::unique_ptr<Record> record, size_t attr_id);
   void ProcessSampleRecordInTraceOffCpuMode(std::unique_ptr<Record> record, size_t attr_id);
   bool ProcessTracingData(const std::vector<char>& data);
   bool PrintReport();
@@ -517,6 +529,8 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_REPORTING
   std::string csv_separator_ = ",";
   bool print_sample_count_ = false;
   bool print_event_count_ = false;
+  bool pipeline_ = false;
+  size_t load_symbols_jobs_ = 0;
   std::vector<std::string> sort_keys_;
   std::string report_filename_;
   RecordFilter record_filter_;
@@ -572,17 +586,20 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       {"-g", {OptionValueType::OPT_STRING, OptionType::SINGLE}},
       {"-i", {OptionValueType::STRING, OptionType::SINGLE}},
       {"--kallsyms", {OptionValueType::STRING, OptionType::SINGLE}},
+      {"--load-symbols-jobs", {OptionValueType::UINT, OptionType::SINGLE}},
       {"--max-stack", {OptionValueType::UINT, OptionType::SINGLE}},
       {"-n", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--no-demangle", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--no-show-ip", {OptionValueType::NONE, OptionType::SINGLE}},
       {"-o", {OptionValueType::STRING, OptionType::SINGLE}},
       {"--percent-limit", {OptionValueType::DOUBLE, OptionType::SINGLE}},
+      {"--pipeline", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--pids", {OptionValueType::STRING, OptionType::MULTIPLE}},
       {"--print-event-count", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--tids", {OptionValueType::STRING, OptionType::MULTIPLE}},
       {"--raw-period", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--sort", {OptionValueType::STRING, OptionType::SINGLE}},
+      {"--symbol-cache-dir", {OptionValueType::STRING, OptionType::SINGLE}},
       {"--symbols", {OptionValueType::STRING, OptionType::MULTIPLE}},
       {"--symfs", {OptionValueType::STRING, OptionType::SINGLE}},
       {"--vmlinux", {OptionValueType::STRING, OptionType::SINGLE}},
@@ -644,6 +661,9 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     }
     Dso::SetKallsyms(kallsyms);
   }
+  if (!options.PullUintValue("--load-symbols-jobs", &load_symbols_jobs_, 1)) {
+    return false;
+  }
   if (!options.PullUintValue("--max-stack", &callgraph_max_stack_)) {
     return false;
   }
@@ -660,6 +680,7 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     return false;
   }
 
+  pipeline_ = options.PullBoolValue("--pipeline");
   if (auto strs = options.PullStringValues("--pids"); !strs.empty()) {
     if (auto pids = GetPidsFromStrings(strs, false, false); pids) {
       record_filter_.AddPids(pids.value(), false);
@@ -687,6 +708,11 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     sample_tree_builder_options_.symbol_filter.insert(symbols.begin(), symbols.end());
   }
 
+  if (auto value = options.PullValue("--symbol-cache-dir"); value) {
+    if (!Dso::SetSymbolCacheDir(*value->str_value)) {
+      return false;
+    }
+  }
   if (auto value = options.PullValue("--symfs"); value) {
     if (!Dso::SetSymFsDir(*value->str_value)) {
       return false;
@@ -895,6 +921,9 @@ bool ReportCommand::ReadFeaturesFromRecordFile() {
   if (!record_file_reader_->LoadBuildIdAndFileFeatures(thread_tree_)) {
     return false;
   }
+  if (load_symbols_jobs_ > 0) {
+    Dso::LoadSymbolsInParallel(thread_tree_.GetAllDsos(), load_symbols_jobs_);
+  }
 
   std::string arch = record_file_reader_->ReadFeatureString(PerfFileFormat::FEAT_ARCH);
   if (!arch.empty()) {
@@ -938,10 +967,37 @@ bool ReportCommand::ReadSampleTreeFromRecordFile() {
     }
   }
 
-  if (!record_file_reader_->ReadDataSection(
-          [this](std::unique_ptr<Record> record) { return ProcessRecord(std::move(record)); })) {
+  bool result;
+  std::optional<std::pair<uint64_t, uint64_t>> time_range = record_filter_.GetTimeRange();
+  if (time_range && record_file_reader_->HasFeature(PerfFileFormat::FEAT_TIME_INDEX)) {
+    // Samples out of the time range are filtered out anyway, so only read blocks overlapping it.
+    auto callback = [this](std::unique_ptr<Record> record) {
+      size_t attr_id = record_file_reader_->GetAttrIndexOfRecord(record.get());
+      if (trace_offcpu_) {
+        return ProcessRecordInTraceOffCpuMode(std::move(record), attr_id);
+      }
+      return ProcessRecord(*record, attr_id);
+    };
+    result = record_file_reader_->ReadDataSectionInTimeRange(time_range->first, time_range->second,
+                                                             callback, callback);
+  } else if (trace_offcpu_) {
+    // Samples are kept by sample tree builders in trace offcpu mode, so they can't be borrowed.
+    result = record_file_reader_->ReadDataSection([this](std::unique_ptr<Record> record) {
+      size_t attr_id = record_file_reader_->GetAttrIndexOfRecord(record.get());
+      return ProcessRecordInTraceOffCpuMode(std::move(record), attr_id);
+    });
+  } else if (pipeline_) {
+    result = record_file_reader_->ReadDataSectionInBackground(
+        [this](const Record& record, size_t attr_id) { return ProcessRecord(record, attr_id); });
+  } else {
+    result = record_file_reader_->ReadDataSectionInPlace([this](const Record& record) {
+      return ProcessRecord(record, record_file_reader_->GetAttrIndexOfRecord(&record));
+    });
+  }
+  if (!result) {
     return false;
   }
+  LOG(DEBUG) << "ip cache: " << thread_tree_.IpCacheStatToString();
   for (size_t i = 0; i < sample_tree_builder_.size(); ++i) {
     sample_tree_.push_back(sample_tree_builder_[i]->GetSampleTree());
     sample_tree_sorter_->Sort(sample_tree_.back().samples, print_callgraph_);
@@ -949,22 +1005,17 @@ bool ReportCommand::ReadSampleTreeFromRecordFile() {
   return true;
 }
 
-bool ReportCommand::ProcessRecord(std::unique_ptr<Record> record) {
-  thread_tree_.Update(*record);
-  if (record->type() == PERF_RECORD_SAMPLE) {
-    if (!record_filter_.Check(static_cast<SampleRecord&>(*record))) {
+bool ReportCommand::ProcessRecord(const Record& record, size_t attr_id) {
+  thread_tree_.Update(record);
+  if (record.type() == PERF_RECORD_SAMPLE) {
+    const auto& r = static_cast<const SampleRecord&>(record);
+    if (!record_filter_.Check(r)) {
       return true;
     }
-    size_t attr_id = record_file_reader_->GetAttrIndexOfRecord(record.get());
-    if (!trace_offcpu_) {
-      sample_tree_builder_[attr_id]->ReportCmdProcessSampleRecord(
-          *static_cast<SampleRecord*>(record.get()));
-    } else {
-      ProcessSampleRecordInTraceOffCpuMode(std::move(record), attr_id);
-    }
-  } else if (record->type() == PERF_RECORD_TRACING_DATA ||
-             record->type() == SIMPLE_PERF_RECORD_TRACING_DATA) {
-    const auto& r = *static_cast<TracingDataRecord*>(record.get());
+    sample_tree_builder_[attr_id]->ReportCmdProcessSampleRecord(r);
+  } else if (record.type() == PERF_RECORD_TRACING_DATA ||
+             record.type() == SIMPLE_PERF_RECORD_TRACING_DATA) {
+    const auto& r = static_cast<const TracingDataRecord&>(record);
     if (!ProcessTracingData(std::vector<char>(r.data, r.data + r.data_size))) {
       return false;
     }
@@ -972,6 +1023,19 @@ bool ReportCommand::ProcessRecord(std::unique_ptr<Record> record) {
   return true;
 }
 
+bool ReportCommand::ProcessRecordInTraceOffCpuMode(std::unique_ptr<Record> record,
+                                                   size_t attr_id) {
+  if (record->type() != PERF_RECORD_SAMPLE) {
+    return ProcessRecord(*record, attr_id);
+  }
+  thread_tree_.Update(*record);
+  if (!record_filter_.Check(static_cast<SampleRecord&>(*record))) {
+    return true;
+  }
+  ProcessSampleRecordInTraceOffCpuMode(std::move(record), attr_id);
+  return true;
+}
+
 void ReportCommand::ProcessSampleRecordInTraceOffCpuMode(std::unique_ptr<Record> record,
                                                          size_t attr_id) {
   std::shared_ptr<SampleRecord> r(static_cast<SampleRecord*>(record.release()));
@@ -163,9 +163,18 @@ class ReportSampleCommand : public Command {
 "--dump-protobuf-report <file>      Dump report file generated by\n"
 "                                   `simpleperf report-sample --protobuf -o <file>`.\n"
 "-i <file>                          Specify path of record file, default is perf.data.\n"
+"--intern-callchains                Used with --protobuf. Write each distinct frame and call\n"
+"                                   stack once, and refer to the call stack by id in samples.\n"
+"                                   It reduces the report size when callchains repeat.\n"
+"--load-symbols-jobs <count>        Load symbols of shared libraries in the record file in\n"
+"                                   <count> threads before reporting. By default, symbols are\n"
+"                                   loaded lazily one shared library at a time.\n"
 "-o report_file_name                Set report file name. When --protobuf is used, default is\n"
 "                                   report_sample.trace. Otherwise, default writes to stdout.\n"
 "--proguard-mapping-file <file>     Add proguard mapping file to de-obfuscate symbols.\n"
+"--proguard-mapping-index           Save an index of classes in proguard mapping files next to\n"
+"                                   them, as <file>.simpleperf_index. Later runs read the index\n"
+"                                   instead of scanning the mapping files.\n"
 "--protobuf                         Use protobuf format in cmd_report_sample.proto to output\n"
 "                                   samples.\n"
 "--remove-gaps MAX_GAP_LENGTH       Ideally all callstacks are complete. But some may be broken\n"
@@ -178,6 +187,9 @@ class ReportSampleCommand : public Command {
 "--show-art-frames                  Show frames of internal methods in the ART Java interpreter.\n"
 "--show-callchain                   Show callchain with samples.\n"
 "--show-execution-type              Show execution type of a method\n"
+"--symbol-cache-dir <dir>           Cache symbols read from elf files in <dir>, keyed by build\n"
+"                                   id. Later runs using the same <dir> load cached symbols\n"
+"                                   directly.\n"
 "--symdir <dir>                     Look for files with symbols in a directory recursively.\n"
 "\n"
 "Sample filter options:\n"
@@ -211,6 +223,9 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_REPORTING
   bool ReportSample(const ThreadId& thread_id, const SampleEntry& sample, size_t stack_gap_length);
   bool FinishReportSamples();
   bool PrintSampleInProtobuf(const ThreadId& thread_id, const SampleEntry& sample);
+  void AddCallChainEntryInProtobuf(const CallChainReportEntry& node,
+                                   proto::Sample_CallChainEntry* callchain);
+  bool PrintCallStacksInProtobuf();
   void AddUnwindingResultInProtobuf(const UnwindingResult& unwinding_result,
                                     proto::Sample_UnwindingResult* proto_unwinding_result);
   bool ProcessSwitchRecord(Record* r);
@@ -242,6 +257,12 @@ RECORD_FILTER_OPTION_HELP_MSG_FOR_REPORTING
   std::unique_ptr<UnwindingResultRecord> last_unwinding_result_;
   RecordFilter record_filter_;
   uint32_t max_remove_gap_length_ = 3;
+  size_t load_symbols_jobs_ = 0;
+  bool intern_callchains_ = false;
+  CallChainInterner callchain_interner_;
+  // Count of frames and call stack nodes in callchain_interner_ already written.
+  size_t written_frame_count_ = 0;
+  size_t written_callstack_node_count_ = 0;
 };
 
 bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
@@ -298,8 +319,25 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
   if (!PrintMetaInfo()) {
     return false;
   }
-  if (!record_file_reader_->ReadDataSection(
-          [this](std::unique_ptr<Record> record) { return ProcessRecord(std::move(record)); })) {
+  auto callback = [this](std::unique_ptr<Record> record) {
+    return ProcessRecord(std::move(record));
+  };
+  std::optional<std::pair<uint64_t, uint64_t>> time_range = record_filter_.GetTimeRange();
+  if (time_range && record_file_reader_->HasFeature(PerfFileFormat::FEAT_TIME_INDEX)) {
+    // Samples out of the time range are filtered out anyway, so only read blocks overlapping it.
+    // Records before them only rebuild thread state and lost count.
+    auto state_callback = [this](std::unique_ptr<Record> record) {
+      thread_tree_.Update(*record);
+      if (record->type() == PERF_RECORD_LOST) {
+        lost_count_ += static_cast<const LostRecord*>(record.get())->lost;
+      }
+      return true;
+    };
+    if (!record_file_reader_->ReadDataSectionInTimeRange(time_range->first, time_range->second,
+                                                         state_callback, callback)) {
+      return false;
+    }
+  } else if (!record_file_reader_->ReadDataSection(callback)) {
     return false;
   }
 
@@ -338,14 +376,18 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
   OptionFormatMap option_formats = {
       {"--dump-protobuf-report", {OptionValueType::STRING, OptionType::SINGLE}},
       {"-i", {OptionValueType::STRING, OptionType::SINGLE}},
+      {"--intern-callchains", {OptionValueType::NONE, OptionType::SINGLE}},
+      {"--load-symbols-jobs", {OptionValueType::UINT, OptionType::SINGLE}},
       {"-o", {OptionValueType::STRING, OptionType::SINGLE}},
       {"--proguard-mapping-file", {OptionValueType::STRING, OptionType::MULTIPLE}},
+      {"--proguard-mapping-index", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--protobuf", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--show-callchain", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--remove-gaps", {OptionValueType::UINT, OptionType::SINGLE}},
       {"--remove-unknown-kernel-symbols", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--show-art-frames", {OptionValueType::NONE, OptionType::SINGLE}},
       {"--show-execution-type", {OptionValueType::NONE, OptionType::SINGLE}},
+      {"--symbol-cache-dir", {OptionValueType::STRING, OptionType::SINGLE}},
       {"--symdir", {OptionValueType::STRING, OptionType::MULTIPLE}},
   };
   OptionFormatMap record_filter_options = GetRecordFilterOptionFormats(false);
@@ -357,9 +399,15 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
   }
   options.PullStringValue("--dump-protobuf-report", &dump_protobuf_report_file_);
   options.PullStringValue("-i", &record_filename_);
+  intern_callchains_ = options.PullBoolValue("--intern-callchains");
+  if (!options.PullUintValue("--load-symbols-jobs", &load_symbols_jobs_, 1)) {
+    return false;
+  }
   options.PullStringValue("-o", &report_filename_);
+  bool use_proguard_mapping_index = options.PullBoolValue("--proguard-mapping-index");
   for (const OptionValue& value : options.PullValues("--proguard-mapping-file")) {
-    if (!callchain_report_builder_.AddProguardMappingFile(*value.str_value)) {
+    if (!callchain_report_builder_.AddProguardMappingFile(*value.str_value,
+                                                          use_proguard_mapping_index)) {
       return false;
     }
   }
@@ -373,6 +421,11 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
     callchain_report_builder_.SetRemoveArtFrame(false);
   }
   show_execution_type_ = options.PullBoolValue("--show-execution-type");
+  if (auto value = options.PullValue("--symbol-cache-dir"); value) {
+    if (!Dso::SetSymbolCacheDir(*value->str_value)) {
+      return false;
+    }
+  }
   for (const OptionValue& value : options.PullValues("--symdir")) {
     if (!Dso::AddSymbolDir(*value.str_value)) {
       return false;
@@ -383,6 +436,10 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
   }
   CHECK(options.values.empty());
 
+  if (intern_callchains_ && !use_protobuf_) {
+    LOG(ERROR) << "--intern-callchains should be used with --protobuf";
+    return false;
+  }
   if (use_protobuf_ && report_filename_.empty()) {
     report_filename_ = "report_sample.trace";
   }
@@ -416,6 +473,20 @@ bool ReportSampleCommand::DumpProtobufReport(const std::string& filename) {
   std::unordered_map<uint32_t, int32_t> max_symbol_id_map;
   // files[file_id] is the number of symbols in the file.
   std::vector<uint32_t> files;
+  size_t callstack_frame_count = 0;
+  size_t callstack_node_count = 0;
+  auto check_symbol_id = [&](const proto::Sample_CallChainEntry& callchain) {
+    int32_t symbol_id = callchain.symbol_id();
+    if (symbol_id < -1) {
+      LOG(ERROR) << "unexpected symbol_id " << symbol_id;
+      return false;
+    }
+    if (symbol_id != -1) {
+      max_symbol_id_map[callchain.file_id()] =
+          std::max(max_symbol_id_map[callchain.file_id()], symbol_id);
+    }
+    return true;
+  };
   uint32_t max_message_size = 64 * (1 << 20);
   coded_is.SetTotalBytesLimit(max_message_size);
   while (true) {
@@ -454,19 +525,22 @@ bool ReportSampleCommand::DumpProtobufReport(const std::string& filename) {
         FprintIndented(report_fp_, 2, "file_id: %u\n", callchain.file_id());
         int32_t symbol_id = callchain.symbol_id();
         FprintIndented(report_fp_, 2, "symbol_id: %d\n", symbol_id);
-        if (symbol_id < -1) {
-          LOG(ERROR) << "unexpected symbol_id " << symbol_id;
+        if (!check_symbol_id(callchain)) {
           return false;
         }
-        if (symbol_id != -1) {
-          max_symbol_id_map[callchain.file_id()] =
-              std::max(max_symbol_id_map[callchain.file_id()], symbol_id);
-        }
         if (callchain.has_execution_type()) {
           FprintIndented(report_fp_, 2, "execution_type: %s\n",
                          ProtoExecutionTypeToString(callchain.execution_type()));
         }
       }
+      if (sample.has_callstack_id()) {
+        FprintIndented(report_fp_, 1, "callstack_id: %u\n", sample.callstack_id());
+        if (sample.callstack_id() >= callstack_node_count) {
+          LOG(ERROR) << "callstack_id(" << sample.callstack_id() << ") >= callstack node count ("
+                     << callstack_node_count << ")";
+          return false;
+        }
+      }
       if (sample.has_unwinding_result()) {
         FprintIndented(report_fp_, 1, "unwinding_result:\n");
         FprintIndented(report_fp_, 2, "raw_error_code: %u\n",
@@ -529,6 +603,46 @@ bool ReportSampleCommand::DumpProtobufReport(const std::string& filename) {
         FprintIndented(report_fp_, 1, "trace_offcpu: %s\n",
                        meta_info.trace_offcpu() ? "true" : "false");
       }
+    } else if (proto_record.has_callstack_frame()) {
+      auto& frame = proto_record.callstack_frame();
+      auto& entry = frame.entry();
+      FprintIndented(report_fp_, 0, "callstack_frame:\n");
+      FprintIndented(report_fp_, 1, "id: %u\n", frame.id());
+      FprintIndented(report_fp_, 1, "vaddr_in_file: %" PRIx64 "\n", entry.vaddr_in_file());
+      FprintIndented(report_fp_, 1, "file_id: %u\n", entry.file_id());
+      FprintIndented(report_fp_, 1, "symbol_id: %d\n", entry.symbol_id());
+      if (entry.has_execution_type()) {
+        FprintIndented(report_fp_, 1, "execution_type: %s\n",
+                       ProtoExecutionTypeToString(entry.execution_type()));
+      }
+      if (!check_symbol_id(entry)) {
+        return false;
+      }
+      if (frame.id() != callstack_frame_count) {
+        LOG(ERROR) << "callstack frame id doesn't increase orderly, expected "
+                   << callstack_frame_count << ", really " << frame.id();
+        return false;
+      }
+      callstack_frame_count++;
+    } else if (proto_record.has_callstack_node()) {
+      auto& node = proto_record.callstack_node();
+      FprintIndented(report_fp_, 0, "callstack_node:\n");
+      FprintIndented(report_fp_, 1, "id: %u\n", node.id());
+      FprintIndented(report_fp_, 1, "frame_id: %u\n", node.frame_id());
+      if (node.has_parent_id()) {
+        FprintIndented(report_fp_, 1, "parent_id: %u\n", node.parent_id());
+      }
+      if (node.id() != callstack_node_count) {
+        LOG(ERROR) << "callstack node id doesn't increase orderly, expected "
+                   << callstack_node_count << ", really " << node.id();
+        return false;
+      }
+      if (node.frame_id() >= callstack_frame_count ||
+          (node.has_parent_id() && node.parent_id() >= node.id())) {
+        LOG(ERROR) << "callstack node " << node.id() << " refers to an unknown frame or parent";
+        return false;
+      }
+      callstack_node_count++;
     } else if (proto_record.has_context_switch()) {
       auto& context_switch = proto_record.context_switch();
       FprintIndented(report_fp_, 0, "context_switch:\n");
@@ -563,6 +677,9 @@ bool ReportSampleCommand::OpenRecordFile() {
   if (!record_file_reader_->LoadBuildIdAndFileFeatures(thread_tree_)) {
     return false;
   }
+  if (load_symbols_jobs_ > 0) {
+    Dso::LoadSymbolsInParallel(thread_tree_.GetAllDsos(), load_symbols_jobs_);
+  }
   auto& meta_info = record_file_reader_->GetMetaInfoFeature();
   if (auto it = meta_info.find("trace_offcpu"); it != meta_info.end()) {
     trace_offcpu_ = it->second == "true";
@@ -792,23 +909,15 @@ bool ReportSampleCommand::PrintSampleInProtobuf(const ThreadId& thread_id,
   proto_sample->set_thread_id(thread_id.tid);
   proto_sample->set_event_type_id(sample.event_type_id);
 
-  for (const auto& node : sample.callchain) {
-    proto::Sample_CallChainEntry* callchain = proto_sample->add_callchain();
-    uint32_t file_id;
-    if (!node.dso->GetDumpId(&file_id)) {
-      file_id = node.dso->CreateDumpId();
-    }
-    int32_t symbol_id = -1;
-    if (node.symbol != thread_tree_.UnknownSymbol()) {
-      if (!node.symbol->GetDumpId(reinterpret_cast<uint32_t*>(&symbol_id))) {
-        symbol_id = node.dso->CreateSymbolDumpId(node.symbol);
-      }
+  if (intern_callchains_) {
+    uint32_t callstack_id = callchain_interner_.AddCallChain(sample.callchain);
+    if (!PrintCallStacksInProtobuf()) {
+      return false;
     }
-    callchain->set_vaddr_in_file(node.vaddr_in_file);
-    callchain->set_file_id(file_id);
-    callchain->set_symbol_id(symbol_id);
-    if (show_execution_type_) {
-      callchain->set_execution_type(ToProtoExecutionType(node.execution_type));
+    proto_sample->set_callstack_id(callstack_id);
+  } else {
+    for (const auto& node : sample.callchain) {
+      AddCallChainEntryInProtobuf(node, proto_sample->add_callchain());
     }
   }
   if (sample.unwinding_result.has_value()) {
@@ -818,6 +927,55 @@ bool ReportSampleCommand::PrintSampleInProtobuf(const ThreadId& thread_id,
   return WriteRecordInProtobuf(proto_record);
 }
 
+void ReportSampleCommand::AddCallChainEntryInProtobuf(const CallChainReportEntry& node,
+                                                      proto::Sample_CallChainEntry* callchain) {
+  uint32_t file_id;
+  if (!node.dso->GetDumpId(&file_id)) {
+    file_id = node.dso->CreateDumpId();
+  }
+  int32_t symbol_id = -1;
+  if (node.symbol != thread_tree_.UnknownSymbol()) {
+    if (!node.symbol->GetDumpId(reinterpret_cast<uint32_t*>(&symbol_id))) {
+      symbol_id = node.dso->CreateSymbolDumpId(node.symbol);
+    }
+  }
+  callchain->set_vaddr_in_file(node.vaddr_in_file);
+  callchain->set_file_id(file_id);
+  callchain->set_symbol_id(symbol_id);
+  if (show_execution_type_) {
+    callchain->set_execution_type(ToProtoExecutionType(node.execution_type));
+  }
+}
+
+// Write frames and call stack nodes added to callchain_interner_ since the last call.
+bool ReportSampleCommand::PrintCallStacksInProtobuf() {
+  const auto& frames = callchain_interner_.GetFrames();
+  for (; written_frame_count_ < frames.size(); written_frame_count_++) {
+    proto::Record proto_record;
+    proto::CallStackFrame* proto_frame = proto_record.mutable_callstack_frame();
+    proto_frame->set_id(written_frame_count_);
+    AddCallChainEntryInProtobuf(frames[written_frame_count_], proto_frame->mutable_entry());
+    if (!WriteRecordInProtobuf(proto_record)) {
+      return false;
+    }
+  }
+  const auto& nodes = callchain_interner_.GetCallStackNodes();
+  for (; written_callstack_node_count_ < nodes.size(); written_callstack_node_count_++) {
+    const CallChainInterner::CallStackNode& node = nodes[written_callstack_node_count_];
+    proto::Record proto_record;
+    proto::CallStackNode* proto_node = proto_record.mutable_callstack_node();
+    proto_node->set_id(written_callstack_node_count_);
+    proto_node->set_frame_id(node.frame_id);
+    if (node.parent_id != CallChainInterner::NO_PARENT) {
+      proto_node->set_parent_id(node.parent_id);
+    }
+    if (!WriteRecordInProtobuf(proto_record)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void ReportSampleCommand::AddUnwindingResultInProtobuf(
     const UnwindingResult& unwinding_result,
     proto::Sample_UnwindingResult* proto_unwinding_result) {
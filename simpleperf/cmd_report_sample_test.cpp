@@ -108,6 +108,25 @@ TEST(cmd_report_sample, have_clear_callchain_end_in_protobuf_output) {
   ASSERT_EQ(data.find("_start_main"), std::string::npos);
 }
 
+TEST(cmd_report_sample, intern_callchains_option) {
+  std::string data;
+  GetProtobufReport(CALLGRAPH_FP_PERF_DATA, &data, {"--show-callchain"});
+  std::string interned_data;
+  GetProtobufReport(CALLGRAPH_FP_PERF_DATA, &interned_data,
+                    {"--show-callchain", "--intern-callchains"});
+  ASSERT_EQ(data.find("callstack_id:"), std::string::npos);
+  ASSERT_NE(interned_data.find("callstack_frame:"), std::string::npos);
+  ASSERT_NE(interned_data.find("callstack_node:"), std::string::npos);
+  ASSERT_NE(interned_data.find("callstack_id:"), std::string::npos);
+  // Samples don't have callchain entries.
+  ASSERT_NE(data.find("  callchain:\n    vaddr_in_file:"), std::string::npos);
+  ASSERT_EQ(interned_data.find("  callchain:\n    vaddr_in_file:"), std::string::npos);
+
+  TemporaryFile tmpfile;
+  ASSERT_FALSE(ReportSampleCmd()->Run({"-i", GetTestData(CALLGRAPH_FP_PERF_DATA), "-o",
+                                       tmpfile.path, "--intern-callchains"}));
+}
+
 TEST(cmd_report_sample, app_device_info_in_meta_info) {
   std::string data;
   GetProtobufReport("perf_with_meta_info.data", &data);
@@ -176,6 +176,15 @@ TEST_F(ReportCommandTest, callgraph_option) {
   ASSERT_TRUE(CheckCallerMode(lines));
 }
 
+TEST_F(ReportCommandTest, pipeline_option) {
+  Report(CALLGRAPH_FP_PERF_DATA, {"-g"});
+  ASSERT_TRUE(success);
+  std::string expected_content = content;
+  Report(CALLGRAPH_FP_PERF_DATA, {"-g", "--pipeline"});
+  ASSERT_TRUE(success);
+  ASSERT_EQ(content, expected_content);
+}
+
 static bool AllItemsWithString(std::vector<std::string>& lines,
                                const std::vector<std::string>& strs) {
   size_t line_index = 0;
@@ -333,6 +342,18 @@ TEST_F(ReportCommandTest, report_symbols_of_nativelib_in_apk) {
   ASSERT_NE(content.find("Func2"), std::string::npos);
 }
 
+TEST_F(ReportCommandTest, load_symbols_jobs_option) {
+  for (const std::string& perf_data : {PERF_DATA, NATIVELIB_IN_APK_PERF_DATA}) {
+    Report(perf_data);
+    ASSERT_TRUE(success);
+    std::string expected_content = content;
+    Report(perf_data, {"--load-symbols-jobs", "4"});
+    ASSERT_TRUE(success);
+    ASSERT_EQ(content, expected_content);
+  }
+  ASSERT_NE(content.find("Func2"), std::string::npos);
+}
+
 TEST_F(ReportCommandTest, report_more_than_one_event_types) {
   Report(PERF_DATA_WITH_TWO_EVENT_TYPES);
   ASSERT_TRUE(success);
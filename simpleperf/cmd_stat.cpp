@@ -376,6 +376,12 @@ class StatCommand : public Command {
 "                        starting point. But this can be changed by\n"
 "                        --interval-only-values.\n"
 "--interval-only-values  Print numbers of events happened in each interval.\n"
+"--stream         Used with --interval. Instead of printing tables, write one line per event\n"
+"                 for each interval, in format:\n"
+"                   event[,tid=tid][,cpu=cpu] count=Ni,time_enabled=Ni,time_running=Ni timestamp\n"
+"                 tid and cpu tags are added for --per-thread and --per-core. Timestamp is\n"
+"                 in ns, using CLOCK_MONOTONIC. The output is flushed after each interval,\n"
+"                 so it can be a pipe read by a monitoring daemon.\n"
 "-e event1[:modifier1],event2[:modifier2],...\n"
 "                 Select a list of events to count. An event can be:\n"
 "                   1) an event name listed in `simpleperf list`;\n"
@@ -398,6 +404,11 @@ class StatCommand : public Command {
 "-o output_filename  Write report to output_filename instead of standard output.\n"
 "--per-core       Print counters for each cpu core.\n"
 "--per-thread     Print counters for each thread.\n"
+"--attach-new-threads  Used with --per-thread when monitoring processes. Check new threads in\n"
+"                      monitored processes every second, and start monitoring them. Event\n"
+"                      files of exited threads are closed, keeping their counts. It\n"
+"                      implies --no-inherit, so counts of new threads aren't added to the\n"
+"                      threads creating them.\n"
 "-p pid_or_process_name_regex1,pid_or_process_name_regex2,...\n"
 "                      Stat events on existing processes. Processes are searched either by pid\n"
 "                      or process name regex. Mutually exclusive with -a.\n"
@@ -426,7 +437,7 @@ class StatCommand : public Command {
 "                          with performance governor. It affects memory latency during profiling,\n"
 "                          and may cause wedged power if simpleperf is killed in between.\n"
 #endif
-"--verbose        Show result in verbose mode.\n"
+"--verbose        Show result in verbose mode, including the cost of reading counters.\n"
 #if 0
 // Below options are only used internally and shouldn't be visible to the public.
 "--in-app         We are already running in the app's context.\n"
@@ -460,7 +471,8 @@ class StatCommand : public Command {
   bool AddDefaultMeasuredEventTypes();
   void SetEventSelectionFlags();
   void MonitorEachThread();
-  void AdjustToIntervalOnlyValues(std::vector<CountersInfo>& counters);
+  bool AttachNewThreads();
+  void StreamCounters(const std::vector<CountersInfo>& counters, uint64_t timestamp, FILE* fp);
   bool ShowCounters(const std::vector<CountersInfo>& counters, double duration_in_sec, FILE* fp);
   void CheckHardwareCounterMultiplexing();
   void PrintWarningForInaccurateEvents();
@@ -471,7 +483,7 @@ class StatCommand : public Command {
   double duration_in_sec_;
   double interval_in_ms_;
   bool interval_only_values_;
-  std::vector<std::vector<CounterSum>> last_sum_values_;
+  IntervalCounterConverter interval_counter_converter_;
   EventSelectionSet event_selection_set_;
   std::string output_filename_;
   android::base::unique_fd out_fd_;
@@ -489,6 +501,15 @@ class StatCommand : public Command {
   std::vector<std::string> sort_keys_;
   std::optional<SummaryComparator> summary_comparator_;
   bool print_hw_counter_ = false;
+  bool stream_ = false;
+  bool attach_new_threads_ = false;
+  // processes checked for new and exited threads when attach_new_threads_ is true
+  std::set<pid_t> attach_processes_;
+  // monitored threads in attach_processes_ with event files open
+  std::set<pid_t> attached_threads_;
+  // used to sum counters per cpu in StreamCounters()
+  std::vector<CounterSum> stream_cpu_sums_;
+  std::vector<bool> stream_cpu_used_;
 };
 
 bool StatCommand::Run(const std::vector<std::string>& args) {
@@ -557,7 +578,15 @@ bool StatCommand::Run(const std::vector<std::string>& args) {
   }
 
   if (report_per_thread_) {
+    if (attach_new_threads_) {
+      attach_processes_ = event_selection_set_.GetMonitoredProcesses();
+    }
     MonitorEachThread();
+    for (const auto& [tid, info] : thread_info_) {
+      if (attach_processes_.count(info.pid) != 0) {
+        attached_threads_.insert(tid);
+      }
+    }
   }
 
   // 3. Open perf_event_files and output file if defined.
@@ -601,16 +630,27 @@ bool StatCommand::Run(const std::vector<std::string>& args) {
       return false;
     }
   }
+  if (!attach_processes_.empty()) {
+    if (!loop->AddPeriodicEvent(
+            SecondToTimeval(DEFAULT_PERIOD_TO_CHECK_MONITORED_TARGETS_IN_SEC),
+            [this]() { return AttachNewThreads(); })) {
+      return false;
+    }
+  }
   auto print_counters = [&]() {
     auto end_time = std::chrono::steady_clock::now();
     if (!event_selection_set_.ReadCounters(&counters)) {
       return false;
     }
-    double duration_in_sec =
-        std::chrono::duration_cast<std::chrono::duration<double>>(end_time - start_time).count();
     if (interval_only_values_) {
-      AdjustToIntervalOnlyValues(counters);
+      interval_counter_converter_.ToIntervalValues(counters);
+    }
+    if (stream_) {
+      StreamCounters(counters, GetSystemClock(), fp);
+      return true;
     }
+    double duration_in_sec =
+        std::chrono::duration_cast<std::chrono::duration<double>>(end_time - start_time).count();
     if (!ShowCounters(counters, duration_in_sec, fp)) {
       return false;
     }
@@ -693,6 +733,14 @@ bool StatCommand::ParseOptions(const std::vector<std::string>& args,
 
   report_per_core_ = options.PullBoolValue("--per-core");
   report_per_thread_ = options.PullBoolValue("--per-thread");
+  attach_new_threads_ = options.PullBoolValue("--attach-new-threads");
+  if (attach_new_threads_) {
+    if (!report_per_thread_) {
+      LOG(ERROR) << "--attach-new-threads should be used with --per-thread";
+      return false;
+    }
+    child_inherit_ = false;
+  }
 
   if (auto strs = options.PullStringValues("-p"); !strs.empty()) {
     if (auto pids = GetPidsFromStrings(strs, true, true); pids) {
@@ -707,6 +755,12 @@ bool StatCommand::ParseOptions(const std::vector<std::string>& args,
     sort_keys_ = Split(*value->str_value, ",");
   }
 
+  stream_ = options.PullBoolValue("--stream");
+  if (stream_ && interval_in_ms_ == 0) {
+    LOG(ERROR) << "--stream should be used with --interval";
+    return false;
+  }
+
   if (auto value = options.PullValue("--stop-signal-fd"); value) {
     stop_signal_fd_.reset(static_cast<int>(value->uint_value));
   }
@@ -903,26 +957,105 @@ void StatCommand::MonitorEachThread() {
   event_selection_set_.AddMonitoredThreads(threads);
 }
 
-void StatCommand::AdjustToIntervalOnlyValues(std::vector<CountersInfo>& counters) {
-  if (last_sum_values_.size() < counters.size()) {
-    last_sum_values_.resize(counters.size());
+bool StatCommand::AttachNewThreads() {
+  std::vector<pid_t> new_threads;
+  std::set<pid_t> exited_threads = attached_threads_;
+  for (pid_t pid : attach_processes_) {
+    for (pid_t tid : GetThreadsInProcess(pid)) {
+      if (exited_threads.erase(tid) != 0) {
+        continue;
+      }
+      ThreadInfo info;
+      if (GetThreadName(tid, &info.name)) {
+        info.tid = tid;
+        info.pid = pid;
+        thread_info_[tid] = std::move(info);
+        new_threads.push_back(tid);
+      }
+    }
+  }
+  if (!exited_threads.empty()) {
+    // Their counts are kept in event_selection_set_, and thread_info_ is kept to report them.
+    LOG(DEBUG) << "detach " << exited_threads.size() << " exited threads";
+    if (!event_selection_set_.CloseEventFilesForExitedThreads(exited_threads)) {
+      return false;
+    }
+    for (pid_t tid : exited_threads) {
+      attached_threads_.erase(tid);
+    }
+  }
+  if (new_threads.empty()) {
+    return true;
   }
-  for (size_t i = 0; i < counters.size(); i++) {
-    std::vector<CounterInfo>& counters_per_event = counters[i].counters;
-    std::vector<CounterSum>& last_sum = last_sum_values_[i];
+  LOG(DEBUG) << "attach " << new_threads.size() << " new threads";
+  attached_threads_.insert(new_threads.begin(), new_threads.end());
+  return event_selection_set_.OpenEventFilesForNewThreads(new_threads);
+}
 
-    if (last_sum.size() < counters_per_event.size()) {
-      last_sum.resize(counters_per_event.size());
+void StatCommand::StreamCounters(const std::vector<CountersInfo>& counters, uint64_t timestamp,
+                                 FILE* fp) {
+  auto print_line = [&](const CountersInfo& info, pid_t tid, int cpu, const CounterSum& sum) {
+    fprintf(fp, "%s%s%s", info.event_name.c_str(), info.event_modifier.empty() ? "" : ":",
+            info.event_modifier.c_str());
+    if (report_per_thread_) {
+      fprintf(fp, ",tid=%d", tid);
     }
-    for (size_t j = 0; j < counters_per_event.size(); j++) {
-      PerfCounter& counter = counters_per_event[j].counter;
-      CounterSum new_sum;
-      new_sum.FromCounter(counter);
-      CounterSum delta = new_sum - last_sum[j];
-      delta.ToCounter(counter);
-      last_sum[j] = new_sum;
+    if (report_per_core_) {
+      fprintf(fp, ",cpu=%d", cpu);
+    }
+    fprintf(fp,
+            " count=%" PRIu64 "i,time_enabled=%" PRIu64 "i,time_running=%" PRIu64 "i %" PRIu64
+            "\n",
+            sum.value, sum.time_enabled, sum.time_running, timestamp);
+  };
+
+  for (const auto& info : counters) {
+    CounterSum sum;
+    if (report_per_core_ && !report_per_thread_) {
+      // Sum counters on each cpu, using buffers reused across intervals.
+      stream_cpu_sums_.assign(stream_cpu_sums_.size(), CounterSum());
+      stream_cpu_used_.assign(stream_cpu_used_.size(), false);
+      for (const auto& counter_info : info.counters) {
+        size_t cpu = static_cast<size_t>(std::max(counter_info.cpu, 0));
+        if (cpu >= stream_cpu_sums_.size()) {
+          stream_cpu_sums_.resize(cpu + 1);
+          stream_cpu_used_.resize(cpu + 1, false);
+        }
+        sum.FromCounter(counter_info.counter);
+        stream_cpu_sums_[cpu] = stream_cpu_sums_[cpu] + sum;
+        stream_cpu_used_[cpu] = true;
+      }
+      for (size_t cpu = 0; cpu < stream_cpu_sums_.size(); ++cpu) {
+        if (stream_cpu_used_[cpu]) {
+          print_line(info, -1, static_cast<int>(cpu), stream_cpu_sums_[cpu]);
+        }
+      }
+    } else if (report_per_thread_ && !report_per_core_) {
+      // Counters of a thread are opened together, so they are adjacent.
+      for (size_t i = 0; i < info.counters.size();) {
+        pid_t tid = info.counters[i].tid;
+        CounterSum thread_sum;
+        for (; i < info.counters.size() && info.counters[i].tid == tid; ++i) {
+          sum.FromCounter(info.counters[i].counter);
+          thread_sum = thread_sum + sum;
+        }
+        print_line(info, tid, -1, thread_sum);
+      }
+    } else if (report_per_thread_ && report_per_core_) {
+      for (const auto& counter_info : info.counters) {
+        sum.FromCounter(counter_info.counter);
+        print_line(info, counter_info.tid, counter_info.cpu, sum);
+      }
+    } else {
+      CounterSum total_sum;
+      for (const auto& counter_info : info.counters) {
+        sum.FromCounter(counter_info.counter);
+        total_sum = total_sum + sum;
+      }
+      print_line(info, -1, -1, total_sum);
     }
   }
+  fflush(fp);
 }
 
 bool StatCommand::ShowCounters(const std::vector<CountersInfo>& counters, double duration_in_sec,
@@ -953,6 +1086,16 @@ bool StatCommand::ShowCounters(const std::vector<CountersInfo>& counters, double
         }
       }
     }
+    // Show the cost of stat itself, which affects the accuracy of short intervals.
+    const CounterReadStat& read_stat = event_selection_set_.GetCounterReadStat();
+    double read_time_in_ms = read_stat.read_time_in_ns / 1e6;
+    if (csv_) {
+      fprintf(fp, "counter read overhead,counters,%zu,read calls,%zu,time,%lf,ms,\n",
+              read_stat.counter_count, read_stat.read_count, read_time_in_ms);
+    } else {
+      fprintf(fp, "Read %zu counters with %zu read calls in %lf ms.\n", read_stat.counter_count,
+              read_stat.read_count, read_time_in_ms);
+    }
   }
 
   CounterSummaryBuilder builder(report_per_thread_, report_per_core_, csv_, thread_info_,
@@ -67,6 +67,29 @@ struct CounterSum {
   }
 };
 
+// Convert counter values accumulated since event files were opened to values in the current
+// interval, for --interval-only-values. Counters are matched by their perf event ids, because
+// their positions in CountersInfo::counters change when event files of exited threads are closed.
+class IntervalCounterConverter {
+ public:
+  void ToIntervalValues(std::vector<CountersInfo>& counters) {
+    for (CountersInfo& counters_info : counters) {
+      for (CounterInfo& counter_info : counters_info.counters) {
+        PerfCounter& counter = counter_info.counter;
+        CounterSum new_sum;
+        new_sum.FromCounter(counter);
+        CounterSum& last_sum = last_sums_[counter.id];
+        CounterSum delta = new_sum - last_sum;
+        delta.ToCounter(counter);
+        last_sum = new_sum;
+      }
+    }
+  }
+
+ private:
+  std::unordered_map<uint64_t, CounterSum> last_sums_;
+};
+
 struct ThreadInfo {
   pid_t tid;
   pid_t pid;
@@ -307,6 +330,8 @@ inline const OptionFormatMap& GetStatCmdOptionFormats() {
   static const OptionFormatMap option_formats = {
       {"-a", {OptionValueType::NONE, OptionType::SINGLE, AppRunnerType::NOT_ALLOWED}},
       {"--app", {OptionValueType::STRING, OptionType::SINGLE, AppRunnerType::NOT_ALLOWED}},
+      {"--attach-new-threads",
+       {OptionValueType::NONE, OptionType::SINGLE, AppRunnerType::ALLOWED}},
       {"--cpu", {OptionValueType::STRING, OptionType::ORDERED, AppRunnerType::ALLOWED}},
       {"--csv", {OptionValueType::NONE, OptionType::SINGLE, AppRunnerType::ALLOWED}},
       {"--duration", {OptionValueType::DOUBLE, OptionType::SINGLE, AppRunnerType::ALLOWED}},
@@ -326,6 +351,7 @@ inline const OptionFormatMap& GetStatCmdOptionFormats() {
       {"--print-hw-counter", {OptionValueType::NONE, OptionType::SINGLE, AppRunnerType::ALLOWED}},
       {"--sort", {OptionValueType::STRING, OptionType::SINGLE, AppRunnerType::ALLOWED}},
       {"--stop-signal-fd", {OptionValueType::UINT, OptionType::SINGLE, AppRunnerType::CHECK_FD}},
+      {"--stream", {OptionValueType::NONE, OptionType::SINGLE, AppRunnerType::ALLOWED}},
       {"-t", {OptionValueType::STRING, OptionType::MULTIPLE, AppRunnerType::ALLOWED}},
       {"--tp-filter", {OptionValueType::STRING, OptionType::ORDERED, AppRunnerType::ALLOWED}},
       {"--tracepoint-events",
@@ -20,6 +20,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
+#include <atomic>
 #include <thread>
 
 #include "ProbeEvents.h"
@@ -50,6 +51,12 @@ TEST(stat_cmd, system_wide_option) {
 
 TEST(stat_cmd, verbose_option) {
   ASSERT_TRUE(StatCmd()->Run({"--verbose", "sleep", "1"}));
+  TemporaryFile tmp_file;
+  ASSERT_TRUE(StatCmd()->Run({"--verbose", "--group", "context-switches,page-faults", "-o",
+                              tmp_file.path, "sleep", "1"}));
+  std::string s;
+  ASSERT_TRUE(android::base::ReadFileToString(tmp_file.path, &s));
+  ASSERT_NE(s.find("read calls in"), s.npos);
 }
 
 TEST(stat_cmd, tracepoint_event) {
@@ -353,6 +360,40 @@ TEST(stat_cmd, per_core_option) {
   TEST_IN_ROOT(StatCmd()->Run({"--per-core", "-a", "--duration", "0.1"}));
 }
 
+TEST(stat_cmd, stream_option) {
+  ASSERT_FALSE(StatCmd()->Run({"--stream", "sleep", "0.1"}));
+  TemporaryFile tmp_file;
+  ASSERT_TRUE(StatCmd()->Run({"--stream", "--interval", "5", "--interval-only-values", "-e",
+                              "task-clock", "--per-thread", "-o", tmp_file.path, "sleep", "0.1"}));
+  std::string s;
+  ASSERT_TRUE(android::base::ReadFileToString(tmp_file.path, &s));
+  ASSERT_EQ(s.find("statistics"), s.npos);
+  std::vector<std::string> lines = android::base::Split(android::base::Trim(s), "\n");
+  ASSERT_GT(lines.size(), 1u);
+  for (const auto& line : lines) {
+    ASSERT_TRUE(android::base::StartsWith(line, "task-clock,tid=")) << line;
+    ASSERT_NE(line.find(" count="), line.npos) << line;
+  }
+}
+
+TEST(stat_cmd, attach_new_threads_option) {
+  ASSERT_FALSE(StatCmd()->Run({"--attach-new-threads", "sleep", "0.1"}));
+  std::atomic<bool> stop(false);
+  std::thread thread([&]() {
+    // Create new threads while stat is running.
+    while (!stop) {
+      std::thread([]() { usleep(50000); }).join();
+    }
+  });
+  TemporaryFile tmp_file;
+  bool result = StatCmd()->Run({"--attach-new-threads", "--per-thread", "-e", "task-clock", "-p",
+                                std::to_string(getpid()), "--in-app", "--duration", "1.5", "-o",
+                                tmp_file.path});
+  stop = true;
+  thread.join();
+  ASSERT_TRUE(result);
+}
+
 TEST(stat_cmd, sort_option) {
   ASSERT_TRUE(
       StatCmd()->Run({"--per-thread", "--per-core", "--sort", "cpu,count", "sleep", "0.1"}));
@@ -382,6 +423,42 @@ TEST(stat_cmd, counter_sum) {
   ASSERT_EQ(counter.time_running, 6);
 }
 
+TEST(stat_cmd, interval_counter_converter) {
+  auto make_counter = [](pid_t tid, uint64_t id, uint64_t value) {
+    CounterInfo counter;
+    counter.tid = tid;
+    counter.cpu = -1;
+    counter.counter.value = value;
+    counter.counter.time_enabled = value;
+    counter.counter.time_running = value;
+    counter.counter.id = id;
+    return counter;
+  };
+  IntervalCounterConverter converter;
+  std::vector<CountersInfo> counters(1);
+  counters[0].counters = {make_counter(1, 11, 100), make_counter(2, 12, 200),
+                          make_counter(3, 13, 300)};
+  converter.ToIntervalValues(counters);
+  ASSERT_EQ(counters[0].counters[1].counter.value, 200);
+
+  // Thread 2 exits. Its counter is moved to the front, and counters of other threads move.
+  counters[0].counters = {make_counter(2, 12, 250), make_counter(1, 11, 110),
+                          make_counter(3, 13, 330)};
+  converter.ToIntervalValues(counters);
+  ASSERT_EQ(counters[0].counters[0].counter.value, 50);
+  ASSERT_EQ(counters[0].counters[1].counter.value, 10);
+  ASSERT_EQ(counters[0].counters[2].counter.value, 30);
+  ASSERT_EQ(counters[0].counters[2].counter.time_running, 30);
+
+  // The counter of the exited thread doesn't change anymore.
+  counters[0].counters = {make_counter(2, 12, 250), make_counter(1, 11, 115),
+                          make_counter(3, 13, 335)};
+  converter.ToIntervalValues(counters);
+  ASSERT_EQ(counters[0].counters[0].counter.value, 0);
+  ASSERT_EQ(counters[0].counters[1].counter.value, 5);
+  ASSERT_EQ(counters[0].counters[2].counter.value, 5);
+}
+
 TEST(stat_cmd, print_hw_counter_option) {
   ASSERT_TRUE(StatCmd()->Run({"--print-hw-counter"}));
 }
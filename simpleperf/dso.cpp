@@ -20,10 +20,13 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <limits>
 #include <memory>
 #include <optional>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -246,6 +249,164 @@ std::string_view Symbol::FunctionName() const {
   return name;
 }
 
+namespace simpleperf_dso_impl {
+
+// Layout of a symbol cache file: a SymbolCacheHeader, symbol_count SymbolCacheEntrys sorted by
+// addr, then a string pool of string_pool_size bytes. Names are null terminated strings in the
+// string pool.
+static constexpr char kSymbolCacheMagic[8] = {'S', 'Y', 'M', 'C', 'A', 'C', 'H', 'E'};
+static constexpr uint32_t kSymbolCacheVersion = 1;
+static constexpr uint32_t kNoDemangledName = std::numeric_limits<uint32_t>::max();
+
+struct SymbolCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t symbol_count;
+  uint64_t string_pool_size;
+};
+
+struct SymbolCacheEntry {
+  uint64_t addr;
+  uint64_t len;
+  uint32_t name_offset;
+  // kNoDemangledName if demangled names aren't in the cache.
+  uint32_t demangled_name_offset;
+};
+
+void SymbolCache::Reset() {
+  std::lock_guard<std::mutex> guard(mapped_files_lock_);
+  cache_dir_.clear();
+  mapped_files_.clear();
+}
+
+bool SymbolCache::SetCacheDir(const std::string& cache_dir) {
+  std::string dir = RemovePathSeparatorSuffix(cache_dir);
+  if (!IsDir(dir) && !MkdirWithParents(dir + OS_PATH_SEPARATOR)) {
+    LOG(ERROR) << "Invalid symbol cache dir '" << dir << "'";
+    return false;
+  }
+  cache_dir_ = dir;
+  return true;
+}
+
+std::string SymbolCache::GetCacheFilePath(const BuildId& build_id,
+                                          const std::string& symbol_source) {
+  return cache_dir_ + OS_PATH_SEPARATOR + build_id.ToString().substr(2) + "." + symbol_source +
+         ".symbols";
+}
+
+bool SymbolCache::ReadSymbols(const BuildId& build_id, const std::string& symbol_source,
+                              bool demangle, std::vector<Symbol>* symbols) {
+  if (build_id.IsEmpty()) {
+    return false;
+  }
+  std::string path = GetCacheFilePath(build_id, symbol_source);
+  android::base::unique_fd fd(FileHelper::OpenReadOnly(path));
+  if (fd == -1) {
+    return false;
+  }
+  uint64_t file_size = GetFileSize(path);
+  if (file_size < sizeof(SymbolCacheHeader)) {
+    return false;
+  }
+  auto map = android::base::MappedFile::FromFd(fd, 0, file_size, PROT_READ);
+  if (!map) {
+    return false;
+  }
+  SymbolCacheHeader header;
+  memcpy(&header, map->data(), sizeof(header));
+  uint64_t entries_size = static_cast<uint64_t>(header.symbol_count) * sizeof(SymbolCacheEntry);
+  if (memcmp(header.magic, kSymbolCacheMagic, sizeof(kSymbolCacheMagic)) != 0 ||
+      header.version != kSymbolCacheVersion || header.string_pool_size == 0 ||
+      sizeof(header) + entries_size + header.string_pool_size != file_size) {
+    LOG(WARNING) << "Ignore invalid symbol cache file " << path;
+    return false;
+  }
+  const char* entry_data = map->data() + sizeof(header);
+  const char* string_pool = entry_data + entries_size;
+  if (string_pool[header.string_pool_size - 1] != '\0') {
+    LOG(WARNING) << "Ignore invalid symbol cache file " << path;
+    return false;
+  }
+  std::vector<Symbol> result;
+  result.reserve(header.symbol_count);
+  for (uint32_t i = 0; i < header.symbol_count; i++) {
+    SymbolCacheEntry entry;
+    memcpy(&entry, entry_data + i * sizeof(entry), sizeof(entry));
+    if (entry.name_offset >= header.string_pool_size ||
+        (entry.demangled_name_offset != kNoDemangledName &&
+         entry.demangled_name_offset >= header.string_pool_size)) {
+      LOG(WARNING) << "Ignore invalid symbol cache file " << path;
+      return false;
+    }
+    const char* demangled_name = nullptr;
+    if (demangle && entry.demangled_name_offset != kNoDemangledName) {
+      demangled_name = string_pool + entry.demangled_name_offset;
+    }
+    result.push_back(Symbol(string_pool + entry.name_offset, demangled_name, entry.addr, entry.len));
+  }
+  {
+    std::lock_guard<std::mutex> guard(mapped_files_lock_);
+    mapped_files_.emplace_back(std::move(map));
+  }
+  *symbols = std::move(result);
+  return true;
+}
+
+bool SymbolCache::WriteSymbols(const BuildId& build_id, const std::string& symbol_source,
+                               bool demangle, const std::vector<Symbol>& symbols) {
+  if (build_id.IsEmpty() || symbols.empty()) {
+    return false;
+  }
+  std::string string_pool;
+  auto add_string = [&](const char* s) {
+    uint32_t offset = static_cast<uint32_t>(string_pool.size());
+    string_pool.append(s, strlen(s) + 1);
+    return offset;
+  };
+  std::vector<SymbolCacheEntry> entries;
+  entries.reserve(symbols.size());
+  for (const auto& symbol : symbols) {
+    SymbolCacheEntry& entry = entries.emplace_back();
+    entry.addr = symbol.addr;
+    entry.len = symbol.len;
+    entry.name_offset = add_string(symbol.Name());
+    entry.demangled_name_offset = kNoDemangledName;
+    if (demangle) {
+      // This also keeps the demangled name in the symbol, so it isn't demangled again.
+      const char* demangled_name = symbol.DemangledName();
+      entry.demangled_name_offset =
+          strcmp(demangled_name, symbol.Name()) == 0 ? entry.name_offset
+                                                     : add_string(demangled_name);
+    }
+    if (string_pool.size() >= kNoDemangledName) {
+      return false;
+    }
+  }
+  SymbolCacheHeader header;
+  memcpy(header.magic, kSymbolCacheMagic, sizeof(kSymbolCacheMagic));
+  header.version = kSymbolCacheVersion;
+  header.symbol_count = static_cast<uint32_t>(entries.size());
+  header.string_pool_size = string_pool.size();
+
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  data.append(reinterpret_cast<const char*>(entries.data()),
+              entries.size() * sizeof(SymbolCacheEntry));
+  data += string_pool;
+
+  // Dsos loaded in parallel may write the same cache file. So write through a unique temporary
+  // file.
+  std::string path = GetCacheFilePath(build_id, symbol_source);
+  if (!WriteFileAtomically(path, data)) {
+    LOG(DEBUG) << "failed to write symbol cache file " << path;
+    return false;
+  }
+  LOG(VERBOSE) << "Write " << symbols.size() << " symbols to " << path;
+  return true;
+}
+
+}  // namespace simpleperf_dso_impl
+
 static bool CompareSymbolToAddr(const Symbol& s, uint64_t addr) {
   return s.addr < addr;
 }
@@ -261,6 +422,7 @@ std::unordered_map<std::string, BuildId> Dso::build_id_map_;
 size_t Dso::dso_count_;
 uint32_t Dso::g_dump_id_;
 simpleperf_dso_impl::DebugElfFileFinder Dso::debug_elf_file_finder_;
+simpleperf_dso_impl::SymbolCache Dso::symbol_cache_;
 
 void Dso::SetDemangle(bool demangle) {
   demangle_ = demangle;
@@ -320,6 +482,10 @@ bool Dso::AddSymbolDir(const std::string& symbol_dir) {
   return debug_elf_file_finder_.AddSymbolDir(symbol_dir);
 }
 
+bool Dso::SetSymbolCacheDir(const std::string& symbol_cache_dir) {
+  return symbol_cache_.SetCacheDir(symbol_cache_dir);
+}
+
 void Dso::SetVmlinux(const std::string& vmlinux) {
   vmlinux_ = vmlinux;
 }
@@ -375,6 +541,7 @@ Dso::~Dso() {
     build_id_map_.clear();
     g_dump_id_ = 0;
     debug_elf_file_finder_.Reset();
+    symbol_cache_.Reset();
   }
 }
 
@@ -413,6 +580,47 @@ const Symbol* Dso::FindSymbol(uint64_t vaddr_in_dso) {
   return nullptr;
 }
 
+void Dso::LoadSymbolsInParallel(const std::vector<Dso*>& dsos, size_t jobs) {
+  std::vector<Dso*> dsos_to_load;
+  for (Dso* dso : dsos) {
+    if (!dso->is_loaded_ && dso->type() != DSO_KERNEL && dso->type() != DSO_UNKNOWN_FILE) {
+      dsos_to_load.push_back(dso);
+    }
+  }
+  jobs = std::min(jobs, dsos_to_load.size());
+  if (jobs <= 1) {
+    for (Dso* dso : dsos_to_load) {
+      dso->LoadSymbols();
+    }
+    return;
+  }
+  auto start_time = std::chrono::steady_clock::now();
+  std::atomic<size_t> next_index = 0;
+  auto load_symbols = [&]() {
+    for (size_t i = next_index++; i < dsos_to_load.size(); i = next_index++) {
+      Dso* dso = dsos_to_load[i];
+      auto dso_start_time = std::chrono::steady_clock::now();
+      dso->LoadSymbols();
+      std::chrono::duration<double, std::milli> duration =
+          std::chrono::steady_clock::now() - dso_start_time;
+      LOG(VERBOSE) << "Loaded " << dso->symbols_.size() << " symbols of " << dso->Path() << " in "
+                   << duration.count() << " ms";
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < jobs; i++) {
+    threads.emplace_back(load_symbols);
+  }
+  load_symbols();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double, std::milli> duration =
+      std::chrono::steady_clock::now() - start_time;
+  LOG(VERBOSE) << "Loaded symbols of " << dsos_to_load.size() << " dsos in " << jobs
+               << " threads in " << duration.count() << " ms";
+}
+
 void Dso::SetSymbols(std::vector<Symbol>* symbols) {
   symbols_ = std::move(*symbols);
   symbols->clear();
@@ -640,6 +848,17 @@ class ElfDso : public Dso {
     };
     ElfStatus status;
     auto elf = ElfFile::Open(GetDebugFilePath(), &build_id, &status);
+    BuildId file_build_id;
+    std::string symbol_source;
+    if (elf && symbol_cache_.IsEnabled() &&
+        elf->GetBuildId(&file_build_id) == ElfStatus::NO_ERROR) {
+      symbol_source = GetSymbolSource(*elf);
+    }
+    if (!symbol_source.empty() &&
+        symbol_cache_.ReadSymbols(file_build_id, symbol_source, demangle_, &symbols)) {
+      LOG(VERBOSE) << "Read symbols of " << GetDebugFilePath() << " from symbol cache";
+      return symbols;
+    }
     if (elf) {
       status = elf->ParseSymbols(symbol_callback);
     }
@@ -655,9 +874,26 @@ class ElfDso : public Dso {
     }
     ReportReadElfSymbolResult(status, path_, GetDebugFilePath(), log_level);
     SortAndFixSymbols(symbols);
+    if (status == ElfStatus::NO_ERROR && !symbol_source.empty()) {
+      symbol_cache_.WriteSymbols(file_build_id, symbol_source, demangle_, symbols);
+    }
     return symbols;
   }
 
+  // Return the section ElfFile::ParseSymbols() reads symbols from.
+  static std::string GetSymbolSource(ElfFile& elf) {
+    bool has_gnu_debugdata = false;
+    for (const ElfSection& section : elf.GetSectionHeader()) {
+      if (section.name == ".symtab") {
+        return "symtab";
+      }
+      if (section.name == ".gnu_debugdata") {
+        has_gnu_debugdata = true;
+      }
+    }
+    return has_gnu_debugdata ? "gnu_debugdata" : "dynsym";
+  }
+
  private:
   static constexpr uint64_t uninitialized_value = std::numeric_limits<uint64_t>::max();
 
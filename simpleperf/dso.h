@@ -18,6 +18,7 @@
 #define SIMPLE_PERF_DSO_H_
 
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -26,12 +27,16 @@
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/mapped_file.h>
 
 #include "build_id.h"
 #include "kallsyms.h"
 #include "read_elf.h"
 
 namespace simpleperf {
+
+struct Symbol;
+
 namespace simpleperf_dso_impl {
 
 // Find elf files with symbol table and debug information.
@@ -54,6 +59,32 @@ class DebugElfFileFinder {
   std::unordered_map<std::string, std::string> build_id_to_file_map_;
 };
 
+// Cache sorted symbols read from elf files in a directory, keyed by build id and symbol source.
+// The symbol source is the section symbols are read from (like symtab or gnu_debugdata), as a
+// stripped file and its unstripped copy share a build id. A cache file has symbols, a string
+// pool and demangled names. It is mapped into memory when read, so later runs don't need to
+// parse, sort and demangle symbols again.
+class SymbolCache {
+ public:
+  void Reset();
+  bool SetCacheDir(const std::string& cache_dir);
+  bool IsEnabled() const { return !cache_dir_.empty(); }
+  // If demangle is true, symbols read from the cache have demangled names.
+  bool ReadSymbols(const BuildId& build_id, const std::string& symbol_source, bool demangle,
+                   std::vector<Symbol>* symbols);
+  // If demangle is true, demangled names of symbols are also written to the cache.
+  bool WriteSymbols(const BuildId& build_id, const std::string& symbol_source, bool demangle,
+                    const std::vector<Symbol>& symbols);
+  // Only for testing
+  std::string GetCacheFilePath(const BuildId& build_id, const std::string& symbol_source);
+
+ private:
+  std::string cache_dir_;
+  // Symbol names point to the mapped files, so keep them until Reset().
+  std::mutex mapped_files_lock_;
+  std::vector<std::unique_ptr<android::base::MappedFile>> mapped_files_;
+};
+
 }  // namespace simpleperf_dso_impl
 
 struct Symbol {
@@ -96,7 +127,12 @@ struct Symbol {
   mutable const char* demangled_name_;
   mutable uint32_t dump_id_;
 
+  // Create a symbol with names not copied, used by SymbolCache.
+  Symbol(const char* name, const char* demangled_name, uint64_t addr, uint64_t len)
+      : addr(addr), len(len), name_(name), demangled_name_(demangled_name), dump_id_(UINT_MAX) {}
+
   friend class Dso;
+  friend class simpleperf_dso_impl::SymbolCache;
 };
 
 enum DsoType {
@@ -121,6 +157,9 @@ class Dso {
   // SymbolDir is used to add a directory containing files with symbols. Each file under it will
   // be searched recursively to build a build_id_map.
   static bool AddSymbolDir(const std::string& symbol_dir);
+  // SymbolCacheDir is used to cache symbols read from elf files with build ids. Symbols of an elf
+  // file are written to the cache when first read, and read from the cache in later runs.
+  static bool SetSymbolCacheDir(const std::string& symbol_cache_dir);
   static void SetVmlinux(const std::string& vmlinux);
   static void SetKallsyms(std::string kallsyms) {
     if (!kallsyms.empty()) {
@@ -138,6 +177,10 @@ class Dso {
   static std::unique_ptr<Dso> CreateKernelModuleDso(const std::string& dso_path,
                                                     uint64_t memory_start, uint64_t memory_end,
                                                     Dso* kernel_dso);
+  // Load symbols of dsos in jobs threads, instead of loading them lazily one by one when first
+  // searching symbols. Symbols of the kernel dso are still loaded lazily, because they depend on
+  // how kernel addresses are converted.
+  static void LoadSymbolsInParallel(const std::vector<Dso*>& dsos, size_t jobs);
   virtual ~Dso();
 
   DsoType type() const { return type_; }
@@ -200,6 +243,7 @@ class Dso {
   static size_t dso_count_;
   static uint32_t g_dump_id_;
   static simpleperf_dso_impl::DebugElfFileFinder debug_elf_file_finder_;
+  static simpleperf_dso_impl::SymbolCache symbol_cache_;
 
   Dso(DsoType type, const std::string& path);
   BuildId GetExpectedBuildId() const;
@@ -378,3 +378,85 @@ TEST(dso, demangle) {
   ASSERT_EQ(Dso::Demangle("_RNvC6_123foo3bar"), "123foo::bar");
 #endif
 }
+
+TEST(SymbolCache, write_and_read_symbols) {
+  TemporaryDir tmpdir;
+  SymbolCache cache;
+  ASSERT_TRUE(cache.SetCacheDir(tmpdir.path));
+  BuildId build_id(ELF_FILE_BUILD_ID);
+  std::vector<Symbol> symbols;
+  symbols.emplace_back("_ZN4main4main17h2a68d4d833d7495aE", 0x100, 0x10);
+  symbols.emplace_back("main", 0x200, 0x20);
+  ASSERT_TRUE(cache.WriteSymbols(build_id, "symtab", true, symbols));
+
+  std::vector<Symbol> cached_symbols;
+  ASSERT_TRUE(cache.ReadSymbols(build_id, "symtab", true, &cached_symbols));
+  ASSERT_EQ(cached_symbols.size(), symbols.size());
+  for (size_t i = 0; i < symbols.size(); i++) {
+    ASSERT_EQ(cached_symbols[i].addr, symbols[i].addr);
+    ASSERT_EQ(cached_symbols[i].len, symbols[i].len);
+    ASSERT_STREQ(cached_symbols[i].Name(), symbols[i].Name());
+    ASSERT_STREQ(cached_symbols[i].DemangledName(), symbols[i].DemangledName());
+  }
+  ASSERT_STREQ(cached_symbols[0].DemangledName(), "main::main::h2a68d4d833d7495a");
+
+  // No cache file for other symbol sources.
+  ASSERT_FALSE(cache.ReadSymbols(build_id, "gnu_debugdata", true, &cached_symbols));
+  // No cache file for other build ids.
+  ASSERT_FALSE(cache.ReadSymbols(BuildId("1234"), "symtab", true, &cached_symbols));
+  // Ignore invalid cache files.
+  ASSERT_TRUE(android::base::WriteStringToFile("invalid", cache.GetCacheFilePath(build_id, "symtab")));
+  ASSERT_FALSE(cache.ReadSymbols(build_id, "symtab", true, &cached_symbols));
+}
+
+TEST(dso, symbol_cache_dir) {
+  TemporaryDir tmpdir;
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, GetTestData(ELF_FILE));
+  ASSERT_TRUE(Dso::SetSymbolCacheDir(tmpdir.path));
+  dso->LoadSymbols();
+  const std::vector<Symbol>& symbols = dso->GetSymbols();
+  ASSERT_FALSE(symbols.empty());
+  SymbolCache cache;
+  ASSERT_TRUE(cache.SetCacheDir(tmpdir.path));
+  ASSERT_TRUE(IsRegularFile(cache.GetCacheFilePath(elf_file_build_id, "symtab")));
+  // A second dso reads the same symbols from the cache.
+  std::unique_ptr<Dso> dso2 = Dso::CreateDso(DSO_ELF_FILE, GetTestData(ELF_FILE));
+  dso2->LoadSymbols();
+  const std::vector<Symbol>& cached_symbols = dso2->GetSymbols();
+  ASSERT_EQ(cached_symbols.size(), symbols.size());
+  for (size_t i = 0; i < symbols.size(); i++) {
+    ASSERT_EQ(cached_symbols[i].addr, symbols[i].addr);
+    ASSERT_EQ(cached_symbols[i].len, symbols[i].len);
+    ASSERT_STREQ(cached_symbols[i].Name(), symbols[i].Name());
+  }
+}
+
+TEST(dso, symbol_cache_for_stripped_and_unstripped_files) {
+  // stripped_elf has the same build id as elf, but only has the symbol of main in .gnu_debugdata.
+  auto load_symbols = [](const std::string& filename) {
+    std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, GetTestData(filename));
+    dso->LoadSymbols();
+    std::vector<std::string> names;
+    for (const Symbol& symbol : dso->GetSymbols()) {
+      names.emplace_back(symbol.Name());
+    }
+    return names;
+  };
+  std::vector<std::string> stripped_symbols = load_symbols(STRIPPED_ELF_FILE);
+  std::vector<std::string> unstripped_symbols = load_symbols(ELF_FILE);
+  ASSERT_LT(stripped_symbols.size(), unstripped_symbols.size());
+
+  // Keep a dso alive, so the symbol cache dir isn't reset when the loaded dsos are destroyed.
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, GetTestData(ELF_FILE));
+  TemporaryDir tmpdir;
+  ASSERT_TRUE(Dso::SetSymbolCacheDir(tmpdir.path));
+  for (int i = 0; i < 2; i++) {
+    // Each file gets its own symbols, whichever is loaded first.
+    ASSERT_EQ(load_symbols(STRIPPED_ELF_FILE), stripped_symbols);
+    ASSERT_EQ(load_symbols(ELF_FILE), unstripped_symbols);
+  }
+  SymbolCache cache;
+  ASSERT_TRUE(cache.SetCacheDir(tmpdir.path));
+  ASSERT_TRUE(IsRegularFile(cache.GetCacheFilePath(elf_file_build_id, "symtab")));
+  ASSERT_TRUE(IsRegularFile(cache.GetCacheFilePath(elf_file_build_id, "gnu_debugdata")));
+}
@@ -144,17 +144,53 @@ bool EventFd::ReadCounter(PerfCounter* counter) {
   if (!InnerReadCounter(counter)) {
     return false;
   }
+  TraceCounterValue(counter->value);
+  return true;
+}
+
+bool EventFd::ReadGroupCounters(const std::vector<EventFd*>& group,
+                                std::vector<PerfCounter>* counters) {
+  CHECK(!group.empty());
+  EventFd* leader = group[0];
+  constexpr uint64_t kGroupReadFormat = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                        PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_ID;
+  CHECK_EQ(leader->attr_.read_format & kGroupReadFormat, kGroupReadFormat);
+  // The data layout is: nr, time_enabled, time_running, {value, id} * nr.
+  std::vector<uint64_t> data(3 + 2 * group.size());
+  if (!android::base::ReadFully(leader->perf_event_fd_, data.data(),
+                                data.size() * sizeof(uint64_t))) {
+    PLOG(ERROR) << "ReadGroupCounters from " << leader->Name() << " failed";
+    return false;
+  }
+  if (data[0] != group.size()) {
+    LOG(ERROR) << "ReadGroupCounters from " << leader->Name() << " failed: expect "
+               << group.size() << " counters, but get " << data[0];
+    return false;
+  }
+  counters->resize(group.size());
+  for (size_t i = 0; i < group.size(); ++i) {
+    PerfCounter& counter = (*counters)[i];
+    counter.value = data[3 + 2 * i];
+    counter.time_enabled = data[1];
+    counter.time_running = data[2];
+    counter.id = data[4 + 2 * i];
+    group[i]->id_ = counter.id;
+    group[i]->TraceCounterValue(counter.value);
+  }
+  return true;
+}
+
+void EventFd::TraceCounterValue(uint64_t value) {
   // Trace is always available to systrace if enabled
   if (tid_ > 0) {
     ATRACE_INT64(
         android::base::StringPrintf("%s_tid%d_cpu%d", event_name_.c_str(), tid_, cpu_).c_str(),
-        counter->value - last_counter_value_);
+        value - last_counter_value_);
   } else {
     ATRACE_INT64(android::base::StringPrintf("%s_cpu%d", event_name_.c_str(), cpu_).c_str(),
-                 counter->value - last_counter_value_);
+                 value - last_counter_value_);
   }
-  last_counter_value_ = counter->value;
-  return true;
+  last_counter_value_ = value;
 }
 
 bool EventFd::CreateMappedBuffer(size_t mmap_pages, bool report_error) {
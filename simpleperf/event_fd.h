@@ -65,6 +65,12 @@ class EventFd {
 
   bool ReadCounter(PerfCounter* counter);
 
+  // Read counters of all event files in a group with one read() call. group[0] should be the
+  // group leader, followed by other event files in the order they are added to the group. All
+  // event files should be opened with PERF_FORMAT_GROUP.
+  static bool ReadGroupCounters(const std::vector<EventFd*>& group,
+                                std::vector<PerfCounter>* counters);
+
   // Create mapped buffer used to receive records sent by the kernel.
   // mmap_pages should be power of 2.
   virtual bool CreateMappedBuffer(size_t mmap_pages, bool report_error);
@@ -126,6 +132,7 @@ class EventFd {
         last_counter_value_(0) {}
 
   bool InnerReadCounter(PerfCounter* counter) const;
+  void TraceCounterValue(uint64_t value);
 
   const perf_event_attr attr_;
   int perf_event_fd_;
@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <thread>
 #include <unordered_map>
 
@@ -314,6 +315,12 @@ bool EventSelectionSet::AddEventGroup(const std::vector<std::string>& event_name
   if (cpus_) {
     group.cpus = cpus_.value();
   }
+  if (for_stat_cmd_ && group.selections.size() > 1) {
+    // Read counters of the whole group with one read() call.
+    for (auto& selection : group.selections) {
+      selection.event_attr.read_format |= PERF_FORMAT_GROUP;
+    }
+  }
   groups_.emplace_back(std::move(group));
   UnionSampleType();
   return true;
@@ -644,14 +651,19 @@ bool EventSelectionSet::SetTracepointFilter(const std::string& filter) {
 }
 
 bool EventSelectionSet::OpenEventFilesOnGroup(EventSelectionGroup& group, pid_t tid, int cpu,
-                                              std::string* failed_event_type) {
+                                              std::string* failed_event_type, bool enable_now) {
   std::vector<std::unique_ptr<EventFd>> event_fds;
   // Given a tid and cpu, events on the same group should be all opened
   // successfully or all failed to open.
   EventFd* group_fd = nullptr;
   for (auto& selection : group.selections) {
+    perf_event_attr attr = selection.event_attr;
+    if (enable_now) {
+      attr.disabled = 0;
+      attr.enable_on_exec = 0;
+    }
     std::unique_ptr<EventFd> event_fd = EventFd::OpenEventFile(
-        selection.event_attr, tid, cpu, group_fd, selection.event_type_modifier.name, false);
+        attr, tid, cpu, group_fd, selection.event_type_modifier.name, false);
     if (!event_fd) {
       *failed_event_type = selection.event_type_modifier.name;
       return false;
@@ -708,6 +720,18 @@ bool EventSelectionSet::OpenEventFiles() {
       return false;
     }
 
+    if (for_stat_cmd_ && (group.selections[0].event_attr.read_format & PERF_FORMAT_GROUP)) {
+      // Old kernels don't support PERF_FORMAT_GROUP with inherit. Then read counters one by one.
+      const EventSelection& leader = group.selections[0];
+      if (!IsEventAttrSupported(leader.event_attr, leader.event_type_modifier.name)) {
+        LOG(DEBUG) << "PERF_FORMAT_GROUP isn't supported for event group led by "
+                   << leader.event_type_modifier.name;
+        for (auto& selection : group.selections) {
+          selection.event_attr.read_format &= ~PERF_FORMAT_GROUP;
+        }
+      }
+    }
+
     size_t success_count = 0;
     std::string failed_event_type;
     for (const auto tid : threads) {
@@ -733,6 +757,39 @@ bool EventSelectionSet::OpenEventFiles() {
   return ApplyFilters();
 }
 
+bool EventSelectionSet::OpenEventFilesForNewThreads(const std::vector<pid_t>& tids) {
+  std::vector<int> online_cpus = GetOnlineCpus();
+  for (auto& group : groups_) {
+    const std::vector<int>* pcpus = &group.cpus;
+    if (!group.selections[0].allowed_cpus.empty()) {
+      pcpus = &group.selections[0].allowed_cpus;
+    }
+    if (pcpus->empty()) {
+      pcpus = &online_cpus;
+    }
+    size_t old_fd_count = group.selections[0].event_fds.size();
+    std::string failed_event_type;
+    for (const auto tid : tids) {
+      for (const auto& cpu : *pcpus) {
+        if (!OpenEventFilesOnGroup(group, tid, cpu, &failed_event_type, true)) {
+          LOG(DEBUG) << "failed to open event files for new thread " << tid << " on cpu " << cpu;
+        }
+      }
+    }
+    for (auto& selection : group.selections) {
+      if (!selection.tracepoint_filter.empty()) {
+        for (size_t i = old_fd_count; i < selection.event_fds.size(); ++i) {
+          if (!selection.event_fds[i]->SetFilter(selection.tracepoint_filter)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  threads_.insert(tids.begin(), tids.end());
+  return true;
+}
+
 bool EventSelectionSet::ApplyFilters() {
   return ApplyAddrFilters() && ApplyTracepointFilters();
 }
@@ -807,24 +864,117 @@ static bool ReadCounter(EventFd* event_fd, CounterInfo* counter) {
 }
 
 bool EventSelectionSet::ReadCounters(std::vector<CountersInfo>* counters) {
-  counters->clear();
+  auto start_time = std::chrono::steady_clock::now();
+  counter_read_stat_ = CounterReadStat();
+  // Reuse CountersInfo in [counters], to avoid allocating memory when reading counters
+  // periodically.
+  size_t info_count = 0;
   for (size_t i = 0; i < groups_.size(); ++i) {
-    for (auto& selection : groups_[i].selections) {
-      CountersInfo counters_info;
+    auto& selections = groups_[i].selections;
+    size_t first_info_index = info_count;
+    for (auto& selection : selections) {
+      if (info_count == counters->size()) {
+        counters->emplace_back();
+      }
+      CountersInfo& counters_info = (*counters)[info_count++];
       counters_info.group_id = i;
       counters_info.event_name = selection.event_type_modifier.event_type.name;
       counters_info.event_modifier = selection.event_type_modifier.modifier;
-      counters_info.counters = selection.hotplugged_counters;
-      for (auto& event_fd : selection.event_fds) {
-        CounterInfo counter;
-        if (!ReadCounter(event_fd.get(), &counter)) {
+      counters_info.counters.assign(selection.closed_counters.begin(),
+                                    selection.closed_counters.end());
+    }
+    if (selections[0].event_attr.read_format & PERF_FORMAT_GROUP) {
+      // Event files in a group are opened together for each (tid, cpu). So the event_fds of
+      // each selection in the group have the same size and order.
+      std::vector<EventFd*> group_fds(selections.size());
+      std::vector<PerfCounter> values;
+      for (size_t fd_index = 0; fd_index < selections[0].event_fds.size(); ++fd_index) {
+        for (size_t j = 0; j < selections.size(); ++j) {
+          group_fds[j] = selections[j].event_fds[fd_index].get();
+        }
+        if (!EventFd::ReadGroupCounters(group_fds, &values)) {
+          return false;
+        }
+        counter_read_stat_.read_count++;
+        for (size_t j = 0; j < selections.size(); ++j) {
+          CounterInfo counter;
+          counter.tid = group_fds[j]->ThreadId();
+          counter.cpu = group_fds[j]->Cpu();
+          counter.counter = values[j];
+          (*counters)[first_info_index + j].counters.push_back(counter);
+        }
+        counter_read_stat_.counter_count += selections.size();
+      }
+    } else {
+      for (size_t j = 0; j < selections.size(); ++j) {
+        for (auto& event_fd : selections[j].event_fds) {
+          CounterInfo counter;
+          if (!ReadCounter(event_fd.get(), &counter)) {
+            return false;
+          }
+          counter_read_stat_.read_count++;
+          (*counters)[first_info_index + j].counters.push_back(counter);
+        }
+        counter_read_stat_.counter_count += selections[j].event_fds.size();
+      }
+    }
+  }
+  counters->resize(info_count);
+  counter_read_stat_.read_time_in_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                           std::chrono::steady_clock::now() - start_time)
+                                           .count();
+  return true;
+}
+
+bool EventSelectionSet::CloseEventFilesForExitedThreads(const std::set<pid_t>& tids) {
+  for (auto& group : groups_) {
+    auto& selections = group.selections;
+    std::vector<EventFd*> group_fds(selections.size());
+    std::vector<PerfCounter> values;
+    size_t kept_count = 0;
+    // Event files in a group are opened together for each (tid, cpu). So the event_fds of each
+    // selection in the group have the same size and order.
+    for (size_t fd_index = 0; fd_index < selections[0].event_fds.size(); ++fd_index) {
+      if (tids.count(selections[0].event_fds[fd_index]->ThreadId()) == 0) {
+        if (kept_count != fd_index) {
+          for (auto& selection : selections) {
+            selection.event_fds[kept_count] = std::move(selection.event_fds[fd_index]);
+          }
+        }
+        kept_count++;
+        continue;
+      }
+      if (selections[0].event_attr.read_format & PERF_FORMAT_GROUP) {
+        for (size_t j = 0; j < selections.size(); ++j) {
+          group_fds[j] = selections[j].event_fds[fd_index].get();
+        }
+        if (!EventFd::ReadGroupCounters(group_fds, &values)) {
           return false;
         }
-        counters_info.counters.push_back(counter);
+        for (size_t j = 0; j < selections.size(); ++j) {
+          CounterInfo counter;
+          counter.tid = group_fds[j]->ThreadId();
+          counter.cpu = group_fds[j]->Cpu();
+          counter.counter = values[j];
+          selections[j].closed_counters.push_back(counter);
+        }
+      } else {
+        for (auto& selection : selections) {
+          CounterInfo counter;
+          if (!ReadCounter(selection.event_fds[fd_index].get(), &counter)) {
+            return false;
+          }
+          selection.closed_counters.push_back(counter);
+        }
       }
-      counters->push_back(counters_info);
+    }
+    for (auto& selection : selections) {
+      selection.event_fds.resize(kept_count);
     }
   }
+  for (pid_t tid : tids) {
+    threads_.erase(tid);
+  }
   return true;
 }
 
@@ -837,9 +987,11 @@ bool EventSelectionSet::MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pa
   return true;
 }
 
-bool EventSelectionSet::PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback) {
+bool EventSelectionSet::PrepareToReadMmapEventData(
+    const std::function<bool(Record*)>& callback, const std::function<bool()>& batch_end_callback) {
   // Prepare record callback function.
   record_callback_ = callback;
+  record_batch_end_callback_ = batch_end_callback;
   if (!record_read_thread_->RegisterDataCallback(*loop_,
                                                  [this]() { return ReadMmapEventData(true); })) {
     return false;
@@ -866,9 +1018,26 @@ bool EventSelectionSet::ReadMmapEventData(bool with_time_limit) {
   if (with_time_limit) {
     start_time_in_ns = GetSystemClock();
   }
-  std::unique_ptr<Record> r;
-  while ((r = record_read_thread_->GetRecord()) != nullptr) {
-    if (!record_callback_(r.get())) {
+  // Records in a batch are released when reading the next batch. So check time limit only
+  // between batches.
+  constexpr size_t kRecordBatchSize = 256;
+  while (true) {
+    const std::vector<Record*>& records = record_read_thread_->GetRecordBatch(kRecordBatchSize);
+    if (records.empty()) {
+      break;
+    }
+    bool result = true;
+    for (Record* r : records) {
+      if (!record_callback_(r)) {
+        result = false;
+        break;
+      }
+    }
+    // Always end the batch, so records aren't used after being released.
+    if (record_batch_end_callback_ && !record_batch_end_callback_()) {
+      result = false;
+    }
+    if (!result) {
       return false;
     }
     if (with_time_limit && (GetSystemClock() - start_time_in_ns) >= 1e8) {
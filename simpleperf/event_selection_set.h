@@ -52,6 +52,14 @@ struct CountersInfo {
   std::vector<CounterInfo> counters;
 };
 
+// Cost of reading counters in EventSelectionSet::ReadCounters().
+struct CounterReadStat {
+  size_t counter_count = 0;
+  // Number of read() calls. Counters of an event group are read with one call.
+  size_t read_count = 0;
+  uint64_t read_time_in_ns = 0;
+};
+
 struct SampleRate {
   // There are two ways to set sample rate:
   // 1. sample_freq: take [sample_freq] samples every second.
@@ -164,10 +172,21 @@ class EventSelectionSet {
   IOEventLoop* GetIOEventLoop() { return loop_.get(); }
 
   bool OpenEventFiles();
+  // Open event files for threads created after OpenEventFiles(). The new event files start
+  // counting immediately. Threads exited before being opened are ignored.
+  bool OpenEventFilesForNewThreads(const std::vector<pid_t>& tids);
+  // Close event files of exited threads, to avoid running out of fds when monitoring threads
+  // created and exiting for a long time. Their last counts are still returned by ReadCounters().
+  bool CloseEventFilesForExitedThreads(const std::set<pid_t>& tids);
   bool ReadCounters(std::vector<CountersInfo>* counters);
+  // Return the cost of the last ReadCounters() call.
+  const CounterReadStat& GetCounterReadStat() const { return counter_read_stat_; }
   bool MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pages, size_t aux_buffer_size,
                       size_t record_buffer_size, bool allow_truncating_samples, bool exclude_perf);
-  bool PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback);
+  // [callback] is called for each record read from the RecordBuffer. Records are read in
+  // batches, and are only valid until [batch_end_callback] is called after each batch.
+  bool PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback,
+                                  const std::function<bool()>& batch_end_callback = nullptr);
   bool SyncKernelBuffer();
   bool FinishReadMmapEventData();
   void CloseEventFiles();
@@ -185,8 +204,8 @@ class EventSelectionSet {
     EventTypeAndModifier event_type_modifier;
     perf_event_attr event_attr;
     std::vector<std::unique_ptr<EventFd>> event_fds;
-    // counters for event files closed for cpu hotplug events
-    std::vector<CounterInfo> hotplugged_counters;
+    // counters for event files closed for cpu hotplug events or exited threads
+    std::vector<CounterInfo> closed_counters;
     std::vector<int> allowed_cpus;
     std::string tracepoint_filter;
   };
@@ -207,7 +226,7 @@ class EventSelectionSet {
   void UnionSampleType();
   void SetSampleRateForGroup(EventSelectionGroup& group, const SampleRate& rate);
   bool OpenEventFilesOnGroup(EventSelectionGroup& group, pid_t tid, int cpu,
-                             std::string* failed_event_type);
+                             std::string* failed_event_type, bool enable_now = false);
   bool ApplyFilters();
   bool ApplyAddrFilters();
   bool ApplyTracepointFilters();
@@ -224,6 +243,7 @@ class EventSelectionSet {
 
   std::unique_ptr<IOEventLoop> loop_;
   std::function<bool(Record*)> record_callback_;
+  std::function<bool()> record_batch_end_callback_;
 
   std::unique_ptr<simpleperf::RecordReadThread> record_read_thread_;
 
@@ -231,6 +251,7 @@ class EventSelectionSet {
   std::vector<AddrFilter> addr_filters_;
   std::optional<SampleRate> sample_rate_;
   std::optional<std::vector<int>> cpus_;
+  CounterReadStat counter_read_stat_;
 
   DISALLOW_COPY_AND_ASSIGN(EventSelectionSet);
 };
@@ -16,6 +16,9 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <thread>
+
 #include "event_selection_set.h"
 
 using namespace simpleperf;
@@ -92,3 +95,66 @@ TEST(EventSelectionSet, set_cpus_for_new_events) {
   ASSERT_EQ(attrs[3].ids.size(), 1);
   ASSERT_EQ(get_cpu(attrs[3].ids[0]), online_cpus.back());
 }
+
+TEST(EventSelectionSet, read_counters_of_group_in_one_call) {
+  EventSelectionSet event_selection_set(true);
+  ASSERT_TRUE(event_selection_set.AddEventGroup({"context-switches", "page-faults"}));
+  event_selection_set.AddMonitoredThreads({gettid()});
+  ASSERT_TRUE(event_selection_set.OpenEventFiles());
+  std::vector<CountersInfo> counters;
+  ASSERT_TRUE(event_selection_set.ReadCounters(&counters));
+  ASSERT_EQ(counters.size(), 2);
+  ASSERT_EQ(counters[0].counters.size(), counters[1].counters.size());
+  ASSERT_FALSE(counters[0].counters.empty());
+  for (size_t i = 0; i < counters[0].counters.size(); ++i) {
+    const CounterInfo& c0 = counters[0].counters[i];
+    const CounterInfo& c1 = counters[1].counters[i];
+    ASSERT_EQ(c0.tid, c1.tid);
+    ASSERT_EQ(c0.cpu, c1.cpu);
+    ASSERT_NE(c0.counter.id, c1.counter.id);
+  }
+  const CounterReadStat& stat = event_selection_set.GetCounterReadStat();
+  ASSERT_EQ(stat.counter_count, counters[0].counters.size() * 2);
+  ASSERT_EQ(stat.read_count, counters[0].counters.size());
+}
+
+TEST(EventSelectionSet, close_event_files_for_exited_threads) {
+  EventSelectionSet event_selection_set(true);
+  ASSERT_TRUE(event_selection_set.AddEventType("task-clock"));
+  event_selection_set.AddMonitoredThreads({gettid()});
+  ASSERT_TRUE(event_selection_set.OpenEventFiles());
+  std::atomic<pid_t> thread_tid(0);
+  std::atomic<bool> stop(false);
+  std::thread thread([&]() {
+    thread_tid = gettid();
+    while (!stop) {
+      usleep(1000);
+    }
+  });
+  while (thread_tid == 0) {
+    usleep(1000);
+  }
+  pid_t tid = thread_tid;
+  bool opened = event_selection_set.OpenEventFilesForNewThreads({tid});
+  stop = true;
+  thread.join();
+  ASSERT_TRUE(opened);
+  std::vector<CountersInfo> counters;
+  ASSERT_TRUE(event_selection_set.ReadCounters(&counters));
+  ASSERT_EQ(counters.size(), 1);
+  size_t counter_count = counters[0].counters.size();
+  size_t read_count = event_selection_set.GetCounterReadStat().read_count;
+
+  // Counters of the exited thread are still reported, without reading its event files.
+  ASSERT_TRUE(event_selection_set.CloseEventFilesForExitedThreads({tid}));
+  ASSERT_TRUE(event_selection_set.ReadCounters(&counters));
+  ASSERT_EQ(counters[0].counters.size(), counter_count);
+  ASSERT_LT(event_selection_set.GetCounterReadStat().read_count, read_count);
+  size_t exited_thread_counters = 0;
+  for (const auto& counter : counters[0].counters) {
+    if (counter.tid == tid) {
+      exited_thread_counters++;
+    }
+  }
+  ASSERT_GT(exited_thread_counters, 0);
+}
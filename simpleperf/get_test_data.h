@@ -30,6 +30,8 @@ const std::string& GetTestDataDir();
 static const std::string ELF_FILE = "elf";
 static const std::string ELF_FILE_BUILD_ID = "0b12a384a9f4a3f3659b7171ca615dbec3a81f71";
 static const std::string ELF_FILE_WITH_MINI_DEBUG_INFO = "elf_with_mini_debug_info";
+// stripped_elf is elf stripped, with a .gnu_debugdata section only having the symbol of main.
+static const std::string STRIPPED_ELF_FILE = "stripped_elf";
 // perf.data is generated by sampling on three processes running different
 // executables: elf, t1, t2 (all generated by elf_file_source.cpp, but with different
 // executable name).
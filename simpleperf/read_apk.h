@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <unordered_map>
@@ -78,6 +79,8 @@ class ApkInspector {
     // Map from entry_name to EmbeddedElf.
     std::unordered_map<std::string, EmbeddedElf*> name_map;
   };
+  // Guards embedded_elf_cache_, as symbols of dsos can be loaded in parallel.
+  static std::mutex embedded_elf_cache_lock_;
   static std::unordered_map<std::string, ApkNode> embedded_elf_cache_;
 };
 
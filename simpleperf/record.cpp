@@ -73,6 +73,7 @@ static std::string RecordTypeToString(int record_type) {
       {SIMPLE_PERF_RECORD_UNWINDING_RESULT, "unwinding_result"},
       {SIMPLE_PERF_RECORD_TRACING_DATA, "tracing_data"},
       {SIMPLE_PERF_RECORD_DEBUG, "debug"},
+      {SIMPLE_PERF_RECORD_COMPRESSED, "compressed"},
   };
 
   auto it = record_type_names.find(record_type);
@@ -220,6 +221,15 @@ bool Record::ParseHeader(char*& p, char*& end) {
   return true;
 }
 
+bool Record::ParseInPlace(const perf_event_attr& attr, char* p, char* end) {
+  if (own_binary_) {
+    delete[] binary_;
+    own_binary_ = false;
+  }
+  binary_ = nullptr;
+  return Parse(attr, p, end);
+}
+
 void Record::Dump(size_t indent) const {
   PrintIndented(indent, "record %s: type %u, misc 0x%x, size %u\n",
                 RecordTypeToString(type()).c_str(), type(), misc(), size());
@@ -1636,6 +1646,45 @@ void DebugRecord::DumpData(size_t indent) const {
   PrintIndented(indent, "s %s\n", s);
 }
 
+CompressedRecord::CompressedRecord(uint32_t uncompressed_size, const char* compressed_data,
+                                   uint32_t compressed_size) {
+  SetTypeAndMisc(SIMPLE_PERF_RECORD_COMPRESSED, 0);
+  uint32_t size = header_size() + sizeof(uint32_t) * 2 + Align(compressed_size, sizeof(uint64_t));
+  SetSize(size);
+  char* new_binary = new char[size];
+  char* p = new_binary;
+  MoveToBinaryFormat(header, p);
+  MoveToBinaryFormat(uncompressed_size, p);
+  MoveToBinaryFormat(compressed_size, p);
+  this->uncompressed_size = uncompressed_size;
+  this->compressed_size = compressed_size;
+  data = p;
+  MoveToBinaryFormat(compressed_data, compressed_size, p);
+  memset(p, 0, new_binary + size - p);
+  UpdateBinary(new_binary);
+}
+
+bool CompressedRecord::Parse(const perf_event_attr&, char* p, char* end) {
+  if (!ParseHeader(p, end)) {
+    return false;
+  }
+  CHECK_SIZE(p, end, sizeof(uint32_t) * 2);
+  MoveFromBinaryFormat(uncompressed_size, p);
+  MoveFromBinaryFormat(compressed_size, p);
+  CHECK_SIZE(p, end, compressed_size);
+  data = p;
+  return true;
+}
+
+bool CompressedRecord::Decompress(std::vector<char>* buf) const {
+  return ZlibDecompress(data, compressed_size, uncompressed_size, buf);
+}
+
+void CompressedRecord::DumpData(size_t indent) const {
+  PrintIndented(indent, "uncompressed_size %u\n", uncompressed_size);
+  PrintIndented(indent, "compressed_size %u\n", compressed_size);
+}
+
 bool UnknownRecord::Parse(const perf_event_attr&, char* p, char* end) {
   if (!ParseHeader(p, end)) {
     return false;
@@ -1713,6 +1762,9 @@ std::unique_ptr<Record> ReadRecordFromBuffer(const perf_event_attr& attr, uint32
     case SIMPLE_PERF_RECORD_DEBUG:
       r.reset(new DebugRecord);
       break;
+    case SIMPLE_PERF_RECORD_COMPRESSED:
+      r.reset(new CompressedRecord);
+      break;
     default:
       r.reset(new UnknownRecord);
       break;
@@ -57,6 +57,7 @@ enum user_record_type {
   SIMPLE_PERF_RECORD_UNWINDING_RESULT,
   SIMPLE_PERF_RECORD_TRACING_DATA,
   SIMPLE_PERF_RECORD_DEBUG,
+  SIMPLE_PERF_RECORD_COMPRESSED,
 };
 
 // perf_event_header uses u16 to store record size. However, that is not
@@ -240,6 +241,10 @@ struct Record {
 
   virtual bool Parse(const perf_event_attr& attr, char* p, char* end) = 0;
 
+  // Parse a new binary into this record object, so the object can be reused to read many records
+  // of the same type without allocation. The record doesn't own the new binary.
+  bool ParseInPlace(const perf_event_attr& attr, char* p, char* end);
+
   void OwnBinary() { own_binary_ = true; }
 
   uint32_t type() const { return header.type; }
@@ -688,6 +693,27 @@ struct DebugRecord : public Record {
   void DumpData(size_t indent) const override;
 };
 
+// CompressedRecord stores a block of records compressed with zlib. It is written in the data
+// section when recording with -z. The size of a compressed record never exceeds 65535, so it
+// doesn't need to be split.
+struct CompressedRecord : public Record {
+  uint32_t uncompressed_size = 0;
+  uint32_t compressed_size = 0;
+  const char* data = nullptr;
+
+  CompressedRecord() {}
+
+  CompressedRecord(uint32_t uncompressed_size, const char* compressed_data,
+                   uint32_t compressed_size);
+
+  bool Parse(const perf_event_attr& attr, char* p, char* end) override;
+  // Decompress the records stored in this record into buf.
+  bool Decompress(std::vector<char>* buf) const;
+
+ protected:
+  void DumpData(size_t indent) const override;
+};
+
 // UnknownRecord is used for unknown record types, it makes sure all unknown
 // records are not changed when modifying perf.data.
 struct UnknownRecord : public Record {
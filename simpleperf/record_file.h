@@ -28,6 +28,7 @@
 #include <vector>
 
 #include <android-base/macros.h>
+#include <android-base/mapped_file.h>
 
 #include "dso.h"
 #include "event_attr.h"
@@ -39,6 +40,8 @@
 
 namespace simpleperf {
 
+class RecordCompressor;
+
 struct FileFeature {
   std::string path;
   DsoType type;
@@ -70,6 +73,20 @@ struct DebugUnwindFile {
 
 using DebugUnwindFeature = std::vector<DebugUnwindFile>;
 
+// The time index splits the data section into blocks, and records the time range of records in
+// each block. With offsets of non-sample records, which update thread and map states, it allows
+// reading records in a time range without reading the whole data section.
+struct TimeIndexBlock {
+  uint64_t data_offset;
+  uint64_t min_time;
+  uint64_t max_time;
+};
+
+struct TimeIndexFeature {
+  std::vector<TimeIndexBlock> blocks;
+  std::vector<uint64_t> state_record_offsets;
+};
+
 // RecordFileWriter writes to a perf record file, like perf.data.
 // User should call RecordFileWriter::Close() to finish writing the file, otherwise the file will
 // be removed in RecordFileWriter::~RecordFileWriter().
@@ -84,10 +101,25 @@ class RecordFileWriter {
   bool WriteAttrSection(const EventAttrIds& attr_ids);
   bool WriteRecord(const Record& record);
   bool WriteData(const void* buf, size_t len);
+  // Like WriteRecord(), but the record data isn't copied. Records added are written together
+  // in FlushRecordBatch(), using a single writev() call on Linux. So the record data should stay
+  // valid until FlushRecordBatch() is called. Other writes flush the batch first.
+  bool AddRecordToBatch(const Record& record);
+  bool FlushRecordBatch();
 
   uint64_t GetDataSectionSize() const { return data_section_size_; }
   bool ReadDataSection(const std::function<void(const Record*)>& callback);
 
+  // Build a time index of the data section in ReadDataSection(), and write it in the time_index
+  // feature section in EndWriteFeatures(). The feature section isn't counted in the feature
+  // count passed to BeginWriteFeatures().
+  void EnableTimeIndex();
+
+  // Compress records written by WriteRecord() with zlib on a background thread, and write them
+  // as CompressedRecords in the data section. ReadDataSection() and RecordFileReader decompress
+  // them transparently. It can't be used together with the time index.
+  void EnableCompression();
+
   bool BeginWriteFeatures(size_t feature_count);
   bool WriteBuildIdFeature(const std::vector<BuildIdRecord>& build_id_records);
   bool WriteFeatureString(int feature, const std::string& s);
@@ -108,12 +140,17 @@ class RecordFileWriter {
                              std::vector<std::string>* hit_kernel_modules,
                              std::vector<std::string>* hit_user_files);
   bool WriteFileHeader();
+  bool AppendToDataSection(const void* buf, size_t len);
+  bool WriteCompressedBlocks(size_t max_pending_blocks);
+  bool FlushCompressedRecords();
   bool Write(const void* buf, size_t len);
   bool Read(void* buf, size_t len);
   bool GetFilePos(uint64_t* file_pos);
   bool WriteStringWithLength(const std::string& s);
   bool WriteFeatureBegin(int feature);
   bool WriteFeatureEnd(int feature);
+  void AddRecordToTimeIndex(const Record& record, uint64_t data_offset);
+  bool WriteTimeIndexFeature();
 
   const std::string filename_;
   FILE* record_fp_;
@@ -129,6 +166,16 @@ class RecordFileWriter {
   std::map<int, PerfFileFormat::SectionDesc> features_;
   size_t feature_count_;
 
+  bool build_time_index_ = false;
+  TimeIndexFeature time_index_;
+
+  // Data of records added by AddRecordToBatch().
+  std::vector<std::pair<const char*, size_t>> record_batch_;
+
+  std::unique_ptr<RecordCompressor> compressor_;
+  // Records waiting to be added to compressor_ as a block.
+  std::vector<char> compress_buf_;
+
   DISALLOW_COPY_AND_ASSIGN(RecordFileWriter);
 };
 
@@ -163,6 +210,30 @@ class RecordFileReader {
   bool ReadDataSection(const std::function<bool(std::unique_ptr<Record>)>& callback);
   bool ReadAtOffset(uint64_t offset, void* buf, size_t len);
 
+  // Like ReadDataSection(), but the data section is mapped into memory and records are parsed in
+  // place. The Record passed to [callback] is borrowed from the reader. It points into the mapped
+  // data and is only valid until [callback] returns. Record objects are reused between calls, so
+  // no allocation is needed per record. Fall back to ReadDataSection() if mapping fails.
+  bool ReadDataSectionInPlace(const std::function<bool(const Record&)>& callback);
+
+  // Like ReadDataSectionInPlace(), but records are parsed in place on a separate thread, and
+  // passed in batches to [callback] on the calling thread. So reading and parsing records overlaps
+  // with processing them. The Record passed to [callback] is only valid until [callback] returns.
+  // As the event id map is updated on the reading thread, [callback] also gets the attr index of
+  // each record, and shouldn't call GetAttrIndexOfRecord().
+  bool ReadDataSectionInBackground(
+      const std::function<bool(const Record&, size_t attr_index)>& callback);
+
+  // Read records in time range [start_time, end_time) using the time index feature section.
+  // Non-sample records before the blocks overlapping the time range are passed to
+  // [state_callback] first, so the state (like a ThreadTree) can be rebuilt as it is at the start
+  // of the time range. Then records in those blocks are passed to [callback], with samples out
+  // of the time range skipped.
+  bool ReadDataSectionInTimeRange(
+      uint64_t start_time, uint64_t end_time,
+      const std::function<bool(std::unique_ptr<Record>)>& state_callback,
+      const std::function<bool(std::unique_ptr<Record>)>& callback);
+
   // Read next record. If read successfully, set [record] and return true.
   // If there is no more records, set [record] to nullptr and return true.
   // Otherwise return false.
@@ -186,6 +257,7 @@ class RecordFileReader {
   const std::unordered_map<std::string, std::string>& GetMetaInfoFeature() { return meta_info_; }
   std::string GetClockId();
   std::optional<DebugUnwindFeature> ReadDebugUnwindFeature();
+  std::optional<TimeIndexFeature> ReadTimeIndexFeature();
 
   bool LoadBuildIdAndFileFeatures(ThreadTree& thread_tree);
 
@@ -214,6 +286,17 @@ class RecordFileReader {
   bool ReadMetaInfoFeature();
   void UseRecordingEnvironment();
   std::unique_ptr<Record> ReadRecord();
+  std::unique_ptr<Record> ReadDecompressedRecord();
+  bool SeekToDataOffset(uint64_t data_offset);
+  const perf_event_attr& GetAttrOfRecordBinary(uint32_t type, uint32_t size, const char* p);
+  bool MapDataSection();
+  Record* ParseRecordInPlace(std::unique_ptr<Record>& r, uint32_t type, char* p, char* end);
+  // Parse records in the mapped data section with [parse], and pass them to [callback]. Records
+  // merged from SPLIT records or decompressed are in reused buffers. If [keep_buffer] is set,
+  // it is called to take such a buffer after its records are passed to [callback].
+  bool ReadMappedRecords(const std::function<Record*(uint32_t type, char* p, char* end)>& parse,
+                         const std::function<bool(Record*)>& callback,
+                         const std::function<void(std::vector<char>& buf)>& keep_buffer);
   bool Read(void* buf, size_t len);
   void ProcessEventIdRecord(const EventIdRecord& r);
   bool BuildAuxDataLocation();
@@ -232,6 +315,17 @@ class RecordFileReader {
 
   uint64_t read_record_size_;
 
+  // Records decompressed from a CompressedRecord, and the position of the next record to read.
+  std::vector<char> decompressed_records_;
+  size_t decompressed_records_pos_ = 0;
+
+  // Used by ReadDataSectionInPlace() and ReadDataSectionInBackground().
+  std::unique_ptr<android::base::MappedFile> data_section_map_;
+  // Record objects reused to parse records in place, indexed by record type.
+  std::unordered_map<uint32_t, std::unique_ptr<Record>> in_place_records_;
+  // Buffer used to merge SPLIT records.
+  std::vector<char> split_record_buf_;
+
   std::unordered_map<std::string, std::string> meta_info_;
   std::unique_ptr<ScopedCurrentArch> scoped_arch_;
   std::unique_ptr<ScopedEventTypes> scoped_event_types_;
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+#include "record.h"
+#include "record_file.h"
+
+using namespace simpleperf;
+
+static constexpr size_t kMapCount = 1000;
+static constexpr uint64_t kMapSize = 0x10000;
+
+// Writes a record file with sample_count samples having callchains, similar to a recording of
+// a busy app with --call-graph fp.
+static bool CreateRecordFile(const std::string& path, size_t sample_count) {
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(path);
+  std::unique_ptr<EventTypeAndModifier> event_type = ParseEventType("cpu-clock");
+  if (!writer || !event_type) {
+    return false;
+  }
+  EventAttrIds attr_ids(1);
+  attr_ids[0].attr = CreateDefaultPerfEventAttr(event_type->event_type);
+  attr_ids[0].attr.sample_id_all = 1;
+  attr_ids[0].attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+  attr_ids[0].ids.push_back(0);
+  if (!writer->WriteAttrSection(attr_ids)) {
+    return false;
+  }
+  const perf_event_attr& attr = attr_ids[0].attr;
+  for (size_t i = 0; i < kMapCount; i++) {
+    MmapRecord r(attr, false, 1, 1, i * kMapSize, kMapSize, 0, "/system/lib64/lib.so", 0);
+    if (!writer->WriteRecord(r)) {
+      return false;
+    }
+  }
+  srand(0);
+  for (size_t i = 0; i < sample_count; i++) {
+    std::vector<uint64_t> ips(1 + rand() % 32);
+    for (auto& ip : ips) {
+      ip = rand() % (kMapCount * kMapSize);
+    }
+    SampleRecord r(attr, 0, ips[0], 1, 1 + rand() % 8, i, 0, 1, {}, ips, {}, 0);
+    if (!writer->WriteRecord(r)) {
+      return false;
+    }
+  }
+  return writer->Close();
+}
+
+// Does work similar to building a report for each sample: finding the map of each ip in the
+// callchain, and accumulating the period of each (map, ip) entry.
+class FakeReportBuilder {
+ public:
+  FakeReportBuilder() {
+    for (size_t i = 0; i < kMapCount; i++) {
+      maps_[i * kMapSize] = i;
+    }
+  }
+
+  bool ProcessRecord(const Record& record) {
+    if (record.type() != PERF_RECORD_SAMPLE) {
+      return true;
+    }
+    const auto& r = static_cast<const SampleRecord&>(record);
+    size_t kernel_ip_count;
+    for (uint64_t ip : r.GetCallChain(&kernel_ip_count)) {
+      auto it = maps_.upper_bound(ip);
+      if (it != maps_.begin()) {
+        --it;
+        entries_[(it->second << 32) | (ip - it->first)] += r.period_data.period;
+      }
+    }
+    return true;
+  }
+
+  size_t EntryCount() const { return entries_.size(); }
+
+ private:
+  std::map<uint64_t, size_t> maps_;
+  std::unordered_map<uint64_t, uint64_t> entries_;
+};
+
+// Reads a record file and builds a fake report. Arg is 0 for reading with
+// ReadDataSectionInPlace(), and 1 for reading with ReadDataSectionInBackground() (report
+// --pipeline).
+static void BM_ReadDataSection(benchmark::State& state) {
+  TemporaryFile tmpfile;
+  close(tmpfile.release());
+  if (!CreateRecordFile(tmpfile.path, 500000)) {
+    state.SkipWithError("failed to create record file");
+    return;
+  }
+  bool in_background = state.range(0) != 0;
+  for (auto _ : state) {
+    std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile.path);
+    FakeReportBuilder builder;
+    bool result = false;
+    if (reader) {
+      if (in_background) {
+        result = reader->ReadDataSectionInBackground(
+            [&](const Record& r, size_t) { return builder.ProcessRecord(r); });
+      } else {
+        result = reader->ReadDataSectionInPlace(
+            [&](const Record& r) { return builder.ProcessRecord(r); });
+      }
+    }
+    if (!result) {
+      state.SkipWithError("failed to read record file");
+      return;
+    }
+    benchmark::DoNotOptimize(builder.EntryCount());
+  }
+}
+BENCHMARK(BM_ReadDataSection)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -85,6 +85,17 @@ file2 feature section (used to replace file feature section):
 
 etm_branch_list feature section:
   ETMBranchList etm_branch_list;  // from etm_branch_list.proto
+
+time_index feature section:
+  uint64_t block_count;
+  struct {
+    uint64_t data_offset;  // offset of the first record of the block in the data section
+    uint64_t min_time;     // min timestamp of records in the block
+    uint64_t max_time;     // max timestamp of records in the block
+  } blocks[block_count];   // sorted by data_offset, covering the whole data section
+  uint64_t state_record_count;
+  uint64_t state_record_offsets[state_record_count];  // offsets of non-sample records in the
+                                                      // data section, sorted
 */
 
 namespace simpleperf {
@@ -120,6 +131,7 @@ enum {
   FEAT_DEBUG_UNWIND_FILE,
   FEAT_FILE2,
   FEAT_ETM_BRANCH_LIST,
+  FEAT_TIME_INDEX,
   FEAT_MAX_NUM = 256,
 };
 
@@ -19,8 +19,13 @@
 #include <fcntl.h>
 #include <string.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <set>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -61,6 +66,7 @@ static const std::map<int, std::string> feature_name_map = {
     {FEAT_DEBUG_UNWIND_FILE, "debug_unwind_file"},
     {FEAT_FILE2, "file2"},
     {FEAT_ETM_BRANCH_LIST, "etm_branch_list"},
+    {FEAT_TIME_INDEX, "time_index"},
 };
 
 std::string GetFeatureName(int feature_id) {
@@ -278,26 +284,311 @@ bool RecordFileReader::ReadDataSection(
   return false;
 }
 
+bool RecordFileReader::ReadDataSectionInBackground(
+    const std::function<bool(const Record&, size_t attr_index)>& callback) {
+  if (header_.data.size == 0) {
+    return true;
+  }
+  if (!MapDataSection()) {
+    return ReadDataSection([&](std::unique_ptr<Record> r) {
+      return callback(*r, GetAttrIndexOfRecord(r.get()));
+    });
+  }
+  // Records are parsed in place on the reading thread, and passed to the calling thread in
+  // batches to reduce synchronization cost. Batches are recycled after being processed, so
+  // Record objects are reused like in ReadDataSectionInPlace(). The number of batches is limited,
+  // to bound memory used when the reading thread runs ahead.
+  constexpr size_t kRecordsPerBatch = 1024;
+  constexpr size_t kMaxBatches = 16;
+
+  struct RecordPool {
+    std::vector<std::unique_ptr<Record>> records;
+    size_t used = 0;
+  };
+  struct RecordBatch {
+    std::vector<std::pair<Record*, size_t>> records;
+    // Record objects used to parse records in place, by record type.
+    std::unordered_map<uint32_t, RecordPool> record_pools;
+    // Buffers holding merged SPLIT records and decompressed records. As batches are processed
+    // in order, a buffer can be kept by the batch containing the last record using it.
+    std::vector<std::vector<char>> buffers;
+
+    void Clear() {
+      records.clear();
+      for (auto& [_, pool] : record_pools) {
+        pool.used = 0;
+      }
+      buffers.clear();
+    }
+  };
+
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<std::unique_ptr<RecordBatch>> pending_batches;
+  std::vector<std::unique_ptr<RecordBatch>> free_batches;
+  size_t batch_count = 0;
+  bool read_finished = false;
+  bool read_result = true;
+  bool stop_reading = false;
+
+  auto get_free_batch = [&]() -> std::unique_ptr<RecordBatch> {
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait(guard, [&]() {
+      return stop_reading || !free_batches.empty() || batch_count < kMaxBatches;
+    });
+    if (stop_reading) {
+      return nullptr;
+    }
+    if (!free_batches.empty()) {
+      std::unique_ptr<RecordBatch> batch = std::move(free_batches.back());
+      free_batches.pop_back();
+      return batch;
+    }
+    batch_count++;
+    auto batch = std::make_unique<RecordBatch>();
+    batch->records.reserve(kRecordsPerBatch);
+    return batch;
+  };
+
+  auto push_batch = [&](std::unique_ptr<RecordBatch> batch) {
+    std::lock_guard<std::mutex> guard(lock);
+    pending_batches.emplace_back(std::move(batch));
+    cond.notify_all();
+  };
+
+  std::thread read_thread([&]() {
+    // A full batch is pushed only when the next record is parsed. So a buffer passed to
+    // [keep_buffer] after its last record is always kept by the batch holding that record.
+    std::unique_ptr<RecordBatch> batch = get_free_batch();
+    bool result =
+        batch && ReadMappedRecords(
+                     [&](uint32_t type, char* p, char* end) -> Record* {
+                       if (batch->records.size() == kRecordsPerBatch) {
+                         push_batch(std::move(batch));
+                         batch = get_free_batch();
+                         if (!batch) {
+                           return nullptr;
+                         }
+                       }
+                       RecordPool& pool = batch->record_pools[type];
+                       if (pool.used == pool.records.size()) {
+                         pool.records.emplace_back();
+                       }
+                       return ParseRecordInPlace(pool.records[pool.used++], type, p, end);
+                     },
+                     [&](Record* r) {
+                       batch->records.emplace_back(r, GetAttrIndexOfRecord(r));
+                       return true;
+                     },
+                     [&](std::vector<char>& buf) { batch->buffers.emplace_back(std::move(buf)); });
+    // Push the last batch even after an error, as it may keep buffers used by records in batches
+    // already pushed.
+    if (batch && (!batch->records.empty() || !batch->buffers.empty())) {
+      push_batch(std::move(batch));
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    read_finished = true;
+    read_result = result;
+    cond.notify_all();
+  });
+
+  bool result = true;
+  while (true) {
+    std::unique_ptr<RecordBatch> batch;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cond.wait(guard, [&]() { return read_finished || !pending_batches.empty(); });
+      if (pending_batches.empty()) {
+        result = read_result;
+        break;
+      }
+      batch = std::move(pending_batches.front());
+      pending_batches.pop_front();
+    }
+    for (auto& [record, attr_index] : batch->records) {
+      if (!callback(*record, attr_index)) {
+        result = false;
+        break;
+      }
+    }
+    batch->Clear();
+    std::lock_guard<std::mutex> guard(lock);
+    if (!result) {
+      stop_reading = true;
+      cond.notify_all();
+      break;
+    }
+    free_batches.emplace_back(std::move(batch));
+    cond.notify_all();
+  }
+  read_thread.join();
+  return result;
+}
+
+bool RecordFileReader::SeekToDataOffset(uint64_t data_offset) {
+  if (fseek(record_fp_, header_.data.offset + data_offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  read_record_size_ = data_offset;
+  return true;
+}
+
+bool RecordFileReader::ReadDataSectionInTimeRange(
+    uint64_t start_time, uint64_t end_time,
+    const std::function<bool(std::unique_ptr<Record>)>& state_callback,
+    const std::function<bool(std::unique_ptr<Record>)>& callback) {
+  std::optional<TimeIndexFeature> time_index = ReadTimeIndexFeature();
+  if (!time_index) {
+    LOG(ERROR) << filename_ << " doesn't have a valid time index";
+    return false;
+  }
+  const std::vector<TimeIndexBlock>& blocks = time_index->blocks;
+  size_t first_block = blocks.size();
+  size_t last_block = 0;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (blocks[i].min_time < end_time && blocks[i].max_time >= start_time) {
+      first_block = std::min(first_block, i);
+      last_block = i;
+    }
+  }
+  if (first_block == blocks.size()) {
+    return true;
+  }
+  uint64_t range_start = blocks[first_block].data_offset;
+  uint64_t range_end =
+      (last_block + 1 < blocks.size()) ? blocks[last_block + 1].data_offset : header_.data.size;
+
+  // Reading stops at the end of the range, so the reading position needs to be reset at the end
+  // for following ReadRecord() calls.
+  bool result = [&]() {
+    // Replay state records in one forward pass from the start of the data section. Short gaps
+    // between them are read through rather than seeked over, so the stdio buffer keeps being used.
+    // Only long gaps (mostly runs of samples) are skipped with fseek().
+    constexpr uint64_t kMaxReadThroughSize = 64 * 1024;
+    std::vector<char> skip_buf;
+    auto skip_to = [&](uint64_t offset) {
+      if (offset < read_record_size_) {
+        LOG(ERROR) << "invalid record offset in time index of " << filename_;
+        return false;
+      }
+      uint64_t gap = offset - read_record_size_;
+      if (gap > kMaxReadThroughSize) {
+        return SeekToDataOffset(offset);
+      }
+      skip_buf.resize(gap);
+      if (!Read(skip_buf.data(), gap)) {
+        return false;
+      }
+      read_record_size_ = offset;
+      return true;
+    };
+    if (!SeekToDataOffset(0)) {
+      return false;
+    }
+    for (uint64_t offset : time_index->state_record_offsets) {
+      if (offset >= range_start) {
+        break;
+      }
+      if (!skip_to(offset)) {
+        return false;
+      }
+      std::unique_ptr<Record> r = ReadRecord();
+      if (!r) {
+        return false;
+      }
+      if (r->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+        ProcessEventIdRecord(*static_cast<EventIdRecord*>(r.get()));
+      }
+      if (!state_callback(std::move(r))) {
+        return false;
+      }
+    }
+    if (!skip_to(range_start)) {
+      return false;
+    }
+    while (read_record_size_ < range_end) {
+      std::unique_ptr<Record> r = ReadRecord();
+      if (!r) {
+        return false;
+      }
+      if (r->type() == SIMPLE_PERF_RECORD_COMPRESSED) {
+        LOG(ERROR) << "time index doesn't support compressed records";
+        return false;
+      }
+      if (r->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+        ProcessEventIdRecord(*static_cast<EventIdRecord*>(r.get()));
+      } else if (r->type() == PERF_RECORD_SAMPLE) {
+        uint64_t time = r->Timestamp();
+        if (time < start_time || time >= end_time) {
+          continue;
+        }
+      }
+      if (!callback(std::move(r))) {
+        return false;
+      }
+    }
+    return true;
+  }();
+  read_record_size_ = 0;
+  return result;
+}
+
 bool RecordFileReader::ReadRecord(std::unique_ptr<Record>& record) {
   if (read_record_size_ == 0) {
     if (fseek(record_fp_, header_.data.offset, SEEK_SET) != 0) {
       PLOG(ERROR) << "fseek() failed";
       return false;
     }
+    decompressed_records_.clear();
+    decompressed_records_pos_ = 0;
   }
   record = nullptr;
-  if (read_record_size_ < header_.data.size) {
+  if (decompressed_records_pos_ < decompressed_records_.size()) {
+    record = ReadDecompressedRecord();
+  } else if (read_record_size_ < header_.data.size) {
     record = ReadRecord();
-    if (record == nullptr) {
-      return false;
-    }
-    if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
-      ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
+    if (record && record->type() == SIMPLE_PERF_RECORD_COMPRESSED) {
+      if (!static_cast<CompressedRecord*>(record.get())->Decompress(&decompressed_records_)) {
+        return false;
+      }
+      decompressed_records_pos_ = 0;
+      return ReadRecord(record);
     }
+  } else {
+    return true;
+  }
+  if (record == nullptr) {
+    return false;
+  }
+  if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+    ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
   }
   return true;
 }
 
+std::unique_ptr<Record> RecordFileReader::ReadDecompressedRecord() {
+  char* p = decompressed_records_.data() + decompressed_records_pos_;
+  size_t left = decompressed_records_.size() - decompressed_records_pos_;
+  RecordHeader header;
+  if (left < Record::header_size() || !header.Parse(p) || header.size > left ||
+      header.type == PERF_RECORD_AUXTRACE || header.type == SIMPLE_PERF_RECORD_COMPRESSED) {
+    LOG(ERROR) << "invalid record in a compressed record in " << filename_;
+    return nullptr;
+  }
+  decompressed_records_pos_ += header.size;
+  std::unique_ptr<char[]> binary(new char[header.size]);
+  memcpy(binary.get(), p, header.size);
+  const perf_event_attr& attr = GetAttrOfRecordBinary(header.type, header.size, binary.get());
+  auto r = ReadRecordFromBuffer(attr, header.type, binary.get(), binary.get() + header.size);
+  if (!r) {
+    return nullptr;
+  }
+  binary.release();
+  r->OwnBinary();
+  return r;
+}
+
 std::unique_ptr<Record> RecordFileReader::ReadRecord() {
   char header_buf[Record::header_size()];
   RecordHeader header;
@@ -343,45 +634,193 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord() {
     read_record_size_ += header.size;
   }
 
-  const perf_event_attr* attr = &event_attrs_[0].attr;
-  if (event_attrs_.size() > 1 && header.type < PERF_RECORD_USER_DEFINED_TYPE_START) {
+  const perf_event_attr& attr = GetAttrOfRecordBinary(header.type, header.size, p.get());
+  auto r = ReadRecordFromBuffer(attr, header.type, p.get(), p.get() + header.size);
+  if (!r) {
+    return nullptr;
+  }
+  p.release();
+  r->OwnBinary();
+  if (r->type() == PERF_RECORD_AUXTRACE) {
+    auto auxtrace = static_cast<AuxTraceRecord*>(r.get());
+    auxtrace->location.file_offset = header_.data.offset + read_record_size_;
+    read_record_size_ += auxtrace->data->aux_size;
+    if (fseek(record_fp_, auxtrace->data->aux_size, SEEK_CUR) != 0) {
+      PLOG(ERROR) << "fseek() failed";
+      return nullptr;
+    }
+  }
+  return r;
+}
+
+const perf_event_attr& RecordFileReader::GetAttrOfRecordBinary(uint32_t type, uint32_t size,
+                                                                const char* p) {
+  if (event_attrs_.size() > 1 && type < PERF_RECORD_USER_DEFINED_TYPE_START) {
     bool has_event_id = false;
     uint64_t event_id;
-    if (header.type == PERF_RECORD_SAMPLE) {
-      if (header.size > event_id_pos_in_sample_records_ + sizeof(uint64_t)) {
+    if (type == PERF_RECORD_SAMPLE) {
+      if (size > event_id_pos_in_sample_records_ + sizeof(uint64_t)) {
         has_event_id = true;
-        event_id = *reinterpret_cast<uint64_t*>(p.get() + event_id_pos_in_sample_records_);
+        event_id = *reinterpret_cast<const uint64_t*>(p + event_id_pos_in_sample_records_);
       }
     } else {
-      if (header.size > event_id_reverse_pos_in_non_sample_records_) {
+      if (size > event_id_reverse_pos_in_non_sample_records_) {
         has_event_id = true;
-        event_id = *reinterpret_cast<uint64_t*>(p.get() + header.size -
-                                                event_id_reverse_pos_in_non_sample_records_);
+        event_id = *reinterpret_cast<const uint64_t*>(p + size -
+                                                      event_id_reverse_pos_in_non_sample_records_);
       }
     }
     if (has_event_id) {
       auto it = event_id_to_attr_map_.find(event_id);
       if (it != event_id_to_attr_map_.end()) {
-        attr = &event_attrs_[it->second].attr;
+        return event_attrs_[it->second].attr;
       }
     }
   }
-  auto r = ReadRecordFromBuffer(*attr, header.type, p.get(), p.get() + header.size);
+  return event_attrs_[0].attr;
+}
+
+bool RecordFileReader::MapDataSection() {
+  if (data_section_map_) {
+    return true;
+  }
+  data_section_map_ = android::base::MappedFile::FromFd(fileno(record_fp_), header_.data.offset,
+                                                        header_.data.size, PROT_READ);
+  if (!data_section_map_) {
+    PLOG(DEBUG) << "failed to map data section of " << filename_;
+    return false;
+  }
+  return true;
+}
+
+Record* RecordFileReader::ParseRecordInPlace(std::unique_ptr<Record>& r, uint32_t type, char* p,
+                                             char* end) {
+  const perf_event_attr& attr = GetAttrOfRecordBinary(type, end - p, p);
   if (!r) {
+    r = ReadRecordFromBuffer(attr, type, p, end);
+    return r.get();
+  }
+  if (!r->ParseInPlace(attr, p, end)) {
+    LOG(ERROR) << "failed to parse record of type " << type << " in " << filename_;
+    r.reset();
     return nullptr;
   }
-  p.release();
-  r->OwnBinary();
-  if (r->type() == PERF_RECORD_AUXTRACE) {
-    auto auxtrace = static_cast<AuxTraceRecord*>(r.get());
-    auxtrace->location.file_offset = header_.data.offset + read_record_size_;
-    read_record_size_ += auxtrace->data->aux_size;
-    if (fseek(record_fp_, auxtrace->data->aux_size, SEEK_CUR) != 0) {
-      PLOG(ERROR) << "fseek() failed";
-      return nullptr;
+  return r.get();
+}
+
+bool RecordFileReader::ReadDataSectionInPlace(const std::function<bool(const Record&)>& callback) {
+  if (header_.data.size == 0) {
+    return true;
+  }
+  if (!MapDataSection()) {
+    return ReadDataSection([&](std::unique_ptr<Record> r) { return callback(*r); });
+  }
+  return ReadMappedRecords(
+      [this](uint32_t type, char* p, char* end) {
+        return ParseRecordInPlace(in_place_records_[type], type, p, end);
+      },
+      [&](Record* r) { return callback(*r); }, nullptr);
+}
+
+bool RecordFileReader::ReadMappedRecords(
+    const std::function<Record*(uint32_t type, char* p, char* end)>& parse,
+    const std::function<bool(Record*)>& callback,
+    const std::function<void(std::vector<char>& buf)>& keep_buffer) {
+  char* data = data_section_map_->data();
+  const uint64_t data_size = header_.data.size;
+  uint64_t pos = 0;
+  RecordHeader header;
+  while (pos < data_size) {
+    char* p = data + pos;
+    if (data_size - pos < Record::header_size() || !header.Parse(p) ||
+        header.size > data_size - pos) {
+      LOG(ERROR) << "invalid record at data offset " << pos << " in " << filename_;
+      return false;
+    }
+    char* end = p + header.size;
+    pos += header.size;
+    bool in_split_record_buf = false;
+    if (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+      // SPLIT records aren't contiguous, so merge them in a buffer reused between calls.
+      split_record_buf_.clear();
+      while (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+        split_record_buf_.insert(split_record_buf_.end(), p + Record::header_size(), end);
+        p = data + pos;
+        if (data_size - pos < Record::header_size() || !header.Parse(p) ||
+            header.size > data_size - pos) {
+          LOG(ERROR) << "invalid record at data offset " << pos << " in " << filename_;
+          return false;
+        }
+        end = p + header.size;
+        pos += header.size;
+      }
+      if (header.type != SIMPLE_PERF_RECORD_SPLIT_END) {
+        LOG(ERROR) << "SPLIT records are not followed by a SPLIT_END record.";
+        return false;
+      }
+      if (split_record_buf_.size() < Record::header_size() ||
+          !header.Parse(split_record_buf_.data()) || header.size != split_record_buf_.size()) {
+        LOG(ERROR) << "invalid record merged from SPLIT records";
+        return false;
+      }
+      p = split_record_buf_.data();
+      end = p + split_record_buf_.size();
+      in_split_record_buf = true;
+    }
+    Record* r = parse(header.type, p, end);
+    if (r == nullptr) {
+      return false;
+    }
+    if (r->type() == SIMPLE_PERF_RECORD_COMPRESSED) {
+      if (!static_cast<CompressedRecord*>(r)->Decompress(&decompressed_records_)) {
+        return false;
+      }
+      char* q = decompressed_records_.data();
+      char* q_end = q + decompressed_records_.size();
+      while (q < q_end) {
+        if (static_cast<size_t>(q_end - q) < Record::header_size() || !header.Parse(q) ||
+            header.size > static_cast<size_t>(q_end - q) || header.type == PERF_RECORD_AUXTRACE ||
+            header.type == SIMPLE_PERF_RECORD_COMPRESSED) {
+          LOG(ERROR) << "invalid record in a compressed record in " << filename_;
+          return false;
+        }
+        Record* inner = parse(header.type, q, q + header.size);
+        if (inner == nullptr) {
+          return false;
+        }
+        q += header.size;
+        if (inner->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+          ProcessEventIdRecord(*static_cast<EventIdRecord*>(inner));
+        }
+        if (!callback(inner)) {
+          return false;
+        }
+      }
+      if (keep_buffer) {
+        keep_buffer(decompressed_records_);
+      }
+      decompressed_records_.clear();
+      continue;
+    }
+    if (r->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+      ProcessEventIdRecord(*static_cast<EventIdRecord*>(r));
+    } else if (r->type() == PERF_RECORD_AUXTRACE) {
+      auto auxtrace = static_cast<AuxTraceRecord*>(r);
+      auxtrace->location.file_offset = header_.data.offset + pos;
+      if (auxtrace->data->aux_size > data_size - pos) {
+        LOG(ERROR) << "invalid auxtrace record in " << filename_;
+        return false;
+      }
+      pos += auxtrace->data->aux_size;
+    }
+    if (!callback(r)) {
+      return false;
+    }
+    if (in_split_record_buf && keep_buffer) {
+      keep_buffer(split_record_buf_);
     }
   }
-  return r;
+  return true;
 }
 
 bool RecordFileReader::Read(void* buf, size_t len) {
@@ -735,6 +1174,52 @@ std::optional<DebugUnwindFeature> RecordFileReader::ReadDebugUnwindFeature() {
   return std::nullopt;
 }
 
+std::optional<TimeIndexFeature> RecordFileReader::ReadTimeIndexFeature() {
+  std::vector<char> buf;
+  if (!HasFeature(FEAT_TIME_INDEX) || !ReadFeatureSection(FEAT_TIME_INDEX, &buf)) {
+    return std::nullopt;
+  }
+  BinaryReader reader(buf.data(), buf.size());
+  TimeIndexFeature time_index;
+  uint64_t block_count = 0;
+  reader.Read(block_count);
+  if (reader.error || block_count > reader.LeftSize() / sizeof(TimeIndexBlock)) {
+    return std::nullopt;
+  }
+  time_index.blocks.resize(block_count);
+  reader.Read(time_index.blocks.data(), block_count);
+  uint64_t state_record_count = 0;
+  reader.Read(state_record_count);
+  if (reader.error || state_record_count > reader.LeftSize() / sizeof(uint64_t)) {
+    return std::nullopt;
+  }
+  time_index.state_record_offsets.resize(state_record_count);
+  reader.Read(time_index.state_record_offsets.data(), state_record_count);
+  if (reader.error) {
+    return std::nullopt;
+  }
+  // Offsets should be sorted and inside the data section.
+  auto check_offsets = [&](auto begin, auto end, auto get_offset) {
+    uint64_t prev_offset = 0;
+    for (auto it = begin; it != end; ++it) {
+      uint64_t offset = get_offset(*it);
+      if (offset < prev_offset || offset >= header_.data.size) {
+        return false;
+      }
+      prev_offset = offset;
+    }
+    return true;
+  };
+  if (!check_offsets(time_index.blocks.begin(), time_index.blocks.end(),
+                     [](const TimeIndexBlock& block) { return block.data_offset; }) ||
+      !check_offsets(time_index.state_record_offsets.begin(),
+                     time_index.state_record_offsets.end(), [](uint64_t offset) { return offset; })) {
+    LOG(ERROR) << "invalid time index feature section in " << filename_;
+    return std::nullopt;
+  }
+  return time_index;
+}
+
 bool RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree) {
   std::vector<BuildIdRecord> records = ReadBuildIdFeature();
   std::vector<std::pair<std::string, BuildId>> build_ids;
@@ -254,4 +254,345 @@ TEST_F(RecordFileTest, write_file2_feature_section) {
   }
   ASSERT_FALSE(error);
   ASSERT_EQ(file_id, files.size());
-}
\ No newline at end of file
+}
+
+TEST_F(RecordFileTest, read_data_section_in_place) {
+  // Write to a record file.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+
+  std::vector<std::unique_ptr<Record>> records;
+  records.emplace_back(new MmapRecord(attr_ids_[0].attr, true, 1, 1, 0x1000, 0x2000, 0x3000,
+                                      "mmap_record_example", attr_ids_[0].ids[0]));
+  for (uint64_t i = 0; i < 3; i++) {
+    records.emplace_back(new SampleRecord(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000 + i, 1,
+                                          1, i, 0, 1, {}, {}, {}, 0));
+  }
+  for (auto& r : records) {
+    ASSERT_TRUE(writer->WriteRecord(*r));
+  }
+  ASSERT_TRUE(writer->Close());
+
+  // Read records in place, and check them against records written.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  size_t read_count = 0;
+  ASSERT_TRUE(reader->ReadDataSectionInPlace([&](const Record& r) {
+    EXPECT_LT(read_count, records.size());
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], r);
+    }
+    read_count++;
+    return true;
+  }));
+  ASSERT_EQ(read_count, records.size());
+}
+
+TEST_F(RecordFileTest, read_data_section_in_background) {
+  // Write to a record file.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+
+  // Write enough records to fill many batches.
+  std::vector<std::unique_ptr<Record>> records;
+  records.emplace_back(new MmapRecord(attr_ids_[0].attr, true, 1, 1, 0x1000, 0x2000, 0x3000,
+                                      "mmap_record_example", attr_ids_[0].ids[0]));
+  for (uint64_t i = 0; i < 50000; i++) {
+    records.emplace_back(new SampleRecord(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000 + i, 1,
+                                          1, i, 0, 1, {}, {}, {}, 0));
+  }
+  for (auto& r : records) {
+    ASSERT_TRUE(writer->WriteRecord(*r));
+  }
+  ASSERT_TRUE(writer->Close());
+
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  size_t read_count = 0;
+  ASSERT_TRUE(reader->ReadDataSectionInBackground([&](const Record& r, size_t attr_index) {
+    EXPECT_LT(read_count, records.size());
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], r);
+    }
+    EXPECT_EQ(attr_index, 0u);
+    read_count++;
+    return true;
+  }));
+  ASSERT_EQ(read_count, records.size());
+
+  // Stop reading when the callback fails.
+  read_count = 0;
+  ASSERT_FALSE(reader->ReadDataSectionInBackground([&](const Record&, size_t) {
+    return ++read_count < 10000;
+  }));
+  ASSERT_EQ(read_count, 10000u);
+}
+
+TEST_F(RecordFileTest, write_record_batch) {
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+
+  // Mix records written with and without copying, and check they are kept in order.
+  std::vector<std::unique_ptr<Record>> records;
+  for (uint64_t i = 0; i < 2000; i++) {
+    records.emplace_back(new SampleRecord(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000 + i, 1,
+                                          1, i, 0, 1, {}, {}, {}, 0));
+  }
+  for (size_t i = 0; i < records.size(); i++) {
+    if (i % 100 == 0) {
+      ASSERT_TRUE(writer->WriteRecord(*records[i]));
+    } else {
+      ASSERT_TRUE(writer->AddRecordToBatch(*records[i]));
+    }
+  }
+  ASSERT_TRUE(writer->FlushRecordBatch());
+  MmapRecord mmap_record(attr_ids_[0].attr, true, 1, 1, 0x1000, 0x2000, 0x3000,
+                         "mmap_record_example", attr_ids_[0].ids[0]);
+  ASSERT_TRUE(writer->AddRecordToBatch(mmap_record));
+  ASSERT_TRUE(writer->BeginWriteFeatures(0));
+  ASSERT_TRUE(writer->EndWriteFeatures());
+  ASSERT_TRUE(writer->Close());
+
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  std::vector<std::unique_ptr<Record>> read_records = reader->DataSection();
+  ASSERT_EQ(read_records.size(), records.size() + 1);
+  for (size_t i = 0; i < records.size(); i++) {
+    CheckRecordEqual(*records[i], *read_records[i]);
+  }
+  CheckRecordEqual(mmap_record, *read_records.back());
+}
+
+TEST_F(RecordFileTest, compressed_records) {
+  // Write to a record file.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  writer->EnableCompression();
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+
+  // Write enough records to fill several compressed blocks.
+  std::vector<std::unique_ptr<Record>> records;
+  uint64_t records_size = 0;
+  records.emplace_back(new MmapRecord(attr_ids_[0].attr, true, 1, 1, 0x1000, 0x2000, 0x3000,
+                                      "mmap_record_example", attr_ids_[0].ids[0]));
+  for (uint64_t i = 0; i < 10000; i++) {
+    records.emplace_back(new SampleRecord(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000 + i % 16,
+                                          1, 1, i, 0, 1, {}, {}, {}, 0));
+  }
+  for (auto& r : records) {
+    ASSERT_TRUE(writer->WriteRecord(*r));
+    records_size += r->size();
+  }
+  size_t read_count = 0;
+  ASSERT_TRUE(writer->ReadDataSection([&](const Record* r) {
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], *r);
+    }
+    read_count++;
+  }));
+  ASSERT_EQ(read_count, records.size());
+  ASSERT_LT(writer->GetDataSectionSize(), records_size / 2);
+  ASSERT_TRUE(writer->Close());
+
+  // Read records with ReadRecord().
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  read_count = 0;
+  std::unique_ptr<Record> record;
+  while (reader->ReadRecord(record) && record) {
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], *record);
+    }
+    read_count++;
+  }
+  ASSERT_EQ(read_count, records.size());
+
+  // Read records in place.
+  read_count = 0;
+  ASSERT_TRUE(reader->ReadDataSectionInPlace([&](const Record& r) {
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], r);
+    }
+    read_count++;
+    return true;
+  }));
+  ASSERT_EQ(read_count, records.size());
+
+  // Read records in place on a separate thread.
+  read_count = 0;
+  ASSERT_TRUE(reader->ReadDataSectionInBackground([&](const Record& r, size_t) {
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], r);
+    }
+    read_count++;
+    return true;
+  }));
+  ASSERT_EQ(read_count, records.size());
+}
+
+TEST_F(RecordFileTest, read_compressed_records_in_background) {
+  // The record count is a multiple of the batch size used by ReadDataSectionInBackground(), so
+  // the last compressed block ends exactly at the end of a batch.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  writer->EnableCompression();
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  std::vector<std::unique_ptr<Record>> records;
+  records.emplace_back(new MmapRecord(attr_ids_[0].attr, true, 1, 1, 0x1000, 0x2000, 0x3000,
+                                      "mmap_record_example", attr_ids_[0].ids[0]));
+  while (records.size() < 10 * 1024) {
+    uint64_t i = records.size();
+    records.emplace_back(new SampleRecord(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000 + i % 16,
+                                          1, 1, i, 0, 1, {}, {}, {}, 0));
+  }
+  for (auto& r : records) {
+    ASSERT_TRUE(writer->WriteRecord(*r));
+  }
+  ASSERT_TRUE(writer->Close());
+
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  size_t read_count = 0;
+  ASSERT_TRUE(reader->ReadDataSectionInBackground([&](const Record& r, size_t) {
+    if (read_count < records.size()) {
+      CheckRecordEqual(*records[read_count], r);
+    }
+    read_count++;
+    return true;
+  }));
+  ASSERT_EQ(read_count, records.size());
+}
+
+TEST_F(RecordFileTest, time_index_feature_section) {
+  // Write to a record file.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  writer->EnableTimeIndex();
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  MmapRecord mmap_record(attr_ids_[0].attr, true, 1, 1, 0x1000, 0x2000, 0x3000,
+                         "mmap_record_example", attr_ids_[0].ids[0]);
+  ASSERT_TRUE(writer->WriteRecord(mmap_record));
+  for (uint64_t time = 1; time <= 5; time++) {
+    SampleRecord r(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000, 1, 1, time, 0, 1, {}, {}, {},
+                   0);
+    ASSERT_TRUE(writer->WriteRecord(r));
+  }
+  ASSERT_TRUE(writer->ReadDataSection([](const Record*) {}));
+  ASSERT_TRUE(writer->BeginWriteFeatures(0));
+  ASSERT_TRUE(writer->EndWriteFeatures());
+  ASSERT_TRUE(writer->Close());
+
+  // Read from a record file.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  auto time_index = reader->ReadTimeIndexFeature();
+  ASSERT_TRUE(time_index.has_value());
+  ASSERT_EQ(time_index->blocks.size(), 1u);
+  ASSERT_EQ(time_index->blocks[0].data_offset, 0u);
+  ASSERT_EQ(time_index->blocks[0].min_time, 1u);
+  ASSERT_EQ(time_index->blocks[0].max_time, 5u);
+  ASSERT_EQ(time_index->state_record_offsets, std::vector<uint64_t>{0});
+
+  std::vector<uint64_t> sample_times;
+  size_t non_sample_count = 0;
+  ASSERT_TRUE(reader->ReadDataSectionInTimeRange(
+      2, 4, [](std::unique_ptr<Record>) { return true; },
+      [&](std::unique_ptr<Record> r) {
+        if (r->type() == PERF_RECORD_SAMPLE) {
+          sample_times.push_back(r->Timestamp());
+        } else {
+          non_sample_count++;
+        }
+        return true;
+      }));
+  ASSERT_EQ(sample_times, std::vector<uint64_t>({2, 3}));
+  ASSERT_EQ(non_sample_count, 1u);
+  // Time ranges not covered by the recording file don't return any record.
+  ASSERT_TRUE(reader->ReadDataSectionInTimeRange(
+      10, 20, [](std::unique_ptr<Record>) { return false; },
+      [](std::unique_ptr<Record>) { return false; }));
+}
+
+TEST_F(RecordFileTest, read_time_range_with_state_records_in_many_blocks) {
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  writer->EnableTimeIndex();
+  AddEventType("cpu-cycles");
+  attr_ids_[0].attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  // Write an mmap record every 10 samples. Some samples have long callchains, so the gaps
+  // between mmap records are both short and long, and the data section has many index blocks.
+  for (uint64_t time = 1; time <= 300; time++) {
+    if (time % 10 == 0) {
+      MmapRecord mmap_record(attr_ids_[0].attr, true, 1, 1, 0x1000 * time, 0x1000, time,
+                             "mmap_record_example", attr_ids_[0].ids[0]);
+      ASSERT_TRUE(writer->WriteRecord(mmap_record));
+    }
+    std::vector<uint64_t> ips((time % 50 == 0) ? 10000 : 10, 0x1000);
+    SampleRecord r(attr_ids_[0].attr, attr_ids_[0].ids[0], 0x1000, 1, 1, time, 0, 1, {}, ips, {},
+                   0);
+    ASSERT_TRUE(writer->WriteRecord(r));
+  }
+  ASSERT_TRUE(writer->ReadDataSection([](const Record*) {}));
+  ASSERT_TRUE(writer->BeginWriteFeatures(0));
+  ASSERT_TRUE(writer->EndWriteFeatures());
+  ASSERT_TRUE(writer->Close());
+
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  auto time_index = reader->ReadTimeIndexFeature();
+  ASSERT_TRUE(time_index.has_value());
+  ASSERT_GT(time_index->blocks.size(), 1u);
+
+  std::vector<uint64_t> mmap_pgoffs;
+  std::vector<uint64_t> sample_times;
+  size_t state_record_count = 0;
+  auto add_mmap = [&](const Record& r) {
+    ASSERT_EQ(r.type(), PERF_RECORD_MMAP);
+    mmap_pgoffs.push_back(static_cast<const MmapRecord&>(r).data->pgoff);
+  };
+  ASSERT_TRUE(reader->ReadDataSectionInTimeRange(
+      280, 290,
+      [&](std::unique_ptr<Record> r) {
+        add_mmap(*r);
+        state_record_count++;
+        return true;
+      },
+      [&](std::unique_ptr<Record> r) {
+        if (r->type() == PERF_RECORD_SAMPLE) {
+          sample_times.push_back(r->Timestamp());
+        } else {
+          add_mmap(*r);
+        }
+        return true;
+      }));
+  ASSERT_GT(state_record_count, 0u);
+  std::vector<uint64_t> expected_sample_times;
+  for (uint64_t time = 280; time < 290; time++) {
+    expected_sample_times.push_back(time);
+  }
+  ASSERT_EQ(sample_times, expected_sample_times);
+  // State records before the time range are replayed in order, followed by mmap records in the
+  // blocks read, without gaps.
+  ASSERT_GE(mmap_pgoffs.size(), 28u);
+  for (size_t i = 0; i < mmap_pgoffs.size(); i++) {
+    ASSERT_EQ(mmap_pgoffs[i], (i + 1) * 10);
+  }
+
+  // Reading the whole data section still works after reading in a time range.
+  size_t record_count = 0;
+  ASSERT_TRUE(reader->ReadDataSection([&](std::unique_ptr<Record>) {
+    record_count++;
+    return true;
+  }));
+  ASSERT_EQ(record_count, 330u);
+}
@@ -19,10 +19,18 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <limits.h>
+#include <sys/uio.h>
+#endif
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -40,6 +48,104 @@ namespace simpleperf {
 
 using namespace PerfFileFormat;
 
+// linux-tools-perf only accepts records with size <= 65535 bytes.
+static constexpr uint32_t RECORD_SIZE_LIMIT = 65535;
+
+// Max data pieces in a record batch before flushing it.
+static constexpr size_t kMaxRecordBatchSize = 1024;
+
+// Records are compressed in blocks of up to 128K bytes. A compressed block should fit in a
+// CompressedRecord, which can't exceed RECORD_SIZE_LIMIT. Otherwise records in the block are
+// written uncompressed.
+static constexpr size_t kCompressBlockSize = 128 * 1024;
+static constexpr size_t kMaxCompressedDataSize =
+    (RECORD_SIZE_LIMIT - sizeof(perf_event_header) - 2 * sizeof(uint32_t)) &
+    ~(sizeof(uint64_t) - 1);
+// Use the fastest zlib compression level, to keep up with recording.
+static constexpr int kCompressLevel = 1;
+// Max blocks waiting for compression before WriteRecord() waits for the compress thread.
+static constexpr size_t kMaxPendingCompressBlocks = 16;
+
+// RecordCompressor compresses blocks of records on a background thread. Compressed blocks are
+// returned in the order they are added, so the writer can keep records in order.
+class RecordCompressor {
+ public:
+  struct Block {
+    std::vector<char> records;
+    std::vector<char> compressed_data;
+    bool compressed = false;
+  };
+
+  RecordCompressor() : thread_(&RecordCompressor::CompressThread, this) {}
+
+  ~RecordCompressor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+  }
+
+  void AddBlock(std::vector<char>&& records) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      blocks_.emplace_back();
+      blocks_.back().records = std::move(records);
+    }
+    cond_.notify_all();
+  }
+
+  // Return the first block if it has been handled by the compress thread. If there are more
+  // than [max_pending_blocks] blocks, wait for the first block. Return false if no block is
+  // returned.
+  bool GetBlock(size_t max_pending_blocks, Block* block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (blocks_.empty()) {
+      return false;
+    }
+    if (compressed_blocks_ == 0) {
+      if (blocks_.size() <= max_pending_blocks) {
+        return false;
+      }
+      cond_.wait(lock, [&]() { return compressed_blocks_ > 0; });
+    }
+    *block = std::move(blocks_.front());
+    blocks_.pop_front();
+    compressed_blocks_--;
+    return true;
+  }
+
+ private:
+  void CompressThread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [&]() { return stop_ || compressed_blocks_ < blocks_.size(); });
+      if (stop_) {
+        return;
+      }
+      // References to elements in a deque stay valid when adding elements at the back. And the
+      // block isn't popped until it is compressed.
+      Block& block = blocks_[compressed_blocks_];
+      lock.unlock();
+      block.compressed = ZlibCompress(block.records.data(), block.records.size(), kCompressLevel,
+                                      &block.compressed_data) &&
+                         block.compressed_data.size() <= kMaxCompressedDataSize;
+      lock.lock();
+      compressed_blocks_++;
+      cond_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<Block> blocks_;
+  // The first [compressed_blocks_] blocks in blocks_ have been handled by the compress thread.
+  size_t compressed_blocks_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
 std::unique_ptr<RecordFileWriter> RecordFileWriter::CreateInstance(const std::string& filename) {
   // Remove old perf.data to avoid file ownership problems.
   std::string err;
@@ -125,12 +231,38 @@ bool RecordFileWriter::WriteAttrSection(const EventAttrIds& attr_ids) {
   return true;
 }
 
+void RecordFileWriter::EnableTimeIndex() {
+  CHECK(!compressor_);
+  build_time_index_ = true;
+}
+
+void RecordFileWriter::EnableCompression() {
+  CHECK(!build_time_index_);
+  if (!compressor_) {
+    compressor_.reset(new RecordCompressor);
+    compress_buf_.reserve(kCompressBlockSize);
+  }
+}
+
 bool RecordFileWriter::WriteRecord(const Record& record) {
-  // linux-tools-perf only accepts records with size <= 65535 bytes. To make
-  // perf.data generated by simpleperf be able to be parsed by linux-tools-perf,
+  // Aux data following AUXTRACE records is located by file offset, so AUXTRACE records are not
+  // compressed.
+  if (compressor_ && record.size() <= RECORD_SIZE_LIMIT &&
+      record.type() != PERF_RECORD_AUXTRACE) {
+    if (compress_buf_.size() + record.size() > kCompressBlockSize) {
+      compressor_->AddBlock(std::move(compress_buf_));
+      compress_buf_.clear();
+      compress_buf_.reserve(kCompressBlockSize);
+      if (!WriteCompressedBlocks(kMaxPendingCompressBlocks)) {
+        return false;
+      }
+    }
+    compress_buf_.insert(compress_buf_.end(), record.Binary(), record.Binary() + record.size());
+    return true;
+  }
+  // To make perf.data generated by simpleperf be able to be parsed by linux-tools-perf,
   // Split simpleperf custom records which are > 65535 into a bunch of
   // RECORD_SPLIT records, followed by a RECORD_SPLIT_END record.
-  constexpr uint32_t RECORD_SIZE_LIMIT = 65535;
   if (record.size() <= RECORD_SIZE_LIMIT) {
     bool result = WriteData(record.Binary(), record.size());
     if (result && record.type() == PERF_RECORD_AUXTRACE) {
@@ -168,6 +300,92 @@ bool RecordFileWriter::WriteRecord(const Record& record) {
 }
 
 bool RecordFileWriter::WriteData(const void* buf, size_t len) {
+  // Keep the order of data written after batched or compressed records.
+  if (!FlushRecordBatch()) {
+    return false;
+  }
+  if (compressor_ && !FlushCompressedRecords()) {
+    return false;
+  }
+  return AppendToDataSection(buf, len);
+}
+
+bool RecordFileWriter::AddRecordToBatch(const Record& record) {
+  if (compressor_ || record.size() > RECORD_SIZE_LIMIT) {
+    return WriteRecord(record);
+  }
+  record_batch_.emplace_back(record.Binary(), record.size());
+  if (record.type() == PERF_RECORD_AUXTRACE) {
+    auto auxtrace = static_cast<const AuxTraceRecord*>(&record);
+    if (auxtrace->data->aux_size > 0) {
+      record_batch_.emplace_back(auxtrace->location.addr, auxtrace->data->aux_size);
+    }
+  }
+  if (record_batch_.size() >= kMaxRecordBatchSize) {
+    return FlushRecordBatch();
+  }
+  return true;
+}
+
+bool RecordFileWriter::FlushRecordBatch() {
+  if (record_batch_.empty()) {
+    return true;
+  }
+#if defined(__linux__)
+  // Data buffered in record_fp_ goes before the batch.
+  if (fflush(record_fp_) != 0) {
+    PLOG(ERROR) << "failed to write to record file '" << filename_ << "'";
+    return false;
+  }
+  std::vector<iovec> iov(record_batch_.size());
+  for (size_t i = 0; i < record_batch_.size(); i++) {
+    iov[i].iov_base = const_cast<char*>(record_batch_[i].first);
+    iov[i].iov_len = record_batch_[i].second;
+  }
+  record_batch_.clear();
+  int fd = fileno(record_fp_);
+  uint64_t offset = data_section_offset_ + data_section_size_;
+  size_t i = 0;
+  while (i < iov.size()) {
+    int count = static_cast<int>(std::min<size_t>(iov.size() - i, IOV_MAX));
+    ssize_t n = TEMP_FAILURE_RETRY(pwritev(fd, &iov[i], count, offset));
+    if (n <= 0) {
+      PLOG(ERROR) << "failed to write to record file '" << filename_ << "'";
+      return false;
+    }
+    offset += n;
+    data_section_size_ += n;
+    // Skip data written, which may end in the middle of an iovec.
+    size_t left = n;
+    while (left > 0) {
+      if (left >= iov[i].iov_len) {
+        left -= iov[i].iov_len;
+        i++;
+      } else {
+        iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + left;
+        iov[i].iov_len -= left;
+        left = 0;
+      }
+    }
+  }
+  // pwritev() doesn't move the file position of record_fp_.
+  if (fseeko(record_fp_, offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+#else
+  std::vector<std::pair<const char*, size_t>> batch = std::move(record_batch_);
+  record_batch_.clear();
+  for (auto& data : batch) {
+    if (!AppendToDataSection(data.first, data.second)) {
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+bool RecordFileWriter::AppendToDataSection(const void* buf, size_t len) {
   if (!Write(buf, len)) {
     return false;
   }
@@ -175,6 +393,30 @@ bool RecordFileWriter::WriteData(const void* buf, size_t len) {
   return true;
 }
 
+bool RecordFileWriter::WriteCompressedBlocks(size_t max_pending_blocks) {
+  RecordCompressor::Block block;
+  while (compressor_->GetBlock(max_pending_blocks, &block)) {
+    if (block.compressed) {
+      CompressedRecord r(block.records.size(), block.compressed_data.data(),
+                         block.compressed_data.size());
+      if (!AppendToDataSection(r.Binary(), r.size())) {
+        return false;
+      }
+    } else if (!AppendToDataSection(block.records.data(), block.records.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RecordFileWriter::FlushCompressedRecords() {
+  if (!compress_buf_.empty()) {
+    compressor_->AddBlock(std::move(compress_buf_));
+    compress_buf_.clear();
+  }
+  return WriteCompressedBlocks(0);
+}
+
 bool RecordFileWriter::Write(const void* buf, size_t len) {
   if (len != 0u && fwrite(buf, len, 1, record_fp_) != 1) {
     PLOG(ERROR) << "failed to write to record file '" << filename_ << "'";
@@ -192,13 +434,24 @@ bool RecordFileWriter::Read(void* buf, size_t len) {
 }
 
 bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>& callback) {
+  if (!FlushRecordBatch()) {
+    return false;
+  }
+  if (compressor_ && !FlushCompressedRecords()) {
+    return false;
+  }
   if (fseek(record_fp_, data_section_offset_, SEEK_SET) == -1) {
     PLOG(ERROR) << "fseek() failed";
     return false;
   }
   std::vector<char> record_buf(512);
+  std::vector<char> decompressed_buf;
   uint64_t read_pos = 0;
+  if (build_time_index_) {
+    time_index_ = TimeIndexFeature();
+  }
   while (read_pos < data_section_size_) {
+    uint64_t record_offset = read_pos;
     if (!Read(record_buf.data(), Record::header_size())) {
       return false;
     }
@@ -216,6 +469,16 @@ bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>&
     std::unique_ptr<Record> r = ReadRecordFromBuffer(event_attr_, header.type, record_buf.data(),
                                                      record_buf.data() + header.size);
     CHECK(r);
+    if (r->type() == SIMPLE_PERF_RECORD_COMPRESSED) {
+      if (!static_cast<CompressedRecord*>(r.get())->Decompress(&decompressed_buf)) {
+        return false;
+      }
+      for (auto& inner : ReadRecordsFromBuffer(event_attr_, decompressed_buf.data(),
+                                               decompressed_buf.size())) {
+        callback(inner.get());
+      }
+      continue;
+    }
     if (r->type() == PERF_RECORD_AUXTRACE) {
       auto auxtrace = static_cast<AuxTraceRecord*>(r.get());
       auxtrace->location.file_offset = data_section_offset_ + read_pos;
@@ -225,6 +488,9 @@ bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>&
       }
       read_pos += auxtrace->data->aux_size;
     }
+    if (build_time_index_) {
+      AddRecordToTimeIndex(*r, record_offset);
+    }
     callback(r.get());
   }
   return true;
@@ -240,8 +506,34 @@ bool RecordFileWriter::GetFilePos(uint64_t* file_pos) {
   return true;
 }
 
+void RecordFileWriter::AddRecordToTimeIndex(const Record& record, uint64_t data_offset) {
+  // Each block covers about 256K bytes of records. It is small enough to read only a little more
+  // than needed for a time range, and big enough to keep the index small.
+  constexpr uint64_t kTimeIndexBlockSize = 256 * 1024;
+  auto& blocks = time_index_.blocks;
+  if (blocks.empty() || data_offset - blocks.back().data_offset >= kTimeIndexBlockSize) {
+    blocks.emplace_back(TimeIndexBlock{data_offset, UINT64_MAX, 0});
+  }
+  if (record.type() != PERF_RECORD_SAMPLE) {
+    time_index_.state_record_offsets.push_back(data_offset);
+  }
+  if (uint64_t time = record.Timestamp(); time != 0) {
+    blocks.back().min_time = std::min(blocks.back().min_time, time);
+    blocks.back().max_time = std::max(blocks.back().max_time, time);
+  }
+}
+
 bool RecordFileWriter::BeginWriteFeatures(size_t feature_count) {
+  if (!FlushRecordBatch()) {
+    return false;
+  }
+  if (compressor_ && !FlushCompressedRecords()) {
+    return false;
+  }
   feature_section_offset_ = data_section_offset_ + data_section_size_;
+  if (build_time_index_) {
+    feature_count++;
+  }
   feature_count_ = feature_count;
   uint64_t feature_header_size = feature_count * sizeof(SectionDesc);
 
@@ -465,7 +757,26 @@ bool RecordFileWriter::WriteFeatureEnd(int feature) {
   return true;
 }
 
+bool RecordFileWriter::WriteTimeIndexFeature() {
+  std::vector<uint64_t> data;
+  data.reserve(2 + time_index_.blocks.size() * 3 + time_index_.state_record_offsets.size());
+  data.push_back(time_index_.blocks.size());
+  for (const TimeIndexBlock& block : time_index_.blocks) {
+    data.push_back(block.data_offset);
+    data.push_back(block.min_time);
+    data.push_back(block.max_time);
+  }
+  data.push_back(time_index_.state_record_offsets.size());
+  data.insert(data.end(), time_index_.state_record_offsets.begin(),
+              time_index_.state_record_offsets.end());
+  return WriteFeature(FEAT_TIME_INDEX, reinterpret_cast<char*>(data.data()),
+                      data.size() * sizeof(uint64_t));
+}
+
 bool RecordFileWriter::EndWriteFeatures() {
+  if (build_time_index_ && !WriteTimeIndexFeature()) {
+    return false;
+  }
   // Used features (features_.size()) should be <= allocated feature space.
   CHECK_LE(features_.size(), feature_count_);
   if (fseek(record_fp_, feature_section_offset_, SEEK_SET) == -1) {
@@ -508,6 +819,12 @@ bool RecordFileWriter::WriteFileHeader() {
 bool RecordFileWriter::Close() {
   CHECK(record_fp_ != nullptr);
   bool result = true;
+  if (!FlushRecordBatch()) {
+    result = false;
+  }
+  if (compressor_ && !FlushCompressedRecords()) {
+    result = false;
+  }
 
   // Write file header. We gather enough information to write file header only after
   // writing data section and feature section.
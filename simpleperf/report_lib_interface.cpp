@@ -17,6 +17,7 @@
 #include <memory>
 #include <optional>
 #include <queue>
+#include <unordered_map>
 #include <utility>
 
 #include <android-base/file.h>
@@ -97,6 +98,59 @@ struct FeatureSection {
   uint32_t data_size;
 };
 
+// Samples returned by GetNextSampleBatch(), stored in columns. Column arrays are indexed by
+// sample index, except callchain_offsets (having sample_count + 1 entries) and frame arrays.
+// Frames of sample i are in frame arrays at [callchain_offsets[i], callchain_offsets[i + 1]).
+// The first frame is the instruction hit by the sample, followed by its callchain.
+// A batch has either frame arrays or callstack_ids, depending on the callstacks_only argument of
+// GetNextSampleBatch(). The other arrays are nullptr.
+struct SampleBatch {
+  uint32_t sample_count;
+  uint64_t* times;
+  uint32_t* pids;
+  uint32_t* tids;
+  const char** thread_comms;
+  uint32_t* cpus;
+  uint32_t* in_kernels;
+  uint64_t* periods;
+  // Index in the array returned by GetEventsOfSampleBatch().
+  uint32_t* event_ids;
+  // Tracing data of each sample, or nullptr if not available.
+  const char** tracing_data;
+  uint32_t* callchain_offsets;
+  // Index in the array returned by GetCallStacksOfSampleBatch(), referring to the innermost frame
+  // of the sample. Samples with the same frames have the same callstack id.
+  uint32_t* callstack_ids;
+
+  uint32_t frame_count;
+  uint64_t* frame_ips;
+  uint64_t* frame_vaddr_in_files;
+  // Index in the array returned by GetSymbolsOfSampleBatch().
+  uint32_t* frame_symbol_ids;
+  // Index in the array returned by GetMappingsOfSampleBatch().
+  uint32_t* frame_mapping_ids;
+};
+
+// A symbol referred by frames in SampleBatch.
+struct BatchSymbol {
+  const char* dso_name;
+  const char* symbol_name;
+  uint64_t symbol_addr;
+  uint64_t symbol_len;
+};
+
+// A node in the prefix tree of call stacks referred by SampleBatch.callstack_ids. The call stack
+// of a node starts from the frame of the node, followed by the call stack of its parent.
+struct BatchCallStackNode {
+  // Index of the node of the caller, or UINT32_MAX for the outermost frame.
+  uint32_t parent_id;
+  // Index in the array returned by GetSymbolsOfSampleBatch().
+  uint32_t symbol_id;
+  // Index in the array returned by GetMappingsOfSampleBatch().
+  uint32_t mapping_id;
+  uint64_t vaddr_in_file;
+};
+
 }  // extern "C"
 
 namespace simpleperf {
@@ -113,6 +167,18 @@ struct EventInfo {
   } tracing_info;
 };
 
+// A symbol in a sample batch is identified by its dso name and Symbol.
+using BatchSymbolKey = std::pair<const char*, const Symbol*>;
+
+struct BatchSymbolKeyHash {
+  size_t operator()(const BatchSymbolKey& key) const noexcept {
+    size_t seed = 0;
+    HashCombine(seed, key.first);
+    HashCombine(seed, key.second);
+    return seed;
+  }
+};
+
 // If a recording file is generated with --trace-offcpu, we can select TraceOffCpuMode to report.
 // It affects which samples are reported, and how period in each sample is calculated.
 enum class TraceOffCpuMode {
@@ -171,7 +237,8 @@ class ReportLib {
         record_filename_("perf.data"),
         current_thread_(nullptr),
         callchain_report_builder_(thread_tree_),
-        record_filter_(thread_tree_) {}
+        record_filter_(thread_tree_),
+        callchain_interner_(true) {}
 
   bool SetLogSeverity(const char* log_level);
 
@@ -203,6 +270,11 @@ class ReportLib {
   bool AggregateThreads(const char** thread_name_regex, int thread_name_regex_len);
 
   Sample* GetNextSample();
+  SampleBatch* GetNextSampleBatch(uint32_t max_samples, bool callstacks_only);
+  Event* GetEventsOfSampleBatch(uint32_t* count);
+  BatchSymbol* GetSymbolsOfSampleBatch(uint32_t* count);
+  Mapping* GetMappingsOfSampleBatch(uint32_t* count);
+  BatchCallStackNode* GetCallStacksOfSampleBatch(uint32_t* count);
   Event* GetEventOfCurrentSample() { return &current_event_; }
   SymbolEntry* GetSymbolOfCurrentSample() { return current_symbol_; }
   CallChain* GetCallChainOfCurrentSample() { return &current_callchain_; }
@@ -212,10 +284,16 @@ class ReportLib {
   FeatureSection* GetFeatureSection(const char* feature_name);
 
  private:
+  bool ReadSampleRecords();
   void ProcessSampleRecord(std::unique_ptr<Record> r);
   void ProcessSwitchRecord(std::unique_ptr<Record> r);
   void AddSampleRecordToQueue(SampleRecord* r);
   void SetCurrentSample(const SampleRecord& r);
+  void AddSampleToBatch(const SampleRecord& r, bool callstacks_only);
+  uint32_t GetBatchSymbolId(const CallChainReportEntry& entry);
+  uint32_t GetBatchMappingId(const MapEntry* map);
+  void ClearSampleBatch();
+  size_t GetEventIndex(const SampleRecord& r);
   const EventInfo* FindEventOfCurrentSample();
   void CreateEvents();
 
@@ -244,6 +322,38 @@ class ReportLib {
   ThreadReportBuilder thread_report_builder_;
   std::unique_ptr<Tracing> tracing_;
   RecordFilter record_filter_;
+
+  // Used by GetNextSampleBatch().
+  struct SampleBatchData {
+    std::vector<uint64_t> times;
+    std::vector<uint32_t> pids;
+    std::vector<uint32_t> tids;
+    std::vector<const char*> thread_comms;
+    std::vector<uint32_t> cpus;
+    std::vector<uint32_t> in_kernels;
+    std::vector<uint64_t> periods;
+    std::vector<uint32_t> event_ids;
+    std::vector<const char*> tracing_data;
+    std::vector<uint32_t> callchain_offsets;
+    std::vector<uint32_t> callstack_ids;
+    std::vector<uint64_t> frame_ips;
+    std::vector<uint64_t> frame_vaddr_in_files;
+    std::vector<uint32_t> frame_symbol_ids;
+    std::vector<uint32_t> frame_mapping_ids;
+    // Keep records of the batch alive, since tracing_data points to them.
+    std::vector<std::unique_ptr<SampleRecord>> records;
+  } batch_data_;
+  SampleBatch sample_batch_;
+  // Symbols, mappings and events are interned across batches. So they are only added, and ids
+  // returned in a batch stay valid in later batches.
+  std::unordered_map<BatchSymbolKey, uint32_t, BatchSymbolKeyHash> batch_symbol_ids_;
+  std::vector<BatchSymbol> batch_symbols_;
+  std::unordered_map<const MapEntry*, uint32_t> batch_mapping_ids_;
+  std::vector<Mapping> batch_mappings_;
+  std::vector<Event> batch_events_;
+  // Frames are separated by maps, to report the mapping of each call stack node.
+  CallChainInterner callchain_interner_;
+  std::vector<BatchCallStackNode> batch_callstacks_;
 };
 
 bool ReportLib::SetLogSeverity(const char* log_level) {
@@ -360,10 +470,93 @@ Sample* ReportLib::GetNextSample() {
   if (!sample_record_queue_.empty()) {
     sample_record_queue_.pop();
   }
+  if (!ReadSampleRecords()) {
+    return nullptr;
+  }
+  SetCurrentSample(*sample_record_queue_.front());
+  return &current_sample_;
+}
+
+SampleBatch* ReportLib::GetNextSampleBatch(uint32_t max_samples, bool callstacks_only) {
+  if (!OpenRecordFileIfNecessary()) {
+    return nullptr;
+  }
+  ClearSampleBatch();
+  // Like GetNextSample(), the front of sample_record_queue_ is the last returned sample.
+  while (batch_data_.times.size() < max_samples) {
+    if (!sample_record_queue_.empty()) {
+      batch_data_.records.emplace_back(std::move(sample_record_queue_.front()));
+      sample_record_queue_.pop();
+    }
+    if (!ReadSampleRecords()) {
+      break;
+    }
+    AddSampleToBatch(*sample_record_queue_.front(), callstacks_only);
+  }
+  if (batch_data_.times.empty()) {
+    return nullptr;
+  }
+  SampleBatchData& d = batch_data_;
+  sample_batch_.sample_count = d.times.size();
+  sample_batch_.times = d.times.data();
+  sample_batch_.pids = d.pids.data();
+  sample_batch_.tids = d.tids.data();
+  sample_batch_.thread_comms = d.thread_comms.data();
+  sample_batch_.cpus = d.cpus.data();
+  sample_batch_.in_kernels = d.in_kernels.data();
+  sample_batch_.periods = d.periods.data();
+  sample_batch_.event_ids = d.event_ids.data();
+  sample_batch_.tracing_data = d.tracing_data.data();
+  sample_batch_.callchain_offsets = callstacks_only ? nullptr : d.callchain_offsets.data();
+  sample_batch_.callstack_ids = callstacks_only ? d.callstack_ids.data() : nullptr;
+  sample_batch_.frame_count = d.frame_ips.size();
+  sample_batch_.frame_ips = callstacks_only ? nullptr : d.frame_ips.data();
+  sample_batch_.frame_vaddr_in_files = callstacks_only ? nullptr : d.frame_vaddr_in_files.data();
+  sample_batch_.frame_symbol_ids = callstacks_only ? nullptr : d.frame_symbol_ids.data();
+  sample_batch_.frame_mapping_ids = callstacks_only ? nullptr : d.frame_mapping_ids.data();
+  return &sample_batch_;
+}
+
+Event* ReportLib::GetEventsOfSampleBatch(uint32_t* count) {
+  if (!OpenRecordFileIfNecessary()) {
+    *count = 0;
+    return nullptr;
+  }
+  if (events_.empty()) {
+    CreateEvents();
+  }
+  if (batch_events_.empty()) {
+    for (const EventInfo& event : events_) {
+      batch_events_.emplace_back();
+      batch_events_.back().name = event.name.c_str();
+      batch_events_.back().tracing_data_format = event.tracing_info.data_format;
+    }
+  }
+  *count = batch_events_.size();
+  return batch_events_.data();
+}
+
+BatchSymbol* ReportLib::GetSymbolsOfSampleBatch(uint32_t* count) {
+  *count = batch_symbols_.size();
+  return batch_symbols_.data();
+}
+
+Mapping* ReportLib::GetMappingsOfSampleBatch(uint32_t* count) {
+  *count = batch_mappings_.size();
+  return batch_mappings_.data();
+}
+
+BatchCallStackNode* ReportLib::GetCallStacksOfSampleBatch(uint32_t* count) {
+  *count = batch_callstacks_.size();
+  return batch_callstacks_.data();
+}
+
+// Read records until sample_record_queue_ isn't empty. Return false if no more samples.
+bool ReportLib::ReadSampleRecords() {
   while (sample_record_queue_.empty()) {
     std::unique_ptr<Record> record;
     if (!record_file_reader_->ReadRecord(record) || record == nullptr) {
-      return nullptr;
+      return false;
     }
     thread_tree_.Update(*record);
     if (record->type() == PERF_RECORD_SAMPLE) {
@@ -376,12 +569,11 @@ Sample* ReportLib::GetNextSample() {
       const auto& r = *static_cast<TracingDataRecord*>(record.get());
       tracing_ = Tracing::Create(std::vector<char>(r.data, r.data + r.data_size));
       if (!tracing_) {
-        return nullptr;
+        return false;
       }
     }
   }
-  SetCurrentSample(*sample_record_queue_.front());
-  return &current_sample_;
+  return true;
 }
 
 void ReportLib::ProcessSampleRecord(std::unique_ptr<Record> r) {
@@ -502,18 +694,118 @@ void ReportLib::SetCurrentSample(const SampleRecord& r) {
   }
 }
 
-const EventInfo* ReportLib::FindEventOfCurrentSample() {
+void ReportLib::AddSampleToBatch(const SampleRecord& r, bool callstacks_only) {
+  SampleBatchData& d = batch_data_;
+  const ThreadEntry* thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+  ThreadReport thread_report = thread_report_builder_.Build(*thread);
+  d.times.push_back(r.time_data.time);
+  d.pids.push_back(thread_report.pid);
+  d.tids.push_back(thread_report.tid);
+  d.thread_comms.push_back(thread_report.thread_name);
+  d.cpus.push_back(r.cpu_data.cpu);
+  d.in_kernels.push_back(r.InKernel());
+  d.periods.push_back(r.period_data.period);
+
+  size_t event_index = GetEventIndex(r);
+  d.event_ids.push_back(event_index);
+  const EventInfo& event = events_[event_index];
+  if (event.tracing_info.data_format.size > 0u && (r.sample_type & PERF_SAMPLE_RAW)) {
+    CHECK_GE(r.raw_data.size, event.tracing_info.data_format.size);
+    d.tracing_data.push_back(r.raw_data.data);
+  } else {
+    d.tracing_data.push_back(nullptr);
+  }
+
+  size_t kernel_ip_count;
+  std::vector<uint64_t> ips = r.GetCallChain(&kernel_ip_count);
+  std::vector<CallChainReportEntry> report_entries =
+      callchain_report_builder_.Build(thread, ips, kernel_ip_count);
+  if (callstacks_only) {
+    // Only new call stack nodes are added, instead of all frames of the sample.
+    d.callstack_ids.push_back(callchain_interner_.AddCallChain(report_entries));
+    const auto& frames = callchain_interner_.GetFrames();
+    const auto& nodes = callchain_interner_.GetCallStackNodes();
+    for (size_t i = batch_callstacks_.size(); i < nodes.size(); i++) {
+      const CallChainReportEntry& frame = frames[nodes[i].frame_id];
+      BatchCallStackNode& node = batch_callstacks_.emplace_back();
+      node.parent_id = nodes[i].parent_id;
+      node.symbol_id = GetBatchSymbolId(frame);
+      node.mapping_id = GetBatchMappingId(frame.map);
+      node.vaddr_in_file = frame.vaddr_in_file;
+    }
+    return;
+  }
+  for (const auto& report_entry : report_entries) {
+    d.frame_ips.push_back(report_entry.ip);
+    d.frame_vaddr_in_files.push_back(report_entry.vaddr_in_file);
+    d.frame_symbol_ids.push_back(GetBatchSymbolId(report_entry));
+    d.frame_mapping_ids.push_back(GetBatchMappingId(report_entry.map));
+  }
+  d.callchain_offsets.push_back(d.frame_ips.size());
+}
+
+uint32_t ReportLib::GetBatchSymbolId(const CallChainReportEntry& entry) {
+  const char* dso_name =
+      entry.dso_name != nullptr ? entry.dso_name : entry.dso->GetReportPath().data();
+  auto symbol_key = std::make_pair(dso_name, entry.symbol);
+  auto it = batch_symbol_ids_.find(symbol_key);
+  if (it == batch_symbol_ids_.end()) {
+    it = batch_symbol_ids_.emplace(symbol_key, batch_symbols_.size()).first;
+    BatchSymbol& symbol = batch_symbols_.emplace_back();
+    symbol.dso_name = dso_name;
+    symbol.symbol_name = entry.symbol->DemangledName();
+    symbol.symbol_addr = entry.symbol->addr;
+    symbol.symbol_len = entry.symbol->len;
+  }
+  return it->second;
+}
+
+uint32_t ReportLib::GetBatchMappingId(const MapEntry* map) {
+  auto it = batch_mapping_ids_.find(map);
+  if (it == batch_mapping_ids_.end()) {
+    it = batch_mapping_ids_.emplace(map, batch_mappings_.size()).first;
+    Mapping& mapping = batch_mappings_.emplace_back();
+    mapping.start = map->start_addr;
+    mapping.end = map->start_addr + map->len;
+    mapping.pgoff = map->pgoff;
+  }
+  return it->second;
+}
+
+void ReportLib::ClearSampleBatch() {
+  SampleBatchData& d = batch_data_;
+  d.times.clear();
+  d.pids.clear();
+  d.tids.clear();
+  d.thread_comms.clear();
+  d.cpus.clear();
+  d.in_kernels.clear();
+  d.periods.clear();
+  d.event_ids.clear();
+  d.tracing_data.clear();
+  d.callchain_offsets.assign(1, 0);
+  d.callstack_ids.clear();
+  d.frame_ips.clear();
+  d.frame_vaddr_in_files.clear();
+  d.frame_symbol_ids.clear();
+  d.frame_mapping_ids.clear();
+  d.records.clear();
+}
+
+size_t ReportLib::GetEventIndex(const SampleRecord& r) {
   if (events_.empty()) {
     CreateEvents();
   }
   if (trace_offcpu_.mode == TraceOffCpuMode::MIXED_ON_OFF_CPU) {
     // To mix on-cpu and off-cpu samples, pretend they are from the same event type.
     // Otherwise, some report scripts may split them.
-    return &events_[0];
+    return 0;
   }
-  SampleRecord* r = sample_record_queue_.front().get();
-  size_t attr_index = record_file_reader_->GetAttrIndexOfRecord(r);
-  return &events_[attr_index];
+  return record_file_reader_->GetAttrIndexOfRecord(&r);
+}
+
+const EventInfo* ReportLib::FindEventOfCurrentSample() {
+  return &events_[GetEventIndex(*sample_record_queue_.front())];
 }
 
 void ReportLib::CreateEvents() {
@@ -625,6 +917,20 @@ SymbolEntry* GetSymbolOfCurrentSample(ReportLib* report_lib) EXPORT;
 CallChain* GetCallChainOfCurrentSample(ReportLib* report_lib) EXPORT;
 const char* GetTracingDataOfCurrentSample(ReportLib* report_lib) EXPORT;
 
+// Read up to max_samples samples in one call, to reduce calls per sample. Return nullptr if no
+// more samples. The returned batch is valid until the next call. It shares the sample reading
+// position with GetNextSample(), but doesn't update the current sample.
+// If callstacks_only is true, samples only refer to call stacks returned by
+// GetCallStacksOfSampleBatch(), instead of having all their frames in frame arrays. Since most
+// samples repeat call stacks, this is much smaller.
+SampleBatch* GetNextSampleBatch(ReportLib* report_lib, uint32_t max_samples,
+                                bool callstacks_only) EXPORT;
+// Return tables referred by ids in sample batches. New entries are appended after each batch.
+Event* GetEventsOfSampleBatch(ReportLib* report_lib, uint32_t* count) EXPORT;
+BatchSymbol* GetSymbolsOfSampleBatch(ReportLib* report_lib, uint32_t* count) EXPORT;
+Mapping* GetMappingsOfSampleBatch(ReportLib* report_lib, uint32_t* count) EXPORT;
+BatchCallStackNode* GetCallStacksOfSampleBatch(ReportLib* report_lib, uint32_t* count) EXPORT;
+
 const char* GetBuildIdForPath(ReportLib* report_lib, const char* path) EXPORT;
 FeatureSection* GetFeatureSection(ReportLib* report_lib, const char* feature_name) EXPORT;
 }
@@ -707,6 +1013,27 @@ const char* GetTracingDataOfCurrentSample(ReportLib* report_lib) {
   return report_lib->GetTracingDataOfCurrentSample();
 }
 
+SampleBatch* GetNextSampleBatch(ReportLib* report_lib, uint32_t max_samples,
+                                bool callstacks_only) {
+  return report_lib->GetNextSampleBatch(max_samples, callstacks_only);
+}
+
+Event* GetEventsOfSampleBatch(ReportLib* report_lib, uint32_t* count) {
+  return report_lib->GetEventsOfSampleBatch(count);
+}
+
+BatchSymbol* GetSymbolsOfSampleBatch(ReportLib* report_lib, uint32_t* count) {
+  return report_lib->GetSymbolsOfSampleBatch(count);
+}
+
+Mapping* GetMappingsOfSampleBatch(ReportLib* report_lib, uint32_t* count) {
+  return report_lib->GetMappingsOfSampleBatch(count);
+}
+
+BatchCallStackNode* GetCallStacksOfSampleBatch(ReportLib* report_lib, uint32_t* count) {
+  return report_lib->GetCallStacksOfSampleBatch(count);
+}
+
 const char* GetBuildIdForPath(ReportLib* report_lib, const char* path) {
   return report_lib->GetBuildIdForPath(path);
 }
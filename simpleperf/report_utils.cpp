@@ -17,9 +17,10 @@
 #include "report_utils.h"
 
 #include <stdlib.h>
+#include <sys/stat.h>
 
+#include <android-base/file.h>
 #include <android-base/parsebool.h>
-#include <android-base/scopeguard.h>
 #include <android-base/strings.h>
 
 #include "JITDebugReader.h"
@@ -27,48 +28,212 @@
 
 namespace simpleperf {
 
-bool ProguardMappingRetrace::AddProguardMappingFile(std::string_view mapping_file) {
+static constexpr char kProguardIndexMagic[8] = {'S', 'P', 'P', 'G', 'I', 'N', 'D', 'X'};
+static constexpr uint32_t kProguardIndexVersion = 1;
+
+// Header of a proguard mapping index file. It's followed by class_count uint64 offsets of class
+// lines in the mapping file.
+struct ProguardIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  // Used to check if the index file matches the mapping file.
+  uint64_t mapping_file_size;
+  int64_t mapping_file_mtime;
+  uint64_t class_count;
+};
+
+// Match line "original_classname -> obfuscated_classname:".
+static bool ParseClassLine(std::string_view s, std::string_view* original_classname,
+                           std::string_view* obfuscated_classname) {
+  if (s.empty() || s[0] == ' ' || s[0] == '#') {
+    return false;
+  }
+  auto arrow_pos = s.find(" -> ");
+  if (arrow_pos == s.npos) {
+    return false;
+  }
+  auto arrow_end_pos = arrow_pos + strlen(" -> ");
+  auto colon_pos = s.find(':', arrow_end_pos);
+  if (colon_pos == s.npos) {
+    return false;
+  }
+  *original_classname = s.substr(0, arrow_pos);
+  *obfuscated_classname = s.substr(arrow_end_pos, colon_pos - arrow_end_pos);
+  return true;
+}
+
+static std::string_view GetLineAt(std::string_view data, size_t pos) {
+  size_t end = data.find('\n', pos);
+  return data.substr(pos, end == data.npos ? data.npos : end - pos);
+}
+
+static bool GetFileMTime(const std::string& path, int64_t* mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  *mtime = st.st_mtime;
+  return true;
+}
+
+bool ProguardMappingRetrace::AddProguardMappingFile(std::string_view mapping_file,
+                                                    bool use_index_file) {
   // The mapping file format is described in
   // https://www.guardsquare.com/en/products/proguard/manual/retrace.
   // Additional info provided by R8 is described in
   // https://r8.googlesource.com/r8/+/refs/heads/main/doc/retrace.md.
-  line_reader_.reset(new LineReader(mapping_file));
-  android::base::ScopeGuard g([&]() { line_reader_ = nullptr; });
-
-  if (!line_reader_->Ok()) {
+  std::string path(mapping_file);
+  android::base::unique_fd fd(FileHelper::OpenReadOnly(path));
+  if (fd == -1) {
     PLOG(ERROR) << "failed to read " << mapping_file;
     return false;
   }
+  uint64_t file_size = GetFileSize(path);
+  if (file_size == 0) {
+    return true;
+  }
+  auto map = android::base::MappedFile::FromFd(fd, 0, file_size, PROT_READ);
+  if (!map) {
+    PLOG(ERROR) << "failed to map " << mapping_file;
+    return false;
+  }
+  std::string_view data(map->data(), map->size());
+
+  // Find class lines. Method lines are parsed lazily in GetMappingClass().
+  std::vector<uint64_t> offsets;
+  std::string index_file = path + ".simpleperf_index";
+  if (!use_index_file || !ReadIndexFile(index_file, path, data, &offsets)) {
+    std::string_view original_classname;
+    std::string_view obfuscated_classname;
+    for (size_t pos = 0; pos < data.size();) {
+      std::string_view line = GetLineAt(data, pos);
+      if (ParseClassLine(line, &original_classname, &obfuscated_classname)) {
+        offsets.push_back(pos);
+      }
+      pos += line.size() + 1;
+    }
+    if (use_index_file) {
+      WriteIndexFile(index_file, path, offsets);
+    }
+  }
 
-  MoveToNextLine();
-  while (cur_line_.type != LineType::LINE_EOF) {
-    if (cur_line_.type == LineType::CLASS_LINE) {
-      // Match line "original_classname -> obfuscated_classname:".
-      std::string_view s = cur_line_.data;
-      auto arrow_pos = s.find(" -> ");
-      auto arrow_end_pos = arrow_pos + strlen(" -> ");
-      if (auto colon_pos = s.find(':', arrow_end_pos); colon_pos != s.npos) {
-        std::string_view original_classname = s.substr(0, arrow_pos);
-        std::string obfuscated_classname(s.substr(arrow_end_pos, colon_pos - arrow_end_pos));
-        MappingClass& cur_class = class_map_[obfuscated_classname];
-        cur_class.original_classname = original_classname;
-        MoveToNextLine();
-        if (cur_line_.type == LineType::SYNTHESIZED_COMMENT) {
-          cur_class.synthesized = true;
-          MoveToNextLine();
-        }
+  uint32_t file_index = static_cast<uint32_t>(mapping_files_.size());
+  for (uint64_t offset : offsets) {
+    std::string_view original_classname;
+    std::string_view obfuscated_classname;
+    ParseClassLine(GetLineAt(data, offset), &original_classname, &obfuscated_classname);
+    ClassLocation location{file_index, offset};
+    auto [it, inserted] = class_index_.try_emplace(obfuscated_classname);
+    if (inserted) {
+      it->second.location = location;
+    } else {
+      duplicated_class_locations_[obfuscated_classname].push_back(location);
+      // The class needs to be parsed again with the new location.
+      it->second.mapping_class.reset();
+    }
+  }
+  mapping_files_.emplace_back(std::move(map));
+  return true;
+}
 
-        while (cur_line_.type == LineType::METHOD_LINE) {
-          ParseMethod(cur_class);
-        }
-        continue;
+bool ProguardMappingRetrace::ReadIndexFile(const std::string& index_file,
+                                           const std::string& mapping_file, std::string_view data,
+                                           std::vector<uint64_t>* offsets) {
+  std::string content;
+  if (!android::base::ReadFileToString(index_file, &content)) {
+    return false;
+  }
+  ProguardIndexHeader header;
+  int64_t mtime;
+  if (content.size() < sizeof(header) || !GetFileMTime(mapping_file, &mtime)) {
+    return false;
+  }
+  memcpy(&header, content.data(), sizeof(header));
+  if (memcmp(header.magic, kProguardIndexMagic, sizeof(kProguardIndexMagic)) != 0 ||
+      header.version != kProguardIndexVersion || header.mapping_file_size != data.size() ||
+      header.mapping_file_mtime != mtime ||
+      header.class_count > (content.size() - sizeof(header)) / sizeof(uint64_t) ||
+      sizeof(header) + header.class_count * sizeof(uint64_t) != content.size()) {
+    LOG(DEBUG) << "Ignore outdated proguard mapping index file " << index_file;
+    return false;
+  }
+  offsets->resize(header.class_count);
+  memcpy(offsets->data(), content.data() + sizeof(header), header.class_count * sizeof(uint64_t));
+  std::string_view original_classname;
+  std::string_view obfuscated_classname;
+  for (uint64_t offset : *offsets) {
+    if (offset >= data.size() || (offset > 0 && data[offset - 1] != '\n') ||
+        !ParseClassLine(GetLineAt(data, offset), &original_classname, &obfuscated_classname)) {
+      LOG(WARNING) << "Ignore invalid proguard mapping index file " << index_file;
+      offsets->clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+void ProguardMappingRetrace::WriteIndexFile(const std::string& index_file,
+                                            const std::string& mapping_file,
+                                            const std::vector<uint64_t>& offsets) {
+  ProguardIndexHeader header;
+  memcpy(header.magic, kProguardIndexMagic, sizeof(kProguardIndexMagic));
+  header.version = kProguardIndexVersion;
+  header.reserved = 0;
+  header.mapping_file_size = GetFileSize(mapping_file);
+  header.class_count = offsets.size();
+  if (!GetFileMTime(mapping_file, &header.mapping_file_mtime)) {
+    return;
+  }
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  data.append(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+
+  if (!WriteFileAtomically(index_file, data)) {
+    LOG(DEBUG) << "failed to write proguard mapping index file " << index_file;
+  }
+}
+
+const ProguardMappingRetrace::MappingClass* ProguardMappingRetrace::GetMappingClass(
+    std::string_view obfuscated_classname) {
+  auto it = class_index_.find(obfuscated_classname);
+  if (it == class_index_.end()) {
+    return nullptr;
+  }
+  ClassIndexEntry& entry = it->second;
+  if (!entry.mapping_class) {
+    entry.mapping_class.reset(new MappingClass);
+    ParseClass(entry.location, *entry.mapping_class);
+    if (auto dup_it = duplicated_class_locations_.find(obfuscated_classname);
+        dup_it != duplicated_class_locations_.end()) {
+      for (const ClassLocation& location : dup_it->second) {
+        ParseClass(location, *entry.mapping_class);
       }
     }
+  }
+  return entry.mapping_class.get();
+}
 
-    // Skip unparsed line.
+void ProguardMappingRetrace::ParseClass(const ClassLocation& location,
+                                        MappingClass& mapping_class) {
+  const auto& map = mapping_files_[location.file_index];
+  data_ = std::string_view(map->data(), map->size());
+  data_pos_ = location.offset;
+  MoveToNextLine();
+  std::string_view original_classname;
+  std::string_view obfuscated_classname;
+  if (cur_line_.type != LineType::CLASS_LINE ||
+      !ParseClassLine(cur_line_.data, &original_classname, &obfuscated_classname)) {
+    return;
+  }
+  mapping_class.original_classname = original_classname;
+  MoveToNextLine();
+  if (cur_line_.type == LineType::SYNTHESIZED_COMMENT) {
+    mapping_class.synthesized = true;
     MoveToNextLine();
   }
-  return true;
+  while (cur_line_.type == LineType::METHOD_LINE) {
+    ParseMethod(mapping_class);
+  }
 }
 
 void ProguardMappingRetrace::ParseMethod(MappingClass& mapping_class) {
@@ -118,9 +283,9 @@ void ProguardMappingRetrace::ParseMethod(MappingClass& mapping_class) {
 }
 
 void ProguardMappingRetrace::MoveToNextLine() {
-  std::string* line;
-  while ((line = line_reader_->ReadLine()) != nullptr) {
-    std::string_view s = *line;
+  while (data_pos_ < data_.size()) {
+    std::string_view s = GetLineAt(data_, data_pos_);
+    data_pos_ += s.size() + 1;
     if (s.empty()) {
       continue;
     }
@@ -152,10 +317,10 @@ void ProguardMappingRetrace::MoveToNextLine() {
 bool ProguardMappingRetrace::DeObfuscateJavaMethods(std::string_view obfuscated_name,
                                                     std::string* original_name, bool* synthesized) {
   if (auto split_pos = obfuscated_name.rfind('.'); split_pos != obfuscated_name.npos) {
-    std::string obfuscated_classname(obfuscated_name.substr(0, split_pos));
+    std::string_view obfuscated_classname = obfuscated_name.substr(0, split_pos);
 
-    if (auto it = class_map_.find(obfuscated_classname); it != class_map_.end()) {
-      const MappingClass& mapping_class = it->second;
+    if (const MappingClass* p = GetMappingClass(obfuscated_classname); p != nullptr) {
+      const MappingClass& mapping_class = *p;
       const auto& method_map = mapping_class.method_map;
       std::string obfuscated_methodname(obfuscated_name.substr(split_pos + 1));
 
@@ -204,11 +369,12 @@ CallChainReportBuilder::CallChainReportBuilder(ThreadTree& thread_tree)
   }
 }
 
-bool CallChainReportBuilder::AddProguardMappingFile(std::string_view mapping_file) {
+bool CallChainReportBuilder::AddProguardMappingFile(std::string_view mapping_file,
+                                                    bool use_index_file) {
   if (!retrace_) {
     retrace_.reset(new ProguardMappingRetrace);
   }
-  return retrace_->AddProguardMappingFile(mapping_file);
+  return retrace_->AddProguardMappingFile(mapping_file, use_index_file);
 }
 
 std::vector<CallChainReportEntry> CallChainReportBuilder::Build(const ThreadEntry* thread,
@@ -377,6 +543,30 @@ void CallChainReportBuilder::DeObfuscateJavaMethods(std::vector<CallChainReportE
   }
 }
 
+uint32_t CallChainInterner::AddFrame(const CallChainReportEntry& entry) {
+  FrameKey key{separate_maps_ ? entry.map : nullptr, entry.dso, entry.symbol, entry.vaddr_in_file,
+               entry.execution_type};
+  auto [it, inserted] = frame_map_.try_emplace(key, frames_.size());
+  if (inserted) {
+    frames_.emplace_back(entry);
+  }
+  return it->second;
+}
+
+uint32_t CallChainInterner::AddCallChain(const std::vector<CallChainReportEntry>& callchain) {
+  uint32_t node_id = NO_PARENT;
+  for (auto it = callchain.rbegin(); it != callchain.rend(); ++it) {
+    uint32_t frame_id = AddFrame(*it);
+    uint64_t key = (static_cast<uint64_t>(node_id) << 32) | frame_id;
+    auto [node_it, inserted] = node_map_.try_emplace(key, nodes_.size());
+    if (inserted) {
+      nodes_.emplace_back(CallStackNode{node_id, frame_id});
+    }
+    node_id = node_it->second;
+  }
+  return node_id;
+}
+
 bool ThreadReportBuilder::AggregateThreads(const std::vector<std::string>& thread_name_regex) {
   size_t i = thread_regs_.size();
   thread_regs_.resize(i + thread_name_regex.size());
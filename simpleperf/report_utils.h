@@ -18,11 +18,14 @@
 
 #include <inttypes.h>
 
+#include <memory>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include <android-base/mapped_file.h>
+
 #include "RegEx.h"
 #include "dso.h"
 #include "thread_tree.h"
@@ -30,10 +33,15 @@
 
 namespace simpleperf {
 
+// De-obfuscate Java methods using proguard mapping files. Mapping files are mapped in memory, and
+// only an index of class lines is built when adding them. Methods of a class are parsed on the
+// first lookup of the class.
 class ProguardMappingRetrace {
  public:
-  // Add proguard mapping.txt to de-obfuscate minified symbols.
-  bool AddProguardMappingFile(std::string_view mapping_file);
+  // Add proguard mapping.txt to de-obfuscate minified symbols. If use_index_file is true, the
+  // class index is read from (or written to) <mapping_file>.simpleperf_index, to avoid scanning
+  // the mapping file again in later runs.
+  bool AddProguardMappingFile(std::string_view mapping_file, bool use_index_file = false);
 
   bool DeObfuscateJavaMethods(std::string_view obfuscated_name, std::string* original_name,
                               bool* synthesized);
@@ -52,6 +60,18 @@ class ProguardMappingRetrace {
     std::unordered_map<std::string, MappingMethod> method_map;
   };
 
+  // Location of a class line in mapping files.
+  struct ClassLocation {
+    uint32_t file_index;
+    uint64_t offset;
+  };
+
+  struct ClassIndexEntry {
+    ClassLocation location;
+    // Parsed on the first lookup.
+    std::unique_ptr<MappingClass> mapping_class;
+  };
+
   enum LineType {
     SYNTHESIZED_COMMENT,
     CLASS_LINE,
@@ -64,12 +84,23 @@ class ProguardMappingRetrace {
     std::string_view data;
   };
 
+  bool ReadIndexFile(const std::string& index_file, const std::string& mapping_file,
+                     std::string_view data, std::vector<uint64_t>* offsets);
+  void WriteIndexFile(const std::string& index_file, const std::string& mapping_file,
+                      const std::vector<uint64_t>& offsets);
+  const MappingClass* GetMappingClass(std::string_view obfuscated_classname);
+  void ParseClass(const ClassLocation& location, MappingClass& mapping_class);
   void ParseMethod(MappingClass& mapping_class);
   void MoveToNextLine();
 
-  // Map from obfuscated class names to ProguardMappingClass.
-  std::unordered_map<std::string, MappingClass> class_map_;
-  std::unique_ptr<LineReader> line_reader_;
+  std::vector<std::unique_ptr<android::base::MappedFile>> mapping_files_;
+  // Map from obfuscated class names (pointing to mapping_files_) to ClassIndexEntry.
+  std::unordered_map<std::string_view, ClassIndexEntry> class_index_;
+  // Locations of classes appearing more than once, following the location in class_index_.
+  std::unordered_map<std::string_view, std::vector<ClassLocation>> duplicated_class_locations_;
+  // Data of the mapping file being parsed, and the position of the next line.
+  std::string_view data_;
+  size_t data_pos_ = 0;
   LineInfo cur_line_;
 };
 
@@ -100,8 +131,9 @@ class CallChainReportBuilder {
   // If true, convert a JIT method into its corresponding interpreted Java method. So they can be
   // merged in reports like flamegraph. Default is true.
   void SetConvertJITFrame(bool enable) { convert_jit_frame_ = enable; }
-  // Add proguard mapping.txt to de-obfuscate minified symbols.
-  bool AddProguardMappingFile(std::string_view mapping_file);
+  // Add proguard mapping.txt to de-obfuscate minified symbols. See
+  // ProguardMappingRetrace::AddProguardMappingFile() for use_index_file.
+  bool AddProguardMappingFile(std::string_view mapping_file, bool use_index_file = false);
   std::vector<CallChainReportEntry> Build(const ThreadEntry* thread,
                                           const std::vector<uint64_t>& ips, size_t kernel_ip_count);
 
@@ -126,6 +158,69 @@ class CallChainReportBuilder {
   std::unique_ptr<ProguardMappingRetrace> retrace_;
 };
 
+// Assign ids to callchain frames and call stacks, so that repeated call stacks can be reported
+// once and referred by id. A frame is identified by its dso, symbol, vaddr_in_file and execution
+// type. Call stacks are stored in a prefix tree starting from the outermost frame, so call stacks
+// sharing callers share nodes. Ids start from 0. Frames and nodes are only appended, so reporters
+// can output new ones incrementally.
+class CallChainInterner {
+ public:
+  static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+  struct CallStackNode {
+    // Id of the node of the caller, or NO_PARENT for the outermost frame.
+    uint32_t parent_id;
+    uint32_t frame_id;
+  };
+
+  // If separate_maps is true, frames in different MapEntries are different frames, so the map of
+  // a frame is the map of every sample having it.
+  explicit CallChainInterner(bool separate_maps = false) : separate_maps_(separate_maps) {}
+
+  uint32_t AddFrame(const CallChainReportEntry& entry);
+  // Add a callchain having the innermost frame first, like the result of
+  // CallChainReportBuilder::Build(). Return the node id of the innermost frame, or NO_PARENT if
+  // the callchain is empty.
+  uint32_t AddCallChain(const std::vector<CallChainReportEntry>& callchain);
+  // A frame keeps the first CallChainReportEntry added for it. So only fields identifying the
+  // frame are meaningful.
+  const std::vector<CallChainReportEntry>& GetFrames() const { return frames_; }
+  const std::vector<CallStackNode>& GetCallStackNodes() const { return nodes_; }
+
+ private:
+  struct FrameKey {
+    const MapEntry* map;
+    const Dso* dso;
+    const Symbol* symbol;
+    uint64_t vaddr_in_file;
+    CallChainExecutionType execution_type;
+
+    bool operator==(const FrameKey& other) const {
+      return map == other.map && dso == other.dso && symbol == other.symbol &&
+             vaddr_in_file == other.vaddr_in_file && execution_type == other.execution_type;
+    }
+  };
+
+  struct FrameKeyHash {
+    size_t operator()(const FrameKey& key) const noexcept {
+      size_t seed = 0;
+      HashCombine(seed, key.map);
+      HashCombine(seed, key.dso);
+      HashCombine(seed, key.symbol);
+      HashCombine(seed, key.vaddr_in_file);
+      HashCombine(seed, static_cast<int>(key.execution_type));
+      return seed;
+    }
+  };
+
+  const bool separate_maps_;
+  std::unordered_map<FrameKey, uint32_t, FrameKeyHash> frame_map_;
+  std::vector<CallChainReportEntry> frames_;
+  // Map from (parent_id << 32 | frame_id) to node id.
+  std::unordered_map<uint64_t, uint32_t> node_map_;
+  std::vector<CallStackNode> nodes_;
+};
+
 struct ThreadReport {
   int pid;
   int tid;
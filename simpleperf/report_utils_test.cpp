@@ -68,6 +68,84 @@ TEST(ProguardMappingRetrace, smoke) {
   ASSERT_TRUE(synthesized);
 }
 
+TEST(ProguardMappingRetrace, index_file) {
+  TemporaryFile tmpfile;
+  close(tmpfile.release());
+  std::string index_file = std::string(tmpfile.path) + ".simpleperf_index";
+  ASSERT_TRUE(android::base::WriteStringToFile("original.class.A -> A:\n"
+                                               "    void method_a() -> a\n"
+                                               "original.class.B -> B:\n"
+                                               "    void method_b() -> b\n",
+                                               tmpfile.path));
+  std::string original_name;
+  bool synthesized;
+  {
+    ProguardMappingRetrace retrace;
+    ASSERT_TRUE(retrace.AddProguardMappingFile(tmpfile.path, true));
+    ASSERT_TRUE(retrace.DeObfuscateJavaMethods("B.b", &original_name, &synthesized));
+    ASSERT_EQ(original_name, "original.class.B.method_b");
+  }
+  ASSERT_TRUE(IsRegularFile(index_file));
+  {
+    // Read classes from the index file.
+    ProguardMappingRetrace retrace;
+    ASSERT_TRUE(retrace.AddProguardMappingFile(tmpfile.path, true));
+    ASSERT_TRUE(retrace.DeObfuscateJavaMethods("A.a", &original_name, &synthesized));
+    ASSERT_EQ(original_name, "original.class.A.method_a");
+    ASSERT_TRUE(retrace.DeObfuscateJavaMethods("B.b", &original_name, &synthesized));
+    ASSERT_EQ(original_name, "original.class.B.method_b");
+  }
+  // An outdated index file is ignored and rewritten.
+  ASSERT_TRUE(android::base::WriteStringToFile("original.class.C -> C:\n"
+                                               "    void method_c() -> c\n",
+                                               tmpfile.path));
+  {
+    ProguardMappingRetrace retrace;
+    ASSERT_TRUE(retrace.AddProguardMappingFile(tmpfile.path, true));
+    ASSERT_FALSE(retrace.DeObfuscateJavaMethods("A.a", &original_name, &synthesized));
+    ASSERT_TRUE(retrace.DeObfuscateJavaMethods("C.c", &original_name, &synthesized));
+    ASSERT_EQ(original_name, "original.class.C.method_c");
+  }
+  // An index file with a class_count overflowing the size check is ignored.
+  std::string content;
+  ASSERT_TRUE(android::base::ReadFileToString(index_file, &content));
+  ASSERT_EQ(content.size(), 48);
+  uint64_t class_count = (1ULL << 61) + 1;
+  memcpy(content.data() + 32, &class_count, sizeof(class_count));
+  ASSERT_TRUE(android::base::WriteStringToFile(content, index_file));
+  {
+    ProguardMappingRetrace retrace;
+    ASSERT_TRUE(retrace.AddProguardMappingFile(tmpfile.path, true));
+    ASSERT_TRUE(retrace.DeObfuscateJavaMethods("C.c", &original_name, &synthesized));
+    ASSERT_EQ(original_name, "original.class.C.method_c");
+  }
+  unlink(index_file.c_str());
+}
+
+TEST(ProguardMappingRetrace, class_in_multiple_files) {
+  TemporaryFile tmpfile1;
+  close(tmpfile1.release());
+  ASSERT_TRUE(android::base::WriteStringToFile("original.class.A -> A:\n"
+                                               "    void method_a() -> a\n",
+                                               tmpfile1.path));
+  TemporaryFile tmpfile2;
+  close(tmpfile2.release());
+  ASSERT_TRUE(android::base::WriteStringToFile("original.class.A -> A:\n"
+                                               "    void method_b() -> b\n",
+                                               tmpfile2.path));
+  ProguardMappingRetrace retrace;
+  ASSERT_TRUE(retrace.AddProguardMappingFile(tmpfile1.path));
+  std::string original_name;
+  bool synthesized;
+  ASSERT_TRUE(retrace.DeObfuscateJavaMethods("A.a", &original_name, &synthesized));
+  ASSERT_EQ(original_name, "original.class.A.method_a");
+  ASSERT_TRUE(retrace.AddProguardMappingFile(tmpfile2.path));
+  ASSERT_TRUE(retrace.DeObfuscateJavaMethods("A.a", &original_name, &synthesized));
+  ASSERT_EQ(original_name, "original.class.A.method_a");
+  ASSERT_TRUE(retrace.DeObfuscateJavaMethods("A.b", &original_name, &synthesized));
+  ASSERT_EQ(original_name, "original.class.A.method_b");
+}
+
 class CallChainReportBuilderTest : public testing::Test {
  protected:
   virtual void SetUp() {
@@ -540,6 +618,74 @@ TEST_F(CallChainReportBuilderTest, convert_jit_frame_for_jit_method_with_signatu
   ASSERT_EQ(entries[1].execution_type, CallChainExecutionType::JIT_JVM_METHOD);
 }
 
+TEST(CallChainInterner, smoke) {
+  Symbol func_a("func_a", 0x0, 0x100);
+  Symbol func_b("func_b", 0x100, 0x100);
+  Symbol func_c("func_c", 0x200, 0x100);
+  auto entry = [](const Symbol& symbol, uint64_t vaddr_in_file) {
+    CallChainReportEntry entry;
+    entry.ip = vaddr_in_file + 0x1000;
+    entry.symbol = &symbol;
+    entry.vaddr_in_file = vaddr_in_file;
+    return entry;
+  };
+  CallChainInterner interner;
+  // func_a -> func_b -> func_c
+  uint32_t stack1 = interner.AddCallChain({entry(func_c, 0x210), entry(func_b, 0x110),
+                                           entry(func_a, 0x10)});
+  ASSERT_EQ(interner.GetFrames().size(), 3);
+  ASSERT_EQ(interner.GetCallStackNodes().size(), 3);
+  ASSERT_EQ(interner.AddCallChain({entry(func_c, 0x210), entry(func_b, 0x110),
+                                   entry(func_a, 0x10)}),
+            stack1);
+  // func_a -> func_b shares nodes with stack1.
+  uint32_t stack2 = interner.AddCallChain({entry(func_b, 0x110), entry(func_a, 0x10)});
+  ASSERT_EQ(interner.GetCallStackNodes()[stack1].parent_id, stack2);
+  // func_a -> func_c adds a node, but no frame.
+  uint32_t stack3 = interner.AddCallChain({entry(func_c, 0x210), entry(func_a, 0x10)});
+  ASSERT_NE(stack3, stack1);
+  ASSERT_EQ(interner.GetFrames().size(), 3);
+  ASSERT_EQ(interner.GetCallStackNodes().size(), 4);
+  const auto& nodes = interner.GetCallStackNodes();
+  ASSERT_EQ(nodes[stack3].frame_id, nodes[stack1].frame_id);
+  ASSERT_EQ(nodes[stack3].parent_id, nodes[stack2].parent_id);
+  uint32_t root = nodes[stack2].parent_id;
+  ASSERT_EQ(nodes[root].parent_id, CallChainInterner::NO_PARENT);
+  ASSERT_EQ(interner.GetFrames()[nodes[root].frame_id].symbol, &func_a);
+  // A different vaddr_in_file is a different frame.
+  interner.AddCallChain({entry(func_a, 0x20)});
+  ASSERT_EQ(interner.GetFrames().size(), 4);
+  ASSERT_EQ(interner.AddCallChain({}), CallChainInterner::NO_PARENT);
+}
+
+TEST(CallChainInterner, separate_maps) {
+  Symbol func_a("func_a", 0x0, 0x100);
+  MapEntry map1(0x1000, 0x1000, 0, nullptr, false);
+  MapEntry map2(0x5000, 0x1000, 0, nullptr, false);
+  auto entry = [&](const MapEntry& map) {
+    CallChainReportEntry entry;
+    entry.ip = map.start_addr + 0x10;
+    entry.symbol = &func_a;
+    entry.vaddr_in_file = 0x10;
+    entry.map = &map;
+    return entry;
+  };
+  // The same library mapped twice shares frames by default.
+  CallChainInterner interner;
+  ASSERT_EQ(interner.AddCallChain({entry(map1)}), interner.AddCallChain({entry(map2)}));
+  ASSERT_EQ(interner.GetFrames().size(), 1);
+
+  CallChainInterner map_interner(true);
+  uint32_t stack1 = map_interner.AddCallChain({entry(map1)});
+  uint32_t stack2 = map_interner.AddCallChain({entry(map2)});
+  ASSERT_NE(stack1, stack2);
+  const auto& frames = map_interner.GetFrames();
+  const auto& nodes = map_interner.GetCallStackNodes();
+  ASSERT_EQ(frames[nodes[stack1].frame_id].map, &map1);
+  ASSERT_EQ(frames[nodes[stack2].frame_id].map, &map2);
+  ASSERT_EQ(map_interner.AddCallChain({entry(map1)}), stack1);
+}
+
 class ThreadReportBuilderTest : public testing::Test {
  protected:
   virtual void SetUp() {
@@ -20,7 +20,7 @@ import shutil
 import tempfile
 from typing import Dict, List, Optional, Set
 
-from simpleperf_report_lib import ReportLib
+from simpleperf_report_lib import BATCH_CALLSTACK_NO_PARENT, ReportLib
 from simpleperf_utils import ReadElf
 from . test_utils import TestBase, TestHelper
 
@@ -68,6 +68,74 @@ class TestReportLib(TestBase):
                 self.assertEqual(callchain.nr, 0)
         self.assertTrue(found_sample)
 
+    def test_sample_batch(self):
+        record_file = TestHelper.testdata_path('perf_with_symbols.data')
+        self.report_lib.SetRecordFile(record_file)
+        expected = []
+        while self.report_lib.GetNextSample():
+            sample = self.report_lib.GetCurrentSample()
+            symbol = self.report_lib.GetSymbolOfCurrentSample()
+            callchain = self.report_lib.GetCallChainOfCurrentSample()
+            event = self.report_lib.GetEventOfCurrentSample()
+            expected.append((sample.time, sample.pid, sample.tid, sample.thread_comm, sample.cpu,
+                             sample.period, event.name, sample.ip, symbol.symbol_name,
+                             symbol.dso_name, symbol.mapping[0].start, callchain.nr + 1))
+
+        batch_report_lib = ReportLib()
+        try:
+            batch_report_lib.SetRecordFile(record_file)
+            actual = []
+            frames = []
+            while True:
+                batch = batch_report_lib.GetNextSampleBatch(max_samples=7)
+                if batch is None:
+                    break
+                self.assertLessEqual(batch.sample_count, 7)
+                self.assertEqual(batch.callstack_ids, [])
+                for i in range(batch.sample_count):
+                    frame = batch.callchain_offsets[i]
+                    symbol = batch_report_lib.batch_symbols[batch.frame_symbol_ids[frame]]
+                    mapping = batch_report_lib.batch_mappings[batch.frame_mapping_ids[frame]]
+                    event = batch_report_lib.batch_events[batch.event_ids[i]]
+                    actual.append((batch.times[i], batch.pids[i], batch.tids[i],
+                                   batch.thread_comms[i], batch.cpus[i], batch.periods[i],
+                                   event.name, batch.frame_ips[frame], symbol.symbol_name,
+                                   symbol.dso_name, mapping.start,
+                                   batch.callchain_offsets[i + 1] - frame))
+                    frames.append(
+                        [(batch_report_lib.batch_symbols[batch.frame_symbol_ids[j]],
+                          batch.frame_vaddr_in_files[j])
+                         for j in range(frame, batch.callchain_offsets[i + 1])])
+        finally:
+            batch_report_lib.Close()
+        self.assertGreater(len(expected), 7)
+        self.assertEqual(actual, expected)
+
+        # In callstacks_only mode, call stacks have the same frames as callchains.
+        batch_report_lib = ReportLib()
+        try:
+            batch_report_lib.SetRecordFile(record_file)
+            callstack_frames = []
+            while True:
+                batch = batch_report_lib.GetNextSampleBatch(max_samples=7, callstacks_only=True)
+                if batch is None:
+                    break
+                self.assertEqual(batch.frame_count, 0)
+                self.assertEqual(batch.callchain_offsets, [])
+                for i in range(batch.sample_count):
+                    sample_frames = []
+                    node_id = batch.callstack_ids[i]
+                    while node_id != BATCH_CALLSTACK_NO_PARENT:
+                        node = batch_report_lib.batch_callstacks[node_id]
+                        self.assertLess(node.mapping_id, len(batch_report_lib.batch_mappings))
+                        sample_frames.append((batch_report_lib.batch_symbols[node.symbol_id],
+                                              node.vaddr_in_file))
+                        node_id = node.parent_id
+                    callstack_frames.append(sample_frames)
+        finally:
+            batch_report_lib.Close()
+        self.assertEqual(callstack_frames, frames)
+
     def test_meta_info(self):
         self.report_lib.SetRecordFile(TestHelper.testdata_path('perf_with_trace_offcpu_v2.data'))
         meta_info = self.report_lib.MetaInfo()
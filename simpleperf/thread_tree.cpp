@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <limits>
 
 #include <android-base/logging.h>
@@ -222,6 +223,7 @@ void ThreadTree::AddSymbolsForProcess(int pid, std::vector<Symbol>* symbols) {
 
   auto dso = FindUserDsoOrNew(name, 0, DSO_SYMBOL_MAP_FILE);
   dso->SetSymbols(symbols);
+  ClearIpCache();
 
   auto thread = FindThreadOrNew(pid, pid);
   AddThreadMapsForDsoSymbols(thread, dso);
@@ -275,7 +277,7 @@ void ThreadTree::InsertMap(MapSet& maps, const MapEntry& entry) {
   }
   // Insert the new entry.
   map.emplace(entry.start_addr, AllocateMap(entry));
-  maps.version++;
+  maps.version = ++last_maps_version_;
 }
 
 const MapEntry* MapSet::FindMapByAddr(uint64_t addr) const {
@@ -290,26 +292,71 @@ const MapEntry* MapSet::FindMapByAddr(uint64_t addr) const {
 }
 
 const MapEntry* ThreadTree::FindMap(const ThreadEntry* thread, uint64_t ip, bool in_kernel) {
-  const MapEntry* result = nullptr;
   if (!in_kernel) {
-    result = thread->maps->FindMapByAddr(ip);
-  } else {
-    result = kernel_maps_.FindMapByAddr(ip);
+    return FindMapWithCache(thread->maps.get(), nullptr, ip);
   }
-  return result != nullptr ? result : &unknown_map_;
+  return FindMapWithCache(nullptr, &kernel_maps_, ip);
 }
 
 const MapEntry* ThreadTree::FindMap(const ThreadEntry* thread, uint64_t ip) {
-  const MapEntry* result = thread->maps->FindMapByAddr(ip);
-  if (result != nullptr) {
-    return result;
+  return FindMapWithCache(thread->maps.get(), &kernel_maps_, ip);
+}
+
+ThreadTree::IpCacheEntry& ThreadTree::GetIpCacheEntry(uint64_t ip) {
+  if (ip_cache_.empty()) {
+    ip_cache_.resize(kIpCacheSize);
   }
-  result = kernel_maps_.FindMapByAddr(ip);
-  return result != nullptr ? result : &unknown_map_;
+  // Instructions are at least 2-byte aligned, and nearby ips are likely to be looked up together.
+  return ip_cache_[((ip >> 1) ^ (ip >> 13)) & (kIpCacheSize - 1)];
+}
+
+// Search maps first, then kernel_maps. Each of them can be nullptr.
+const MapEntry* ThreadTree::FindMapWithCache(const MapSet* maps, const MapSet* kernel_maps,
+                                             uint64_t ip) {
+  uint64_t maps_version = maps != nullptr ? maps->version : kNoMapsVersion;
+  uint64_t kernel_maps_version = kernel_maps != nullptr ? kernel_maps->version : kNoMapsVersion;
+  ip_cache_stat_.map_lookups++;
+  IpCacheEntry& entry = GetIpCacheEntry(ip);
+  if (entry.map != nullptr && entry.ip == ip && entry.maps_version == maps_version &&
+      entry.kernel_maps_version == kernel_maps_version) {
+    ip_cache_stat_.map_hits++;
+    return entry.map;
+  }
+  const MapEntry* result = nullptr;
+  if (maps != nullptr) {
+    result = maps->FindMapByAddr(ip);
+  }
+  if (result == nullptr && kernel_maps != nullptr) {
+    result = kernel_maps->FindMapByAddr(ip);
+  }
+  if (result == nullptr) {
+    result = &unknown_map_;
+  }
+  entry = IpCacheEntry();
+  entry.ip = ip;
+  entry.maps_version = maps_version;
+  entry.kernel_maps_version = kernel_maps_version;
+  entry.map = result;
+  return result;
 }
 
 const Symbol* ThreadTree::FindSymbol(const MapEntry* map, uint64_t ip, uint64_t* pvaddr_in_file,
                                      Dso** pdso) {
+  // The symbol only depends on the map and the ip. MapEntrys are kept until
+  // ClearThreadAndMap(), which clears the cache.
+  ip_cache_stat_.symbol_lookups++;
+  IpCacheEntry& entry = GetIpCacheEntry(ip);
+  bool use_cache = entry.map == map && entry.ip == ip;
+  if (use_cache && entry.symbol != nullptr) {
+    ip_cache_stat_.symbol_hits++;
+    if (pvaddr_in_file != nullptr) {
+      *pvaddr_in_file = entry.vaddr_in_file;
+    }
+    if (pdso != nullptr) {
+      *pdso = entry.dso;
+    }
+    return entry.symbol;
+  }
   uint64_t vaddr_in_file = 0;
   const Symbol* symbol = nullptr;
   Dso* dso = map->dso;
@@ -339,6 +386,11 @@ const Symbol* ThreadTree::FindSymbol(const MapEntry* map, uint64_t ip, uint64_t*
       symbol = &unknown_symbol_;
     }
   }
+  if (use_cache) {
+    entry.symbol = symbol;
+    entry.vaddr_in_file = vaddr_in_file;
+    entry.dso = dso;
+  }
   if (pvaddr_in_file != nullptr) {
     *pvaddr_in_file = vaddr_in_file;
   }
@@ -356,8 +408,26 @@ const Symbol* ThreadTree::FindKernelSymbol(uint64_t ip) {
 void ThreadTree::ClearThreadAndMap() {
   thread_tree_.clear();
   thread_comm_storage_.clear();
+  clear_count_++;
   kernel_maps_.maps.clear();
+  kernel_maps_.version = ++last_maps_version_;
   map_storage_.clear();
+  ClearIpCache();
+}
+
+void ThreadTree::ClearIpCache() {
+  std::fill(ip_cache_.begin(), ip_cache_.end(), IpCacheEntry());
+}
+
+std::string ThreadTree::IpCacheStatToString() const {
+  auto percent = [](uint64_t hits, uint64_t lookups) {
+    return lookups == 0 ? 0.0 : 100.0 * hits / lookups;
+  };
+  return android::base::StringPrintf(
+      "map lookups %" PRIu64 " (%.2f%% hit), symbol lookups %" PRIu64 " (%.2f%% hit)",
+      ip_cache_stat_.map_lookups, percent(ip_cache_stat_.map_hits, ip_cache_stat_.map_lookups),
+      ip_cache_stat_.symbol_lookups,
+      percent(ip_cache_stat_.symbol_hits, ip_cache_stat_.symbol_lookups));
 }
 
 bool ThreadTree::AddDsoInfo(FileFeature& file) {
@@ -378,12 +448,14 @@ bool ThreadTree::AddDsoInfo(FileFeature& file) {
   for (uint64_t offset : file.dex_file_offsets) {
     dso->AddDexFileOffset(offset);
   }
+  ClearIpCache();
   return true;
 }
 
 void ThreadTree::AddDexFileOffset(const std::string& file_path, uint64_t dex_file_offset) {
   Dso* dso = FindUserDsoOrNew(file_path, 0, DSO_DEX_FILE);
   dso->AddDexFileOffset(dex_file_offset);
+  ClearIpCache();
 }
 
 void ThreadTree::Update(const Record& record) {
@@ -418,6 +490,7 @@ void ThreadTree::Update(const Record& record) {
   } else if (record.type() == SIMPLE_PERF_RECORD_KERNEL_SYMBOL) {
     const auto& r = *static_cast<const KernelSymbolRecord*>(&record);
     Dso::SetKallsyms(std::string(r.kallsyms, r.kallsyms_size));
+    ClearIpCache();
   }
 }
 
@@ -69,7 +69,7 @@ struct MapEntry {
 
 struct MapSet {
   std::map<uint64_t, const MapEntry*> maps;  // Map from start_addr to a MapEntry.
-  uint64_t version = 0u;                     // incremented each time changing maps
+  uint64_t version = 0u;  // set to a new value unique in a ThreadTree each time changing maps
 
   const MapEntry* FindMapByAddr(uint64_t addr) const;
 };
@@ -115,6 +115,8 @@ class ThreadTree {
   // For example, these might be symbols generated by a JIT.
   void AddSymbolsForProcess(int pid, std::vector<Symbol>* symbols);
 
+  // FindMap() and FindSymbol() cache results of recent lookups by maps version and ip. So
+  // looking up the same ips repeatedly, like ips in hot call chains, is cheap.
   const MapEntry* FindMap(const ThreadEntry* thread, uint64_t ip, bool in_kernel);
   // Find map for an ip address when we don't know whether it is in kernel.
   const MapEntry* FindMap(const ThreadEntry* thread, uint64_t ip);
@@ -124,14 +126,21 @@ class ThreadTree {
   bool IsUnknownDso(const Dso* dso) const { return dso == unknown_dso_.get(); }
   const Symbol* UnknownSymbol() const { return &unknown_symbol_; }
 
-  void ShowIpForUnknownSymbol() { show_ip_for_unknown_symbol_ = true; }
+  void ShowIpForUnknownSymbol() {
+    show_ip_for_unknown_symbol_ = true;
+    ClearIpCache();
+  }
   void ShowMarkForUnknownSymbol() {
     show_mark_for_unknown_symbol_ = true;
     unknown_symbol_ = Symbol("*unknown", 0, ULLONG_MAX);
+    ClearIpCache();
   }
   // Clear thread and map information, but keep loaded dso information. It saves
   // the time to reload dso information.
   void ClearThreadAndMap();
+  // Increased by each ClearThreadAndMap(). Users caching ThreadEntry data, like comm pointers,
+  // should drop their cache when it changes.
+  uint64_t GetClearCount() const { return clear_count_; }
   bool AddDsoInfo(FileFeature& file);
   void AddDexFileOffset(const std::string& file_path, uint64_t dex_file_offset);
 
@@ -142,12 +151,40 @@ class ThreadTree {
   Dso* FindUserDsoOrNew(const std::string& filename, uint64_t start_addr = 0,
                         DsoType dso_type = DSO_ELF_FILE);
 
+  struct IpCacheStat {
+    uint64_t map_lookups = 0;
+    uint64_t map_hits = 0;
+    uint64_t symbol_lookups = 0;
+    uint64_t symbol_hits = 0;
+  };
+  const IpCacheStat& GetIpCacheStat() const { return ip_cache_stat_; }
+  std::string IpCacheStatToString() const;
+
  private:
+  // An entry in the ip cache. It is valid when the versions of maps searched for the ip match.
+  // Maps not searched for the ip have version kNoMapsVersion.
+  struct IpCacheEntry {
+    uint64_t ip = 0;
+    uint64_t maps_version = kNoMapsVersion;
+    uint64_t kernel_maps_version = kNoMapsVersion;
+    const MapEntry* map = nullptr;  // nullptr if the entry is empty
+    const Symbol* symbol = nullptr;  // nullptr if the symbol of the ip isn't looked up yet
+    uint64_t vaddr_in_file = 0;
+    Dso* dso = nullptr;
+  };
+  static constexpr uint64_t kNoMapsVersion = std::numeric_limits<uint64_t>::max();
+  static constexpr size_t kIpCacheSize = 4096;
+
   ThreadEntry* CreateThread(int pid, int tid);
   Dso* FindKernelDsoOrNew();
   Dso* FindKernelModuleDsoOrNew(const std::string& filename, uint64_t memory_start,
                                 uint64_t memory_end);
 
+  IpCacheEntry& GetIpCacheEntry(uint64_t ip);
+  const MapEntry* FindMapWithCache(const MapSet* maps, const MapSet* kernel_maps, uint64_t ip);
+  // Called when symbols of dsos may change.
+  void ClearIpCache();
+
   const MapEntry* AllocateMap(const MapEntry& entry);
   void InsertMap(MapSet& maps, const MapEntry& entry);
 
@@ -156,10 +193,17 @@ class ThreadTree {
 
   std::unordered_map<int, std::unique_ptr<ThreadEntry>> thread_tree_;
   std::vector<std::unique_ptr<std::string>> thread_comm_storage_;
+  uint64_t clear_count_ = 0;
 
   MapSet kernel_maps_;
   std::vector<std::unique_ptr<MapEntry>> map_storage_;
   MapEntry unknown_map_;
+  // Last version assigned to a MapSet.
+  uint64_t last_maps_version_ = 0;
+
+  // Direct-mapped cache indexed by ip, allocated on first use.
+  std::vector<IpCacheEntry> ip_cache_;
+  IpCacheStat ip_cache_stat_;
 
   std::unique_ptr<Dso> kernel_dso_;
   std::unordered_map<std::string, std::unique_ptr<Dso>> module_dso_tree_;
@@ -150,3 +150,29 @@ TEST_F(ThreadTreeTest, invalid_fork) {
   // pid != tid && pid != ppid
   ASSERT_FALSE(thread_tree_.ForkThread(1, 2, 3, 1));
 }
+
+TEST_F(ThreadTreeTest, ip_cache) {
+  std::vector<Symbol> symbols = ReadSymbolMapFromString("0x1000 0x10 one\n");
+  thread_tree_.AddSymbolsForProcess(1, &symbols);
+  ASSERT_STREQ("one", FindSymbol(1, 1, 0x1000)->Name());
+  ASSERT_STREQ("one", FindSymbol(1, 1, 0x1000)->Name());
+  const ThreadTree::IpCacheStat& stat = thread_tree_.GetIpCacheStat();
+  ASSERT_EQ(stat.map_lookups, 2u);
+  ASSERT_EQ(stat.map_hits, 1u);
+  ASSERT_EQ(stat.symbol_lookups, 2u);
+  ASSERT_EQ(stat.symbol_hits, 1u);
+
+  // Changing symbols invalidates cached symbols.
+  symbols = ReadSymbolMapFromString("0x1000 0x10 new_one\n");
+  thread_tree_.AddSymbolsForProcess(1, &symbols);
+  ASSERT_STREQ("new_one", FindSymbol(1, 1, 0x1000)->Name());
+
+  // Changing maps invalidates cached maps, even for maps copied by fork.
+  thread_tree_.ForkThread(2, 2, 1, 1);
+  thread_tree_.AddThreadMap(2, 2, 0x1000, 0x1000, 0, "child");
+  ThreadEntry* parent = thread_tree_.FindThreadOrNew(1, 1);
+  ThreadEntry* child = thread_tree_.FindThreadOrNew(2, 2);
+  ASSERT_EQ(thread_tree_.FindMap(child, 0x1000, false)->dso->Path(), "child");
+  ASSERT_NE(thread_tree_.FindMap(parent, 0x1000, false)->dso->Path(), "child");
+  ASSERT_EQ(thread_tree_.FindMap(child, 0x1000, false)->dso->Path(), "child");
+}
@@ -39,6 +39,7 @@
 #include <7zCrc.h>
 #include <Xz.h>
 #include <XzCrc64.h>
+#include <zlib.h>
 
 #include "RegEx.h"
 #include "environment.h"
@@ -50,6 +51,7 @@ using android::base::Split;
 using android::base::StringPrintf;
 
 void OneTimeFreeAllocator::Clear() {
+  std::lock_guard<std::mutex> guard(lock_);
   for (auto& p : v_) {
     delete[] p;
   }
@@ -60,6 +62,7 @@ void OneTimeFreeAllocator::Clear() {
 
 const char* OneTimeFreeAllocator::AllocateString(std::string_view s) {
   size_t size = s.size() + 1;
+  std::lock_guard<std::mutex> guard(lock_);
   if (cur_ + size > end_) {
     size_t alloc_size = std::max(size, unit_size_);
     char* p = new char[alloc_size];
@@ -260,6 +263,20 @@ bool MkdirWithParents(const std::string& path) {
   return true;
 }
 
+bool WriteFileAtomically(const std::string& path, const std::string& data) {
+  TemporaryFile tmpfile(android::base::Dirname(path));
+  if (tmpfile.fd == -1) {
+    return false;
+  }
+  bool result = android::base::WriteFully(tmpfile.fd, data.data(), data.size());
+  close(tmpfile.release());
+  if (!result || rename(tmpfile.path, path.c_str()) != 0) {
+    return false;
+  }
+  tmpfile.DoNotRemove();
+  return true;
+}
+
 static void* xz_alloc(ISzAllocPtr, size_t size) {
   return malloc(size);
 }
@@ -306,6 +323,32 @@ bool XzDecompress(const std::string& compressed_data, std::string* decompressed_
   return true;
 }
 
+bool ZlibCompress(const char* data, size_t size, int level, std::vector<char>* compressed_data) {
+  uLongf dst_size = compressBound(size);
+  compressed_data->resize(dst_size);
+  int res = compress2(reinterpret_cast<Bytef*>(compressed_data->data()), &dst_size,
+                      reinterpret_cast<const Bytef*>(data), size, level);
+  if (res != Z_OK) {
+    LOG(ERROR) << "zlib compression failed with error " << res;
+    return false;
+  }
+  compressed_data->resize(dst_size);
+  return true;
+}
+
+bool ZlibDecompress(const char* data, size_t size, size_t decompressed_size,
+                    std::vector<char>* decompressed_data) {
+  decompressed_data->resize(decompressed_size);
+  uLongf dst_size = decompressed_size;
+  int res = uncompress(reinterpret_cast<Bytef*>(decompressed_data->data()), &dst_size,
+                       reinterpret_cast<const Bytef*>(data), size);
+  if (res != Z_OK || dst_size != decompressed_size) {
+    LOG(ERROR) << "zlib decompression failed with error " << res;
+    return false;
+  }
+  return true;
+}
+
 static std::map<std::string, android::base::LogSeverity> log_severity_map = {
     {"verbose", android::base::VERBOSE}, {"debug", android::base::DEBUG},
     {"info", android::base::INFO},       {"warning", android::base::WARNING},
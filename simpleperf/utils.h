@@ -23,6 +23,7 @@
 
 #include <fstream>
 #include <functional>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
@@ -58,7 +59,7 @@ static inline uint64_t Align(uint64_t value, uint64_t alignment) {
 #endif
 
 // OneTimeAllocator is used to allocate memory many times and free only once at the end.
-// It reduces the cost to free each allocated memory.
+// It reduces the cost to free each allocated memory. It is thread-safe.
 class OneTimeFreeAllocator {
  public:
   explicit OneTimeFreeAllocator(size_t unit_size = 8192u)
@@ -71,6 +72,7 @@ class OneTimeFreeAllocator {
 
  private:
   const size_t unit_size_;
+  std::mutex lock_;
   std::vector<char*> v_;
   char* cur_;
   char* end_;
@@ -238,8 +240,14 @@ bool IsDir(const std::string& dirpath);
 bool IsRegularFile(const std::string& filename);
 uint64_t GetFileSize(const std::string& filename);
 bool MkdirWithParents(const std::string& path);
+// Write data to a unique temporary file in the same directory, then rename it to path. So readers
+// never see a partially written file, and concurrent writers never share a temporary file.
+bool WriteFileAtomically(const std::string& path, const std::string& data);
 
 bool XzDecompress(const std::string& compressed_data, std::string* decompressed_data);
+bool ZlibCompress(const char* data, size_t size, int level, std::vector<char>* compressed_data);
+bool ZlibDecompress(const char* data, size_t size, size_t decompressed_size,
+                    std::vector<char>* decompressed_data);
 
 bool GetLogSeverity(const std::string& name, android::base::LogSeverity* severity);
 std::string GetLogSeverityName();
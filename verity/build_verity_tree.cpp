@@ -26,7 +26,8 @@ bool generate_verity_tree(const std::string& data_filename,
                           const std::string& verity_filename,
                           HashTreeBuilder* builder,
                           const std::vector<unsigned char>& salt_content,
-                          size_t block_size, bool sparse, bool verbose) {
+                          size_t block_size, bool sparse, bool verbose,
+                          bool low_memory) {
   android::base::unique_fd data_fd(open(data_filename.c_str(), O_RDONLY));
   if (data_fd == -1) {
     PLOG(ERROR) << "failed to open " << data_filename;
@@ -52,6 +53,16 @@ bool generate_verity_tree(const std::string& data_filename,
     return false;
   }
 
+  android::base::unique_fd verity_fd;
+  if (low_memory) {
+    verity_fd.reset(open(verity_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if (verity_fd == -1) {
+      PLOG(ERROR) << "failed to open " << verity_filename;
+      return false;
+    }
+    builder->SetOutputFd(verity_fd, 0);
+  }
+
   // Initialize the builder to compute the hash tree.
   if (!builder->Initialize(len, salt_content)) {
     LOG(ERROR) << "Failed to initialize HashTreeBuilder";
@@ -69,6 +80,10 @@ bool generate_verity_tree(const std::string& data_filename,
   if (!builder->BuildHashTree()) {
     return false;
   }
+  if (low_memory) {
+    // The hash tree has been written while building.
+    return true;
+  }
 
   return builder->WriteHashTreeToFile(verity_filename);
 }
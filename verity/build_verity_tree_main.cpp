@@ -39,6 +39,9 @@ static void usage(void) {
       "  -a,--salt-str=<string>       set salt to <string>\n"
       "  -A,--salt-hex=<hex digits>   set salt to <hex digits>\n"
       "  -h                           show this help\n"
+      "  -j,--threads=<count>         hash blocks with <count> threads\n"
+      "  --low-memory                 write hash tree levels to <verity> while\n"
+      "                               building, instead of keeping them in memory\n"
       "  -s,--verity-size=<data size> print the size of the verity tree\n"
       "  -v,                          enable verbose logging\n"
       "  -S                           treat <data image> as a sparse file\n");
@@ -52,19 +55,23 @@ int main(int argc, char** argv) {
   uint64_t calculate_size = 0;
   bool verbose = false;
   std::string hash_algorithm;
+  size_t thread_count = 1;
+  bool low_memory = false;
 
   while (1) {
     constexpr struct option long_options[] = {
         {"salt-str", required_argument, nullptr, 'a'},
         {"salt-hex", required_argument, nullptr, 'A'},
         {"help", no_argument, nullptr, 'h'},
+        {"threads", required_argument, nullptr, 'j'},
         {"sparse", no_argument, nullptr, 'S'},
         {"verity-size", required_argument, nullptr, 's'},
         {"verbose", no_argument, nullptr, 'v'},
         {"hash-algorithm", required_argument, nullptr, 0},
+        {"low-memory", no_argument, nullptr, 0},
         {nullptr, 0, nullptr, 0}};
     int option_index;
-    int c = getopt_long(argc, argv, "a:A:hSs:v", long_options, &option_index);
+    int c = getopt_long(argc, argv, "a:A:hj:Ss:v", long_options, &option_index);
     if (c < 0) {
       break;
     }
@@ -82,6 +89,12 @@ int main(int argc, char** argv) {
       case 'h':
         usage();
         return 1;
+      case 'j':
+        if (!android::base::ParseUint(optarg, &thread_count) || thread_count == 0) {
+          LOG(ERROR) << "Invalid thread count: " << optarg;
+          return 1;
+        }
+        break;
       case 'S':
         sparse = true;
         break;
@@ -100,6 +113,8 @@ int main(int argc, char** argv) {
         std::string option = long_options[option_index].name;
         if (option == "hash-algorithm") {
           hash_algorithm = optarg;
+        } else if (option == "low-memory") {
+          low_memory = true;
         }
       } break;
       case '?':
@@ -120,6 +135,7 @@ int main(int argc, char** argv) {
     return 1;
   }
   HashTreeBuilder builder(kBlockSize, hash_function);
+  builder.SetThreadCount(thread_count);
 
   if (calculate_size) {
     if (argc != 0) {
@@ -155,7 +171,7 @@ int main(int argc, char** argv) {
   }
 
   if (!generate_verity_tree(argv[0], argv[1], &builder, salt, kBlockSize,
-                            sparse, verbose)) {
+                            sparse, verbose, low_memory)) {
     return 1;
   }
 
@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <gtest/gtest.h>
 #include <openssl/evp.h>
 
@@ -205,3 +206,55 @@ TEST_F(BuildVerityTreeTest, SHA1MultipleBlocks) {
   ASSERT_EQ("7ea287e6167929988810077abaafbc313b2b8593000000000000000000000000",
             HashTreeBuilder::BytesArrayToString(builder->root_hash()));
 }
+
+TEST_F(BuildVerityTreeTest, MultipleThreads) {
+  std::vector<unsigned char> data(300 * 4096);
+  for (size_t i = 0; i < 300; i++) {
+    std::fill_n(data.begin() + i * 4096, 4096, i);
+  }
+
+  GenerateHashTree(data, salt_hex);
+  std::vector<std::vector<unsigned char>> expected_tree = verity_tree();
+  std::vector<unsigned char> expected_root_hash = builder->root_hash();
+
+  builder.reset(new HashTreeBuilder(4096, EVP_sha256()));
+  builder->SetThreadCount(4);
+  GenerateHashTree(data, salt_hex);
+  ASSERT_EQ(expected_tree, verity_tree());
+  ASSERT_EQ(expected_root_hash, builder->root_hash());
+}
+
+TEST_F(BuildVerityTreeTest, WriteToOutputFd) {
+  std::vector<unsigned char> data(300 * 4096);
+  for (size_t i = 0; i < 300; i++) {
+    std::fill_n(data.begin() + i * 4096, 4096, i);
+  }
+
+  GenerateHashTree(data, salt_hex);
+  std::vector<unsigned char> expected_root_hash = builder->root_hash();
+  std::string expected_tree;
+  ASSERT_TRUE(builder->WriteHashTree([&](const void* data, size_t size) {
+    expected_tree.append(static_cast<const char*>(data), size);
+    return true;
+  }));
+
+  TemporaryFile tmpfile;
+  builder.reset(new HashTreeBuilder(4096, EVP_sha256()));
+  builder->SetOutputFd(tmpfile.fd, 4096);
+  ASSERT_TRUE(builder->Initialize(data.size(), salt_hex));
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size_t data_length = std::min<size_t>(rand() % 40960, data.size() - offset);
+    ASSERT_TRUE(builder->Update(data.data() + offset, data_length));
+    offset += data_length;
+  }
+  ASSERT_TRUE(builder->BuildHashTree());
+  ASSERT_EQ(expected_root_hash, builder->root_hash());
+
+  std::string output;
+  ASSERT_TRUE(android::base::ReadFileToString(tmpfile.path, &output));
+  ASSERT_EQ(std::string(4096, '\0') + expected_tree, output);
+  // Only the top level is kept in memory.
+  ASSERT_TRUE(verity_tree()[0].empty());
+  ASSERT_FALSE(builder->WriteHashTree([](const void*, size_t) { return true; }));
+}
@@ -17,8 +17,11 @@
 #include "verity/hash_tree_builder.h"
 
 #include <algorithm>
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -50,6 +53,82 @@ const EVP_MD* HashTreeBuilder::HashFunction(const std::string& hash_name) {
   return nullptr;
 }
 
+// Runs tasks on a fixed set of threads, so threads aren't created and joined
+// for every HashBlocks() call.
+class HashTreeBuilder::WorkerPool {
+ public:
+  explicit WorkerPool(size_t thread_count) {
+    for (size_t i = 0; i < thread_count; i++) {
+      threads_.emplace_back(&WorkerPool::WorkerLoop, this);
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      exit_ = true;
+    }
+    work_cond_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  size_t thread_count() const { return threads_.size(); }
+
+  // Runs task(i) for i in [0, task_count) on the worker threads and the calling
+  // thread, and returns when all tasks are finished.
+  void Run(size_t task_count, const std::function<void(size_t)>& task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    task_count_ = task_count;
+    next_task_ = 0;
+    finished_tasks_ = 0;
+    work_cond_.notify_all();
+    RunTasks(lock);
+    done_cond_.wait(lock, [&] { return finished_tasks_ == task_count_; });
+    task_ = nullptr;
+  }
+
+ private:
+  void WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_cond_.wait(lock, [&] {
+        return exit_ || (task_ != nullptr && next_task_ < task_count_);
+      });
+      if (exit_) {
+        return;
+      }
+      RunTasks(lock);
+    }
+  }
+
+  // Called with mutex_ locked, runs tasks until none is left.
+  void RunTasks(std::unique_lock<std::mutex>& lock) {
+    while (task_ != nullptr && next_task_ < task_count_) {
+      const std::function<void(size_t)>* task = task_;
+      size_t i = next_task_++;
+      lock.unlock();
+      (*task)(i);
+      lock.lock();
+      if (++finished_tasks_ == task_count_) {
+        done_cond_.notify_all();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  const std::function<void(size_t)>* task_ = nullptr;
+  size_t task_count_ = 0;
+  size_t next_task_ = 0;
+  size_t finished_tasks_ = 0;
+  bool exit_ = false;
+  std::vector<std::thread> threads_;
+};
+
 HashTreeBuilder::HashTreeBuilder(size_t block_size, const EVP_MD* md)
     : block_size_(block_size), data_size_(0), md_(md) {
   CHECK(md_ != nullptr) << "Failed to initialize md";
@@ -64,6 +143,8 @@ HashTreeBuilder::HashTreeBuilder(size_t block_size, const EVP_MD* md)
   CHECK_LT(hash_size_ * 2, block_size_);
 }
 
+HashTreeBuilder::~HashTreeBuilder() = default;
+
 std::string HashTreeBuilder::BytesArrayToString(
     const std::vector<unsigned char>& bytes) {
   std::string result;
@@ -122,12 +203,32 @@ bool HashTreeBuilder::Initialize(int64_t expected_data_size,
     return false;
   }
 
-  // Reserve enough space for the hash of the input data.
-  size_t base_level_blocks =
-      verity_tree_blocks(data_size_, block_size_, hash_size_, 0);
-  std::vector<unsigned char> base_level;
-  base_level.reserve(base_level_blocks * block_size_);
-  verity_tree_.emplace_back(std::move(base_level));
+  if (output_fd_ != -1) {
+    // Levels are written top-down, so the offsets of all levels are needed
+    // before any level is complete.
+    std::vector<uint64_t> level_sizes;
+    size_t level_blocks;
+    do {
+      level_blocks = verity_tree_blocks(data_size_, block_size_, hash_size_,
+                                        level_sizes.size());
+      level_sizes.push_back(static_cast<uint64_t>(level_blocks) * block_size_);
+    } while (level_blocks > 1);
+    level_offsets_.resize(level_sizes.size());
+    uint64_t offset = output_offset_;
+    for (size_t i = level_sizes.size(); i > 0; i--) {
+      level_offsets_[i - 1] = offset;
+      offset += level_sizes[i - 1];
+    }
+    level_written_sizes_.assign(level_sizes.size(), 0);
+    verity_tree_.resize(level_sizes.size());
+  } else {
+    // Reserve enough space for the hash of the input data.
+    size_t base_level_blocks =
+        verity_tree_blocks(data_size_, block_size_, hash_size_, 0);
+    std::vector<unsigned char> base_level;
+    base_level.reserve(base_level_blocks * block_size_);
+    verity_tree_.emplace_back(std::move(base_level));
+  }
 
   // Save the hash of the zero block to avoid future recalculation.
   std::vector<unsigned char> zero_block(block_size_, 0);
@@ -139,20 +240,32 @@ bool HashTreeBuilder::Initialize(int64_t expected_data_size,
 
 bool HashTreeBuilder::HashBlock(const unsigned char* block,
                                 unsigned char* out) {
-  unsigned int s;
-  int ret = 1;
-
-  EVP_MD_CTX* mdctx = EVP_MD_CTX_create();
-  CHECK(mdctx != nullptr);
-  ret &= EVP_DigestInit_ex(mdctx, md_, nullptr);
-  ret &= EVP_DigestUpdate(mdctx, salt_.data(), salt_.size());
-  ret &= EVP_DigestUpdate(mdctx, block, block_size_);
-  ret &= EVP_DigestFinal_ex(mdctx, out, &s);
-  EVP_MD_CTX_destroy(mdctx);
+  return HashSaltedBlocks(block, 1, out);
+}
 
+bool HashTreeBuilder::HashSaltedBlocks(const unsigned char* blocks,
+                                       size_t block_count,
+                                       unsigned char* out) {
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> salted_ctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> mdctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  CHECK(salted_ctx != nullptr && mdctx != nullptr);
+  int ret = 1;
+  ret &= EVP_DigestInit_ex(salted_ctx.get(), md_, nullptr);
+  ret &= EVP_DigestUpdate(salted_ctx.get(), salt_.data(), salt_.size());
   CHECK_EQ(1, ret);
-  CHECK_EQ(hash_size_raw_, s);
-  std::fill(out + s, out + hash_size_, 0);
+
+  for (size_t i = 0; i < block_count; i++) {
+    unsigned int s;
+    unsigned char* hash = out + i * hash_size_;
+    ret &= EVP_MD_CTX_copy_ex(mdctx.get(), salted_ctx.get());
+    ret &= EVP_DigestUpdate(mdctx.get(), blocks + i * block_size_, block_size_);
+    ret &= EVP_DigestFinal_ex(mdctx.get(), hash, &s);
+    CHECK_EQ(1, ret);
+    CHECK_EQ(hash_size_raw_, s);
+    std::fill(hash + s, hash + hash_size_, 0);
+  }
 
   return true;
 }
@@ -172,16 +285,38 @@ bool HashTreeBuilder::HashBlocks(const unsigned char* data, size_t len,
     return true;
   }
 
-  for (size_t i = 0; i < len; i += block_size_) {
-    unsigned char hash_buffer[hash_size_];
-    if (!HashBlock(data + i, hash_buffer)) {
-      return false;
-    }
-    output_vector->insert(output_vector->end(), hash_buffer,
-                          hash_buffer + hash_size_);
+  // Hashes are stored in place, so blocks can be hashed in any order.
+  size_t block_count = len / block_size_;
+  size_t output_offset = output_vector->size();
+  output_vector->resize(output_offset + block_count * hash_size_);
+  unsigned char* output = output_vector->data() + output_offset;
+
+  // Handing a range to a worker costs about as much as hashing a few blocks,
+  // so only split ranges large enough.
+  constexpr size_t kMinBlocksPerThread = 64;
+  size_t range_count =
+      std::min(thread_count_, block_count / kMinBlocksPerThread);
+  if (range_count <= 1) {
+    return HashSaltedBlocks(data, block_count, output);
   }
-
-  return true;
+  if (!worker_pool_ || worker_pool_->thread_count() != thread_count_ - 1) {
+    worker_pool_.reset(new WorkerPool(thread_count_ - 1));
+  }
+  size_t blocks_per_range = div_round_up(block_count, range_count);
+  // Each range writes its own result, so no lock is needed. Not a
+  // std::vector<bool>, whose elements share bytes.
+  std::vector<char> range_results(range_count, 1);
+  worker_pool_->Run(range_count, [&](size_t range) {
+    size_t start = range * blocks_per_range;
+    size_t end = std::min(block_count, start + blocks_per_range);
+    if (start < end) {
+      range_results[range] = HashSaltedBlocks(data + start * block_size_,
+                                              end - start,
+                                              output + start * hash_size_);
+    }
+  });
+  return std::all_of(range_results.begin(), range_results.end(),
+                     [](char result) { return result; });
 }
 
 bool HashTreeBuilder::Update(const unsigned char* data, size_t len) {
@@ -215,7 +350,44 @@ bool HashTreeBuilder::Update(const unsigned char* data, size_t len) {
     }
     len -= len % block_size_;
   }
-  return HashBlocks(data, len, &verity_tree_[0]);
+  if (!HashBlocks(data, len, &verity_tree_[0])) {
+    return false;
+  }
+  return output_fd_ == -1 || FlushLevel(0);
+}
+
+bool HashTreeBuilder::FlushLevel(size_t level) {
+  if (level + 1 == verity_tree_.size()) {
+    return true;
+  }
+  auto& level_blocks = verity_tree_[level];
+  size_t len = level_blocks.size() - level_blocks.size() % block_size_;
+  if (len == 0) {
+    return true;
+  }
+  if (!WriteToOutputFd(level_blocks.data(), len,
+                       level_offsets_[level] + level_written_sizes_[level])) {
+    return false;
+  }
+  level_written_sizes_[level] += len;
+  if (!HashBlocks(level_blocks.data(), len, &verity_tree_[level + 1])) {
+    return false;
+  }
+  level_blocks.erase(level_blocks.begin(), level_blocks.begin() + len);
+  return FlushLevel(level + 1);
+}
+
+bool HashTreeBuilder::WriteToOutputFd(const unsigned char* data, size_t len,
+                                      uint64_t offset) {
+  if (lseek(output_fd_, offset, SEEK_SET) != static_cast<off_t>(offset)) {
+    PLOG(ERROR) << "Failed to seek the output fd, offset: " << offset;
+    return false;
+  }
+  if (!android::base::WriteFully(output_fd_, data, len)) {
+    PLOG(ERROR) << "Failed to write " << len << " bytes to the output fd";
+    return false;
+  }
+  return true;
 }
 
 bool HashTreeBuilder::CalculateRootDigest(const std::vector<unsigned char>& root_verity,
@@ -227,14 +399,36 @@ bool HashTreeBuilder::CalculateRootDigest(const std::vector<unsigned char>& root
 }
 
 bool HashTreeBuilder::BuildHashTree() {
-  // Expects only the base level in the verity_tree_.
-  CHECK_EQ(1, verity_tree_.size());
-
   if (!leftover_.empty()) {
     LOG(ERROR) << leftover_.size() << " bytes data left from last Update().";
     return false;
   }
 
+  if (output_fd_ != -1) {
+    // Pads each level bottom-up. A level is complete once the level below it
+    // has been flushed.
+    for (size_t i = 0; i < verity_tree_.size(); i++) {
+      AppendPaddings(&verity_tree_[i]);
+      if (!FlushLevel(i)) {
+        return false;
+      }
+      if (i + 1 < verity_tree_.size()) {
+        size_t level_blocks =
+            verity_tree_blocks(data_size_, block_size_, hash_size_, i);
+        CHECK_EQ(level_blocks * block_size_, level_written_sizes_[i]);
+      }
+    }
+    CHECK_EQ(block_size_, verity_tree_.back().size());
+    if (!WriteToOutputFd(verity_tree_.back().data(), block_size_,
+                         level_offsets_.back())) {
+      return false;
+    }
+    return CalculateRootDigest(verity_tree_.back(), &root_hash_);
+  }
+
+  // Expects only the base level in the verity_tree_.
+  CHECK_EQ(1, verity_tree_.size());
+
   // Expects the base level to have the same size as the total hash size of
   // input data.
   AppendPaddings(&verity_tree_.back());
@@ -265,6 +459,10 @@ bool HashTreeBuilder::BuildHashTree() {
 
 bool HashTreeBuilder::CheckHashTree(
     const std::vector<unsigned char>& hash_tree) const {
+  if (output_fd_ != -1) {
+    LOG(ERROR) << "Hash tree levels were written to the output fd";
+    return false;
+  }
   size_t offset = 0;
   // Reads reversely to output the verity tree top-down.
   for (size_t i = verity_tree_.size(); i > 0; i--) {
@@ -305,6 +503,10 @@ bool HashTreeBuilder::WriteHashTreeToFile(const std::string& output) const {
 bool HashTreeBuilder::WriteHashTree(
     std::function<bool(const void*, size_t)> callback) const {
   CHECK(!verity_tree_.empty());
+  if (output_fd_ != -1) {
+    LOG(ERROR) << "Hash tree levels were written to the output fd";
+    return false;
+  }
 
   // Reads reversely to output the verity tree top-down.
   for (size_t i = verity_tree_.size(); i > 0; i--) {
@@ -321,7 +523,7 @@ bool HashTreeBuilder::WriteHashTree(
 bool HashTreeBuilder::WriteHashTreeToFd(int fd, uint64_t offset) const {
   CHECK(!verity_tree_.empty());
 
-  if (lseek(fd, offset, SEEK_SET) != offset) {
+  if (lseek(fd, offset, SEEK_SET) != static_cast<off_t>(offset)) {
     PLOG(ERROR) << "Failed to seek the output fd, offset: " << offset;
     return false;
   }
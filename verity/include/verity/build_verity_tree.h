@@ -24,10 +24,13 @@
 
 #include "hash_tree_builder.h"
 
+// If |low_memory| is true, each level of the hash tree is written to
+// |verity_filename| once complete, instead of keeping the whole tree in memory.
 bool generate_verity_tree(const std::string& data_filename,
                           const std::string& verity_filename,
                           HashTreeBuilder* hasher,
                           const std::vector<unsigned char>& salt_content,
-                          size_t block_size, bool sparse, bool verbose);
+                          size_t block_size, bool sparse, bool verbose,
+                          bool low_memory = false);
 
 #endif  // __BUILD_VERITY_TREE_H__
@@ -20,7 +20,9 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+#include <algorithm>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -34,11 +36,28 @@
 class HashTreeBuilder {
  public:
   HashTreeBuilder(size_t block_size, const EVP_MD* md);
+  ~HashTreeBuilder();
   // Returns the size of the verity tree in bytes given the input data size.
   uint64_t CalculateSize(uint64_t input_size) const {
       return CalculateSize(input_size, block_size_, hash_size_);
   }
   static uint64_t CalculateSize(uint64_t input_size, size_t block_size, size_t hash_size);
+  // Hashes blocks with up to |thread_count| threads. Each thread hashes a
+  // disjoint range of the blocks passed to Update() or of a tree level, and
+  // stores the hashes at their positions in the level, so the output doesn't
+  // depend on the thread count. The threads are created once and reused for
+  // every Update() and tree level.
+  void SetThreadCount(size_t thread_count) {
+    thread_count_ = std::max<size_t>(thread_count, 1);
+  }
+  // Writes the hash tree top-down to |fd| at |offset| while building it,
+  // instead of keeping every level in memory. Only a partial block of each
+  // level is kept. Should be called before Initialize(). In this mode, the hash
+  // tree can't be checked or written again after BuildHashTree().
+  void SetOutputFd(int fd, uint64_t offset) {
+    output_fd_ = fd;
+    output_offset_ = offset;
+  }
   // Gets ready for the hash tree computation. We expect |expected_data_size|
   // bytes source data.
   bool Initialize(int64_t expected_data_size,
@@ -76,15 +95,26 @@ class HashTreeBuilder {
 
  private:
   friend class BuildVerityTreeTest;
+  class WorkerPool;
+
   // Calculates the hash of one single block. Write the result to |out|, a
   // buffer allocated by the caller.
   bool HashBlock(const unsigned char* block, unsigned char* out);
+  // Calculates the hashes of |block_count| consecutive blocks starting from
+  // |blocks|, and writes them |hash_size_| bytes apart to |out|. The salt is
+  // hashed once and the salted digest state is reused for every block.
+  bool HashSaltedBlocks(const unsigned char* blocks, size_t block_count,
+                        unsigned char* out);
   // Calculates the hash of |len| bytes of data starting from |data|. Append the
   // result to |output_vector|.
   bool HashBlocks(const unsigned char* data, size_t len,
                   std::vector<unsigned char>* output_vector);
   // Aligns |data| with block_size by padding 0s to the end.
   void AppendPaddings(std::vector<unsigned char>* data);
+  // When writing to output_fd_, writes the complete blocks of |level| to the
+  // output fd and hashes them to the next level. The top level is kept.
+  bool FlushLevel(size_t level);
+  bool WriteToOutputFd(const unsigned char* data, size_t len, uint64_t offset);
 
   size_t block_size_;
   // Expected size of the source data, which is used to compute the hash for the
@@ -106,6 +136,18 @@ class HashTreeBuilder {
   // The remaining data passed to the last call to Update() that's less than a
   // block.
   std::vector<unsigned char> leftover_;
+
+  size_t thread_count_ = 1;
+  // Created on first use with thread_count_ - 1 threads, the calling thread
+  // hashes blocks too.
+  std::unique_ptr<WorkerPool> worker_pool_;
+  // When output_fd_ != -1, levels are written to output_fd_ while building,
+  // and verity_tree_ only keeps the part of each level not written yet.
+  int output_fd_ = -1;
+  uint64_t output_offset_ = 0;
+  // Offset in output_fd_ and bytes written for each level.
+  std::vector<uint64_t> level_offsets_;
+  std::vector<uint64_t> level_written_sizes_;
 };
 
 #endif  // __HASH_TREE_BUILDER_H__